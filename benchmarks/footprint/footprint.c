@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "threason.h"
+
+#define ELEMENTS_COUNT 1000000
+#define ROUNDS 5
+
+typedef enum {
+    DATASET_SMALL_INTS,
+    DATASET_NESTED_ARRAYS,
+    DATASET_SMALL_OBJECTS,
+    DATASET_STRINGS,
+} Dataset;
+
+static const char* DATASET_NAMES[] = {"small ints", "nested arrays",
+                                      "small objects", "strings"};
+
+static char* generate_document(Dataset dataset, size_t* /*out*/ size) {
+    const size_t max_element_len = 64;
+    char* buffer = malloc(ELEMENTS_COUNT * max_element_len + 2);
+    if (buffer == NULL) {
+        fprintf(stderr, "Failed to allocate the document\n");
+        exit(1);
+    }
+    size_t offset = 0;
+    buffer[offset++] = '[';
+    for (size_t i = 0; i < ELEMENTS_COUNT; ++i) {
+        const char* separator = i == 0 ? "" : ",";
+        char* element = buffer + offset;
+        switch (dataset) {
+            case DATASET_SMALL_INTS:
+                offset += sprintf(element, "%s%zu", separator, i % 100);
+                break;
+            case DATASET_NESTED_ARRAYS:
+                offset += sprintf(element, "%s[%zu,%zu]", separator, i % 10,
+                                  i % 7);
+                break;
+            case DATASET_SMALL_OBJECTS:
+                offset += sprintf(element, "%s{\"id\":%zu,\"ok\":%s}",
+                                  separator, i, i % 2 ? "true" : "false");
+                break;
+            case DATASET_STRINGS:
+                offset += sprintf(element, "%s\"element number %zu\"",
+                                  separator, i);
+                break;
+        }
+    }
+    buffer[offset++] = ']';
+    *size = offset;
+    return buffer;
+}
+
+static double elapsed_ms(struct timespec start_time,
+                         struct timespec end_time) {
+    return (double)(end_time.tv_sec - start_time.tv_sec) * 1e3 +
+           (double)(end_time.tv_nsec - start_time.tv_nsec) / 1e6;
+}
+
+/* Bytes used by the segments, not counting the allocations' slack */
+static size_t document_size(const ThsnDocument* document) {
+    size_t size = 0;
+    for (size_t i = 0; i < document->segment_count; ++i) {
+        size += document->segments[i].size;
+    }
+    return size;
+}
+
+static void run(const char* name, const char* json, size_t json_size) {
+    for (size_t threads_count = 1; threads_count <= 4; threads_count *= 4) {
+        double best_ms = 0.0;
+        size_t dom_size = 0;
+        for (size_t round = 0; round < ROUNDS; ++round) {
+            ThsnSlice json_slice = thsn_slice_make(json, json_size);
+            ThsnDocument* document = NULL;
+            struct timespec start_time;
+            clock_gettime(CLOCK_MONOTONIC, &start_time);
+            if (thsn_document_parse_multithreaded(&json_slice, &document,
+                                                  threads_count) !=
+                THSN_RESULT_SUCCESS) {
+                fprintf(stderr, "Failed to parse %s\n", name);
+                exit(1);
+            }
+            struct timespec end_time;
+            clock_gettime(CLOCK_MONOTONIC, &end_time);
+            const double round_ms = elapsed_ms(start_time, end_time);
+            if (round == 0 || round_ms < best_ms) {
+                best_ms = round_ms;
+            }
+            dom_size = document_size(document);
+            thsn_document_free(&document);
+        }
+        printf("%-16s %zu thread(s): %9zu input bytes, %9zu DOM bytes, "
+               "%5.2f DOM bytes per input byte, %7.2f ms\n",
+               name, threads_count, json_size, dom_size,
+               (double)dom_size / (double)json_size, best_ms);
+    }
+}
+
+static char* read_file(const char* path, size_t* /*out*/ size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        exit(1);
+    }
+    const long file_size = ftell(file);
+    char* buffer = malloc(file_size > 0 ? (size_t)file_size : 1);
+    rewind(file);
+    if (file_size < 0 || buffer == NULL ||
+        fread(buffer, 1, (size_t)file_size, file) != (size_t)file_size) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        exit(1);
+    }
+    fclose(file);
+    *size = (size_t)file_size;
+    return buffer;
+}
+
+/* Reports the DOM footprint for generated documents, or for the files given
+ * as arguments. */
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            size_t json_size = 0;
+            char* json = read_file(argv[i], &json_size);
+            run(argv[i], json, json_size);
+            free(json);
+        }
+        return 0;
+    }
+    for (Dataset dataset = DATASET_SMALL_INTS; dataset <= DATASET_STRINGS;
+         ++dataset) {
+        size_t json_size = 0;
+        char* json = generate_document(dataset, &json_size);
+        run(DATASET_NAMES[dataset], json, json_size);
+        free(json);
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "number.h"
+
+#define NUMBERS_COUNT 1000000
+#define ROUNDS 5
+#define MAX_DOUBLE_LEN 128
+
+typedef enum {
+    DATASET_TELEMETRY,
+    DATASET_ROUNDTRIP,
+    DATASET_INTEGERS,
+} Dataset;
+
+static const char* DATASET_NAMES[] = {"telemetry (%.6f)", "roundtrip (%.17g)",
+                                      "integers (%lld)"};
+
+/* The parser's path before the in-place number parser */
+static ThsnResult strtod_copy(ThsnSlice slice, double* /*out*/ result) {
+    BAIL_WITH_INPUT_ERROR_UNLESS(slice.size <= MAX_DOUBLE_LEN);
+    char double_str[MAX_DOUBLE_LEN + 1];
+    memcpy(double_str, slice.data, slice.size);
+    double_str[slice.size] = '\0';
+    char* double_str_end = NULL;
+    *result = strtod(double_str, &double_str_end);
+    return double_str_end == double_str ? THSN_RESULT_INPUT_ERROR
+                                        : THSN_RESULT_SUCCESS;
+}
+
+static ThsnSlice* generate_numbers(Dataset dataset,
+                                   char** /*out*/ numbers_buffer) {
+    const size_t max_number_len = 32;
+    char* buffer = malloc(NUMBERS_COUNT * max_number_len);
+    ThsnSlice* numbers = malloc(NUMBERS_COUNT * sizeof(ThsnSlice));
+    if (buffer == NULL || numbers == NULL) {
+        fprintf(stderr, "Failed to allocate numbers\n");
+        exit(1);
+    }
+    unsigned long long state = 42;
+    for (size_t i = 0; i < NUMBERS_COUNT; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        char* number = buffer + i * max_number_len;
+        const double unit = (double)(state >> 11) / (double)(1ULL << 53);
+        int number_len = 0;
+        switch (dataset) {
+            case DATASET_TELEMETRY:
+                number_len = snprintf(number, max_number_len, "%.6f",
+                                      (unit - 0.5) * 2000.0);
+                break;
+            case DATASET_ROUNDTRIP:
+                number_len = snprintf(number, max_number_len, "%.17g",
+                                      ldexp(unit, (int)(state % 200) - 100));
+                break;
+            case DATASET_INTEGERS:
+                number_len = snprintf(number, max_number_len, "%lld",
+                                      (long long)(state >> 20) - (1LL << 43));
+                break;
+        }
+        numbers[i] = thsn_slice_make(number, number_len);
+    }
+    *numbers_buffer = buffer;
+    return numbers;
+}
+
+static double elapsed_ns(struct timespec start_time,
+                         struct timespec end_time) {
+    return (double)(end_time.tv_sec - start_time.tv_sec) * 1e9 +
+           (double)(end_time.tv_nsec - start_time.tv_nsec);
+}
+
+static double run(ThsnResult (*parse_fn)(ThsnSlice, double*),
+                  const ThsnSlice* numbers, double* /*out*/ checksum) {
+    double best_ns = INFINITY;
+    for (size_t round = 0; round < ROUNDS; ++round) {
+        double sum = 0.0;
+        struct timespec start_time;
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        for (size_t i = 0; i < NUMBERS_COUNT; ++i) {
+            double value = 0.0;
+            if (parse_fn(numbers[i], &value) != THSN_RESULT_SUCCESS) {
+                fprintf(stderr, "Failed to parse %.*s\n", (int)numbers[i].size,
+                        numbers[i].data);
+                exit(1);
+            }
+            sum += value;
+        }
+        struct timespec end_time;
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        const double round_ns = elapsed_ns(start_time, end_time);
+        if (round_ns < best_ns) {
+            best_ns = round_ns;
+        }
+        *checksum = sum;
+    }
+    return best_ns / NUMBERS_COUNT;
+}
+
+int main(void) {
+    for (Dataset dataset = DATASET_TELEMETRY; dataset <= DATASET_INTEGERS;
+         ++dataset) {
+        char* numbers_buffer = NULL;
+        ThsnSlice* numbers = generate_numbers(dataset, &numbers_buffer);
+        double strtod_checksum = 0.0;
+        double thsn_checksum = 0.0;
+        const double strtod_ns = run(strtod_copy, numbers, &strtod_checksum);
+        const double thsn_ns =
+            run(thsn_number_parse_double, numbers, &thsn_checksum);
+        printf("%-20s strtod copy %6.1f ns/number, in place %6.1f ns/number, "
+               "%.2fx%s\n",
+               DATASET_NAMES[dataset], strtod_ns, thsn_ns, strtod_ns / thsn_ns,
+               strtod_checksum == thsn_checksum ? "" : " (checksum mismatch)");
+        free(numbers);
+        free(numbers_buffer);
+    }
+    return 0;
+}
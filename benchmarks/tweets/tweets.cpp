@@ -1,6 +1,8 @@
 #include <chrono>
 #include <cstring>
 #include <iostream>
+#include <iterator>
+#include <string>
 
 #include "simdjson.h"
 #include "threason.h"
@@ -30,40 +32,56 @@ template <typename ParserFn>
 int64_t threason_dom(ParserFn parser_fn, ThsnSlice json, size_t bunch_no,
                      size_t status_no) {
     /* Ignoring errors */
+    const std::string path_str = "/" + std::to_string(bunch_no) +
+                                 "/statuses/" + std::to_string(status_no) +
+                                 "/retweet_count";
+    ThsnPath *path;
+    thsn_path_compile(thsn_slice_make(path_str.data(), path_str.size()),
+                      &path);
     ThsnDocument *document;
     parser_fn(&json, &document);
-    ThsnValueArrayTable top_array_table;
-    thsn_document_read_array(document, thsn_value_handle_first(),
-                             &top_array_table);
-    ThsnValueHandle bunch_object_handle;
-    thsn_document_index_array_element(document, top_array_table, bunch_no,
-                                      &bunch_object_handle);
-    ThsnValueObjectTable bunch_object_sorted_table;
-    thsn_document_read_object_sorted(document, bunch_object_handle,
-                                     &bunch_object_sorted_table);
-    ThsnValueHandle statuses_array_handle;
-    thsn_document_object_index(document, bunch_object_sorted_table,
-                               thsn_slice_from_c_str("statuses"),
-                               &statuses_array_handle);
-    ThsnValueArrayTable statuses_array_table;
-    thsn_document_read_array(document, statuses_array_handle,
-                             &statuses_array_table);
-    ThsnValueHandle status_object_handle;
-    thsn_document_index_array_element(document, statuses_array_table, status_no,
-                                      &status_object_handle);
-    ThsnValueObjectTable status_object_sorted_table;
-    thsn_document_read_object_sorted(document, status_object_handle,
-                                     &status_object_sorted_table);
     ThsnValueHandle retweet_count_handle;
-    thsn_document_object_index(document, status_object_sorted_table,
-                               thsn_slice_from_c_str("retweet_count"),
-                               &retweet_count_handle);
+    thsn_document_query(document, path, &retweet_count_handle);
     double retweet_count;
     thsn_document_read_number(document, retweet_count_handle, &retweet_count);
     thsn_document_free(&document);
+    thsn_path_free(&path);
     return (int64_t)retweet_count;
 }
 
+/* Re-emits the statuses of a bunch, like a service forwarding them */
+int64_t yyjson_forward(char *json, size_t json_size, size_t bunch_no) {
+    yyjson_doc *doc = yyjson_read(json, json_size, YYJSON_READ_NOFLAG);
+    yyjson_val *root = yyjson_doc_get_root(doc);
+    yyjson_val *bunch = yyjson_arr_get(root, bunch_no);
+    yyjson_val *statuses = yyjson_obj_get(bunch, "statuses");
+    size_t output_size = 0;
+    char *output = yyjson_val_write(statuses, YYJSON_WRITE_NOFLAG,
+                                    &output_size);
+    free(output);
+    yyjson_doc_free(doc);
+    return (int64_t)output_size;
+}
+
+int64_t threason_forward(ThsnSlice json, size_t bunch_no) {
+    /* Ignoring errors */
+    const std::string path_str = "/" + std::to_string(bunch_no) + "/statuses";
+    ThsnPath *path;
+    thsn_path_compile(thsn_slice_make(path_str.data(), path_str.size()),
+                      &path);
+    ThsnDocument *document;
+    thsn_document_parse(&json, &document);
+    ThsnValueHandle statuses_handle;
+    thsn_document_query(document, path, &statuses_handle);
+    ThsnOutputBuffer output_buffer = {};
+    thsn_document_serialize(document, statuses_handle, NULL, &output_buffer);
+    const size_t output_size = output_buffer.size;
+    thsn_output_buffer_free(&output_buffer);
+    thsn_document_free(&document);
+    thsn_path_free(&path);
+    return (int64_t)output_size;
+}
+
 int main(int argc, char **argv) {
     enum class Bench {
         simdjson,
@@ -72,6 +90,9 @@ int main(int argc, char **argv) {
         threason_2t,
         threason_4t,
         threason_8t,
+        threason_lazy,
+        yyjson_forward,
+        threason_forward,
     };
 
     Bench bench = Bench::threason_1t;
@@ -86,6 +107,9 @@ int main(int argc, char **argv) {
             {"threason_2t", Bench::threason_2t},
             {"threason_4t", Bench::threason_4t},
             {"threason_8t", Bench::threason_8t},
+            {"threason_lazy", Bench::threason_lazy},
+            {"yyjson_forward", Bench::yyjson_forward},
+            {"threason_forward", Bench::threason_forward},
         };
         if (auto b = benches.find(argv[1]); b != benches.end()) {
             bench = b->second;
@@ -100,10 +124,8 @@ int main(int argc, char **argv) {
         status_no = std::stoll(argv[3]);
     }
 
-    std::cin >> std::noskipws;
-    std::istream_iterator<char> cin_begin(std::cin);
-    std::istream_iterator<char> cin_end;
-    std::string json_string(cin_begin, cin_end);
+    /* Reads straight from the stream buffer, without per-char extraction */
+    std::string json_string(std::istreambuf_iterator<char>(std::cin), {});
     simdjson::padded_string padded_json =
         simdjson::padded_string(std::string_view(json_string));
     ThsnSlice json_slice =
@@ -159,6 +181,23 @@ int main(int argc, char **argv) {
                 json_slice, bunch_no, status_no);
             break;
         }
+        case Bench::threason_lazy: {
+            std::cout << "Using threason_lazy" << std::endl;
+            result = threason_dom(thsn_document_parse_lazy, json_slice,
+                                  bunch_no, status_no);
+            break;
+        }
+        case Bench::yyjson_forward: {
+            std::cout << "Using yyjson_forward" << std::endl;
+            result = yyjson_forward(json_string.data(), json_string.size(),
+                                    bunch_no);
+            break;
+        }
+        case Bench::threason_forward: {
+            std::cout << "Using threason_forward" << std::endl;
+            result = threason_forward(json_slice, bunch_no);
+            break;
+        }
     }
     auto end_time = std::chrono::steady_clock::now();
     auto diff = std::chrono::duration_cast<std::chrono::microseconds>(
@@ -117,30 +117,34 @@ int main(int argc, char** argv) {
         thread_count = 16;
     }
 
-    if (argc > 2) {
-        file = fopen(argv[2], "rb");
-    }
+    const char* path = argc > 2 ? argv[2] : NULL;
     char* json_str = NULL;
     size_t json_str_len = 0;
-    char buffer[1024 * 1024];
-    do {
-        size_t read_len = fread(buffer, 1, 1024 * 1024, file);
-        if (read_len == 0) {
-            break;
-        }
-        json_str = realloc(json_str, json_str_len + read_len);
-        memcpy(json_str + json_str_len, buffer, read_len);
-        json_str_len += read_len;
-    } while (true);
-    fprintf(stderr, "Read %zu bytes.\n", json_str_len);
+    if (path == NULL) {
+        char buffer[1024 * 1024];
+        do {
+            size_t read_len = fread(buffer, 1, 1024 * 1024, file);
+            if (read_len == 0) {
+                break;
+            }
+            json_str = realloc(json_str, json_str_len + read_len);
+            memcpy(json_str + json_str_len, buffer, read_len);
+            json_str_len += read_len;
+        } while (true);
+        fprintf(stderr, "Read %zu bytes.\n", json_str_len);
+    }
     ThsnSlice input_slice = {.data = json_str, .size = json_str_len};
-    ThsnDocument* document;
+    ThsnDocument* document = NULL;
 
     ThsnResult parsing_result;
 
     struct timespec start_time;
     clock_gettime(CLOCK_MONOTONIC, &start_time);
-    if (thread_count == 1) {
+    if (path != NULL) {
+        /* Files are mapped and parsed without copying */
+        parsing_result =
+            thsn_document_parse_file(path, &document, thread_count);
+    } else if (thread_count == 1) {
         parsing_result = thsn_document_parse(&input_slice, &document);
     } else {
         parsing_result = thsn_document_parse_multithreaded(
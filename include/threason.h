@@ -33,9 +33,16 @@ typedef enum {
     THSN_VALUE_OBJECT,
 } ThsnValueType;
 
+typedef enum {
+    THSN_NUMBER_INT,
+    /* An integer above `INT64_MAX` */
+    THSN_NUMBER_UINT,
+    THSN_NUMBER_DOUBLE,
+} ThsnNumberType;
+
 typedef struct {
-    uint8_t segment_no;
-    uint64_t offset : 56;
+    uint16_t segment_no;
+    uint64_t offset : 48;
 } ThsnValueHandle;
 
 static inline ThsnValueHandle thsn_value_handle_first(void) {
@@ -43,12 +50,12 @@ static inline ThsnValueHandle thsn_value_handle_first(void) {
 }
 
 static inline ThsnValueHandle thsn_value_handle_not_found(void) {
-    return (ThsnValueHandle){.segment_no = UINT8_MAX, .offset = 0};
+    return (ThsnValueHandle){.segment_no = UINT16_MAX, .offset = 0};
 }
 
 static inline bool thsn_value_handle_is_not_found(
     ThsnValueHandle value_handle) {
-    return value_handle.segment_no == UINT8_MAX;
+    return value_handle.segment_no == UINT16_MAX;
 }
 
 typedef struct {
@@ -79,14 +86,55 @@ typedef struct {
     bool last;
 } ThsnVisitorContext;
 
+/* Memory used by documents and by the parse calls. `reallocate` and `free`
+ * never get NULL pointers, and get the size the block currently has.
+ * Allocators passed to multithreaded parse calls are called from several
+ * threads at once. */
 typedef struct {
+    void* (*allocate)(void* user_data, size_t size);
+    void* (*reallocate)(void* user_data, void* ptr, size_t old_size,
+                        size_t new_size);
+    void (*free)(void* user_data, void* ptr, size_t size);
+    void* user_data;
+} ThsnAllocator;
+
+typedef struct ThsnBumpArena ThsnBumpArena;
+
+typedef struct ThsnArena ThsnArena;
+
+typedef struct ThsnObjectIndex ThsnObjectIndex;
+
+typedef struct {
+    /* Everything the document owns is allocated with it */
+    ThsnAllocator allocator;
+    /* Set by `thsn_document_parse_file`, strings without escapes point into
+     * it, and by `thsn_document_load_mmap`, the only segment is in it */
+    ThsnOwningSlice mapped_input;
+    /* The first segment is a part of `mapped_input` rather than allocated */
+    bool mapped_segment;
+    /* Data built on first access: decoded copies of escaped strings and
+     * object hash indexes */
+    ThsnArena* arena;
+    /* Parser buffers kept for `thsn_document_parse_into`: the stack and the
+     * full capacity of the first segment */
+    ThsnOwningMutSlice parser_stack;
+    size_t segment_capacity;
+    /* Lazy documents parse arrays and objects on first access into the last
+     * segment, this much of it is taken */
+    size_t lazy_segment_offset;
+    /* Segments the document was allocated with, at least `segment_count` */
+    size_t allocated_segment_count;
     size_t segment_count;
     ThsnOwningMutSlice segments[];
 } ThsnDocument;
 
 typedef struct {
-    uint8_t segment_no;
+    uint16_t segment_no;
+    /* Size of the `elements_table` entries */
+    uint8_t offset_size;
     ThsnSlice elements_table;
+    /* Only set by `thsn_document_read_object_indexed` */
+    const ThsnObjectIndex* hash_index;
 } ThsnValueCompositeTable;
 
 typedef ThsnValueCompositeTable ThsnValueArrayTable;
@@ -111,19 +159,212 @@ typedef struct {
                                           void* user_data);
 } ThsnVisitorVTable;
 
+/* Gets every record of a newline-delimited input, along with its number
+ * among the records. The callback owns the document. */
+typedef ThsnVisitorResult (*ThsnRecordCallback)(void* user_data,
+                                                size_t record_no,
+                                                ThsnDocument* document);
+
+typedef struct ThsnParserPool ThsnParserPool;
+
+typedef struct ThsnPushParser ThsnPushParser;
+
+typedef struct ThsnPath ThsnPath;
+
+/* Where `thsn_document_serialize` writes to. A zeroed buffer is empty and
+ * grows with `malloc`, the data is freed with `thsn_output_buffer_free`. */
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+    /* NULL for `malloc` and `free`, has to outlive the buffer */
+    const ThsnAllocator* allocator;
+} ThsnOutputBuffer;
+
+typedef struct {
+    /* Every element on a line of its own, and a space after colons */
+    bool pretty;
+    /* Spaces per level of nesting in pretty output */
+    size_t indent;
+} ThsnSerializeOptions;
+
+/* A bump allocator: allocations only move a pointer within the arena's
+ * chunks, `free` does nothing, and all the memory is released at once by
+ * `thsn_bump_arena_reset`. Meant to be kept per request or per thread, so
+ * concurrent parses don't contend on a shared allocator. The threads of one
+ * multithreaded parse can share an arena, its allocations are serialized. */
+extern ThsnResult thsn_bump_arena_create(ThsnBumpArena** /*out*/ bump_arena);
+
+/* The arena's chunks come from `allocator` */
+extern ThsnResult thsn_bump_arena_create_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnBumpArena** /*out*/ bump_arena);
+
+extern ThsnResult thsn_bump_arena_free(ThsnBumpArena** /*in*/ bump_arena);
+
+/* Documents allocated by the arena must not be used or freed afterwards. The
+ * arena keeps its chunks, so the next request doesn't allocate. */
+extern ThsnResult thsn_bump_arena_reset(ThsnBumpArena* /*mut*/ bump_arena);
+
+extern ThsnAllocator thsn_bump_arena_allocator(
+    ThsnBumpArena* /*in*/ bump_arena);
+
+/* Creates an empty document for `thsn_document_parse_into`, a NULL
+ * `allocator` stands for `malloc` and `free`. */
+extern ThsnResult thsn_document_create(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnDocument** /*out*/ document);
+
 extern ThsnResult thsn_document_free(ThsnDocument** /*in*/ document);
 
 extern ThsnResult thsn_document_parse(ThsnSlice* /*mut*/ json_str_slice,
                                       ThsnDocument** /*out*/ document);
 
+extern ThsnResult thsn_document_parse_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document);
+
+/* Parses into `*document`, reusing its buffers and its allocator, or allocates
+ * a new document if `*document` is NULL. Values of the previous parse, handles
+ * and slices read from it are invalidated. Once the buffers have grown to fit
+ * the input, parsing doesn't allocate. On error the document stays valid but
+ * empty, and still has to be freed. */
+extern ThsnResult thsn_document_parse_into(ThsnDocument** /*mut*/ document,
+                                           ThsnSlice* /*mut*/ json_str_slice);
+
+/* Only the elements of the root value are parsed up front, arrays and
+ * objects within it are just bracket-matched. Each of them is parsed the
+ * same way once a read function gets to it, so reading a few values of a
+ * large document skips most of the parsing. The input has to outlive the
+ * document, and is only fully validated once every value has been read:
+ * reading a part of it that turns out invalid fails with an input error. */
+extern ThsnResult thsn_document_parse_lazy(ThsnSlice* /*mut*/ json_str_slice,
+                                           ThsnDocument** /*out*/ document);
+
+extern ThsnResult thsn_document_parse_lazy_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document);
+
+/* Splits the input into several chunks per thread, preparsed by all the
+ * threads but the calling one, which take over each other's chunks once done
+ * with their own. The calling thread parses the document from the start and
+ * takes the values preparsed in the chunks as it gets to them, or parses the
+ * chunks nobody has started yet itself. */
 extern ThsnResult thsn_document_parse_multithreaded(
     ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
     size_t threads_count);
 
+extern ThsnResult thsn_document_parse_multithreaded_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
+    size_t threads_count);
+
+/* Copies the strings that would point into the input into the document, so
+ * the input can be freed as soon as the call returns, and the document holds
+ * no pointers outside of its own memory. Each thread copies the strings of
+ * its part of the input. `threads_count` of 1 parses on the calling
+ * thread. */
+extern ThsnResult thsn_document_parse_self_contained(
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
+    size_t threads_count);
+
+extern ThsnResult thsn_document_parse_self_contained_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
+    size_t threads_count);
+
+/* Maps the file read-only and parses it in place, the mapping lives as long as
+ * the document. `threads_count` of 1 parses on the calling thread. */
+extern ThsnResult thsn_document_parse_file(const char* /*in*/ path,
+                                           ThsnDocument** /*out*/ document,
+                                           size_t threads_count);
+
+/* A pool of `threads_count - 1` long-lived preparse workers, the thread
+ * calling `thsn_document_parse_with_pool` is the last one. The pool can be
+ * shared between concurrent parse calls. */
+extern ThsnResult thsn_parser_pool_create(size_t threads_count,
+                                          ThsnParserPool** /*out*/ pool);
+
+extern ThsnResult thsn_parser_pool_free(ThsnParserPool** /*in*/ pool);
+
+extern ThsnResult thsn_document_parse_with_pool(
+    ThsnParserPool* /*mut*/ pool, ThsnSlice* /*mut*/ json_str_slice,
+    ThsnDocument** /*out*/ document);
+
+extern ThsnResult thsn_document_parse_with_pool_and_allocator(
+    ThsnParserPool* /*mut*/ pool, const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document);
+
+/* Parses newline-delimited JSON (NDJSON, JSON Lines): one value per line,
+ * blank lines are skipped. The input is split between the threads at line
+ * boundaries and each record becomes a document of its own. `callback` is
+ * called on the calling thread in input order; records of one thread's part
+ * are kept until all the previous ones are passed on. Returning either of the
+ * abort results stops the parse, and the rest of the records are freed. On
+ * an invalid record the ones before it have been passed to `callback`. */
+extern ThsnResult thsn_document_parse_ndjson(ThsnSlice json_lines_slice,
+                                             size_t threads_count,
+                                             ThsnRecordCallback callback,
+                                             void* /*in*/ user_data);
+
+extern ThsnResult thsn_document_parse_ndjson_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator, ThsnSlice json_lines_slice,
+    size_t threads_count, ThsnRecordCallback callback,
+    void* /*in*/ user_data);
+
+/* A parser fed with the input a chunk at a time, as it arrives. Chunks can be
+ * of any size and split tokens anywhere, and don't have to outlive the feed
+ * call: strings that would point into the input are copied into the
+ * document. */
+extern ThsnResult thsn_push_parser_create(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnPushParser** /*out*/ push_parser);
+
+extern ThsnResult thsn_push_parser_free(ThsnPushParser** /*in*/ push_parser);
+
+/* Once a feed call fails, the rest fail as well until
+ * `thsn_push_parser_finish`. */
+extern ThsnResult thsn_push_parser_feed(ThsnPushParser* /*mut*/ push_parser,
+                                        ThsnSlice chunk_slice);
+
+/* Ends the input and hands over the document. Either way, the parser is ready
+ * for the next document afterwards. */
+extern ThsnResult thsn_push_parser_finish(ThsnPushParser* /*mut*/ push_parser,
+                                          ThsnDocument** /*out*/ document);
+
+/* The read functions that take a mutable document cache sorted tables, hash
+ * indexes and decoded strings in it on first access, and parse the composites
+ * of lazy documents, so they can't be called concurrently on the same
+ * document. This does all of that work up front; afterwards the read
+ * functions never write to the document and can be called from any number of
+ * threads at once. */
+extern ThsnResult thsn_document_freeze(ThsnDocument* /*mut*/ document);
+
+/* Copies the value tree into a single segment, in the order a single-threaded
+ * parse would store it, replacing the segments of multithreaded and lazy
+ * documents: values are then read with no handles to follow and no parsing
+ * left. Up to `threads_count` threads copy parts of the root's elements,
+ * lazy documents are compacted on the calling thread. Value handles of the
+ * document are invalidated, and the sorted tables and hash indexes of a
+ * frozen document have to be built again, by freezing it again or on first
+ * access. */
+extern ThsnResult thsn_document_compact(ThsnDocument* /*mut*/ document,
+                                        size_t threads_count);
+
 extern ThsnResult thsn_document_visit(ThsnDocument* /*mut*/ document,
                                       const ThsnVisitorVTable* /*in*/ vtable,
                                       void* /*in*/ user_data);
 
+/* Fires the `thsn_document_visit` callbacks straight from the tokens, without
+ * building a document. The input is validated as it goes, so callbacks may
+ * have been called by the time it turns out invalid. Values skipped with
+ * `THSN_VISITOR_RESULT_SKIP` are only bracket-matched. So is the whole input
+ * once ahead of the callbacks, to tell which arrays and objects are `last`,
+ * unless the vtable has no array or object callbacks. */
+extern ThsnResult thsn_parse_visit(ThsnSlice* /*mut*/ json_str_slice,
+                                   const ThsnVisitorVTable* /*in*/ vtable,
+                                   void* /*in*/ user_data);
+
 extern ThsnResult thsn_document_value_type(const ThsnDocument* /*in*/ document,
                                            ThsnValueHandle value_handle,
                                            ThsnValueType* /*out*/ value_type);
@@ -136,49 +377,129 @@ extern ThsnResult thsn_document_read_number(const ThsnDocument* /*in*/ document,
                                             ThsnValueHandle value_handle,
                                             double* /*out*/ value);
 
+extern ThsnResult thsn_document_number_type(
+    const ThsnDocument* /*in*/ document, ThsnValueHandle value_handle,
+    ThsnNumberType* /*out*/ number_type);
+
+/* Integers are read exactly, doubles only if they are integral and in
+ * range. */
+extern ThsnResult thsn_document_read_int64(const ThsnDocument* /*in*/ document,
+                                           ThsnValueHandle value_handle,
+                                           int64_t* /*out*/ value);
+
+extern ThsnResult thsn_document_read_uint64(
+    const ThsnDocument* /*in*/ document, ThsnValueHandle value_handle,
+    uint64_t* /*out*/ value);
+
 extern ThsnResult thsn_document_read_string(const ThsnDocument* /*in*/ document,
                                             ThsnValueHandle value_handle,
                                             ThsnSlice* /*out*/ string_slice);
 
+/* Same as `thsn_document_read_string`, but with escape sequences decoded.
+ * Strings without escapes are returned in place, the rest are decoded on first
+ * access and cached in the document. */
+extern ThsnResult thsn_document_read_string_decoded(
+    ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
+    ThsnSlice* /*out*/ string_slice);
+
 extern ThsnResult thsn_document_read_array(
-    ThsnDocument* /*in*/ document, ThsnValueHandle value_handle,
+    ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
     ThsnValueArrayTable* /*out*/ array_table);
 
 extern size_t thsn_document_array_length(ThsnValueArrayTable array_table);
 
 extern ThsnResult thsn_document_index_array_element(
-    const ThsnDocument* /*in*/ document, ThsnValueArrayTable array_table,
+    ThsnDocument* /*mut*/ document, ThsnValueArrayTable array_table,
     size_t element_no, ThsnValueHandle* /*out*/ element_handle);
 
 extern ThsnResult thsn_document_array_consume_element(
-    const ThsnDocument* /*in*/ document,
-    ThsnValueArrayTable* /*mut*/ array_table,
+    ThsnDocument* /*mut*/ document, ThsnValueArrayTable* /*mut*/ array_table,
     ThsnValueHandle* /*out*/ element_handle);
 
 extern ThsnResult thsn_document_read_object(
     ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
     ThsnValueObjectTable* /*out*/ object_table);
 
+/* The table is sorted by key on first access, the sorted order is cached in
+ * the document. */
 extern ThsnResult thsn_document_read_object_sorted(
     ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
     ThsnValueObjectTable* /*out*/ object_table);
 
+/* The table comes with a hash index of the object keys, built on first
+ * access, so `thsn_document_object_index` takes O(1) expected time. */
+extern ThsnResult thsn_document_read_object_indexed(
+    ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
+    ThsnValueObjectTable* /*out*/ object_table);
+
 extern size_t thsn_document_object_length(ThsnValueObjectTable object_table);
 
 extern ThsnResult thsn_document_object_index_element(
-    const ThsnDocument* /*in*/ document, ThsnValueObjectTable object_table,
+    ThsnDocument* /*mut*/ document, ThsnValueObjectTable object_table,
     size_t element_no, ThsnSlice* /*out*/ key_str_slice,
     ThsnValueHandle* /*out*/ element_handle);
 
 extern ThsnResult thsn_document_object_consume_element(
-    const ThsnDocument* /*in*/ document,
-    ThsnValueObjectTable* /*mut*/ object_table, ThsnSlice* /*out*/ key_slice,
-    ThsnValueHandle* /*out*/ element_handle);
+    ThsnDocument* /*mut*/ document, ThsnValueObjectTable* /*mut*/ object_table,
+    ThsnSlice* /*out*/ key_slice, ThsnValueHandle* /*out*/ element_handle);
 
 extern ThsnResult thsn_document_object_index(
-    const ThsnDocument* /*in*/ document, ThsnValueObjectTable object_table,
+    ThsnDocument* /*mut*/ document, ThsnValueObjectTable object_table,
     ThsnSlice key_slice, ThsnValueHandle* /*out*/ element_handle);
 
+/* Compiles a JSON Pointer (RFC 6901), like "/0/statuses/4/retweet_count",
+ * for `thsn_document_query`, which matches keys as they decode rather than as
+ * they're spelled in the input. The empty path refers to the whole document. A
+ * path can be kept and used with any number of documents, from any number of
+ * threads. */
+extern ThsnResult thsn_path_compile(ThsnSlice path_slice,
+                                    ThsnPath** /*out*/ path);
+
+extern ThsnResult thsn_path_compile_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator, ThsnSlice path_slice,
+    ThsnPath** /*out*/ path);
+
+extern ThsnResult thsn_path_free(ThsnPath** /*in*/ path);
+
+/* Returns `thsn_value_handle_not_found()` if the path leads nowhere. Object
+ * keys are looked up with their hashes taken at compile time in the hash
+ * indexes built so far, or else in the sorted tables, or else one by one.
+ * Nothing gets cached, so unlike the read functions queries never write to
+ * the document, other than to parse the composites of lazy ones. */
+extern ThsnResult thsn_document_query(ThsnDocument* /*mut*/ document,
+                                      const ThsnPath* /*in*/ path,
+                                      ThsnValueHandle* /*out*/ value_handle);
+
+/* Appends the value as JSON to the buffer, minified unless `options` asks
+ * for pretty output. Strings are written decoded, with only quotes,
+ * backslashes and control characters escaped, and doubles in the shortest
+ * form that parses back to the same value. Like queries, serializing never
+ * writes to the document other than to parse the composites of lazy ones.
+ * On error the buffer is left as it was, apart from its capacity. */
+extern ThsnResult thsn_document_serialize(
+    ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
+    const ThsnSerializeOptions* /*maybe in*/ options,
+    ThsnOutputBuffer* /*mut*/ output_buffer);
+
+extern ThsnResult thsn_output_buffer_free(
+    ThsnOutputBuffer* /*mut*/ output_buffer);
+
+/* Writes a snapshot of the document to `fd` at its current position, for
+ * `thsn_document_load_mmap`. The snapshot holds the value tree in a single
+ * segment, with strings copied into it and escaped ones decoded, so it
+ * doesn't depend on the input and is read without any indirection. Like
+ * serializing, this never writes to the document other than to parse the
+ * composites of lazy ones. */
+extern ThsnResult thsn_document_save(ThsnDocument* /*mut*/ document, int fd);
+
+/* Maps a snapshot written by `thsn_document_save` and reads it in place, with
+ * no parsing: loading costs as much as checking the checksum, and values are
+ * paged in as they're read. Snapshots of another format version, byte order
+ * or word size are an input error, as are corrupted ones. Caches built on
+ * first access go to private copies of the pages, the file is left as is. */
+extern ThsnResult thsn_document_load_mmap(const char* /*in*/ path,
+                                          ThsnDocument** /*out*/ document);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,72 @@
+#define _GNU_SOURCE
+
+#include "allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Sizes are rounded to huge pages, so mappings can be backed by them */
+static size_t thsn_mapping_size(size_t size) {
+    return (size + THSN_HUGE_PAGE_SIZE - 1) &
+           ~(size_t)(THSN_HUGE_PAGE_SIZE - 1);
+}
+
+static void* thsn_map(size_t size) {
+    void* const data = mmap(NULL, thsn_mapping_size(size),
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    /* Only a hint, DOM traversal takes fewer DTLB misses if it's taken */
+    madvise(data, thsn_mapping_size(size), MADV_HUGEPAGE);
+#endif
+    return data;
+}
+
+void* thsn_system_allocate(void* user_data, size_t size) {
+    (void)user_data;
+    return size < THSN_MAPPED_BLOCK_MIN_SIZE ? malloc(size) : thsn_map(size);
+}
+
+/* Mapped blocks are grown by remapping their pages, so large segments are
+ * never copied and never need twice their size. */
+void* thsn_system_reallocate(void* user_data, void* ptr, size_t old_size,
+                             size_t new_size) {
+    (void)user_data;
+    const bool was_mapped = old_size >= THSN_MAPPED_BLOCK_MIN_SIZE;
+    const bool is_mapped = new_size >= THSN_MAPPED_BLOCK_MIN_SIZE;
+    if (!was_mapped && !is_mapped) {
+        return realloc(ptr, new_size);
+    }
+    if (was_mapped && is_mapped) {
+        const size_t old_mapping_size = thsn_mapping_size(old_size);
+        const size_t new_mapping_size = thsn_mapping_size(new_size);
+        if (old_mapping_size == new_mapping_size) {
+            return ptr;
+        }
+#ifdef MREMAP_MAYMOVE
+        void* const data =
+            mremap(ptr, old_mapping_size, new_mapping_size, MREMAP_MAYMOVE);
+        return data == MAP_FAILED ? NULL : data;
+#endif
+    }
+    /* Crossing the threshold, or no `mremap` */
+    void* const data = thsn_system_allocate(user_data, new_size);
+    if (data != NULL) {
+        memcpy(data, ptr, old_size < new_size ? old_size : new_size);
+        thsn_system_free(user_data, ptr, old_size);
+    }
+    return data;
+}
+
+void thsn_system_free(void* user_data, void* ptr, size_t size) {
+    (void)user_data;
+    if (size < THSN_MAPPED_BLOCK_MIN_SIZE) {
+        free(ptr);
+    } else if (ptr != NULL) {
+        munmap(ptr, thsn_mapping_size(size));
+    }
+}
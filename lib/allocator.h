@@ -0,0 +1,71 @@
+#ifndef THSN_ALLOCATOR_H
+#define THSN_ALLOCATOR_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "threason.h"
+
+/* Blocks this large, in practice only segments of large documents, are mapped
+ * directly instead of coming from `malloc`. */
+#define THSN_MAPPED_BLOCK_MIN_SIZE (32 * 1024 * 1024)
+#define THSN_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* The default allocator, `user_data` is unused. */
+void* thsn_system_allocate(void* user_data, size_t size);
+void* thsn_system_reallocate(void* user_data, void* ptr, size_t old_size,
+                             size_t new_size);
+void thsn_system_free(void* user_data, void* ptr, size_t size);
+
+static inline ThsnAllocator thsn_system_allocator(void) {
+    return (ThsnAllocator){.allocate = thsn_system_allocate,
+                           .reallocate = thsn_system_reallocate,
+                           .free = thsn_system_free,
+                           .user_data = NULL};
+}
+
+/* A NULL `allocator` stands for the system one, so internal buffers not owned
+ * by a document skip the indirect calls. Blocks can move between NULL and a
+ * document's copy of the system allocator. */
+static inline void* thsn_allocate(const ThsnAllocator* /*maybe in*/ allocator,
+                                  size_t size) {
+    return allocator == NULL ? thsn_system_allocate(NULL, size)
+                             : allocator->allocate(allocator->user_data, size);
+}
+
+static inline void* thsn_allocate_zeroed(
+    const ThsnAllocator* /*maybe in*/ allocator, size_t size) {
+    void* const ptr = thsn_allocate(allocator, size);
+    if (ptr != NULL) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+static inline void* thsn_reallocate(const ThsnAllocator* /*maybe in*/ allocator,
+                                    void* /*in*/ ptr, size_t old_size,
+                                    size_t new_size) {
+    if (ptr == NULL) {
+        return thsn_allocate(allocator, new_size);
+    }
+    if (allocator == NULL) {
+        return thsn_system_reallocate(NULL, ptr, old_size, new_size);
+    }
+    return allocator->reallocate(allocator->user_data, ptr, old_size,
+                                 new_size);
+}
+
+/* `size` must be the size the block was last allocated or reallocated with */
+static inline void thsn_free(const ThsnAllocator* /*maybe in*/ allocator,
+                             void* /*in*/ ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (allocator == NULL) {
+        thsn_system_free(NULL, ptr, size);
+    } else {
+        allocator->free(allocator->user_data, ptr, size);
+    }
+}
+
+#endif
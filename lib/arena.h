@@ -0,0 +1,184 @@
+#ifndef THSN_ARENA_H
+#define THSN_ARENA_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "result.h"
+#include "threason.h"
+
+#define THSN_ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct ThsnArenaChunk {
+    struct ThsnArenaChunk* previous_chunk;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) char data[];
+} ThsnArenaChunk;
+
+/* Chunks are never reallocated, so allocations stay valid until the arena is
+ * reset or freed. */
+struct ThsnArena {
+    /* NULL for the C library allocator */
+    const ThsnAllocator* allocator;
+    ThsnArenaChunk* last_chunk;
+    /* Chunks released by `thsn_arena_reset`, reused before allocating */
+    ThsnArenaChunk* spare_chunks;
+};
+
+static inline ThsnResult thsn_arena_create(
+    const ThsnAllocator* /*maybe in*/ allocator, ThsnArena** /*out*/ arena) {
+    BAIL_ON_NULL_INPUT(arena);
+    *arena = thsn_allocate_zeroed(allocator, sizeof(ThsnArena));
+    BAIL_ON_ALLOC_FAILURE(*arena);
+    (*arena)->allocator = allocator;
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline void thsn_arena_free_chunks(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnArenaChunk* /*in*/ chunk) {
+    while (chunk != NULL) {
+        ThsnArenaChunk* const previous_chunk = chunk->previous_chunk;
+        thsn_free(allocator, chunk, sizeof(ThsnArenaChunk) + chunk->size);
+        chunk = previous_chunk;
+    }
+}
+
+static inline ThsnResult thsn_arena_free(ThsnArena** /*in*/ arena) {
+    BAIL_ON_NULL_INPUT(arena);
+    if (*arena == NULL) {
+        return THSN_RESULT_SUCCESS;
+    }
+    const ThsnAllocator* const allocator = (*arena)->allocator;
+    thsn_arena_free_chunks(allocator, (*arena)->last_chunk);
+    thsn_arena_free_chunks(allocator, (*arena)->spare_chunks);
+    thsn_free(allocator, *arena, sizeof(ThsnArena));
+    *arena = NULL;
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Invalidates all the allocations but keeps the memory for the next ones. */
+static inline void thsn_arena_reset(ThsnArena* /*maybe mut*/ arena) {
+    if (arena == NULL) {
+        return;
+    }
+    while (arena->last_chunk != NULL) {
+        ThsnArenaChunk* const chunk = arena->last_chunk;
+        arena->last_chunk = chunk->previous_chunk;
+        chunk->previous_chunk = arena->spare_chunks;
+        arena->spare_chunks = chunk;
+    }
+}
+
+/* Moves the allocations of `*source` into `arena`, which has to have the
+ * same allocator, and frees `*source`. They stay where they are, as chunks
+ * are never reallocated. */
+static inline void thsn_arena_merge(ThsnArena* /*mut*/ arena,
+                                    ThsnArena** /*in*/ source) {
+    if (*source == NULL) {
+        return;
+    }
+    ThsnArenaChunk* const last_chunk = (*source)->last_chunk;
+    if (last_chunk != NULL) {
+        ThsnArenaChunk* first_chunk = last_chunk;
+        while (first_chunk->previous_chunk != NULL) {
+            first_chunk = first_chunk->previous_chunk;
+        }
+        /* Behind the arena's last chunk, which the next allocations go to */
+        if (arena->last_chunk == NULL) {
+            arena->last_chunk = last_chunk;
+        } else {
+            first_chunk->previous_chunk = arena->last_chunk->previous_chunk;
+            arena->last_chunk->previous_chunk = last_chunk;
+        }
+        (*source)->last_chunk = NULL;
+    }
+    thsn_arena_free(source);
+}
+
+/* Takes the smallest spare chunk with room for `size`. If none has room, they
+ * are all freed rather than kept: a chunk gets allocated anyway, and spare
+ * chunks too small for the requests would pile up with each reset. */
+static inline ThsnArenaChunk* thsn_arena_take_spare_chunk(
+    ThsnArena* /*mut*/ arena, size_t size) {
+    ThsnArenaChunk** best_link = NULL;
+    for (ThsnArenaChunk** link = &arena->spare_chunks; *link != NULL;
+         link = &(*link)->previous_chunk) {
+        if ((*link)->size >= size &&
+            (best_link == NULL || (*link)->size < (*best_link)->size)) {
+            best_link = link;
+        }
+    }
+    if (best_link != NULL) {
+        ThsnArenaChunk* const chunk = *best_link;
+        *best_link = chunk->previous_chunk;
+        return chunk;
+    }
+    thsn_arena_free_chunks(arena->allocator, arena->spare_chunks);
+    arena->spare_chunks = NULL;
+    return NULL;
+}
+
+/* Creates the arena with the C library allocator on first use. `alignment`
+ * must be a power of two not exceeding `_Alignof(max_align_t)`. */
+static inline ThsnResult thsn_arena_allocate_aligned(
+    ThsnArena** /*mut*/ arena, size_t size, size_t alignment,
+    char** /*out*/ allocated_data) {
+    BAIL_ON_NULL_INPUT(arena);
+    BAIL_ON_NULL_INPUT(allocated_data);
+    if (*arena == NULL) {
+        BAIL_ON_ERROR(thsn_arena_create(NULL, arena));
+    }
+    ThsnArenaChunk* chunk = (*arena)->last_chunk;
+    size_t aligned_used = 0;
+    if (chunk != NULL) {
+        aligned_used = (chunk->used + alignment - 1) & ~(alignment - 1);
+    }
+    if (chunk == NULL || aligned_used > chunk->size ||
+        chunk->size - aligned_used < size) {
+        chunk = thsn_arena_take_spare_chunk(*arena, size);
+        if (chunk == NULL) {
+            const size_t chunk_size =
+                size > THSN_ARENA_CHUNK_SIZE ? size : THSN_ARENA_CHUNK_SIZE;
+            chunk = thsn_allocate((*arena)->allocator,
+                                  sizeof(ThsnArenaChunk) + chunk_size);
+            BAIL_ON_ALLOC_FAILURE(chunk);
+            chunk->size = chunk_size;
+        }
+        chunk->previous_chunk = (*arena)->last_chunk;
+        chunk->used = 0;
+        (*arena)->last_chunk = chunk;
+        aligned_used = 0;
+    }
+    *allocated_data = chunk->data + aligned_used;
+    chunk->used = aligned_used + size;
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline ThsnResult thsn_arena_allocate(ThsnArena** /*mut*/ arena,
+                                             size_t size,
+                                             char** /*out*/ allocated_data) {
+    return thsn_arena_allocate_aligned(arena, size, 1, allocated_data);
+}
+
+/* Succeeds only if `data` is the last allocation and its chunk has room. */
+static inline bool thsn_arena_try_resize_last(ThsnArena* /*mut*/ arena,
+                                              const char* /*in*/ data,
+                                              size_t old_size,
+                                              size_t new_size) {
+    ThsnArenaChunk* const chunk = arena->last_chunk;
+    if (chunk == NULL || data < chunk->data ||
+        data + old_size != chunk->data + chunk->used) {
+        return false;
+    }
+    const size_t data_offset = (size_t)(data - chunk->data);
+    if (chunk->size - data_offset < new_size) {
+        return false;
+    }
+    chunk->used = data_offset + new_size;
+    return true;
+}
+
+#endif
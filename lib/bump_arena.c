@@ -0,0 +1,116 @@
+#include <stddef.h>
+#include <string.h>
+#include <threads.h>
+
+#include "allocator.h"
+#include "arena.h"
+#include "result.h"
+#include "threason.h"
+
+struct ThsnBumpArena {
+    /* Only contended by the threads of one multithreaded parse */
+    mtx_t mutex;
+    /* Where the chunks come from unless it's the system one, the arena
+     * points to it */
+    ThsnAllocator allocator;
+    ThsnArena* arena;
+};
+
+static void* thsn_bump_arena_allocate(void* user_data, size_t size) {
+    ThsnBumpArena* const bump_arena = (ThsnBumpArena*)user_data;
+    char* data = NULL;
+    mtx_lock(&bump_arena->mutex);
+    if (thsn_arena_allocate_aligned(&bump_arena->arena, size,
+                                    _Alignof(max_align_t),
+                                    &data) != THSN_RESULT_SUCCESS) {
+        data = NULL;
+    }
+    mtx_unlock(&bump_arena->mutex);
+    return data;
+}
+
+/* Growing the last allocation in place is the common case: the parser's
+ * segment doubles while nothing else gets allocated. */
+static void* thsn_bump_arena_reallocate(void* user_data, void* ptr,
+                                        size_t old_size, size_t new_size) {
+    ThsnBumpArena* const bump_arena = (ThsnBumpArena*)user_data;
+    char* data = ptr;
+    mtx_lock(&bump_arena->mutex);
+    /* Shrinking keeps the block where it is */
+    if (!thsn_arena_try_resize_last(bump_arena->arena, data, old_size,
+                                    new_size) &&
+        new_size > old_size) {
+        if (thsn_arena_allocate_aligned(&bump_arena->arena, new_size,
+                                        _Alignof(max_align_t),
+                                        &data) == THSN_RESULT_SUCCESS) {
+            memcpy(data, ptr, old_size);
+        } else {
+            data = NULL;
+        }
+    }
+    mtx_unlock(&bump_arena->mutex);
+    return data;
+}
+
+static void thsn_bump_arena_free_allocation(void* user_data, void* ptr,
+                                            size_t size) {
+    /* Released by `thsn_bump_arena_reset` */
+    (void)user_data;
+    (void)ptr;
+    (void)size;
+}
+
+ThsnResult thsn_bump_arena_create_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnBumpArena** /*out*/ bump_arena) {
+    BAIL_ON_NULL_INPUT(bump_arena);
+    *bump_arena = thsn_allocate_zeroed(allocator, sizeof(ThsnBumpArena));
+    BAIL_ON_ALLOC_FAILURE(*bump_arena);
+    (*bump_arena)->allocator =
+        allocator == NULL ? thsn_system_allocator() : *allocator;
+    if (mtx_init(&(*bump_arena)->mutex, mtx_plain) != thrd_success) {
+        thsn_free(allocator, *bump_arena, sizeof(ThsnBumpArena));
+        *bump_arena = NULL;
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    if (thsn_arena_create(allocator == NULL ? NULL : &(*bump_arena)->allocator,
+                          &(*bump_arena)->arena) != THSN_RESULT_SUCCESS) {
+        mtx_destroy(&(*bump_arena)->mutex);
+        thsn_free(allocator, *bump_arena, sizeof(ThsnBumpArena));
+        *bump_arena = NULL;
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_bump_arena_create(ThsnBumpArena** /*out*/ bump_arena) {
+    return thsn_bump_arena_create_with_allocator(NULL, bump_arena);
+}
+
+ThsnResult thsn_bump_arena_free(ThsnBumpArena** /*in*/ bump_arena) {
+    BAIL_ON_NULL_INPUT(bump_arena);
+    if (*bump_arena == NULL) {
+        return THSN_RESULT_SUCCESS;
+    }
+    const ThsnAllocator allocator = (*bump_arena)->allocator;
+    thsn_arena_free(&(*bump_arena)->arena);
+    mtx_destroy(&(*bump_arena)->mutex);
+    thsn_free(&allocator, *bump_arena, sizeof(ThsnBumpArena));
+    *bump_arena = NULL;
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_bump_arena_reset(ThsnBumpArena* /*mut*/ bump_arena) {
+    BAIL_ON_NULL_INPUT(bump_arena);
+    mtx_lock(&bump_arena->mutex);
+    thsn_arena_reset(bump_arena->arena);
+    mtx_unlock(&bump_arena->mutex);
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnAllocator thsn_bump_arena_allocator(ThsnBumpArena* /*in*/ bump_arena) {
+    return (ThsnAllocator){.allocate = thsn_bump_arena_allocate,
+                           .reallocate = thsn_bump_arena_reallocate,
+                           .free = thsn_bump_arena_free_allocation,
+                           .user_data = bump_arena};
+}
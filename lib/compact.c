@@ -0,0 +1,267 @@
+#include "allocator.h"
+#include "document.h"
+#include "result.h"
+#include "segment.h"
+#include "segment_builder.h"
+#include "thread_pool.h"
+#include "vector.h"
+
+/* Root composites with fewer elements per thread are copied on the calling
+ * thread alone */
+#define THSN_COMPACT_MIN_ELEMENTS_PER_THREAD 16
+
+/* A contiguous run of the root's elements, copied into a segment of its own
+ * and then moved after the previous part. The first part starts with the
+ * root's header and ends up holding the whole tree. */
+typedef struct {
+    /* Thread inputs */
+    ThsnSlice elements_table;
+    size_t offset_size;
+    uint16_t segment_no;
+    bool object;
+    /* Thread outputs */
+    ThsnSegmentBuilder builder;
+    /* Offsets of the copied elements in the part's segment */
+    ThsnVector element_offsets;
+    bool failed;
+    ThsnCompletion completion;
+} ThsnCompactPart;
+
+static ThsnResult thsn_compact_copy_part(ThsnCompactPart* /*mut*/ part) {
+    ThsnSlice elements_table = part->elements_table;
+    while (!thsn_slice_is_empty(elements_table) && !part->builder.too_large) {
+        size_t element_offset;
+        BAIL_ON_ERROR(thsn_segment_composite_consume_element_offset(
+            &elements_table, part->offset_size, &element_offset));
+        const size_t copied_element_offset =
+            thsn_vector_current_offset(part->builder.segment);
+        BAIL_ON_ERROR(THSN_VECTOR_PUSH_VAR(part->element_offsets,
+                                           copied_element_offset));
+        BAIL_ON_ERROR(thsn_segment_builder_copy_element(
+            &part->builder,
+            (ThsnValueHandle){.segment_no = part->segment_no,
+                              .offset = element_offset},
+            part->object));
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+static int thsn_compact_part_thread(void* /*in*/ user_data) {
+    if (user_data == NULL) {
+        return 0;
+    }
+    ThsnCompactPart* const part = (ThsnCompactPart*)user_data;
+    part->failed = thsn_compact_copy_part(part) != THSN_RESULT_SUCCESS;
+    thsn_completion_signal(&part->completion);
+    return 0;
+}
+
+static ThsnResult thsn_compact_build_sequential(
+    ThsnDocument* /*in*/ document, ThsnSegment* /*out*/ segment) {
+    ThsnSegmentBuilder builder;
+    thsn_segment_builder_init(&builder, document, &document->allocator, false);
+    const ThsnResult result = thsn_segment_builder_build(&builder);
+    if (result == THSN_RESULT_SUCCESS) {
+        *segment = builder.segment;
+        builder.segment = thsn_vector_make_empty();
+    }
+    thsn_segment_builder_free(&builder);
+    return result;
+}
+
+/* Moves the rest of the parts after the first one and stores the root's
+ * elements table, unless the root's compact offsets can't address them. */
+static ThsnResult thsn_compact_merge_parts(ThsnCompactPart* /*mut*/ parts,
+                                           size_t parts_count,
+                                           bool* /*out*/ too_large) {
+    ThsnSegment* const segment = &parts[0].builder.segment;
+    size_t elements_count = 0;
+    size_t segment_size = 0;
+    *too_large = false;
+    for (size_t i = 0; i < parts_count; ++i) {
+        *too_large = *too_large || parts[i].builder.too_large;
+        elements_count += parts[i].elements_table.size / parts[i].offset_size;
+        segment_size += thsn_vector_current_offset(parts[i].builder.segment);
+    }
+    segment_size += elements_count * sizeof(uint32_t);
+    if (*too_large || segment_size > UINT32_MAX) {
+        *too_large = true;
+        return THSN_RESULT_SUCCESS;
+    }
+    BAIL_ON_ERROR(thsn_vector_reserve(segment, segment_size));
+    for (size_t i = 1; i < parts_count; ++i) {
+        const size_t base = thsn_vector_current_offset(*segment);
+        const ThsnSlice part_slice =
+            thsn_vector_as_slice(parts[i].builder.segment);
+        BAIL_ON_ERROR(thsn_vector_push(segment, part_slice));
+        BAIL_ON_ERROR(thsn_segment_relocate(
+            thsn_mut_slice_make(segment->buffer + base, part_slice.size),
+            thsn_vector_as_slice(parts[i].builder.composites), base));
+        ThsnSlice element_offsets =
+            thsn_vector_as_slice(parts[i].element_offsets);
+        size_t element_offset;
+        while (THSN_SLICE_READ_VAR(element_offsets, element_offset) ==
+               THSN_RESULT_SUCCESS) {
+            element_offset += base;
+            BAIL_ON_ERROR(THSN_VECTOR_PUSH_VAR(parts[0].element_offsets,
+                                               element_offset));
+        }
+    }
+    return thsn_segment_store_composite_elements_table(
+        segment, 0, thsn_vector_as_slice(parts[0].element_offsets));
+}
+
+/* Every part but the first is copied on a pool thread while the calling
+ * thread copies the first one. */
+static ThsnResult thsn_compact_build_parts(ThsnCompactPart* /*mut*/ parts,
+                                           size_t parts_count,
+                                           ThsnTagType root_type,
+                                           bool* /*out*/ too_large) {
+    ThsnThreadPool thread_pool;
+    BAIL_ON_ERROR(thsn_thread_pool_init(&thread_pool, parts_count - 1));
+    ThsnResult result = THSN_RESULT_SUCCESS;
+    size_t parts_started = 1;
+    for (; parts_started < parts_count; ++parts_started) {
+        ThsnCompactPart* const part = &parts[parts_started];
+        result = thsn_completion_init(&part->completion);
+        if (result != THSN_RESULT_SUCCESS) {
+            break;
+        }
+        result = thsn_thread_pool_submit(&thread_pool, thsn_compact_part_thread,
+                                         part);
+        if (result != THSN_RESULT_SUCCESS) {
+            /* Every started part has to be completed */
+            thsn_compact_part_thread(part);
+            ++parts_started;
+            break;
+        }
+    }
+    if (result == THSN_RESULT_SUCCESS) {
+        size_t header_offset;
+        result = thsn_segment_store_composite_header(
+            &parts[0].builder.segment,
+            thsn_tag_make(root_type, THSN_TAG_SIZE_COMPACT), &header_offset);
+        if (result == THSN_RESULT_SUCCESS) {
+            result = thsn_compact_copy_part(&parts[0]);
+        }
+    }
+    for (size_t i = 1; i < parts_started; ++i) {
+        thsn_completion_wait(&parts[i].completion, NULL);
+        if (parts[i].failed && result == THSN_RESULT_SUCCESS) {
+            result = THSN_RESULT_INPUT_ERROR;
+        }
+    }
+    thsn_thread_pool_destroy(&thread_pool);
+    for (size_t i = 1; i < parts_started; ++i) {
+        thsn_completion_destroy(&parts[i].completion);
+    }
+    BAIL_ON_ERROR(result);
+    return thsn_compact_merge_parts(parts, parts_count, too_large);
+}
+
+/* Splits the root's elements into `parts_count` parts of about the same
+ * number of elements */
+static ThsnResult thsn_compact_build_parallel(
+    ThsnDocument* /*in*/ document, ThsnValueHandle root_handle,
+    ThsnTagType root_type, ThsnSlice elements_table, size_t offset_size,
+    size_t parts_count, ThsnSegment* /*out*/ segment) {
+    const size_t elements_count = elements_table.size / offset_size;
+    ThsnCompactPart* const parts = thsn_allocate_zeroed(
+        &document->allocator, sizeof(ThsnCompactPart) * parts_count);
+    BAIL_ON_ALLOC_FAILURE(parts);
+    for (size_t i = 0; i < parts_count; ++i) {
+        ThsnCompactPart* const part = &parts[i];
+        const size_t begin = elements_count * i / parts_count;
+        const size_t end = elements_count * (i + 1) / parts_count;
+        part->elements_table =
+            thsn_slice_make(elements_table.data + begin * offset_size,
+                            (end - begin) * offset_size);
+        part->offset_size = offset_size;
+        part->segment_no = root_handle.segment_no;
+        part->object = root_type == THSN_TAG_OBJECT;
+        thsn_segment_builder_init(&part->builder, document,
+                                  &document->allocator, false);
+        part->element_offsets =
+            thsn_vector_make_empty_with_allocator(&document->allocator);
+    }
+    bool too_large;
+    ThsnResult result =
+        thsn_compact_build_parts(parts, parts_count, root_type, &too_large);
+    if (result == THSN_RESULT_SUCCESS) {
+        if (too_large) {
+            result = thsn_compact_build_sequential(document, segment);
+        } else {
+            *segment = parts[0].builder.segment;
+            parts[0].builder.segment = thsn_vector_make_empty();
+        }
+    }
+    for (size_t i = 0; i < parts_count; ++i) {
+        thsn_segment_builder_free(&parts[i].builder);
+        thsn_vector_free(&parts[i].element_offsets);
+    }
+    thsn_free(&document->allocator, parts,
+              sizeof(ThsnCompactPart) * parts_count);
+    return result;
+}
+
+static ThsnResult thsn_compact_build(ThsnDocument* /*in*/ document,
+                                     size_t threads_count,
+                                     ThsnSegment* /*out*/ segment) {
+    ThsnValueHandle root_handle = thsn_value_handle_first();
+    BAIL_ON_ERROR(thsn_document_follow_handle(document, &root_handle));
+    ThsnTag root_tag;
+    ThsnSlice root_slice;
+    const ThsnSegmentSlice segment_slice =
+        thsn_slice_from_mut_slice(document->segments[root_handle.segment_no]);
+    BAIL_ON_ERROR(thsn_segment_read_tagged_value(
+        segment_slice, root_handle.offset, &root_tag, &root_slice));
+    const ThsnTagType root_type = thsn_tag_type(root_tag);
+    if (threads_count == 1 ||
+        (root_type != THSN_TAG_ARRAY && root_type != THSN_TAG_OBJECT)) {
+        return thsn_compact_build_sequential(document, segment);
+    }
+    ThsnSlice elements_table;
+    size_t offset_size;
+    BAIL_ON_ERROR(thsn_segment_read_composite(segment_slice,
+                                              root_handle.offset, root_type,
+                                              &elements_table, &offset_size));
+    size_t parts_count = elements_table.size / offset_size /
+                         THSN_COMPACT_MIN_ELEMENTS_PER_THREAD;
+    if (parts_count > threads_count) {
+        parts_count = threads_count;
+    }
+    if (parts_count <= 1) {
+        return thsn_compact_build_sequential(document, segment);
+    }
+    return thsn_compact_build_parallel(document, root_handle, root_type,
+                                       elements_table, offset_size,
+                                       parts_count, segment);
+}
+
+ThsnResult thsn_document_compact(ThsnDocument* /*mut*/ document,
+                                 size_t threads_count) {
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_WITH_INPUT_ERROR_UNLESS(threads_count > 0);
+    /* Copying parses the composites of lazy documents, which can't be done
+     * concurrently */
+    if (document->lazy_segment_offset != 0) {
+        threads_count = 1;
+    }
+    ThsnSegment segment;
+    BAIL_ON_ERROR(thsn_compact_build(document, threads_count, &segment));
+    if (!document->mapped_segment) {
+        thsn_free(&document->allocator, document->segments[0].data,
+                  document->segment_capacity);
+    }
+    for (size_t i = 1; i < document->segment_count; ++i) {
+        thsn_free(&document->allocator, document->segments[i].data,
+                  document->segments[i].size);
+    }
+    document->segments[0] =
+        thsn_mut_slice_make(segment.buffer, thsn_vector_current_offset(segment));
+    document->segment_capacity = segment.capacity;
+    document->segment_count = 1;
+    document->mapped_segment = false;
+    document->lazy_segment_offset = 0;
+    return THSN_RESULT_SUCCESS;
+}
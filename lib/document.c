@@ -1,51 +1,151 @@
 #include <stddef.h>
 
+#include "allocator.h"
+#include "arena.h"
+#include "document.h"
+#include "file.h"
+#include "lazy.h"
 #include "parser.h"
+#include "path.h"
 #include "result.h"
 #include "segment.h"
 #include "slice.h"
 #include "threason.h"
 
-/* Used for sorting */
-_Thread_local ThsnSlice* CURRENT_SEGMENT = NULL;
+ThsnResult thsn_document_create(const ThsnAllocator* /*maybe in*/ allocator,
+                                ThsnDocument** /*out*/ document) {
+    return thsn_document_allocate(document, allocator, 1);
+}
 
 ThsnResult thsn_document_free(ThsnDocument** /*in*/ document) {
     BAIL_ON_NULL_INPUT(document);
-    for (size_t i = 0; i < (*document)->segment_count; ++i) {
-        free((*document)->segments[i].data);
+    if (*document == NULL) {
+        return THSN_RESULT_SUCCESS;
+    }
+    /* The document itself is freed with its allocator */
+    const ThsnAllocator allocator = (*document)->allocator;
+    /* Only the first segment has spare capacity */
+    if (!(*document)->mapped_segment) {
+        thsn_free(&allocator, (*document)->segments[0].data,
+                  (*document)->segment_capacity);
     }
-    free(*document);
+    for (size_t i = 1; i < (*document)->segment_count; ++i) {
+        thsn_free(&allocator, (*document)->segments[i].data,
+                  (*document)->segments[i].size);
+    }
+    thsn_free(&allocator, (*document)->parser_stack.data,
+              (*document)->parser_stack.size);
+    thsn_arena_free(&(*document)->arena);
+    thsn_file_unmap((*document)->mapped_input);
+    thsn_free(&allocator, *document,
+              sizeof(ThsnDocument) + sizeof(ThsnOwningMutSlice) *
+                                         (*document)->allocated_segment_count);
     *document = NULL;
     return THSN_RESULT_SUCCESS;
 }
 
-ThsnResult thsn_document_parse(ThsnSlice* /*mut*/ buffer_slice,
-                               ThsnDocument** /*out*/ document) {
+/* Drops everything but the first segment's buffer, the parser stack and the
+ * arena's chunks. */
+static void thsn_document_recycle(ThsnDocument* /*mut*/ document) {
+    for (size_t i = 1; i < document->segment_count; ++i) {
+        thsn_free(&document->allocator, document->segments[i].data,
+                  document->segments[i].size);
+    }
+    document->segment_count = 1;
+    document->segments[0].size = 0;
+    document->lazy_segment_offset = 0;
+    if (document->mapped_segment) {
+        document->segments[0] = thsn_mut_slice_make_empty();
+        document->segment_capacity = 0;
+        document->mapped_segment = false;
+    }
+    thsn_arena_reset(document->arena);
+    thsn_file_unmap(document->mapped_input);
+    document->mapped_input = thsn_slice_make_empty();
+}
+
+static ThsnResult thsn_document_parse_tokens(ThsnDocument** /*mut*/ document,
+                                             ThsnSlice* /*mut*/ buffer_slice,
+                                             bool copy_strings) {
     BAIL_ON_NULL_INPUT(buffer_slice);
     BAIL_ON_NULL_INPUT(document);
-    BAIL_ON_ERROR(thsn_document_allocate(document, 1));
+    if (*document == NULL) {
+        BAIL_ON_ERROR(thsn_document_allocate(document, NULL, 1));
+    } else {
+        thsn_document_recycle(*document);
+    }
+    ThsnDocument* const doc = *document;
+    if (copy_strings && doc->arena == NULL) {
+        BAIL_ON_ERROR(thsn_arena_create(&doc->allocator, &doc->arena));
+    }
     ThsnToken token;
     ThsnSlice token_slice;
+    ThsnStructuralIndex structural_index = thsn_structural_index_make();
     ThsnParserContext parser_context;
-    GOTO_ON_ERROR(thsn_parser_context_init(&parser_context), document_cleanup);
+    const ThsnVector stack = {.buffer = doc->parser_stack.data,
+                              .capacity = doc->parser_stack.size,
+                              .allocator = &doc->allocator};
+    const ThsnVector segment = {.buffer = doc->segments[0].data,
+                                .capacity = doc->segment_capacity,
+                                .allocator = &doc->allocator};
+    /* The context owns the buffers until the parse is over */
+    doc->parser_stack = thsn_mut_slice_make_empty();
+    doc->segments[0] = thsn_mut_slice_make_empty();
+    doc->segment_capacity = 0;
+    BAIL_ON_ERROR(thsn_parser_context_init_with_buffers(
+        &parser_context, buffer_slice->size, stack, segment));
+    if (copy_strings) {
+        parser_context.string_heap = doc->arena;
+    }
     bool finished = false;
     while (!finished) {
-        GOTO_ON_ERROR(thsn_next_token(buffer_slice, &token_slice, &token),
-                      error_cleanup);
+        GOTO_ON_ERROR(thsn_next_token_indexed(&structural_index, buffer_slice,
+                                              &token_slice, &token),
+                      return_buffers);
         GOTO_ON_ERROR(thsn_parser_parse_next_token(&parser_context, token,
                                                    token_slice, &finished),
-                      error_cleanup);
+                      return_buffers);
     }
-    GOTO_ON_ERROR(
-        thsn_parser_context_finish(&parser_context, &(*document)->segments[0]),
-        error_cleanup);
-    return THSN_RESULT_SUCCESS;
 
-error_cleanup:
-    thsn_parser_context_finish(&parser_context, NULL);
-document_cleanup:
-    thsn_document_free(document);
-    return THSN_RESULT_INPUT_ERROR;
+return_buffers:
+    doc->parser_stack = thsn_mut_slice_make(parser_context.stack.buffer,
+                                            parser_context.stack.capacity);
+    doc->segment_capacity = parser_context.segment.capacity;
+    doc->segments[0] =
+        thsn_mut_slice_make(parser_context.segment.buffer,
+                            finished ? parser_context.segment.offset : 0);
+    return finished ? THSN_RESULT_SUCCESS : THSN_RESULT_INPUT_ERROR;
+}
+
+ThsnResult thsn_document_parse_into(ThsnDocument** /*mut*/ document,
+                                    ThsnSlice* /*mut*/ buffer_slice) {
+    return thsn_document_parse_tokens(document, buffer_slice, false);
+}
+
+ThsnResult thsn_document_parse_single_threaded(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ buffer_slice, ThsnDocument** /*out*/ document,
+    bool copy_strings) {
+    BAIL_ON_NULL_INPUT(buffer_slice);
+    BAIL_ON_ERROR(thsn_document_create(allocator, document));
+    const ThsnResult result =
+        thsn_document_parse_tokens(document, buffer_slice, copy_strings);
+    if (result != THSN_RESULT_SUCCESS) {
+        thsn_document_free(document);
+    }
+    return result;
+}
+
+ThsnResult thsn_document_parse_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ buffer_slice, ThsnDocument** /*out*/ document) {
+    return thsn_document_parse_single_threaded(allocator, buffer_slice,
+                                               document, false);
+}
+
+ThsnResult thsn_document_parse(ThsnSlice* /*mut*/ buffer_slice,
+                               ThsnDocument** /*out*/ document) {
+    return thsn_document_parse_with_allocator(NULL, buffer_slice, document);
 }
 
 static ThsnResult thsn_document_read_tagged_value(
@@ -61,9 +161,8 @@ static ThsnResult thsn_document_read_tagged_value(
         value_handle.offset, value_tag, value_slice);
 }
 
-static ThsnResult thsn_document_follow_handle(
-    const ThsnDocument* /*in*/ document,
-    ThsnValueHandle* /*mut*/ value_handle) {
+ThsnResult thsn_document_follow_handle(ThsnDocument* /*mut*/ document,
+                                       ThsnValueHandle* /*mut*/ value_handle) {
     BAIL_ON_NULL_INPUT(document);
     BAIL_ON_NULL_INPUT(value_handle);
     ThsnTag value_tag;
@@ -73,6 +172,12 @@ static ThsnResult thsn_document_follow_handle(
             document, *value_handle, &value_tag, &value_slice));
         if (thsn_tag_type(value_tag) == THSN_TAG_VALUE_HANDLE) {
             BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, *value_handle));
+        } else if (thsn_tag_type(value_tag) == THSN_TAG_UNPARSED) {
+            /* Turns into a handle to the parsed composite */
+            ThsnSlice composite_slice;
+            BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, composite_slice));
+            BAIL_ON_ERROR(thsn_lazy_parse_composite(
+                document, *value_handle, composite_slice));
         } else {
             break;
         }
@@ -98,9 +203,11 @@ ThsnResult thsn_document_value_type(const ThsnDocument* /*in*/ document,
             break;
         case THSN_TAG_SMALL_STRING:
         case THSN_TAG_REF_STRING:
+        case THSN_TAG_INLINE_STRING:
             *value_type = THSN_VALUE_STRING;
             break;
         case THSN_TAG_INT:
+        case THSN_TAG_UINT:
         case THSN_TAG_DOUBLE:
             *value_type = THSN_VALUE_NUMBER;
             break;
@@ -111,6 +218,7 @@ ThsnResult thsn_document_value_type(const ThsnDocument* /*in*/ document,
             *value_type = THSN_VALUE_OBJECT;
             break;
         case THSN_TAG_VALUE_HANDLE:
+        case THSN_TAG_UNPARSED:
             return THSN_RESULT_INPUT_ERROR;
     }
     return THSN_RESULT_SUCCESS;
@@ -140,6 +248,42 @@ ThsnResult thsn_document_read_number(const ThsnDocument* /*in*/ document,
         value_handle.offset, value);
 }
 
+ThsnResult thsn_document_number_type(const ThsnDocument* /*in*/ document,
+                                     ThsnValueHandle value_handle,
+                                     ThsnNumberType* /*out*/ number_type) {
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_ON_NULL_INPUT(number_type);
+    BAIL_WITH_INPUT_ERROR_UNLESS(value_handle.segment_no <
+                                 document->segment_count);
+    return thsn_segment_read_number_type(
+        thsn_slice_from_mut_slice(document->segments[value_handle.segment_no]),
+        value_handle.offset, number_type);
+}
+
+ThsnResult thsn_document_read_int64(const ThsnDocument* /*in*/ document,
+                                    ThsnValueHandle value_handle,
+                                    int64_t* /*out*/ value) {
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_ON_NULL_INPUT(value);
+    BAIL_WITH_INPUT_ERROR_UNLESS(value_handle.segment_no <
+                                 document->segment_count);
+    return thsn_segment_read_int64(
+        thsn_slice_from_mut_slice(document->segments[value_handle.segment_no]),
+        value_handle.offset, value);
+}
+
+ThsnResult thsn_document_read_uint64(const ThsnDocument* /*in*/ document,
+                                     ThsnValueHandle value_handle,
+                                     uint64_t* /*out*/ value) {
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_ON_NULL_INPUT(value);
+    BAIL_WITH_INPUT_ERROR_UNLESS(value_handle.segment_no <
+                                 document->segment_count);
+    return thsn_segment_read_uint64(
+        thsn_slice_from_mut_slice(document->segments[value_handle.segment_no]),
+        value_handle.offset, value);
+}
+
 ThsnResult thsn_document_read_string(const ThsnDocument* /*in*/ document,
                                      ThsnValueHandle value_handle,
                                      ThsnSlice* /*out*/ string_slice) {
@@ -152,6 +296,31 @@ ThsnResult thsn_document_read_string(const ThsnDocument* /*in*/ document,
         value_handle.offset, string_slice, NULL);
 }
 
+/* The arena is created on first use, and with the document's allocator */
+static ThsnResult thsn_document_arena(ThsnDocument* /*mut*/ document,
+                                      ThsnArena*** /*out*/ arena) {
+    if (document->arena == NULL) {
+        BAIL_ON_ERROR(
+            thsn_arena_create(&document->allocator, &document->arena));
+    }
+    *arena = &document->arena;
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_document_read_string_decoded(
+    ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
+    ThsnSlice* /*out*/ string_slice) {
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_ON_NULL_INPUT(string_slice);
+    BAIL_WITH_INPUT_ERROR_UNLESS(value_handle.segment_no <
+                                 document->segment_count);
+    ThsnArena** arena = NULL;
+    BAIL_ON_ERROR(thsn_document_arena(document, &arena));
+    return thsn_segment_read_string_decoded(
+        document->segments[value_handle.segment_no], value_handle.offset,
+        arena, string_slice);
+}
+
 static ThsnResult thsn_document_read_composite(
     ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
     ThsnTagType expected_type, ThsnValueCompositeTable* /*out*/ composite_table,
@@ -161,9 +330,23 @@ static ThsnResult thsn_document_read_composite(
     BAIL_WITH_INPUT_ERROR_UNLESS(value_handle.segment_no <
                                  document->segment_count);
     composite_table->segment_no = value_handle.segment_no;
-    return thsn_segment_read_composite(
-        document->segments[value_handle.segment_no], value_handle.offset,
-        expected_type, &composite_table->elements_table, read_sorted_table);
+    composite_table->hash_index = NULL;
+    size_t offset_size = sizeof(size_t);
+    if (read_sorted_table) {
+        ThsnArena** arena = NULL;
+        BAIL_ON_ERROR(thsn_document_arena(document, &arena));
+        BAIL_ON_ERROR(thsn_segment_read_object_sorted(
+            document->segments[value_handle.segment_no], value_handle.offset,
+            arena, &composite_table->elements_table, &offset_size));
+    } else {
+        BAIL_ON_ERROR(thsn_segment_read_composite(
+            thsn_slice_from_mut_slice(
+                document->segments[value_handle.segment_no]),
+            value_handle.offset, expected_type,
+            &composite_table->elements_table, &offset_size));
+    }
+    composite_table->offset_size = (uint8_t)offset_size;
+    return THSN_RESULT_SUCCESS;
 }
 
 ThsnResult thsn_document_read_array(ThsnDocument* /*mut*/ document,
@@ -176,17 +359,21 @@ ThsnResult thsn_document_read_array(ThsnDocument* /*mut*/ document,
 }
 
 size_t thsn_document_array_length(ThsnValueArrayTable array_table) {
-    return array_table.elements_table.size / sizeof(size_t);
+    if (array_table.offset_size == 0) {
+        return 0;
+    }
+    return array_table.elements_table.size / array_table.offset_size;
 }
 
 ThsnResult thsn_document_index_array_element(
-    const ThsnDocument* /*in*/ document, ThsnValueArrayTable array_table,
+    ThsnDocument* /*mut*/ document, ThsnValueArrayTable array_table,
     size_t element_no, ThsnValueHandle* /*out*/ element_handle) {
     BAIL_ON_NULL_INPUT(document);
     BAIL_ON_NULL_INPUT(element_handle);
     size_t element_offset = 0;
     BAIL_ON_ERROR(thsn_segment_composite_index_element_offset(
-        array_table.elements_table, element_no, &element_offset));
+        array_table.elements_table, array_table.offset_size, element_no,
+        &element_offset));
     *element_handle = (ThsnValueHandle){.segment_no = array_table.segment_no,
                                         .offset = element_offset};
     BAIL_ON_ERROR(thsn_document_follow_handle(document, element_handle));
@@ -194,15 +381,15 @@ ThsnResult thsn_document_index_array_element(
 }
 
 ThsnResult thsn_document_array_consume_element(
-    const ThsnDocument* /*in*/ document,
-    ThsnValueArrayTable* /*mut*/ array_table,
+    ThsnDocument* /*mut*/ document, ThsnValueArrayTable* /*mut*/ array_table,
     ThsnValueHandle* /*out*/ element_handle) {
     BAIL_ON_NULL_INPUT(document);
     BAIL_ON_NULL_INPUT(array_table);
     BAIL_ON_NULL_INPUT(element_handle);
     size_t element_offset = 0;
     BAIL_ON_ERROR(thsn_segment_composite_consume_element_offset(
-        &array_table->elements_table, &element_offset));
+        &array_table->elements_table, array_table->offset_size,
+        &element_offset));
     *element_handle = (ThsnValueHandle){.segment_no = array_table->segment_no,
                                         .offset = element_offset};
     BAIL_ON_ERROR(thsn_document_follow_handle(document, element_handle));
@@ -227,12 +414,26 @@ ThsnResult thsn_document_read_object_sorted(
                                         sorted_object_table, true);
 }
 
+ThsnResult thsn_document_read_object_indexed(
+    ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
+    ThsnValueObjectTable* /*out*/ object_table) {
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_ON_NULL_INPUT(object_table);
+    BAIL_ON_ERROR(thsn_document_read_composite(
+        document, value_handle, THSN_TAG_OBJECT, object_table, false));
+    ThsnArena** arena = NULL;
+    BAIL_ON_ERROR(thsn_document_arena(document, &arena));
+    return thsn_segment_read_object_index(
+        document->segments[value_handle.segment_no], value_handle.offset,
+        arena, &object_table->hash_index);
+}
+
 size_t thsn_document_object_length(ThsnValueObjectTable object_table) {
     return thsn_document_array_length(object_table);
 }
 
 static ThsnResult thsn_document_object_read_kv(
-    const ThsnDocument* /*in*/ document, ThsnValueHandle kv_handle,
+    ThsnDocument* /*mut*/ document, ThsnValueHandle kv_handle,
     ThsnSlice* /*out*/ key_slice, ThsnValueHandle* /*out*/ element_handle) {
     BAIL_ON_NULL_INPUT(document);
     BAIL_ON_NULL_INPUT(key_slice);
@@ -250,7 +451,7 @@ static ThsnResult thsn_document_object_read_kv(
 }
 
 ThsnResult thsn_document_object_index_element(
-    const ThsnDocument* /*in*/ document, ThsnValueObjectTable object_table,
+    ThsnDocument* /*mut*/ document, ThsnValueObjectTable object_table,
     size_t element_no, ThsnSlice* /*out*/ key_slice,
     ThsnValueHandle* /*out*/ element_handle) {
     BAIL_ON_NULL_INPUT(document);
@@ -264,9 +465,8 @@ ThsnResult thsn_document_object_index_element(
 }
 
 ThsnResult thsn_document_object_consume_element(
-    const ThsnDocument* /*in*/ document,
-    ThsnValueObjectTable* /*mut*/ object_table, ThsnSlice* /*out*/ key_slice,
-    ThsnValueHandle* /*out*/ value_handle) {
+    ThsnDocument* /*mut*/ document, ThsnValueObjectTable* /*mut*/ object_table,
+    ThsnSlice* /*out*/ key_slice, ThsnValueHandle* /*out*/ value_handle) {
     BAIL_ON_NULL_INPUT(document);
     BAIL_ON_NULL_INPUT(object_table);
     BAIL_ON_NULL_INPUT(key_slice);
@@ -278,7 +478,7 @@ ThsnResult thsn_document_object_consume_element(
                                         value_handle);
 }
 
-ThsnResult thsn_document_object_index(const ThsnDocument* /*in*/ document,
+ThsnResult thsn_document_object_index(ThsnDocument* /*mut*/ document,
                                       ThsnValueObjectTable object_table,
                                       ThsnSlice key_slice,
                                       ThsnValueHandle* /*out*/ element_handle) {
@@ -287,17 +487,267 @@ ThsnResult thsn_document_object_index(const ThsnDocument* /*in*/ document,
     BAIL_ON_NULL_INPUT(document);
     BAIL_WITH_INPUT_ERROR_UNLESS(object_table.segment_no <
                                  document->segment_count);
+    const ThsnSlice segment_slice =
+        thsn_slice_from_mut_slice(document->segments[object_table.segment_no]);
     size_t element_offset = 0;
     bool found = false;
-    BAIL_ON_ERROR(thsn_segment_object_index(
-        thsn_slice_from_mut_slice(document->segments[object_table.segment_no]),
-        object_table.elements_table, key_slice, &element_offset, &found));
+    if (object_table.hash_index != NULL) {
+        BAIL_ON_ERROR(thsn_segment_object_index_lookup(
+            segment_slice, object_table.hash_index, key_slice, &element_offset,
+            &found));
+    } else {
+        BAIL_ON_ERROR(thsn_segment_object_index(
+            segment_slice, object_table.elements_table,
+            object_table.offset_size, key_slice, &element_offset, &found));
+    }
 
     if (!found) {
         *element_handle = thsn_value_handle_not_found();
-    } else {
-        *element_handle = (ThsnValueHandle){
-            .segment_no = object_table.segment_no, .offset = element_offset};
+        return THSN_RESULT_SUCCESS;
+    }
+    *element_handle = (ThsnValueHandle){.segment_no = object_table.segment_no,
+                                        .offset = element_offset};
+    return thsn_document_follow_handle(document, element_handle);
+}
+
+/* Keys up to this size are decoded on the stack when queried */
+#define THSN_QUERY_KEY_BUFFER_SIZE 256
+
+static ThsnResult thsn_document_key_decodes_to(ThsnSlice escaped_key_slice,
+                                               ThsnSlice key_slice,
+                                               bool* /*out*/ equal) {
+    *equal = false;
+    /* Decoding never makes keys longer */
+    if (escaped_key_slice.size < key_slice.size) {
+        return THSN_RESULT_SUCCESS;
+    }
+    char buffer[THSN_QUERY_KEY_BUFFER_SIZE];
+    char* decoded_data = buffer;
+    if (escaped_key_slice.size > sizeof(buffer)) {
+        decoded_data = thsn_allocate(NULL, escaped_key_slice.size);
+        BAIL_ON_ALLOC_FAILURE(decoded_data);
+    }
+    size_t decoded_size = 0;
+    const ThsnResult result =
+        thsn_unescape_string(escaped_key_slice, decoded_data, &decoded_size);
+    *equal = result == THSN_RESULT_SUCCESS && decoded_size == key_slice.size &&
+             memcmp(decoded_data, key_slice.data, decoded_size) == 0;
+    if (decoded_data != buffer) {
+        thsn_free(NULL, decoded_data, escaped_key_slice.size);
+    }
+    return result;
+}
+
+/* Keys with escapes are stored as they're spelled in the input, which is
+ * what the lookups compare. Goes through them in order and compares them
+ * decoded, with the decoded copy if there is one. */
+static ThsnResult thsn_document_query_escaped_keys(
+    ThsnSegmentSlice segment_slice, ThsnSlice elements_table,
+    size_t offset_size, ThsnSlice key_slice, size_t* /*out*/ element_offset,
+    bool* /*out*/ found) {
+    *found = false;
+    while (!thsn_slice_is_empty(elements_table) && !*found) {
+        size_t kv_offset;
+        BAIL_ON_ERROR(thsn_segment_composite_consume_element_offset(
+            &elements_table, offset_size, &kv_offset));
+        ThsnTag key_tag;
+        ThsnSlice key_value_slice;
+        BAIL_ON_ERROR(thsn_segment_read_tagged_value(
+            segment_slice, kv_offset, &key_tag, &key_value_slice));
+        if (!thsn_tag_is_escaped_string(key_tag)) {
+            continue;
+        }
+        ThsnSlice element_key_slice;
+        bool decoded;
+        size_t key_stored_size;
+        BAIL_ON_ERROR(thsn_segment_read_string_if_decoded(
+            segment_slice, kv_offset, &element_key_slice, &decoded,
+            &key_stored_size));
+        if (decoded) {
+            *found = element_key_slice.size == key_slice.size &&
+                     (key_slice.size == 0 ||
+                      memcmp(element_key_slice.data, key_slice.data,
+                             key_slice.size) == 0);
+        } else {
+            BAIL_ON_ERROR(thsn_document_key_decodes_to(element_key_slice,
+                                                       key_slice, found));
+        }
+        *element_offset = kv_offset + key_stored_size;
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Uses whichever of the object's caches is there, and builds none of them.
+ * Keys without escapes are looked up as they're stored, the rest are only
+ * compared once the lookup misses, and only in objects that have them: they
+ * always have a backslash, so keys without one can't match their spelling. */
+static ThsnResult thsn_document_query_object(
+    const ThsnDocument* /*in*/ document, ThsnValueHandle value_handle,
+    const ThsnPathStep* /*in*/ step, size_t* /*out*/ element_offset,
+    bool* /*out*/ found) {
+    const ThsnSlice segment_slice =
+        thsn_slice_from_mut_slice(document->segments[value_handle.segment_no]);
+    ThsnCompositeHeader header;
+    BAIL_ON_ERROR(thsn_segment_read_composite_header(
+        segment_slice, value_handle.offset, THSN_TAG_OBJECT, &header));
+    *found = false;
+    if (header.elements_count == 0) {
+        return THSN_RESULT_SUCCESS;
+    }
+    ThsnSlice elements_table;
+    size_t offset_size;
+    BAIL_ON_ERROR(thsn_segment_read_composite(
+        segment_slice, value_handle.offset, THSN_TAG_OBJECT, &elements_table,
+        &offset_size));
+    if (thsn_find_char(step->key, '\\') == NULL) {
+        ThsnObjectCaches object_caches;
+        BAIL_ON_ERROR(thsn_segment_read_object_caches(segment_slice, header,
+                                                      &object_caches));
+        if (object_caches.hash_index != NULL) {
+            BAIL_ON_ERROR(thsn_segment_object_index_lookup_hashed(
+                segment_slice, object_caches.hash_index, step->key,
+                step->key_hash, element_offset, found));
+        } else if (object_caches.sorted_table != NULL) {
+            const ThsnSlice sorted_table = thsn_slice_make(
+                object_caches.sorted_table, elements_table.size);
+            BAIL_ON_ERROR(thsn_segment_object_index(
+                segment_slice, sorted_table, offset_size, step->key,
+                element_offset, found));
+        } else {
+            BAIL_ON_ERROR(thsn_segment_object_scan(
+                segment_slice, elements_table, offset_size, step->key,
+                element_offset, found));
+        }
+        if (*found) {
+            return THSN_RESULT_SUCCESS;
+        }
     }
+    if (!header.escaped_keys) {
+        return THSN_RESULT_SUCCESS;
+    }
+    return thsn_document_query_escaped_keys(segment_slice, elements_table,
+                                            offset_size, step->key,
+                                            element_offset, found);
+}
+
+static ThsnResult thsn_document_query_array(
+    const ThsnDocument* /*in*/ document, ThsnValueHandle value_handle,
+    const ThsnPathStep* /*in*/ step, size_t* /*out*/ element_offset,
+    bool* /*out*/ found) {
+    ThsnSlice elements_table;
+    size_t offset_size;
+    BAIL_ON_ERROR(thsn_segment_read_composite(
+        thsn_slice_from_mut_slice(document->segments[value_handle.segment_no]),
+        value_handle.offset, THSN_TAG_ARRAY, &elements_table, &offset_size));
+    *found = step->index < elements_table.size / offset_size;
+    if (!*found) {
+        return THSN_RESULT_SUCCESS;
+    }
+    return thsn_segment_composite_index_element_offset(
+        elements_table, offset_size, step->index, element_offset);
+}
+
+ThsnResult thsn_document_query(ThsnDocument* /*mut*/ document,
+                               const ThsnPath* /*in*/ path,
+                               ThsnValueHandle* /*out*/ value_handle) {
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_ON_NULL_INPUT(path);
+    BAIL_ON_NULL_INPUT(value_handle);
+    ThsnValueHandle current_handle = thsn_value_handle_first();
+    BAIL_ON_ERROR(thsn_document_follow_handle(document, &current_handle));
+    for (size_t i = 0; i < path->steps_count; ++i) {
+        const ThsnPathStep* const step = &path->steps[i];
+        ThsnTag value_tag;
+        ThsnSlice value_slice;
+        BAIL_ON_ERROR(thsn_document_read_tagged_value(
+            document, current_handle, &value_tag, &value_slice));
+        size_t element_offset = 0;
+        bool found = false;
+        if (thsn_tag_type(value_tag) == THSN_TAG_OBJECT) {
+            BAIL_ON_ERROR(thsn_document_query_object(
+                document, current_handle, step, &element_offset, &found));
+        } else if (thsn_tag_type(value_tag) == THSN_TAG_ARRAY &&
+                   step->index != SIZE_MAX) {
+            BAIL_ON_ERROR(thsn_document_query_array(
+                document, current_handle, step, &element_offset, &found));
+        }
+        if (!found) {
+            *value_handle = thsn_value_handle_not_found();
+            return THSN_RESULT_SUCCESS;
+        }
+        current_handle.offset = element_offset;
+        BAIL_ON_ERROR(thsn_document_follow_handle(document, &current_handle));
+    }
+    *value_handle = current_handle;
     return THSN_RESULT_SUCCESS;
 }
+
+ThsnResult thsn_document_freeze(ThsnDocument* /*mut*/ document) {
+    BAIL_ON_NULL_INPUT(document);
+    /* Readers of a frozen document must not race to create the arena */
+    ThsnArena** arena = NULL;
+    BAIL_ON_ERROR(thsn_document_arena(document, &arena));
+    ThsnVector stack = thsn_vector_make_empty();
+    BAIL_ON_ERROR(thsn_vector_allocate(&stack, 64 * sizeof(ThsnValueHandle)));
+    ThsnValueHandle value_handle = thsn_value_handle_first();
+    GOTO_ON_ERROR(THSN_VECTOR_PUSH_VAR(stack, value_handle), error_cleanup);
+    while (!thsn_vector_is_empty(stack)) {
+        GOTO_ON_ERROR(THSN_VECTOR_POP_VAR(stack, value_handle), error_cleanup);
+        ThsnValueType value_type = THSN_VALUE_NULL;
+        GOTO_ON_ERROR(
+            thsn_document_value_type(document, value_handle, &value_type),
+            error_cleanup);
+        switch (value_type) {
+            case THSN_VALUE_STRING: {
+                ThsnSlice string_slice;
+                GOTO_ON_ERROR(thsn_document_read_string_decoded(
+                                  document, value_handle, &string_slice),
+                              error_cleanup);
+                break;
+            }
+            case THSN_VALUE_ARRAY: {
+                ThsnValueArrayTable array_table;
+                GOTO_ON_ERROR(thsn_document_read_array(document, value_handle,
+                                                       &array_table),
+                              error_cleanup);
+                while (thsn_document_array_length(array_table) > 0) {
+                    ThsnValueHandle element_handle;
+                    GOTO_ON_ERROR(thsn_document_array_consume_element(
+                                      document, &array_table, &element_handle),
+                                  error_cleanup);
+                    GOTO_ON_ERROR(THSN_VECTOR_PUSH_VAR(stack, element_handle),
+                                  error_cleanup);
+                }
+                break;
+            }
+            case THSN_VALUE_OBJECT: {
+                ThsnValueObjectTable object_table;
+                GOTO_ON_ERROR(thsn_document_read_object_sorted(
+                                  document, value_handle, &object_table),
+                              error_cleanup);
+                GOTO_ON_ERROR(thsn_document_read_object_indexed(
+                                  document, value_handle, &object_table),
+                              error_cleanup);
+                while (thsn_document_object_length(object_table) > 0) {
+                    ThsnSlice key_slice;
+                    ThsnValueHandle element_handle;
+                    GOTO_ON_ERROR(thsn_document_object_consume_element(
+                                      document, &object_table, &key_slice,
+                                      &element_handle),
+                                  error_cleanup);
+                    GOTO_ON_ERROR(THSN_VECTOR_PUSH_VAR(stack, element_handle),
+                                  error_cleanup);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    thsn_vector_free(&stack);
+    return THSN_RESULT_SUCCESS;
+
+error_cleanup:
+    thsn_vector_free(&stack);
+    return THSN_RESULT_INPUT_ERROR;
+}
@@ -0,0 +1,29 @@
+#ifndef THSN_DOCUMENT_H
+#define THSN_DOCUMENT_H
+
+#include <stdbool.h>
+
+#include "result.h"
+#include "threason.h"
+
+/* Follows the handles multithreaded parses leave in place of values, parsing
+ * the composites of lazy documents on the way, to the value itself. */
+ThsnResult thsn_document_follow_handle(ThsnDocument* /*mut*/ document,
+                                       ThsnValueHandle* /*mut*/ value_handle);
+
+/* Copies the strings that would point into the input to the document's arena
+ * if `copy_strings` is set. */
+ThsnResult thsn_document_parse_single_threaded(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ buffer_slice, ThsnDocument** /*out*/ document,
+    bool copy_strings);
+
+/* Numbers at most `max_segments_count` segments, up to
+ * `THSN_MAX_SEGMENTS_COUNT`, and parses the values of the chunks past them on
+ * the calling thread. Copies strings as the single threaded parse does. */
+ThsnResult thsn_document_parse_in_threads(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
+    size_t threads_count, bool copy_strings, size_t max_segments_count);
+
+#endif
@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+
+#include "file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ThsnResult thsn_file_map(const char* /*in*/ path, bool writable,
+                         ThsnOwningSlice* /*out*/ mapping) {
+    BAIL_ON_NULL_INPUT(path);
+    BAIL_ON_NULL_INPUT(mapping);
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return THSN_RESULT_INPUT_ERROR;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+        close(fd);
+        return THSN_RESULT_INPUT_ERROR;
+    }
+    const size_t size = (size_t)file_stat.st_size;
+    void* const data =
+        mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+             MAP_PRIVATE, fd, 0);
+    /* The mapping keeps the file open */
+    close(fd);
+    if (data == MAP_FAILED) {
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    /* Read ahead the whole file, parsing goes through it front to back */
+    madvise(data, size, MADV_WILLNEED);
+    madvise(data, size, MADV_SEQUENTIAL);
+    *mapping = thsn_slice_make(data, size);
+    return THSN_RESULT_SUCCESS;
+}
+
+void thsn_file_mapping_parsed(ThsnOwningSlice mapping) {
+    if (mapping.data != NULL) {
+        madvise((void*)mapping.data, mapping.size, MADV_NORMAL);
+    }
+}
+
+void thsn_file_unmap(ThsnOwningSlice mapping) {
+    if (mapping.data != NULL) {
+        munmap((void*)mapping.data, mapping.size);
+    }
+}
+
+ThsnResult thsn_document_parse_file(const char* /*in*/ path,
+                                    ThsnDocument** /*out*/ document,
+                                    size_t threads_count) {
+    BAIL_ON_NULL_INPUT(path);
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_WITH_INPUT_ERROR_UNLESS(threads_count > 0);
+    ThsnOwningSlice mapping;
+    BAIL_ON_ERROR(thsn_file_map(path, false, &mapping));
+    ThsnSlice input_slice = mapping;
+    const ThsnResult parse_result =
+        threads_count == 1 ? thsn_document_parse(&input_slice, document)
+                           : thsn_document_parse_multithreaded(
+                                 &input_slice, document, threads_count);
+    if (parse_result != THSN_RESULT_SUCCESS) {
+        thsn_file_unmap(mapping);
+        return parse_result;
+    }
+    thsn_file_mapping_parsed(mapping);
+    (*document)->mapped_input = mapping;
+    return THSN_RESULT_SUCCESS;
+}
@@ -0,0 +1,20 @@
+#ifndef THSN_FILE_H
+#define THSN_FILE_H
+
+#include <stdbool.h>
+
+#include "result.h"
+#include "threason.h"
+
+/* Empty files are an input error, as they can't be mapped. Writable mappings
+ * are private, pages written to are copied and the file is left as is. */
+ThsnResult thsn_file_map(const char* /*in*/ path, bool writable,
+                         ThsnOwningSlice* /*out*/ mapping);
+
+/* Switches the mapping from sequential to random access, for reading the
+ * parsed document. */
+void thsn_file_mapping_parsed(ThsnOwningSlice mapping);
+
+void thsn_file_unmap(ThsnOwningSlice mapping);
+
+#endif
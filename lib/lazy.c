@@ -0,0 +1,201 @@
+#include "lazy.h"
+
+#include "allocator.h"
+#include "parser.h"
+#include "structural.h"
+
+/* Segments of lazy documents grow geometrically, so a few dozen cover any
+ * input, and the document doesn't need room for all the segment numbers */
+#define THSN_LAZY_MAX_SEGMENTS_COUNT UINT8_MAX
+
+#define THSN_LAZY_MIN_SEGMENT_SIZE (64 * 1024)
+
+/* The elements of one composite take less than this many bytes of segment
+ * per input byte, arrays of empty arrays being the worst case, on top of the
+ * composite's own header. */
+#define THSN_LAZY_MAX_SEGMENT_SIZE_PER_INPUT_BYTE 16
+#define THSN_LAZY_MAX_HEADER_SIZE 64
+
+/* Segments readers may point into can't be moved, composites are parsed into
+ * their spare capacity through an allocator that never grows them. */
+static void* thsn_fixed_allocate(void* user_data, size_t size) {
+    (void)user_data;
+    (void)size;
+    return NULL;
+}
+
+static void* thsn_fixed_reallocate(void* user_data, void* ptr,
+                                   size_t old_size, size_t new_size) {
+    (void)user_data;
+    (void)ptr;
+    (void)old_size;
+    (void)new_size;
+    return NULL;
+}
+
+static void thsn_fixed_free(void* user_data, void* ptr, size_t size) {
+    (void)user_data;
+    (void)ptr;
+    (void)size;
+}
+
+/* Parses the value `*buffer_slice` starts with and advances past it. Arrays
+ * and objects within it are only bracket-matched and stored unparsed. */
+static ThsnResult thsn_lazy_parse_value(
+    ThsnParserContext* /*mut*/ parser_context,
+    ThsnSlice* /*mut*/ buffer_slice) {
+    ThsnStructuralIndex structural_index = thsn_structural_index_make();
+    bool nested = false;
+    bool finished = false;
+    while (!finished) {
+        ThsnToken token;
+        ThsnSlice token_slice;
+        BAIL_ON_ERROR(thsn_next_token_indexed(&structural_index, buffer_slice,
+                                              &token_slice, &token));
+        if (nested && (token == THSN_TOKEN_OPEN_BRACKET ||
+                       token == THSN_TOKEN_OPEN_BRACE)) {
+            BAIL_ON_ERROR(thsn_skip_composite(buffer_slice));
+            BAIL_ON_ERROR(thsn_parser_add_unparsed_composite(
+                parser_context,
+                thsn_slice_make(token_slice.data,
+                                buffer_slice->data - token_slice.data),
+                &finished));
+        } else {
+            BAIL_ON_ERROR(thsn_parser_parse_next_token(
+                parser_context, token, token_slice, &finished));
+        }
+        nested = true;
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Fails with `THSN_RESULT_OUT_OF_MEMORY_ERROR` if the composite doesn't fit
+ * into what's left of the last segment. */
+static ThsnResult thsn_lazy_parse_into_last_segment(
+    ThsnDocument* /*mut*/ document, ThsnSlice composite_slice,
+    size_t* /*out*/ value_offset) {
+    static const ThsnAllocator fixed_allocator = {
+        .allocate = thsn_fixed_allocate,
+        .reallocate = thsn_fixed_reallocate,
+        .free = thsn_fixed_free,
+        .user_data = NULL};
+    const ThsnOwningMutSlice segment =
+        document->segments[document->segment_count - 1];
+    ThsnParserContext parser_context = {
+        .state = THSN_PARSER_STATE_VALUE,
+        .stack = {.buffer = document->parser_stack.data,
+                  .capacity = document->parser_stack.size,
+                  .allocator = &document->allocator},
+        .segment = {.buffer = segment.data,
+                    .capacity = segment.size,
+                    .offset = document->lazy_segment_offset,
+                    .allocator = &fixed_allocator},
+        .composite_tag_size = segment.size <= UINT32_MAX
+                                  ? THSN_TAG_SIZE_COMPACT
+                                  : THSN_TAG_SIZE_INBOUND};
+    const ThsnResult result =
+        thsn_lazy_parse_value(&parser_context, &composite_slice);
+    /* The stack is kept for the next composite */
+    document->parser_stack = thsn_mut_slice_make(
+        parser_context.stack.buffer, parser_context.stack.capacity);
+    BAIL_ON_ERROR(result);
+    *value_offset = document->lazy_segment_offset;
+    document->lazy_segment_offset = parser_context.segment.offset;
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Sized to fit the composite, and grown geometrically so the segment numbers
+ * last. */
+static ThsnResult thsn_lazy_add_segment(ThsnDocument* /*mut*/ document,
+                                        size_t input_size) {
+    if (document->segment_count == document->allocated_segment_count ||
+        input_size > (SIZE_MAX - THSN_LAZY_MAX_HEADER_SIZE) /
+                         THSN_LAZY_MAX_SEGMENT_SIZE_PER_INPUT_BYTE) {
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    size_t segment_size =
+        2 * document->segments[document->segment_count - 1].size;
+    if (segment_size < THSN_LAZY_MIN_SEGMENT_SIZE) {
+        segment_size = THSN_LAZY_MIN_SEGMENT_SIZE;
+    }
+    const size_t max_composite_size =
+        input_size * THSN_LAZY_MAX_SEGMENT_SIZE_PER_INPUT_BYTE +
+        THSN_LAZY_MAX_HEADER_SIZE;
+    if (segment_size < max_composite_size) {
+        segment_size = max_composite_size;
+    }
+    char* const segment_data =
+        thsn_allocate(&document->allocator, segment_size);
+    BAIL_ON_ALLOC_FAILURE(segment_data);
+    document->segments[document->segment_count++] =
+        thsn_mut_slice_make(segment_data, segment_size);
+    document->lazy_segment_offset = 0;
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_lazy_parse_composite(ThsnDocument* /*mut*/ document,
+                                     ThsnValueHandle value_handle,
+                                     ThsnSlice composite_slice) {
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_WITH_INPUT_ERROR_UNLESS(value_handle.segment_no <
+                                 document->segment_count);
+    size_t value_offset = 0;
+    ThsnResult result = thsn_lazy_parse_into_last_segment(
+        document, composite_slice, &value_offset);
+    if (result == THSN_RESULT_OUT_OF_MEMORY_ERROR) {
+        BAIL_ON_ERROR(thsn_lazy_add_segment(document, composite_slice.size));
+        result = thsn_lazy_parse_into_last_segment(document, composite_slice,
+                                                   &value_offset);
+    }
+    BAIL_ON_ERROR(result);
+    const ThsnValueHandle parsed_handle = {
+        .segment_no = (uint16_t)(document->segment_count - 1),
+        .offset = value_offset};
+    /* The handle takes less space than the input slice it replaces */
+    char* const unparsed_data =
+        document->segments[value_handle.segment_no].data + value_handle.offset;
+    const ThsnTag value_handle_tag =
+        thsn_tag_make(THSN_TAG_VALUE_HANDLE, THSN_TAG_SIZE_ZERO);
+    memcpy(unparsed_data + sizeof(ThsnTag), &parsed_handle,
+           sizeof(parsed_handle));
+    memcpy(unparsed_data, &value_handle_tag, sizeof(ThsnTag));
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_document_parse_lazy_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document) {
+    BAIL_ON_NULL_INPUT(json_str_slice);
+    BAIL_ON_ERROR(thsn_document_allocate(document, allocator,
+                                         THSN_LAZY_MAX_SEGMENTS_COUNT));
+    ThsnDocument* const doc = *document;
+    doc->segment_count = 1;
+    ThsnParserContext parser_context;
+    /* Only the elements of the root go into the first segment */
+    if (thsn_parser_context_init(&parser_context, &doc->allocator, 0) !=
+        THSN_RESULT_SUCCESS) {
+        thsn_document_free(document);
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    if (json_str_slice->size > THSN_COMPACT_SEGMENT_MAX_INPUT_SIZE) {
+        parser_context.composite_tag_size = THSN_TAG_SIZE_INBOUND;
+    }
+    if (thsn_lazy_parse_value(&parser_context, json_str_slice) !=
+            THSN_RESULT_SUCCESS ||
+        thsn_parser_context_finish(&parser_context, &doc->segments[0]) !=
+            THSN_RESULT_SUCCESS) {
+        thsn_parser_context_finish(&parser_context, NULL);
+        thsn_document_free(document);
+        return THSN_RESULT_INPUT_ERROR;
+    }
+    doc->segment_capacity = doc->segments[0].size;
+    /* Composites parsed later go into segments of their own */
+    doc->lazy_segment_offset = doc->segments[0].size;
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_document_parse_lazy(ThsnSlice* /*mut*/ json_str_slice,
+                                    ThsnDocument** /*out*/ document) {
+    return thsn_document_parse_lazy_with_allocator(NULL, json_str_slice,
+                                                   document);
+}
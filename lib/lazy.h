@@ -0,0 +1,13 @@
+#ifndef THSN_LAZY_H
+#define THSN_LAZY_H
+
+#include "result.h"
+#include "threason.h"
+
+/* Parses the `THSN_TAG_UNPARSED` composite at `value_handle` into the last
+ * segment of the document and replaces it with a handle to the result. */
+ThsnResult thsn_lazy_parse_composite(ThsnDocument* /*mut*/ document,
+                                     ThsnValueHandle value_handle,
+                                     ThsnSlice composite_slice);
+
+#endif
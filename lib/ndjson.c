@@ -0,0 +1,219 @@
+#include <stdatomic.h>
+
+#include "allocator.h"
+#include "structural.h"
+#include "thread_pool.h"
+#include "threads.h"
+#include "tokenizer.h"
+
+typedef struct {
+    /* Thread inputs */
+    ThsnSlice chunk_slice;
+    const ThsnAllocator* allocator;
+    const atomic_bool* cancelled;
+    /* Thread outputs, `ThsnDocument*`s of the records in the chunk */
+    ThsnVector documents;
+    bool failed;
+    ThsnCompletion completion;
+} ThsnRecordsContext;
+
+static bool thsn_is_blank(ThsnSlice slice) {
+    ThsnSlice token_slice;
+    ThsnToken token;
+    return thsn_next_token(&slice, &token_slice, &token) ==
+               THSN_RESULT_SUCCESS &&
+           token == THSN_TOKEN_EOF;
+}
+
+/* Leaves `*document` NULL for blank lines */
+static ThsnResult thsn_parse_record(const ThsnAllocator* /*maybe in*/ allocator,
+                                    ThsnSlice record_slice,
+                                    ThsnDocument** /*out*/ document) {
+    BAIL_ON_NULL_INPUT(document);
+    *document = NULL;
+    if (thsn_is_blank(record_slice)) {
+        return THSN_RESULT_SUCCESS;
+    }
+    BAIL_ON_ERROR(thsn_document_parse_with_allocator(allocator, &record_slice,
+                                                     document));
+    if (!thsn_is_blank(record_slice)) {
+        thsn_document_free(document);
+        return THSN_RESULT_INPUT_ERROR;
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Chunks start right after a newline, and JSON strings can't have raw
+ * newlines in them, so unlike the preparse nothing is speculative here. */
+static int thsn_records_thread(void* /*in*/ user_data) {
+    if (user_data == NULL) {
+        return 0;
+    }
+    ThsnRecordsContext* const records_context = (ThsnRecordsContext*)user_data;
+    ThsnSlice chunk_slice = records_context->chunk_slice;
+    while (!thsn_slice_is_empty(chunk_slice) &&
+           !atomic_load_explicit(records_context->cancelled,
+                                 memory_order_relaxed)) {
+        const char* const newline = thsn_find_char(chunk_slice, '\n');
+        const size_t record_size =
+            newline == NULL ? chunk_slice.size : (size_t)(newline -
+                                                          chunk_slice.data);
+        const ThsnSlice record_slice =
+            thsn_slice_make(chunk_slice.data, record_size);
+        thsn_slice_advance_unsafe(
+            &chunk_slice, newline == NULL ? record_size : record_size + 1);
+        ThsnDocument* document;
+        if (thsn_parse_record(records_context->allocator, record_slice,
+                              &document) != THSN_RESULT_SUCCESS) {
+            records_context->failed = true;
+            break;
+        }
+        if (document != NULL &&
+            THSN_VECTOR_PUSH_VAR(records_context->documents, document) !=
+                THSN_RESULT_SUCCESS) {
+            thsn_document_free(&document);
+            records_context->failed = true;
+            break;
+        }
+    }
+    thsn_completion_signal(&records_context->completion);
+    return 0;
+}
+
+/* Every chunk but the first starts after the first newline at or past its
+ * share of the input, chunks can end up empty. */
+static void thsn_split_records(ThsnSlice json_lines_slice,
+                               ThsnRecordsContext* /*mut*/ records_contexts,
+                               size_t threads_count) {
+    const char* chunk_start = json_lines_slice.data;
+    const char* const end = thsn_slice_end(json_lines_slice);
+    for (size_t i = 0; i < threads_count; ++i) {
+        const char* chunk_end = end;
+        if (i + 1 < threads_count) {
+            const char* const share_end =
+                json_lines_slice.data +
+                json_lines_slice.size / threads_count * (i + 1);
+            const char* const newline = thsn_find_char(
+                thsn_slice_make(share_end, end - share_end), '\n');
+            chunk_end = newline == NULL ? end : newline + 1;
+            chunk_end = chunk_end < chunk_start ? chunk_start : chunk_end;
+        }
+        records_contexts[i].chunk_slice =
+            thsn_slice_make(chunk_start, chunk_end - chunk_start);
+        chunk_start = chunk_end;
+    }
+}
+
+static void thsn_free_documents(ThsnSlice documents_slice) {
+    ThsnDocument* document;
+    while (THSN_SLICE_READ_VAR(documents_slice, document) ==
+           THSN_RESULT_SUCCESS) {
+        thsn_document_free(&document);
+    }
+}
+
+ThsnResult thsn_document_parse_ndjson_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator, ThsnSlice json_lines_slice,
+    size_t threads_count, ThsnRecordCallback callback,
+    void* /*in*/ user_data) {
+    BAIL_ON_NULL_INPUT(callback);
+    BAIL_WITH_INPUT_ERROR_UNLESS(threads_count > 0);
+    threads_count =
+        thsn_effective_threads_count(json_lines_slice.size, threads_count);
+    ThsnRecordsContext* const records_contexts = thsn_allocate_zeroed(
+        allocator, sizeof(ThsnRecordsContext) * threads_count);
+    BAIL_ON_ALLOC_FAILURE(records_contexts);
+    ThsnThreadPool thread_pool;
+    if (thsn_thread_pool_init(&thread_pool, threads_count - 1) !=
+        THSN_RESULT_SUCCESS) {
+        thsn_free(allocator, records_contexts,
+                  sizeof(ThsnRecordsContext) * threads_count);
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    atomic_bool cancelled;
+    atomic_init(&cancelled, false);
+    thsn_split_records(json_lines_slice, records_contexts, threads_count);
+    ThsnResult result = THSN_RESULT_SUCCESS;
+    size_t contexts_started = 0;
+    for (; contexts_started < threads_count; ++contexts_started) {
+        ThsnRecordsContext* const records_context =
+            &records_contexts[contexts_started];
+        records_context->allocator = allocator;
+        records_context->cancelled = &cancelled;
+        records_context->documents =
+            thsn_vector_make_empty_with_allocator(allocator);
+        result = thsn_completion_init(&records_context->completion);
+        if (result != THSN_RESULT_SUCCESS) {
+            break;
+        }
+        /* The first chunk is parsed on this thread, once the rest are
+         * submitted */
+        if (contexts_started > 0) {
+            result = thsn_thread_pool_submit(&thread_pool, thsn_records_thread,
+                                             records_context);
+            if (result != THSN_RESULT_SUCCESS) {
+                /* Every started context has to be completed */
+                atomic_store_explicit(&cancelled, true, memory_order_relaxed);
+                thsn_records_thread(records_context);
+                ++contexts_started;
+                break;
+            }
+        }
+    }
+    if (result != THSN_RESULT_SUCCESS) {
+        atomic_store_explicit(&cancelled, true, memory_order_relaxed);
+    }
+    if (contexts_started > 0) {
+        thsn_records_thread(&records_contexts[0]);
+    }
+
+    size_t record_no = 0;
+    bool stopped = result != THSN_RESULT_SUCCESS;
+    for (size_t i = 0; i < contexts_started; ++i) {
+        ThsnRecordsContext* const records_context = &records_contexts[i];
+        thsn_completion_wait(&records_context->completion, NULL);
+        ThsnSlice documents_slice =
+            thsn_vector_as_slice(records_context->documents);
+        ThsnDocument* document;
+        while (!stopped && THSN_SLICE_READ_VAR(documents_slice, document) ==
+                               THSN_RESULT_SUCCESS) {
+            switch (callback(user_data, record_no++, document)) {
+                case THSN_VISITOR_RESULT_ABORT_SUCCESS:
+                    stopped = true;
+                    break;
+                case THSN_VISITOR_RESULT_ABORT_ERROR:
+                    result = THSN_RESULT_INPUT_ERROR;
+                    stopped = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (!stopped && records_context->failed) {
+            result = THSN_RESULT_INPUT_ERROR;
+            stopped = true;
+        }
+        if (stopped) {
+            atomic_store_explicit(&cancelled, true, memory_order_relaxed);
+        }
+        /* Records the callback didn't get are still owned here */
+        thsn_free_documents(documents_slice);
+        thsn_vector_free(&records_context->documents);
+    }
+
+    thsn_thread_pool_destroy(&thread_pool);
+    for (size_t i = 0; i < contexts_started; ++i) {
+        thsn_completion_destroy(&records_contexts[i].completion);
+    }
+    thsn_free(allocator, records_contexts,
+              sizeof(ThsnRecordsContext) * threads_count);
+    return result;
+}
+
+ThsnResult thsn_document_parse_ndjson(ThsnSlice json_lines_slice,
+                                      size_t threads_count,
+                                      ThsnRecordCallback callback,
+                                      void* /*in*/ user_data) {
+    return thsn_document_parse_ndjson_with_allocator(
+        NULL, json_lines_slice, threads_count, callback, user_data);
+}
@@ -0,0 +1,81 @@
+#ifndef THSN_NUMBER_H
+#define THSN_NUMBER_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "result.h"
+#include "slice.h"
+
+static inline bool thsn_number_parse_digits(ThsnSlice slice, uint64_t limit,
+                                            uint64_t* /*out*/ magnitude) {
+    if (thsn_slice_is_empty(slice)) {
+        return false;
+    }
+    *magnitude = 0;
+    for (size_t i = 0; i < slice.size; ++i) {
+        const unsigned digit = (unsigned char)slice.data[i] - '0';
+        if (digit > 9 || *magnitude > (limit - digit) / 10) {
+            return false;
+        }
+        *magnitude = *magnitude * 10 + digit;
+    }
+    return true;
+}
+
+/* Returns false if the slice isn't an optionally negative decimal integer
+ * fitting into `long long`. */
+static inline bool thsn_number_parse_int(ThsnSlice slice,
+                                         long long* /*out*/ result) {
+    const bool negative = !thsn_slice_is_empty(slice) && slice.data[0] == '-';
+    if (negative) {
+        thsn_slice_advance_unsafe(&slice, 1);
+    }
+    const uint64_t limit = negative ? (uint64_t)LLONG_MAX + 1 : LLONG_MAX;
+    uint64_t magnitude;
+    if (!thsn_number_parse_digits(slice, limit, &magnitude)) {
+        return false;
+    }
+    if (!negative) {
+        *result = (long long)magnitude;
+    } else {
+        *result = magnitude == limit ? LLONG_MIN : -(long long)magnitude;
+    }
+    return true;
+}
+
+/* Returns false if the slice isn't a decimal integer fitting into `unsigned
+ * long long`. */
+static inline bool thsn_number_parse_uint(ThsnSlice slice,
+                                          unsigned long long* /*out*/ result) {
+    uint64_t magnitude;
+    if (!thsn_number_parse_digits(slice, ULLONG_MAX, &magnitude)) {
+        return false;
+    }
+    *result = magnitude;
+    return true;
+}
+
+/* Parses a number token in place and rounds it correctly, only tokens with
+ * more than 19 significant digits or ambiguous rounding go through
+ * `strtod`. */
+ThsnResult thsn_number_parse_double(ThsnSlice slice, double* /*out*/ result);
+
+/* Enough for any output of the format functions, such as
+ * "-2.2250738585072014e-308" */
+#define THSN_MAX_FORMATTED_NUMBER_SIZE 32
+
+/* The format functions write into `output` without a terminating zero, and
+ * return the number of bytes written. */
+size_t thsn_number_format_uint(uint64_t value, char* /*out*/ output);
+
+size_t thsn_number_format_int(int64_t value, char* /*out*/ output);
+
+/* Writes the shortest decimal that parses back to the same double, always
+ * with a '.' or an exponent, so it doesn't parse back as an integer.
+ * Infinities, which only come from out of range input like "1e400", are
+ * written as "1e999" and "-1e999" to do the same. */
+size_t thsn_number_format_double(double value, char* /*out*/ output);
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef THSN_PARSER_H
 #define THSN_PARSER_H
 
+#include "allocator.h"
+#include "arena.h"
+#include "number.h"
 #include "segment.h"
 #include "threason.h"
 #include "tokenizer.h"
@@ -20,17 +23,65 @@ typedef struct {
     ThsnParserState state;
     ThsnVector stack;
     ThsnSegment segment;
+    /* `THSN_TAG_SIZE_COMPACT` unless the segment can outgrow 32-bit offsets */
+    ThsnTagSize composite_tag_size;
+    /* If set, strings that would point into the input are copied here */
+    ThsnArena* string_heap;
 } ThsnParserContext;
 
-static inline ThsnResult thsn_parser_context_init(
-    ThsnParserContext* /*out*/ parser_context) {
+/* Initial buffer sizes scale with the input, so small documents don't pay
+ * for large allocations. */
+#define THSN_PARSER_MIN_BUFFER_SIZE 256
+#define THSN_PARSER_MAX_BUFFER_SIZE (1024 * 1024)
+
+static inline size_t thsn_parser_buffer_size(size_t input_size) {
+    if (input_size < THSN_PARSER_MIN_BUFFER_SIZE) {
+        return THSN_PARSER_MIN_BUFFER_SIZE;
+    }
+    return input_size < THSN_PARSER_MAX_BUFFER_SIZE
+               ? input_size
+               : THSN_PARSER_MAX_BUFFER_SIZE;
+}
+
+/* Takes over `stack` and `segment`, possibly left from a previous parse, and
+ * grows them to fit `input_size`. `input_size` is an upper bound of the input
+ * parsed into the segment. */
+static inline ThsnResult thsn_parser_context_init_with_buffers(
+    ThsnParserContext* /*out*/ parser_context, size_t input_size,
+    ThsnVector stack, ThsnVector segment) {
     BAIL_ON_NULL_INPUT(parser_context);
     parser_context->state = THSN_PARSER_STATE_VALUE;
-    BAIL_ON_ERROR(thsn_vector_allocate(&parser_context->stack, 1024 * 1024));
-    BAIL_ON_ERROR(thsn_vector_allocate(&parser_context->segment, 1024 * 1024));
+    parser_context->composite_tag_size =
+        input_size <= THSN_COMPACT_SEGMENT_MAX_INPUT_SIZE
+            ? THSN_TAG_SIZE_COMPACT
+            : THSN_TAG_SIZE_INBOUND;
+    parser_context->string_heap = NULL;
+    parser_context->stack = stack;
+    parser_context->stack.offset = 0;
+    parser_context->segment = segment;
+    parser_context->segment.offset = 0;
+    /* Compact segments usually take up to twice the input size */
+    const size_t buffer_size = thsn_parser_buffer_size(input_size);
+    if (thsn_vector_reserve(&parser_context->stack, buffer_size) !=
+            THSN_RESULT_SUCCESS ||
+        thsn_vector_reserve(&parser_context->segment, 2 * buffer_size) !=
+            THSN_RESULT_SUCCESS) {
+        thsn_vector_free(&parser_context->stack);
+        thsn_vector_free(&parser_context->segment);
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
     return THSN_RESULT_SUCCESS;
 }
 
+static inline ThsnResult thsn_parser_context_init(
+    ThsnParserContext* /*out*/ parser_context,
+    const ThsnAllocator* /*maybe in*/ allocator, size_t input_size) {
+    return thsn_parser_context_init_with_buffers(
+        parser_context, input_size,
+        thsn_vector_make_empty_with_allocator(allocator),
+        thsn_vector_make_empty_with_allocator(allocator));
+}
+
 static inline ThsnResult thsn_parser_context_finish(
     ThsnParserContext* /*in*/ parser_context,
     ThsnOwningMutSlice* /*maybe out*/ parsing_result) {
@@ -39,23 +90,17 @@ static inline ThsnResult thsn_parser_context_finish(
     if (parsing_result == NULL) {
         thsn_vector_free(&parser_context->segment);
     } else {
+        /* Owners of the result free it by its size */
+        if (thsn_vector_shrink_to_fit(&parser_context->segment) !=
+            THSN_RESULT_SUCCESS) {
+            thsn_vector_free(&parser_context->segment);
+            return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+        }
         *parsing_result = thsn_vector_as_mut_slice(parser_context->segment);
     }
     return THSN_RESULT_SUCCESS;
 }
 
-static inline ThsnResult thsn_parser_add_value_handle(
-    ThsnParserContext* /*mut*/ parser_context, ThsnValueHandle value_handle) {
-    BAIL_ON_NULL_INPUT(parser_context);
-    BAIL_WITH_INPUT_ERROR_UNLESS(parser_context->state ==
-                                 THSN_PARSER_STATE_VALUE);
-    BAIL_ON_ERROR(thsn_segment_store_value_handle(&parser_context->segment,
-                                                  value_handle));
-    BAIL_ON_ERROR(
-        THSN_VECTOR_POP_VAR(parser_context->stack, parser_context->state));
-    return THSN_RESULT_SUCCESS;
-}
-
 static inline ThsnResult thsn_parser_reset_state(
     ThsnParserContext* /*mut*/ parser_context) {
     BAIL_ON_NULL_INPUT(parser_context);
@@ -72,55 +117,44 @@ static inline ThsnResult thsn_parser_next_value_offset(
     return THSN_RESULT_SUCCESS;
 }
 
-static inline ThsnResult thsn_document_allocate(ThsnDocument** /*mut*/ document,
-                                                uint8_t chunks_count) {
+/* Segment numbers go up to `UINT16_MAX - 1`, the last one is taken by
+ * `thsn_value_handle_not_found` */
+#define THSN_MAX_SEGMENTS_COUNT UINT16_MAX
+
+/* The document keeps a copy of `allocator`, or of the system one if it's
+ * NULL. */
+static inline ThsnResult thsn_document_allocate(
+    ThsnDocument** /*mut*/ document,
+    const ThsnAllocator* /*maybe in*/ allocator, size_t segments_count) {
     BAIL_ON_NULL_INPUT(document);
-    *document =
-        calloc(1, sizeof(ThsnDocument) + sizeof(ThsnSlice) * chunks_count);
+    BAIL_WITH_INPUT_ERROR_UNLESS(segments_count <= THSN_MAX_SEGMENTS_COUNT);
+    *document = thsn_allocate_zeroed(
+        allocator,
+        sizeof(ThsnDocument) + sizeof(ThsnOwningMutSlice) * segments_count);
     if (*document == NULL) {
         return THSN_RESULT_OUT_OF_MEMORY_ERROR;
     }
-    (*document)->segment_count = chunks_count;
+    (*document)->allocator =
+        allocator == NULL ? thsn_system_allocator() : *allocator;
+    (*document)->allocated_segment_count = segments_count;
+    (*document)->segment_count = segments_count;
     return THSN_RESULT_SUCCESS;
 }
 
-static inline long long thsn_parser_atoll_checked(ThsnSlice slice) {
-    long long result = 0;
-    char c;
-    if (thsn_slice_try_consume_char(&slice, &c)) {
-        bool sign = true;
-        if (c == '-') {
-            if (thsn_slice_is_empty(slice)) {
-                return 0;
-            }
-            sign = false;
-        } else {
-            result = c - '0';
-        }
-
-        while (thsn_slice_try_consume_char(&slice, &c)) {
-            result = result * 10 + (c - '0');
-        }
-
-        if (!sign) {
-            result *= -1;
-        }
+/* Only small strings without escapes are stored in the segment itself, the
+ * rest are copied to the string heap if there is one. */
+static inline ThsnResult thsn_parser_store_string(
+    ThsnParserContext* /*mut*/ parser_context, ThsnSlice string_slice) {
+    if (parser_context->string_heap != NULL &&
+        (string_slice.size > THSN_TAG_SIZE_MAX ||
+         memchr(string_slice.data, '\\', string_slice.size) != NULL)) {
+        char* string_copy;
+        BAIL_ON_ERROR(thsn_arena_allocate(&parser_context->string_heap,
+                                          string_slice.size, &string_copy));
+        memcpy(string_copy, string_slice.data, string_slice.size);
+        string_slice = thsn_slice_make(string_copy, string_slice.size);
     }
-    return result;
-}
-
-static inline ThsnResult thsn_parser_atod_checked(ThsnSlice slice,
-                                                  double* /*out*/ result) {
-    BAIL_ON_NULL_INPUT(result);
-    const size_t MAX_DOUBLE_LEN = 128;
-    BAIL_WITH_INPUT_ERROR_UNLESS(slice.size <= MAX_DOUBLE_LEN);
-    char double_str[MAX_DOUBLE_LEN + 1];
-    memcpy(double_str, slice.data, slice.size);
-    double_str[slice.size] = '\0';
-    char* double_str_end = NULL;
-    *result = strtod(double_str, &double_str_end);
-    return double_str_end == double_str ? THSN_RESULT_INPUT_ERROR
-                                        : THSN_RESULT_SUCCESS;
+    return thsn_segment_store_string(&parser_context->segment, string_slice);
 }
 
 static inline ThsnResult thsn_parser_parse_value(
@@ -137,18 +171,26 @@ static inline ThsnResult thsn_parser_parse_value(
             return thsn_segment_store_bool(&parser_context->segment, true);
         case THSN_TOKEN_FALSE:
             return thsn_segment_store_bool(&parser_context->segment, false);
-        case THSN_TOKEN_INT:
-            return thsn_segment_store_int(
-                &parser_context->segment,
-                thsn_parser_atoll_checked(token_slice));
+        case THSN_TOKEN_INT: {
+            long long value;
+            if (thsn_number_parse_int(token_slice, &value)) {
+                return thsn_segment_store_int(&parser_context->segment, value);
+            }
+            unsigned long long unsigned_value;
+            if (thsn_number_parse_uint(token_slice, &unsigned_value)) {
+                return thsn_segment_store_uint(&parser_context->segment,
+                                               unsigned_value);
+            }
+            /* Doesn't fit into 64 bits, store it as double instead */
+        }
+        /* fallthrough */
         case THSN_TOKEN_FLOAT: {
             double value;
-            BAIL_ON_ERROR(thsn_parser_atod_checked(token_slice, &value));
+            BAIL_ON_ERROR(thsn_number_parse_double(token_slice, &value));
             return thsn_segment_store_double(&parser_context->segment, value);
         }
         case THSN_TOKEN_STRING:
-            return thsn_segment_store_string(&parser_context->segment,
-                                             token_slice);
+            return thsn_parser_store_string(parser_context, token_slice);
         case THSN_TOKEN_OPEN_BRACKET:
             parser_context->state = THSN_PARSER_STATE_FIRST_ARRAY_ELEMENT;
             return THSN_RESULT_SUCCESS;
@@ -161,12 +203,12 @@ static inline ThsnResult thsn_parser_parse_value(
 }
 
 static inline ThsnResult thsn_parser_store_composite_header(
-    ThsnParserContext* /*mut*/ parser_context, ThsnTag tag,
-    bool with_sorted_table_offset) {
+    ThsnParserContext* /*mut*/ parser_context, ThsnTagType tag_type) {
     BAIL_ON_NULL_INPUT(parser_context);
     size_t composite_header_offset;
     BAIL_ON_ERROR(thsn_segment_store_composite_header(
-        &parser_context->segment, tag, with_sorted_table_offset,
+        &parser_context->segment,
+        thsn_tag_make(tag_type, parser_context->composite_tag_size),
         &composite_header_offset));
     const size_t first_element_offset =
         thsn_vector_current_offset(parser_context->segment);
@@ -192,7 +234,7 @@ static inline ThsnResult thsn_parser_add_composite_element(
 }
 
 static inline ThsnResult thsn_parser_store_composite_elements_table(
-    ThsnParserContext* /*mut*/ parser_context, bool reserve_sorted_table) {
+    ThsnParserContext* /*mut*/ parser_context) {
     BAIL_ON_NULL_INPUT(parser_context);
     size_t composite_elements_count;
     BAIL_ON_ERROR(
@@ -207,8 +249,7 @@ static inline ThsnResult thsn_parser_store_composite_elements_table(
     BAIL_ON_ERROR(
         THSN_VECTOR_POP_VAR(parser_context->stack, composite_header_offset));
     return thsn_segment_store_composite_elements_table(
-        &parser_context->segment, composite_header_offset, elements_table_src,
-        reserve_sorted_table);
+        &parser_context->segment, composite_header_offset, elements_table_src);
 }
 
 static inline ThsnResult thsn_parser_parse_first_array_element(
@@ -222,9 +263,8 @@ static inline ThsnResult thsn_parser_parse_first_array_element(
             thsn_tag_make(THSN_TAG_ARRAY, THSN_TAG_SIZE_EMPTY),
             thsn_slice_make_empty());
     }
-    BAIL_ON_ERROR(thsn_parser_store_composite_header(
-        parser_context, thsn_tag_make(THSN_TAG_ARRAY, THSN_TAG_SIZE_INBOUND),
-        false));
+    BAIL_ON_ERROR(
+        thsn_parser_store_composite_header(parser_context, THSN_TAG_ARRAY));
     ThsnParserState return_to_state = THSN_PARSER_STATE_NEXT_ARRAY_ELEMENT;
     BAIL_ON_ERROR(THSN_VECTOR_PUSH_VAR(parser_context->stack, return_to_state));
     return thsn_parser_parse_value(token, token_slice, parser_context);
@@ -236,8 +276,8 @@ static inline ThsnResult thsn_parser_parse_next_array_element(
     BAIL_ON_NULL_INPUT(parser_context);
     (void)token_slice;
     if (token == THSN_TOKEN_CLOSED_BRACKET) {
-        BAIL_ON_ERROR(thsn_parser_store_composite_elements_table(
-            parser_context, /* reserve_sorted_table = */ false));
+        BAIL_ON_ERROR(
+            thsn_parser_store_composite_elements_table(parser_context));
         parser_context->state = THSN_PARSER_STATE_FINISH;
         return THSN_RESULT_SUCCESS;
     }
@@ -255,8 +295,7 @@ static inline ThsnResult thsn_parser_parse_next_kv(
     BAIL_ON_NULL_INPUT(parser_context);
     BAIL_WITH_INPUT_ERROR_UNLESS(token == THSN_TOKEN_STRING);
     BAIL_ON_ERROR(thsn_parser_add_composite_element(parser_context));
-    BAIL_ON_ERROR(
-        thsn_segment_store_string(&parser_context->segment, token_slice));
+    BAIL_ON_ERROR(thsn_parser_store_string(parser_context, token_slice));
     parser_context->state = THSN_PARSER_STATE_KV_COLON;
     return THSN_RESULT_SUCCESS;
 }
@@ -273,11 +312,9 @@ static inline ThsnResult thsn_parser_parse_first_kv(
             thsn_slice_make_empty());
     }
     BAIL_WITH_INPUT_ERROR_UNLESS(token == THSN_TOKEN_STRING);
-    BAIL_ON_ERROR(thsn_parser_store_composite_header(
-        parser_context, thsn_tag_make(THSN_TAG_OBJECT, THSN_TAG_SIZE_INBOUND),
-        true));
     BAIL_ON_ERROR(
-        thsn_segment_store_string(&parser_context->segment, token_slice));
+        thsn_parser_store_composite_header(parser_context, THSN_TAG_OBJECT));
+    BAIL_ON_ERROR(thsn_parser_store_string(parser_context, token_slice));
     parser_context->state = THSN_PARSER_STATE_KV_COLON;
     return THSN_RESULT_SUCCESS;
 }
@@ -300,8 +337,8 @@ static inline ThsnResult thsn_parser_parse_kv_end(
     BAIL_ON_NULL_INPUT(parser_context);
     (void)token_slice;
     if (token == THSN_TOKEN_CLOSED_BRACE) {
-        BAIL_ON_ERROR(thsn_parser_store_composite_elements_table(
-            parser_context, /*reserve_sorted_table=*/true));
+        BAIL_ON_ERROR(
+            thsn_parser_store_composite_elements_table(parser_context));
         parser_context->state = THSN_PARSER_STATE_FINISH;
         return THSN_RESULT_SUCCESS;
     }
@@ -310,6 +347,20 @@ static inline ThsnResult thsn_parser_parse_kv_end(
     return THSN_RESULT_SUCCESS;
 }
 
+/* Returns to the state of the enclosing composite once a value is done */
+static inline ThsnResult thsn_parser_finish_value(
+    ThsnParserContext* /*mut*/ parser_context, bool* /*out*/ finished) {
+    if (parser_context->state == THSN_PARSER_STATE_FINISH) {
+        if (thsn_vector_is_empty(parser_context->stack)) {
+            *finished = true;
+        } else {
+            BAIL_ON_ERROR(THSN_VECTOR_POP_VAR(parser_context->stack,
+                                              parser_context->state));
+        }
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
 static inline ThsnResult thsn_parser_parse_next_token(
     ThsnParserContext* /*mut*/ parser_context, ThsnToken token,
     ThsnSlice token_slice, bool* /*out*/ finished) {
@@ -348,15 +399,54 @@ static inline ThsnResult thsn_parser_parse_next_token(
         case THSN_PARSER_STATE_FINISH:
             return THSN_RESULT_INPUT_ERROR;
     }
-    if (parser_context->state == THSN_PARSER_STATE_FINISH) {
-        if (thsn_vector_is_empty(parser_context->stack)) {
-            *finished = true;
-        } else {
-            BAIL_ON_ERROR(THSN_VECTOR_POP_VAR(parser_context->stack,
-                                              parser_context->state));
-        }
+    return thsn_parser_finish_value(parser_context, finished);
+}
+
+/* Stores a value parsed into another segment in place of the next value,
+ * which can be the first element of an array. */
+static inline ThsnResult thsn_parser_add_value_handle(
+    ThsnParserContext* /*mut*/ parser_context, ThsnValueHandle value_handle) {
+    BAIL_ON_NULL_INPUT(parser_context);
+    if (parser_context->state == THSN_PARSER_STATE_FIRST_ARRAY_ELEMENT) {
+        BAIL_ON_ERROR(thsn_parser_store_composite_header(parser_context,
+                                                         THSN_TAG_ARRAY));
+        ThsnParserState return_to_state = THSN_PARSER_STATE_NEXT_ARRAY_ELEMENT;
+        BAIL_ON_ERROR(
+            THSN_VECTOR_PUSH_VAR(parser_context->stack, return_to_state));
+    } else {
+        BAIL_WITH_INPUT_ERROR_UNLESS(parser_context->state ==
+                                     THSN_PARSER_STATE_VALUE);
     }
+    BAIL_ON_ERROR(thsn_segment_store_value_handle(&parser_context->segment,
+                                                  value_handle));
+    BAIL_ON_ERROR(
+        THSN_VECTOR_POP_VAR(parser_context->stack, parser_context->state));
     return THSN_RESULT_SUCCESS;
 }
 
+/* Stores an array or object left unparsed in place of the next value,
+ * `composite_slice` is its input from the opening bracket to the closing
+ * one. */
+static inline ThsnResult thsn_parser_add_unparsed_composite(
+    ThsnParserContext* /*mut*/ parser_context, ThsnSlice composite_slice,
+    bool* /*out*/ finished) {
+    BAIL_ON_NULL_INPUT(parser_context);
+    BAIL_ON_NULL_INPUT(finished);
+    *finished = false;
+    if (parser_context->state == THSN_PARSER_STATE_FIRST_ARRAY_ELEMENT) {
+        BAIL_ON_ERROR(thsn_parser_store_composite_header(parser_context,
+                                                         THSN_TAG_ARRAY));
+        ThsnParserState return_to_state = THSN_PARSER_STATE_NEXT_ARRAY_ELEMENT;
+        BAIL_ON_ERROR(
+            THSN_VECTOR_PUSH_VAR(parser_context->stack, return_to_state));
+    } else {
+        BAIL_WITH_INPUT_ERROR_UNLESS(parser_context->state ==
+                                     THSN_PARSER_STATE_VALUE);
+    }
+    BAIL_ON_ERROR(
+        thsn_segment_store_unparsed(&parser_context->segment, composite_slice));
+    parser_context->state = THSN_PARSER_STATE_FINISH;
+    return thsn_parser_finish_value(parser_context, finished);
+}
+
 #endif
@@ -2,10 +2,20 @@
 #include <stdio.h>
 #endif
 
+#include "allocator.h"
+#include "arena.h"
+#include "document.h"
 #include "parser.h"
-#include "stdatomic.h"
+#include "structural.h"
+#include "thread_pool.h"
 #include "threads.h"
 
+struct ThsnParserPool {
+    ThsnThreadPool thread_pool;
+    /* Includes the calling thread */
+    size_t threads_count;
+};
+
 typedef struct {
     ThsnSlice inbuffer_slice;
     size_t value_offset;
@@ -17,25 +27,59 @@ typedef enum {
 } ThsnPreparseScenario;
 
 typedef struct {
-    /* Thread inputs */
+    /* Chunk inputs */
     ThsnSlice subbuffer_slice;
-    uint8_t chunk_no;
-    /* Thread outputs */
-    struct {
-        ThsnOwningSlice pp_table;
-        ThsnOwningMutSlice segment;
-        bool failed;
-        /* Completion flag */
-        volatile atomic_bool completed;
-    } parsing_results[2];
+    /* Of the worker whose range the chunk starts in */
+    size_t home_worker_no;
+    /* Chunk outputs */
+    ThsnOwningSlice pp_table;
+    ThsnOwningMutSlice segment;
+    bool failed;
     ThsnPreparseScenario pp_scenario;
-} ThsnThreadContext;
+    ThsnCompletion completion;
+    /* Given by the main thread when it takes the first value preparsed in the
+     * chunk, 0 is the main thread's own segment and stands for none */
+    size_t segment_no;
+#ifdef METRICS
+    size_t worker_no;
+    ThsnCompletionMetrics completion_metrics;
+#endif
+} ThsnChunkContext;
+
+typedef struct ThsnChunkScheduler ThsnChunkScheduler;
+
+typedef struct {
+    /* The worker's own chunks, the others steal them from the back once they
+     * run out of theirs */
+    ThsnWorkRange chunks;
+    ThsnChunkScheduler* scheduler;
+    /* Set for self-contained documents, gets the copied strings */
+    ThsnArena* string_heap;
+    ThsnCompletion completion;
+} ThsnWorkerContext;
+
+/* Chunk 0 is parsed by the main thread, the rest are split evenly between the
+ * workers' ranges. The main thread takes the chunks nobody has started yet
+ * by the time it gets to them as well. */
+struct ThsnChunkScheduler {
+    const ThsnAllocator* allocator;
+    ThsnChunkContext* chunks;
+    size_t chunks_count;
+    ThsnWorkerContext* workers;
+    size_t workers_count;
+    /* Chunks and workers with initialized completions */
+    size_t chunks_ready;
+    size_t workers_ready;
+};
 
 typedef struct {
-    ThsnSlice thread_contexts;
-    ThsnThreadContext* current_thread_context;
+    ThsnChunkScheduler* scheduler;
+    size_t chunk_no;
     ThsnOwningSlice current_pp_table;
     ThsnPreparsedValue current_pp_value;
+    /* Segments numbered so far, including the main thread's one */
+    size_t segments_count;
+    size_t max_segments_count;
 } ThsnPreparseIterator;
 
 static ThsnPreparsedValue thsn_pp_value_make_empty(void) {
@@ -48,95 +92,103 @@ static bool thsn_pp_value_is_empty(const ThsnPreparsedValue* /*in*/ pp_value) {
     return thsn_slice_is_empty(pp_value->inbuffer_slice);
 }
 
-static void thsn_pp_wait_for_completion(volatile atomic_bool* completed) {
+static void thsn_pp_wait_for_completion(ThsnChunkContext* /*mut*/ chunk) {
 #ifdef METRICS
-    size_t yield_count = 0;
+    thsn_completion_wait(&chunk->completion, &chunk->completion_metrics);
+#else
+    thsn_completion_wait(&chunk->completion, NULL);
 #endif
-    while (true) {
-        if (atomic_load_explicit(completed, memory_order_acquire)) {
-            break;
-        } else {
-            thrd_yield();
+}
+
+static void thsn_pp_chunk_context_destroy(ThsnChunkContext* /*mut*/ chunk,
+                                          size_t chunk_no) {
 #ifdef METRICS
-            ++yield_count;
-#endif
-        }
+    if (chunk->worker_no == SIZE_MAX) {
+        fprintf(stderr, "Chunk %zu: buffer size %zu, parsed by main thread\n",
+                chunk_no, chunk->subbuffer_slice.size);
+    } else {
+        fprintf(stderr,
+                "Chunk %zu: buffer size %zu, worker %zu, speculated %s, "
+                "yielded %zu times, parked %zu times\n",
+                chunk_no, chunk->subbuffer_slice.size, chunk->worker_no,
+                chunk->pp_scenario == THSN_PP_STARTS_IN_STRING
+                    ? "in string"
+                    : "not in string",
+                chunk->completion_metrics.yield_count,
+                chunk->completion_metrics.park_count);
     }
-#ifdef METRICS
-    fprintf(stderr, "Yelded %zu times\n", yield_count);
+#else
+    (void)chunk_no;
 #endif
+    thsn_completion_destroy(&chunk->completion);
+}
+
+/* Takes the chunk away from the workers if none of them has started it */
+static bool thsn_pp_take_chunk(ThsnChunkScheduler* /*mut*/ scheduler,
+                               size_t chunk_no) {
+    ThsnWorkerContext* const home_worker =
+        &scheduler->workers[scheduler->chunks[chunk_no].home_worker_no];
+    size_t taken_chunk_no;
+    return thsn_work_range_take_front(&home_worker->chunks, chunk_no,
+                                      &taken_chunk_no);
 }
 
 static ThsnResult thsn_pp_iter_init(ThsnPreparseIterator* /*mut*/ pp_iter,
-                                    ThsnSlice thread_contexts) {
+                                    ThsnChunkScheduler* /*mut*/ scheduler,
+                                    size_t max_segments_count) {
     BAIL_ON_NULL_INPUT(pp_iter);
+    BAIL_ON_NULL_INPUT(scheduler);
+    BAIL_WITH_INPUT_ERROR_UNLESS(scheduler->chunks_count > 0);
     *pp_iter = (ThsnPreparseIterator){0};
-    pp_iter->thread_contexts = thread_contexts;
-    BAIL_WITH_INPUT_ERROR_UNLESS(
-        !thsn_slice_is_empty(pp_iter->thread_contexts));
-    pp_iter->current_thread_context =
-        (ThsnThreadContext*)pp_iter->thread_contexts.data;
-    BAIL_ON_ERROR(thsn_slice_at_offset(pp_iter->thread_contexts,
-                                       sizeof(ThsnThreadContext), 0,
-                                       &pp_iter->thread_contexts));
+    pp_iter->scheduler = scheduler;
+    pp_iter->segments_count = 1;
+    pp_iter->max_segments_count = max_segments_count;
     return THSN_RESULT_SUCCESS;
 }
 
 static ThsnResult thsn_pp_iter_advance_to_char(
-    ThsnPreparseIterator* /*mut*/ pp_iter, const char* /*in*/ point,
-    bool in_string) {
+    ThsnPreparseIterator* /*mut*/ pp_iter, const char* /*in*/ point) {
     BAIL_ON_NULL_INPUT(pp_iter);
     BAIL_ON_NULL_INPUT(point);
+    ThsnChunkScheduler* const scheduler = pp_iter->scheduler;
     if (point <
-        thsn_slice_end(pp_iter->current_thread_context->subbuffer_slice)) {
+        thsn_slice_end(scheduler->chunks[pp_iter->chunk_no].subbuffer_slice)) {
         return THSN_RESULT_SUCCESS;
     }
 
     while (true) {
-        if (thsn_slice_is_empty(pp_iter->thread_contexts)) {
-            /* No more thread contexts */
+        if (pp_iter->chunk_no + 1 == scheduler->chunks_count) {
+            /* No more chunks */
             pp_iter->current_pp_table = thsn_slice_make_empty();
             pp_iter->current_pp_value = thsn_pp_value_make_empty();
             return THSN_RESULT_SUCCESS;
         }
-        pp_iter->current_thread_context =
-            (ThsnThreadContext*)pp_iter->thread_contexts.data;
-        BAIL_ON_ERROR(thsn_slice_at_offset(pp_iter->thread_contexts,
-                                           sizeof(ThsnThreadContext), 0,
-                                           &pp_iter->thread_contexts));
+        ++pp_iter->chunk_no;
         if (point <
-            thsn_slice_end(pp_iter->current_thread_context->subbuffer_slice)) {
+            thsn_slice_end(
+                scheduler->chunks[pp_iter->chunk_no].subbuffer_slice)) {
             break;
         }
+        /* The main thread is past the chunk, its values aren't needed */
+        thsn_pp_take_chunk(scheduler, pp_iter->chunk_no);
     }
-    ThsnPreparseScenario results_offset =
-        in_string ? THSN_PP_STARTS_IN_STRING : THSN_PP_STARTS_NOT_IN_STRING;
-    /* We have new current_thread_conext here, wait for it */
-    thsn_pp_wait_for_completion(
-        &pp_iter->current_thread_context->parsing_results[results_offset]
-             .completed);
-    pp_iter->current_thread_context->pp_scenario = results_offset;
-    BAIL_WITH_INPUT_ERROR_UNLESS(
-        !pp_iter->current_thread_context->parsing_results[results_offset]
-             .failed);
-    pp_iter->current_pp_table =
-        pp_iter->current_thread_context->parsing_results[results_offset]
-            .pp_table;
-    if (thsn_slice_is_empty(pp_iter->current_pp_table)) {
-        pp_iter->current_pp_value = thsn_pp_value_make_empty();
-    } else {
+    pp_iter->current_pp_table = thsn_slice_make_empty();
+    pp_iter->current_pp_value = thsn_pp_value_make_empty();
+    if (thsn_pp_take_chunk(scheduler, pp_iter->chunk_no)) {
+        /* Parsing it here beats waiting for a worker to get to it */
+        return THSN_RESULT_SUCCESS;
+    }
+    ThsnChunkContext* const chunk = &scheduler->chunks[pp_iter->chunk_no];
+    thsn_pp_wait_for_completion(chunk);
+    BAIL_WITH_INPUT_ERROR_UNLESS(!chunk->failed);
+    pp_iter->current_pp_table = chunk->pp_table;
+    if (!thsn_slice_is_empty(pp_iter->current_pp_table)) {
         BAIL_ON_ERROR(THSN_SLICE_READ_VAR(pp_iter->current_pp_table,
                                           pp_iter->current_pp_value));
     }
     return THSN_RESULT_SUCCESS;
 }
 
-static ThsnResult thsn_pp_iter_str_token(ThsnPreparseIterator* /*mut*/ pp_iter,
-                                         ThsnSlice str_token_slice) {
-    return thsn_pp_iter_advance_to_char(
-        pp_iter, thsn_slice_end(str_token_slice) + 1, true);
-}
-
 static ThsnResult thsn_pp_iter_find_value_at(
     ThsnPreparseIterator* /*mut*/ pp_iter, const char* /*in*/ point,
     ThsnValueHandle* /*out*/ value_handle,
@@ -148,7 +200,7 @@ static ThsnResult thsn_pp_iter_find_value_at(
 
     *value_handle = thsn_value_handle_not_found();
     *inbuffer_value_size = 0;
-    BAIL_ON_ERROR(thsn_pp_iter_advance_to_char(pp_iter, point, false));
+    BAIL_ON_ERROR(thsn_pp_iter_advance_to_char(pp_iter, point));
     if (thsn_pp_value_is_empty(&pp_iter->current_pp_value)) {
         return THSN_RESULT_SUCCESS;
     }
@@ -157,8 +209,18 @@ static ThsnResult thsn_pp_iter_find_value_at(
             return THSN_RESULT_SUCCESS;
         }
         if (point == pp_iter->current_pp_value.inbuffer_slice.data) {
+            ThsnChunkContext* const chunk =
+                &pp_iter->scheduler->chunks[pp_iter->chunk_no];
+            if (chunk->segment_no == 0) {
+                if (pp_iter->segments_count == pp_iter->max_segments_count) {
+                    /* Out of segment numbers, the caller parses the value
+                     * from the input instead */
+                    return THSN_RESULT_SUCCESS;
+                }
+                chunk->segment_no = pp_iter->segments_count++;
+            }
             *value_handle = (ThsnValueHandle){
-                .segment_no = pp_iter->current_thread_context->chunk_no,
+                .segment_no = (uint16_t)chunk->segment_no,
                 pp_iter->current_pp_value.value_offset};
             *inbuffer_value_size =
                 pp_iter->current_pp_value.inbuffer_slice.size;
@@ -207,26 +269,35 @@ static void thsn_advance_after_end_of_string(ThsnSlice* /*mut*/ buffer_slice) {
 }
 
 static ThsnResult thsn_preparse_buffer(
-    ThsnSlice buffer_slice, ThsnOwningMutSlice* /*out*/ segment,
+    ThsnSlice buffer_slice, const ThsnAllocator* /*in*/ allocator,
+    ThsnArena* /*maybe mut*/ string_heap, ThsnOwningMutSlice* /*out*/ segment,
     ThsnOwningSlice* /*out*/ preparsed_table) {
     BAIL_ON_NULL_INPUT(segment);
     BAIL_ON_NULL_INPUT(preparsed_table);
 
-    ThsnVector preparsed_vector = thsn_vector_make_empty();
+    ThsnVector preparsed_vector =
+        thsn_vector_make_empty_with_allocator(allocator);
     BAIL_ON_ERROR(thsn_vector_allocate(&preparsed_vector, 1024));
+    ThsnStructuralIndex structural_index = thsn_structural_index_make();
     ThsnParserContext parser_context;
-    BAIL_ON_ERROR(thsn_parser_context_init(&parser_context));
+    if (thsn_parser_context_init(&parser_context, allocator,
+                                 buffer_slice.size) != THSN_RESULT_SUCCESS) {
+        thsn_vector_free(&preparsed_vector);
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    parser_context.string_heap = string_heap;
 #ifdef METRICS
     size_t total_preparsed = 0;
 #endif
-    /* CONSIDER: Single-pass scenario-switching walkthrough */
     while (true) {
         ThsnToken token;
         ThsnSlice token_slice;
         /* Tokenizing/parsing failures are ok since the buffer isn't
               expected to be well-formed */
         do {
-            GOTO_ON_ERROR(thsn_next_token(&buffer_slice, &token_slice, &token),
+            GOTO_ON_ERROR(thsn_next_token_indexed(&structural_index,
+                                                  &buffer_slice, &token_slice,
+                                                  &token),
                           success_cleanup);
             if (token == THSN_TOKEN_EOF) {
                 goto success_cleanup;
@@ -245,7 +316,9 @@ static ThsnResult thsn_preparse_buffer(
         while (!finished) {
             /* Tokenizing/parsing failures are ok since the buffer isn't
               expected to be well-formed */
-            GOTO_ON_ERROR(thsn_next_token(&buffer_slice, &token_slice, &token),
+            GOTO_ON_ERROR(thsn_next_token_indexed(&structural_index,
+                                                  &buffer_slice, &token_slice,
+                                                  &token),
                           success_cleanup);
             GOTO_ON_ERROR(thsn_parser_parse_next_token(&parser_context, token,
                                                        token_slice, &finished),
@@ -265,7 +338,12 @@ success_cleanup:
     fprintf(stderr, "Total preparsed %zu, skipped %zu\n", total_preparsed,
             buffer_slice.size);
 #endif
-    thsn_parser_context_finish(&parser_context, segment);
+    if (thsn_parser_context_finish(&parser_context, segment) !=
+            THSN_RESULT_SUCCESS ||
+        thsn_vector_shrink_to_fit(&preparsed_vector) != THSN_RESULT_SUCCESS) {
+        thsn_vector_free(&preparsed_vector);
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
     *preparsed_table = thsn_vector_as_slice(preparsed_vector);
     return THSN_RESULT_SUCCESS;
 error_cleanup:
@@ -274,70 +352,96 @@ error_cleanup:
     return THSN_RESULT_INPUT_ERROR;
 }
 
+/* Preparsed values are looked up by their exact position in the buffer, and
+ * parsing a value from its first token is deterministic, so a wrong guess
+ * about where the chunk starts only makes fewer of them match. */
+static void thsn_preparse_chunk(ThsnWorkerContext* /*mut*/ worker,
+                                ThsnChunkContext* /*mut*/ chunk) {
+    ThsnSlice subbuffer_slice = chunk->subbuffer_slice;
+    chunk->pp_scenario = thsn_speculate_starts_in_string(subbuffer_slice)
+                             ? THSN_PP_STARTS_IN_STRING
+                             : THSN_PP_STARTS_NOT_IN_STRING;
+    if (chunk->pp_scenario == THSN_PP_STARTS_IN_STRING) {
+        thsn_advance_after_end_of_string(&subbuffer_slice);
+    }
+    if (thsn_preparse_buffer(subbuffer_slice, worker->scheduler->allocator,
+                             worker->string_heap, &chunk->segment,
+                             &chunk->pp_table) != THSN_RESULT_SUCCESS) {
+        chunk->failed = true;
+    }
+    thsn_completion_signal(&chunk->completion);
+}
+
+/* The worker's own chunks first, in order, then the last chunks of the
+ * others, which they'd get to last. */
+static bool thsn_pp_next_chunk(ThsnWorkerContext* /*mut*/ worker,
+                               size_t* /*out*/ chunk_no) {
+    if (thsn_work_range_take_front(&worker->chunks, SIZE_MAX, chunk_no)) {
+        return true;
+    }
+    ThsnChunkScheduler* const scheduler = worker->scheduler;
+    const size_t worker_no = (size_t)(worker - scheduler->workers);
+    for (size_t i = 1; i < scheduler->workers_count; ++i) {
+        ThsnWorkerContext* const victim =
+            &scheduler->workers[(worker_no + i) % scheduler->workers_count];
+        if (thsn_work_range_steal_back(&victim->chunks, chunk_no)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static int thsn_preparse_thread(void* /*in*/ user_data) {
     if (user_data == NULL) {
         /* Oh well */
         return 0;
     }
 
-    ThsnThreadContext* thread_context = (ThsnThreadContext*)user_data;
-
-    ThsnSlice subbuffer_slice = thread_context->subbuffer_slice;
-    thsn_advance_after_end_of_string(&subbuffer_slice);
-    if (thsn_preparse_buffer(
-            subbuffer_slice,
-            &thread_context->parsing_results[THSN_PP_STARTS_IN_STRING].segment,
-            &thread_context->parsing_results[THSN_PP_STARTS_IN_STRING]
-                 .pp_table) != THSN_RESULT_SUCCESS) {
-        thread_context->parsing_results[THSN_PP_STARTS_IN_STRING].failed = true;
-    }
-    atomic_store_explicit(
-        &thread_context->parsing_results[THSN_PP_STARTS_IN_STRING].completed,
-        true, memory_order_release);
-
-    if (thsn_preparse_buffer(
-            thread_context->subbuffer_slice,
-            &thread_context->parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-                 .segment,
-            &thread_context->parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-                 .pp_table) != THSN_RESULT_SUCCESS) {
-        thread_context->parsing_results[THSN_PP_STARTS_NOT_IN_STRING].failed =
-            true;
+    ThsnWorkerContext* worker = (ThsnWorkerContext*)user_data;
+    size_t chunk_no;
+    while (thsn_pp_next_chunk(worker, &chunk_no)) {
+#ifdef METRICS
+        worker->scheduler->chunks[chunk_no].worker_no =
+            (size_t)(worker - worker->scheduler->workers);
+#endif
+        thsn_preparse_chunk(worker, &worker->scheduler->chunks[chunk_no]);
     }
-    atomic_store_explicit(
-        &thread_context->parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-             .completed,
-        true, memory_order_release);
+    thsn_completion_signal(&worker->completion);
 
     return 0;
 }
 
 static ThsnResult thsn_main_thread(ThsnSlice* /*mut*/ buffer_slice,
+                                   const ThsnAllocator* /*in*/ allocator,
+                                   ThsnArena* /*maybe mut*/ string_heap,
                                    ThsnOwningMutSlice* /*out*/ segment,
-                                   ThsnSlice preparse_thread_contexts) {
+                                   ThsnChunkScheduler* /*mut*/ scheduler,
+                                   size_t max_segments_count) {
     BAIL_ON_NULL_INPUT(buffer_slice);
     BAIL_ON_NULL_INPUT(segment);
     ThsnPreparseIterator pp_iter;
-    BAIL_ON_ERROR(thsn_pp_iter_init(&pp_iter, preparse_thread_contexts));
+    BAIL_ON_ERROR(thsn_pp_iter_init(&pp_iter, scheduler, max_segments_count));
+    ThsnStructuralIndex structural_index = thsn_structural_index_make();
     ThsnParserContext parser_context;
-    BAIL_ON_ERROR(thsn_parser_context_init(&parser_context));
+    /* Parts the other threads failed to preparse are parsed here as well */
+    BAIL_ON_ERROR(thsn_parser_context_init(&parser_context, allocator,
+                                           buffer_slice->size));
+    parser_context.string_heap = string_heap;
     ThsnToken token;
     ThsnSlice token_slice;
     bool finished = false;
 #ifdef METRICS
+    const size_t total_size = buffer_slice->size;
     size_t total_skipped = 0;
 #endif
     while (!finished) {
         ThsnValueHandle value_handle = thsn_value_handle_not_found();
         size_t inbuffer_value_size = 0;
 
-        GOTO_ON_ERROR(thsn_next_token(buffer_slice, &token_slice, &token),
+        GOTO_ON_ERROR(thsn_next_token_indexed(&structural_index, buffer_slice,
+                                              &token_slice, &token),
                       error_cleanup);
         switch (token) {
-            case THSN_TOKEN_STRING:
-                GOTO_ON_ERROR(thsn_pp_iter_str_token(&pp_iter, token_slice),
-                              error_cleanup);
-                break;
             case THSN_TOKEN_OPEN_BRACE:
             case THSN_TOKEN_OPEN_BRACKET:
                 GOTO_ON_ERROR(thsn_pp_iter_find_value_at(
@@ -370,7 +474,7 @@ static ThsnResult thsn_main_thread(ThsnSlice* /*mut*/ buffer_slice,
     BAIL_ON_ERROR(thsn_parser_context_finish(&parser_context, segment));
 #ifdef METRICS
     fprintf(stderr, "Total skipped %zu, total parsed %zu\n", total_skipped,
-            main_thread_context->buffer_slice.size - total_skipped);
+            total_size - buffer_slice->size - total_skipped);
 #endif
     return THSN_RESULT_SUCCESS;
 error_cleanup:
@@ -378,135 +482,273 @@ error_cleanup:
     return THSN_RESULT_INPUT_ERROR;
 }
 
-ThsnResult thsn_document_parse_multithreaded(ThsnSlice* /*mut*/ json_str_slice,
-                                             ThsnDocument** /*out*/ document,
-                                             size_t threads_count) {
-    BAIL_ON_NULL_INPUT(json_str_slice);
-    BAIL_ON_NULL_INPUT(document);
-    BAIL_WITH_INPUT_ERROR_UNLESS(threads_count > 0);
-    size_t threads_created = 0;
-    static const size_t MIN_THREAD_SLICE_SIZE = 1024;
-    if (json_str_slice->size / MIN_THREAD_SLICE_SIZE < threads_count) {
-        threads_count = json_str_slice->size / MIN_THREAD_SLICE_SIZE;
-        threads_count = threads_count == 0 ? 1 : threads_count;
+static ThsnResult thsn_pp_scheduler_init(ThsnChunkScheduler* /*out*/ scheduler,
+                                         const ThsnAllocator* /*in*/ allocator,
+                                         ThsnSlice json_str_slice,
+                                         size_t chunks_count,
+                                         size_t workers_count,
+                                         bool copy_strings) {
+    *scheduler = (ThsnChunkScheduler){.allocator = allocator,
+                                      .chunks_count = chunks_count,
+                                      .workers_count = workers_count};
+    scheduler->chunks = thsn_allocate_zeroed(
+        allocator, sizeof(ThsnChunkContext) * chunks_count);
+    BAIL_ON_ALLOC_FAILURE(scheduler->chunks);
+    if (workers_count > 0) {
+        scheduler->workers = thsn_allocate_zeroed(
+            allocator, sizeof(ThsnWorkerContext) * workers_count);
+        BAIL_ON_ALLOC_FAILURE(scheduler->workers);
+    }
+    /* The main thread's chunk gets the remainder */
+    const size_t chunk_size = json_str_slice.size / chunks_count;
+    size_t chunk_offset = json_str_slice.size - chunk_size * (chunks_count - 1);
+    scheduler->chunks[0].subbuffer_slice =
+        thsn_slice_make(json_str_slice.data, chunk_offset);
+    for (size_t i = 1; i < chunks_count; ++i) {
+        scheduler->chunks[i].subbuffer_slice =
+            thsn_slice_make(json_str_slice.data + chunk_offset, chunk_size);
+        chunk_offset += chunk_size;
     }
 #ifdef METRICS
-    fprintf(stderr, "Effective threads_count %zu\n", threads_count);
-#endif
-    BAIL_ON_ERROR(thsn_document_allocate(document, threads_count));
-    ThsnThreadContext* thread_contexts =
-        calloc(1, sizeof(ThsnThreadContext) * threads_count);
-    size_t subbuffer_size = json_str_slice->size / threads_count;
-    size_t current_offset =
-        json_str_slice->size - subbuffer_size * (threads_count - 1);
-    GOTO_ON_ERROR(thsn_slice_at_offset(*json_str_slice, 0, current_offset,
-                                       &thread_contexts[0].subbuffer_slice),
-                  error_cleanup);
-    GOTO_ON_ERROR(thsn_slice_truncate(&thread_contexts[0].subbuffer_slice,
-                                      current_offset),
-                  error_cleanup);
-#ifdef METRICS
-    fprintf(stderr, "Thread 0: buffer size %zu\n", current_offset);
+    for (size_t i = 0; i < chunks_count; ++i) {
+        scheduler->chunks[i].worker_no = SIZE_MAX;
+    }
 #endif
-    for (size_t i = 1; i < threads_count; ++i) {
-        thread_contexts[i] = (ThsnThreadContext){0};
-        thread_contexts[i].chunk_no = i;
-        const size_t buffer_left = json_str_slice->size - current_offset;
-        if (buffer_left == 0) {
-            break;
-        } else if (buffer_left <= subbuffer_size) {
-            subbuffer_size = buffer_left;
+    for (size_t i = 0; i < workers_count; ++i) {
+        ThsnWorkerContext* const worker = &scheduler->workers[i];
+        const size_t begin = 1 + (chunks_count - 1) * i / workers_count;
+        const size_t end = 1 + (chunks_count - 1) * (i + 1) / workers_count;
+        thsn_work_range_init(&worker->chunks, begin, end);
+        worker->scheduler = scheduler;
+        for (size_t chunk_no = begin; chunk_no < end; ++chunk_no) {
+            scheduler->chunks[chunk_no].home_worker_no = i;
         }
-#ifdef METRICS
-        fprintf(stderr, "Thread %zu: buffer size %zu\n", i, subbuffer_size);
-#endif
-        GOTO_ON_ERROR(thsn_slice_at_offset(*json_str_slice, current_offset,
-                                           subbuffer_size,
-                                           &thread_contexts[i].subbuffer_slice),
-                      error_cleanup);
-        GOTO_ON_ERROR(thsn_slice_truncate(&thread_contexts[i].subbuffer_slice,
-                                          subbuffer_size),
-                      error_cleanup);
-        thrd_t thread;
-        if (thrd_create(&thread, thsn_preparse_thread, &thread_contexts[i]) !=
-            thrd_success) {
-            goto error_cleanup;
+    }
+    for (; scheduler->chunks_ready < chunks_count; ++scheduler->chunks_ready) {
+        BAIL_ON_ERROR(thsn_completion_init(
+            &scheduler->chunks[scheduler->chunks_ready].completion));
+    }
+    for (; scheduler->workers_ready < workers_count;
+         ++scheduler->workers_ready) {
+        ThsnWorkerContext* const worker =
+            &scheduler->workers[scheduler->workers_ready];
+        BAIL_ON_ERROR(thsn_completion_init(&worker->completion));
+        /* Each worker copies strings to a heap of its own, merged into the
+           document's arena once it's done */
+        if (copy_strings &&
+            thsn_arena_create(allocator, &worker->string_heap) !=
+                THSN_RESULT_SUCCESS) {
+            thsn_completion_destroy(&worker->completion);
+            return THSN_RESULT_OUT_OF_MEMORY_ERROR;
         }
-        ++threads_created;
-        if (thrd_detach(thread) != thrd_success) {
-            goto error_cleanup;
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Waits for the `workers_started` first workers to stop, after they finish
+ * the chunks they're at. Segments of the chunks the main thread took values
+ * from are moved to the document, unless it's NULL, the rest are freed. */
+static void thsn_pp_scheduler_destroy(ThsnChunkScheduler* /*mut*/ scheduler,
+                                      size_t workers_started,
+                                      ThsnDocument* /*maybe mut*/ document) {
+    const ThsnAllocator* const allocator = scheduler->allocator;
+    for (size_t i = 0; i < scheduler->workers_ready; ++i) {
+        thsn_work_range_clear(&scheduler->workers[i].chunks);
+    }
+    for (size_t i = 0; i < workers_started; ++i) {
+        thsn_completion_wait(&scheduler->workers[i].completion, NULL);
+    }
+    size_t segments_count = 1;
+    for (size_t i = 0; i < scheduler->chunks_ready; ++i) {
+        ThsnChunkContext* const chunk = &scheduler->chunks[i];
+        thsn_pp_chunk_context_destroy(chunk, i);
+        thsn_free(allocator, (void*)chunk->pp_table.data,
+                  chunk->pp_table.size);
+        if (document != NULL && chunk->segment_no != 0) {
+            document->segments[chunk->segment_no] = chunk->segment;
+            ++segments_count;
+        } else {
+            thsn_free(allocator, chunk->segment.data, chunk->segment.size);
         }
-        current_offset += subbuffer_size;
+    }
+    if (document != NULL) {
+        document->segment_count = segments_count;
+    }
+    for (size_t i = 0; i < scheduler->workers_ready; ++i) {
+        ThsnWorkerContext* const worker = &scheduler->workers[i];
+        thsn_completion_destroy(&worker->completion);
+        if (document != NULL && document->arena != NULL) {
+            thsn_arena_merge(document->arena, &worker->string_heap);
+        } else {
+            thsn_arena_free(&worker->string_heap);
+        }
+    }
+    thsn_free(allocator, scheduler->chunks,
+              sizeof(ThsnChunkContext) * scheduler->chunks_count);
+    thsn_free(allocator, scheduler->workers,
+              sizeof(ThsnWorkerContext) * scheduler->workers_count);
+}
+
+static ThsnResult thsn_document_parse_in_thread_pool(
+    ThsnThreadPool* /*mut*/ thread_pool,
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
+    size_t threads_count, bool copy_strings, size_t max_segments_count) {
+    BAIL_ON_NULL_INPUT(thread_pool);
+    BAIL_ON_NULL_INPUT(json_str_slice);
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_WITH_INPUT_ERROR_UNLESS(threads_count > 0 &&
+                                 threads_count <=
+                                     thread_pool->workers_count + 1);
+    BAIL_WITH_INPUT_ERROR_UNLESS(max_segments_count > 0 &&
+                                 max_segments_count <=
+                                     THSN_MAX_SEGMENTS_COUNT);
+    const size_t chunks_count =
+        thsn_effective_chunks_count(json_str_slice->size, threads_count);
+    /* The main thread parses the values of the chunks past the last segment
+     * number itself */
+    if (max_segments_count > chunks_count) {
+        max_segments_count = chunks_count;
+    }
+#ifdef METRICS
+    fprintf(stderr, "Effective threads_count %zu, chunks_count %zu\n",
+            threads_count, chunks_count);
+#endif
+    BAIL_ON_ERROR(
+        thsn_document_allocate(document, allocator, max_segments_count));
+    /* Everything is allocated with the document's copy of the allocator */
+    allocator = &(*document)->allocator;
+    ThsnChunkScheduler scheduler;
+    ThsnResult result =
+        thsn_pp_scheduler_init(&scheduler, allocator, *json_str_slice,
+                               chunks_count, threads_count - 1, copy_strings);
+    if (result == THSN_RESULT_SUCCESS && copy_strings) {
+        result = thsn_arena_create(allocator, &(*document)->arena);
+    }
+    size_t workers_started = 0;
+    for (size_t i = 0;
+         result == THSN_RESULT_SUCCESS && i < scheduler.workers_count; ++i) {
+        result = thsn_thread_pool_submit(thread_pool, thsn_preparse_thread,
+                                         &scheduler.workers[i]);
+        workers_started += result == THSN_RESULT_SUCCESS;
     }
     ThsnOwningMutSlice segment;
-    GOTO_ON_ERROR(thsn_main_thread(json_str_slice, &segment,
-                                   thsn_slice_make((const char*)thread_contexts,
-                                                   sizeof(ThsnThreadContext) *
-                                                       threads_count)),
-                  error_cleanup);
+    if (result == THSN_RESULT_SUCCESS) {
+        result = thsn_main_thread(json_str_slice, allocator,
+                                  (*document)->arena, &segment, &scheduler,
+                                  max_segments_count);
+    }
+    if (result != THSN_RESULT_SUCCESS) {
+        thsn_pp_scheduler_destroy(&scheduler, workers_started, NULL);
+        thsn_document_free(document);
+        return result;
+    }
     /* Fill in results */
     (*document)->segments[0] = segment;
-    for (size_t i = 1; i < (*document)->segment_count; ++i) {
-        thsn_pp_wait_for_completion(
-            &thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-                 .completed);
-        thsn_pp_wait_for_completion(
-            &thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_IN_STRING]
-                 .completed);
-        if (thread_contexts[i].pp_scenario == THSN_PP_STARTS_IN_STRING) {
-            (*document)->segments[i] =
-                thread_contexts[i]
-                    .parsing_results[THSN_PP_STARTS_IN_STRING]
-                    .segment;
-            free(thread_contexts[i]
-                     .parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-                     .segment.data);
-        } else {
-            (*document)->segments[i] =
-                thread_contexts[i]
-                    .parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-                    .segment;
-            free(thread_contexts[i]
-                     .parsing_results[THSN_PP_STARTS_IN_STRING]
-                     .segment.data);
-        }
-        free((void*)thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_IN_STRING]
-                 .pp_table.data);
-        free((void*)thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-                 .pp_table.data);
-    }
-    free(thread_contexts);
+    (*document)->segment_capacity = segment.size;
+    thsn_pp_scheduler_destroy(&scheduler, workers_started, *document);
     return THSN_RESULT_SUCCESS;
-error_cleanup:
-    for (size_t i = 1; i < threads_created + 1; ++i) {
-        /* The main thread can fail before the other threads finish,
-           so make sure they did. */
-        thsn_pp_wait_for_completion(
-            &thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-                 .completed);
-        free(thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-                 .segment.data);
-        free((void*)thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_NOT_IN_STRING]
-                 .pp_table.data);
-        thsn_pp_wait_for_completion(
-            &thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_IN_STRING]
-                 .completed);
-        free(thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_IN_STRING]
-                 .segment.data);
-        free((void*)thread_contexts[i]
-                 .parsing_results[THSN_PP_STARTS_IN_STRING]
-                 .pp_table.data);
-    }
-    free(thread_contexts);
-    thsn_document_free(document);
-    return THSN_RESULT_INPUT_ERROR;
+}
+
+ThsnResult thsn_document_parse_in_threads(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
+    size_t threads_count, bool copy_strings, size_t max_segments_count) {
+    BAIL_ON_NULL_INPUT(json_str_slice);
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_WITH_INPUT_ERROR_UNLESS(threads_count > 0);
+    threads_count =
+        thsn_effective_threads_count(json_str_slice->size, threads_count);
+    ThsnThreadPool thread_pool;
+    BAIL_ON_ERROR(thsn_thread_pool_init(&thread_pool, threads_count - 1));
+    const ThsnResult parse_result =
+        thsn_document_parse_in_thread_pool(&thread_pool, allocator,
+                                           json_str_slice, document,
+                                           threads_count, copy_strings,
+                                           max_segments_count);
+    thsn_thread_pool_destroy(&thread_pool);
+    return parse_result;
+}
+
+ThsnResult thsn_document_parse_multithreaded_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
+    size_t threads_count) {
+    return thsn_document_parse_in_threads(allocator, json_str_slice, document,
+                                          threads_count, false,
+                                          THSN_MAX_SEGMENTS_COUNT);
+}
+
+ThsnResult thsn_document_parse_multithreaded(ThsnSlice* /*mut*/ json_str_slice,
+                                             ThsnDocument** /*out*/ document,
+                                             size_t threads_count) {
+    return thsn_document_parse_multithreaded_with_allocator(
+        NULL, json_str_slice, document, threads_count);
+}
+
+ThsnResult thsn_document_parse_self_contained_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
+    size_t threads_count) {
+    BAIL_WITH_INPUT_ERROR_UNLESS(threads_count > 0);
+    if (threads_count == 1) {
+        return thsn_document_parse_single_threaded(allocator, json_str_slice,
+                                                   document, true);
+    }
+    return thsn_document_parse_in_threads(allocator, json_str_slice, document,
+                                          threads_count, true,
+                                          THSN_MAX_SEGMENTS_COUNT);
+}
+
+ThsnResult thsn_document_parse_self_contained(
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document,
+    size_t threads_count) {
+    return thsn_document_parse_self_contained_with_allocator(
+        NULL, json_str_slice, document, threads_count);
+}
+
+ThsnResult thsn_parser_pool_create(size_t threads_count,
+                                   ThsnParserPool** /*out*/ pool) {
+    BAIL_ON_NULL_INPUT(pool);
+    BAIL_WITH_INPUT_ERROR_UNLESS(threads_count > 0);
+    *pool = calloc(1, sizeof(ThsnParserPool));
+    BAIL_ON_ALLOC_FAILURE(*pool);
+    const ThsnResult init_result =
+        thsn_thread_pool_init(&(*pool)->thread_pool, threads_count - 1);
+    if (init_result != THSN_RESULT_SUCCESS) {
+        free(*pool);
+        *pool = NULL;
+        return init_result;
+    }
+    (*pool)->threads_count = threads_count;
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_parser_pool_free(ThsnParserPool** /*in*/ pool) {
+    BAIL_ON_NULL_INPUT(pool);
+    BAIL_ON_NULL_INPUT(*pool);
+    thsn_thread_pool_destroy(&(*pool)->thread_pool);
+    free(*pool);
+    *pool = NULL;
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_document_parse_with_pool_and_allocator(
+    ThsnParserPool* /*mut*/ pool, const ThsnAllocator* /*maybe in*/ allocator,
+    ThsnSlice* /*mut*/ json_str_slice, ThsnDocument** /*out*/ document) {
+    BAIL_ON_NULL_INPUT(pool);
+    BAIL_ON_NULL_INPUT(json_str_slice);
+    BAIL_ON_NULL_INPUT(document);
+    return thsn_document_parse_in_thread_pool(
+        &pool->thread_pool, allocator, json_str_slice, document,
+        thsn_effective_threads_count(json_str_slice->size,
+                                     pool->threads_count),
+        false, THSN_MAX_SEGMENTS_COUNT);
+}
+
+ThsnResult thsn_document_parse_with_pool(ThsnParserPool* /*mut*/ pool,
+                                         ThsnSlice* /*mut*/ json_str_slice,
+                                         ThsnDocument** /*out*/ document) {
+    return thsn_document_parse_with_pool_and_allocator(
+        pool, NULL, json_str_slice, document);
 }
@@ -0,0 +1,116 @@
+#include "path.h"
+
+#include <string.h>
+
+#include "allocator.h"
+#include "result.h"
+#include "segment.h"
+#include "slice.h"
+
+/* Array indexes are "0" or digits without leading zeros. Ones too large for
+ * any array are left as keys only. */
+static size_t thsn_path_token_index(ThsnSlice token_slice) {
+    if (token_slice.size == 0 ||
+        (token_slice.size > 1 && token_slice.data[0] == '0')) {
+        return SIZE_MAX;
+    }
+    size_t index = 0;
+    for (size_t i = 0; i < token_slice.size; ++i) {
+        const char c = token_slice.data[i];
+        if (c < '0' || c > '9' || index > (SIZE_MAX - 10) / 10) {
+            return SIZE_MAX;
+        }
+        index = index * 10 + (size_t)(c - '0');
+    }
+    return index;
+}
+
+/* Unescapes "~0" and "~1" into `key_data`, which has room for the token */
+static ThsnResult thsn_path_unescape_token(ThsnSlice token_slice,
+                                           char* /*out*/ key_data,
+                                           size_t* /*out*/ key_size) {
+    size_t size = 0;
+    char c;
+    while (thsn_slice_try_consume_char(&token_slice, &c)) {
+        if (c == '~') {
+            BAIL_WITH_INPUT_ERROR_UNLESS(
+                thsn_slice_try_consume_char(&token_slice, &c));
+            BAIL_WITH_INPUT_ERROR_UNLESS(c == '0' || c == '1');
+            c = c == '0' ? '~' : '/';
+        }
+        key_data[size++] = c;
+    }
+    *key_size = size;
+    return THSN_RESULT_SUCCESS;
+}
+
+static ThsnResult thsn_path_compile_steps(ThsnSlice path_slice,
+                                          ThsnPath* /*mut*/ path) {
+    char* key_data = (char*)&path->steps[path->steps_count];
+    for (size_t i = 0; i < path->steps_count; ++i) {
+        /* Skips the '/' */
+        thsn_slice_advance_unsafe(&path_slice, 1);
+        const char* const token_end = memchr(path_slice.data, '/',
+                                             path_slice.size);
+        const size_t token_size = token_end == NULL
+                                      ? path_slice.size
+                                      : (size_t)(token_end - path_slice.data);
+        const ThsnSlice token_slice =
+            thsn_slice_make(path_slice.data, token_size);
+        thsn_slice_advance_unsafe(&path_slice, token_size);
+        size_t key_size;
+        BAIL_ON_ERROR(
+            thsn_path_unescape_token(token_slice, key_data, &key_size));
+        const ThsnSlice key_slice = thsn_slice_make(key_data, key_size);
+        key_data += key_size;
+        path->steps[i] =
+            (ThsnPathStep){.key = key_slice,
+                           .key_hash = thsn_hash_key(key_slice),
+                           .index = thsn_path_token_index(token_slice)};
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_path_compile_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator, ThsnSlice path_slice,
+    ThsnPath** /*out*/ path) {
+    BAIL_ON_NULL_INPUT(path);
+    if (path_slice.size > 0) {
+        BAIL_ON_NULL_INPUT(path_slice.data);
+        BAIL_WITH_INPUT_ERROR_UNLESS(path_slice.data[0] == '/');
+    }
+    size_t steps_count = 0;
+    for (size_t i = 0; i < path_slice.size; ++i) {
+        steps_count += path_slice.data[i] == '/';
+    }
+    /* Unescaped keys are never longer than their tokens */
+    const size_t allocation_size = sizeof(ThsnPath) +
+                                   steps_count * sizeof(ThsnPathStep) +
+                                   path_slice.size;
+    *path = thsn_allocate(allocator, allocation_size);
+    BAIL_ON_ALLOC_FAILURE(*path);
+    (*path)->allocator =
+        allocator == NULL ? thsn_system_allocator() : *allocator;
+    (*path)->allocation_size = allocation_size;
+    (*path)->steps_count = steps_count;
+    const ThsnResult result = thsn_path_compile_steps(path_slice, *path);
+    if (result != THSN_RESULT_SUCCESS) {
+        thsn_path_free(path);
+    }
+    return result;
+}
+
+ThsnResult thsn_path_compile(ThsnSlice path_slice, ThsnPath** /*out*/ path) {
+    return thsn_path_compile_with_allocator(NULL, path_slice, path);
+}
+
+ThsnResult thsn_path_free(ThsnPath** /*in*/ path) {
+    BAIL_ON_NULL_INPUT(path);
+    if (*path == NULL) {
+        return THSN_RESULT_SUCCESS;
+    }
+    const ThsnAllocator allocator = (*path)->allocator;
+    thsn_free(&allocator, *path, (*path)->allocation_size);
+    *path = NULL;
+    return THSN_RESULT_SUCCESS;
+}
@@ -0,0 +1,25 @@
+#ifndef THSN_PATH_H
+#define THSN_PATH_H
+
+#include <stdint.h>
+
+#include "threason.h"
+
+/* One reference token of a JSON Pointer, unescaped */
+typedef struct {
+    ThsnSlice key;
+    /* `thsn_hash_key(key)` */
+    uint32_t key_hash;
+    /* `SIZE_MAX` unless the token is an array index */
+    size_t index;
+} ThsnPathStep;
+
+/* The keys are stored right after the steps, in the same allocation */
+struct ThsnPath {
+    ThsnAllocator allocator;
+    size_t allocation_size;
+    size_t steps_count;
+    ThsnPathStep steps[];
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "allocator.h"
+#include "arena.h"
+#include "parser.h"
+#include "result.h"
+#include "tokenizer.h"
+#include "vector.h"
+
+/* The incomplete token left from the previous chunk is completed by appending
+ * at least this many bytes of the next one, or as many as it already has. */
+#define THSN_PUSH_PARSER_MIN_CARRY_SIZE 64
+
+/* No literal is longer, so an invalid one this long isn't incomplete */
+#define THSN_MAX_LITERAL_SIZE 5
+
+struct ThsnPushParser {
+    ThsnAllocator allocator;
+    /* Created on the first feed, owns the arena copied strings go to */
+    ThsnDocument* document;
+    ThsnParserContext parser_context;
+    /* The token at the end of the last chunk, which may continue in the next
+     * one */
+    ThsnVector pending;
+    bool finished;
+    bool failed;
+};
+
+static ThsnResult thsn_push_parser_start(
+    ThsnPushParser* /*mut*/ push_parser) {
+    if (push_parser->document != NULL) {
+        return THSN_RESULT_SUCCESS;
+    }
+    BAIL_ON_ERROR(
+        thsn_document_create(&push_parser->allocator, &push_parser->document));
+    ThsnDocument* const document = push_parser->document;
+    if (thsn_arena_create(&document->allocator, &document->arena) !=
+            THSN_RESULT_SUCCESS ||
+        thsn_parser_context_init(&push_parser->parser_context,
+                                 &document->allocator,
+                                 0) != THSN_RESULT_SUCCESS) {
+        thsn_document_free(&push_parser->document);
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    /* The input size isn't known up front */
+    push_parser->parser_context.composite_tag_size = THSN_TAG_SIZE_INBOUND;
+    /* Chunks don't outlive the feed calls */
+    push_parser->parser_context.string_heap = document->arena;
+    push_parser->finished = false;
+    push_parser->failed = false;
+    return THSN_RESULT_SUCCESS;
+}
+
+static void thsn_push_parser_reset(ThsnPushParser* /*mut*/ push_parser) {
+    if (push_parser->document != NULL) {
+        thsn_parser_context_finish(&push_parser->parser_context, NULL);
+        thsn_document_free(&push_parser->document);
+    }
+    push_parser->pending.offset = 0;
+    push_parser->finished = false;
+    push_parser->failed = false;
+}
+
+static ThsnResult thsn_push_parser_parse_token(
+    ThsnPushParser* /*mut*/ push_parser, ThsnToken token,
+    ThsnSlice token_slice) {
+    if (push_parser->finished) {
+        /* Nothing but whitespace after the value */
+        BAIL_WITH_INPUT_ERROR_UNLESS(token == THSN_TOKEN_EOF);
+        return THSN_RESULT_SUCCESS;
+    }
+    return thsn_parser_parse_next_token(&push_parser->parser_context, token,
+                                        token_slice, &push_parser->finished);
+}
+
+/* Unclosed strings, numbers and invalid literals or numbers running up to the
+ * end of the buffer may continue in the next chunk. */
+static bool thsn_token_is_incomplete(ThsnResult token_result, ThsnToken token,
+                                     ThsnSlice token_slice,
+                                     ThsnSlice rest_slice,
+                                     const char* /*in*/ buffer_end) {
+    if (token_result != THSN_RESULT_SUCCESS) {
+        return thsn_slice_is_empty(rest_slice) ||
+               buffer_end - token_slice.data < THSN_MAX_LITERAL_SIZE;
+    }
+    return token == THSN_TOKEN_UNCLOSED_STRING ||
+           ((token == THSN_TOKEN_INT || token == THSN_TOKEN_FLOAT) &&
+            thsn_slice_end(token_slice) == buffer_end);
+}
+
+/* Unless it's the last buffer, the last token is left in `buffer_slice` if
+ * it's incomplete. */
+static ThsnResult thsn_push_parser_parse_buffer(
+    ThsnPushParser* /*mut*/ push_parser, ThsnSlice* /*mut*/ buffer_slice,
+    bool last_buffer) {
+    ThsnStructuralIndex structural_index = thsn_structural_index_make();
+    const char* const buffer_end = thsn_slice_end(*buffer_slice);
+    while (true) {
+        ThsnSlice rest_slice = *buffer_slice;
+        ThsnToken token = THSN_TOKEN_ERROR;
+        ThsnSlice token_slice = thsn_slice_make_empty();
+        const ThsnResult token_result = thsn_next_token_indexed(
+            &structural_index, &rest_slice, &token_slice, &token);
+        if (!last_buffer &&
+            thsn_token_is_incomplete(token_result, token, token_slice,
+                                     rest_slice, buffer_end)) {
+            /* Unclosed strings start after their opening quote */
+            const char* const token_start =
+                token == THSN_TOKEN_UNCLOSED_STRING ? token_slice.data - 1
+                                                    : token_slice.data;
+            thsn_slice_advance_unsafe(buffer_slice,
+                                      token_start - buffer_slice->data);
+            return THSN_RESULT_SUCCESS;
+        }
+        BAIL_ON_ERROR(token_result);
+        *buffer_slice = rest_slice;
+        if (token == THSN_TOKEN_EOF) {
+            return THSN_RESULT_SUCCESS;
+        }
+        BAIL_ON_ERROR(
+            thsn_push_parser_parse_token(push_parser, token, token_slice));
+    }
+}
+
+/* Appends the beginning of the chunk to the pending token until it's
+ * complete, so only the bytes around chunk boundaries get copied. Advances
+ * `chunk_slice` past the appended bytes parsed. */
+static ThsnResult thsn_push_parser_complete_pending(
+    ThsnPushParser* /*mut*/ push_parser, ThsnSlice* /*mut*/ chunk_slice) {
+    ThsnVector* const pending = &push_parser->pending;
+    /* The last `appended_size` bytes of `pending` are the chunk's first */
+    size_t appended_size = 0;
+    while (!thsn_vector_is_empty(*pending)) {
+        if (appended_size == chunk_slice->size) {
+            /* The whole chunk is a part of the pending token */
+            thsn_slice_advance_unsafe(chunk_slice, chunk_slice->size);
+            return THSN_RESULT_SUCCESS;
+        }
+        size_t append_size = thsn_vector_current_offset(*pending);
+        if (append_size < THSN_PUSH_PARSER_MIN_CARRY_SIZE) {
+            append_size = THSN_PUSH_PARSER_MIN_CARRY_SIZE;
+        }
+        if (append_size > chunk_slice->size - appended_size) {
+            append_size = chunk_slice->size - appended_size;
+        }
+        BAIL_ON_ERROR(thsn_vector_push(
+            pending,
+            thsn_slice_make(chunk_slice->data + appended_size, append_size)));
+        appended_size += append_size;
+        ThsnSlice pending_slice = thsn_vector_as_slice(*pending);
+        BAIL_ON_ERROR(thsn_push_parser_parse_buffer(push_parser,
+                                                    &pending_slice, false));
+        if (pending_slice.size <= appended_size) {
+            /* What's left, if anything, is in the chunk */
+            thsn_slice_advance_unsafe(chunk_slice,
+                                      appended_size - pending_slice.size);
+            pending->offset = 0;
+            return THSN_RESULT_SUCCESS;
+        }
+        memmove(pending->buffer, pending_slice.data, pending_slice.size);
+        pending->offset = pending_slice.size;
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+static ThsnResult thsn_push_parser_feed_chunk(
+    ThsnPushParser* /*mut*/ push_parser, ThsnSlice chunk_slice) {
+    BAIL_WITH_INPUT_ERROR_UNLESS(!push_parser->failed);
+    BAIL_ON_ERROR(thsn_push_parser_start(push_parser));
+    BAIL_ON_ERROR(thsn_push_parser_complete_pending(push_parser, &chunk_slice));
+    if (thsn_vector_is_empty(push_parser->pending)) {
+        BAIL_ON_ERROR(thsn_push_parser_parse_buffer(push_parser, &chunk_slice,
+                                                    false));
+    }
+    if (!thsn_slice_is_empty(chunk_slice)) {
+        BAIL_ON_ERROR(thsn_vector_push(&push_parser->pending, chunk_slice));
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_push_parser_create(const ThsnAllocator* /*maybe in*/ allocator,
+                                   ThsnPushParser** /*out*/ push_parser) {
+    BAIL_ON_NULL_INPUT(push_parser);
+    *push_parser = thsn_allocate_zeroed(allocator, sizeof(ThsnPushParser));
+    BAIL_ON_ALLOC_FAILURE(*push_parser);
+    (*push_parser)->allocator =
+        allocator == NULL ? thsn_system_allocator() : *allocator;
+    (*push_parser)->pending =
+        thsn_vector_make_empty_with_allocator(&(*push_parser)->allocator);
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_push_parser_free(ThsnPushParser** /*in*/ push_parser) {
+    BAIL_ON_NULL_INPUT(push_parser);
+    if (*push_parser == NULL) {
+        return THSN_RESULT_SUCCESS;
+    }
+    thsn_push_parser_reset(*push_parser);
+    thsn_vector_free(&(*push_parser)->pending);
+    const ThsnAllocator allocator = (*push_parser)->allocator;
+    thsn_free(&allocator, *push_parser, sizeof(ThsnPushParser));
+    *push_parser = NULL;
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_push_parser_feed(ThsnPushParser* /*mut*/ push_parser,
+                                 ThsnSlice chunk_slice) {
+    BAIL_ON_NULL_INPUT(push_parser);
+    if (chunk_slice.size > 0) {
+        BAIL_ON_NULL_INPUT(chunk_slice.data);
+    }
+    const ThsnResult result =
+        thsn_push_parser_feed_chunk(push_parser, chunk_slice);
+    if (result != THSN_RESULT_SUCCESS) {
+        push_parser->failed = true;
+    }
+    return result;
+}
+
+static ThsnResult thsn_push_parser_finish_document(
+    ThsnPushParser* /*mut*/ push_parser, ThsnDocument** /*out*/ document) {
+    BAIL_WITH_INPUT_ERROR_UNLESS(!push_parser->failed);
+    BAIL_ON_ERROR(thsn_push_parser_start(push_parser));
+    ThsnSlice pending_slice = thsn_vector_as_slice(push_parser->pending);
+    BAIL_ON_ERROR(
+        thsn_push_parser_parse_buffer(push_parser, &pending_slice, true));
+    BAIL_ON_ERROR(thsn_push_parser_parse_token(push_parser, THSN_TOKEN_EOF,
+                                               thsn_slice_make_empty()));
+    BAIL_WITH_INPUT_ERROR_UNLESS(push_parser->finished);
+    ThsnDocument* const finished_document = push_parser->document;
+    BAIL_ON_ERROR(thsn_parser_context_finish(&push_parser->parser_context,
+                                             &finished_document->segments[0]));
+    finished_document->segment_capacity = finished_document->segments[0].size;
+    push_parser->document = NULL;
+    *document = finished_document;
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_push_parser_finish(ThsnPushParser* /*mut*/ push_parser,
+                                   ThsnDocument** /*out*/ document) {
+    BAIL_ON_NULL_INPUT(push_parser);
+    BAIL_ON_NULL_INPUT(document);
+    const ThsnResult result =
+        thsn_push_parser_finish_document(push_parser, document);
+    thsn_push_parser_reset(push_parser);
+    return result;
+}
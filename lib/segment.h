@@ -1,11 +1,17 @@
 #ifndef THSN_SEGMENT_H
 #define THSN_SEGMENT_H
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#include "arena.h"
 #include "result.h"
 #include "slice.h"
+#include "structural.h"
 #include "threason.h"
+#include "unescape.h"
 #include "vector.h"
 
 typedef enum {
@@ -18,6 +24,15 @@ typedef enum {
     THSN_TAG_ARRAY,
     THSN_TAG_OBJECT,
     THSN_TAG_VALUE_HANDLE,
+    /* Only for integers above `LLONG_MAX`, the rest are `THSN_TAG_INT` */
+    THSN_TAG_UINT,
+    /* An array or object of a lazy document, followed by its slice of the
+     * input. Replaced with a `THSN_TAG_VALUE_HANDLE` once it's parsed. */
+    THSN_TAG_UNPARSED,
+    /* A string stored in the segment after its `size_t` size, as in
+     * snapshots, which can't point anywhere else. Escaped ones are followed
+     * by their decoded copy, stored the same way. */
+    THSN_TAG_INLINE_STRING,
 } ThsnTagType;
 
 typedef unsigned char ThsnTagSize;
@@ -33,9 +48,52 @@ typedef ThsnMutSlice ThsnSegmentMutSlice;
 #define THSN_TAG_SIZE_F64 0
 #define THSN_TAG_SIZE_MAX 0xf
 #define THSN_TAG_SIZE_INBOUND 1
-#define THSN_TAG_SIZE_INBOUND_SORTED 2
+/* A composite with 32-bit counts and offsets */
+#define THSN_TAG_SIZE_COMPACT 2
+/* A `THSN_TAG_REF_STRING` with escape sequences, followed by a slot for its
+ * decoded copy, or a `THSN_TAG_INLINE_STRING` followed by the copy itself */
+#define THSN_TAG_SIZE_ESCAPED 2
+/* Added to the size of objects with keys that have escape sequences */
+#define THSN_TAG_SIZE_ESCAPED_KEYS 4
 
-extern _Thread_local ThsnSlice* CURRENT_SEGMENT;
+/* Open addressing with linear probing, `kv_offset` is `SIZE_MAX` for empty
+ * entries. */
+typedef struct {
+    uint32_t key_hash;
+    uint32_t key_size;
+    size_t kv_offset;
+} ThsnObjectIndexEntry;
+
+/* Object headers end with slots for the data built on first access, both
+ * allocated in the document's arena. */
+typedef struct {
+    /* A sorted copy of the elements table */
+    const char* sorted_table;
+    ThsnObjectIndex* hash_index;
+} ThsnObjectCaches;
+
+typedef struct {
+    size_t elements_count;
+    size_t table_offset;
+    /* Size of the counts and offsets, `sizeof(uint32_t)` for compact
+     * composites */
+    size_t offset_size;
+    /* Offset of the `ThsnObjectCaches`, only for non-empty objects */
+    size_t caches_offset;
+    /* Whether some of the object's keys have escape sequences */
+    bool escaped_keys;
+} ThsnCompositeHeader;
+
+/* A segment takes less than 8 bytes per input byte, escaped strings in arrays
+ * being the worst case, so parsing up to this many bytes of input always
+ * produces segments addressable with 32-bit offsets. */
+#define THSN_COMPACT_SEGMENT_MAX_INPUT_SIZE ((size_t)UINT32_MAX / 16)
+
+struct ThsnObjectIndex {
+    /* Power of two, at least twice the number of keys */
+    size_t capacity;
+    ThsnObjectIndexEntry entries[];
+};
 
 static inline ThsnTag thsn_tag_make(ThsnTagType type, ThsnTagSize size) {
     return (ThsnTag)((type << 4) | (size & 0x0f));
@@ -49,6 +107,12 @@ static inline ThsnTagSize thsn_tag_size(ThsnTag tag) {
     return (ThsnTagSize)(tag & 0x0f);
 }
 
+static inline bool thsn_tag_is_escaped_string(ThsnTag tag) {
+    return (thsn_tag_type(tag) == THSN_TAG_REF_STRING ||
+            thsn_tag_type(tag) == THSN_TAG_INLINE_STRING) &&
+           thsn_tag_size(tag) == THSN_TAG_SIZE_ESCAPED;
+}
+
 static inline ThsnResult thsn_segment_store_tagged_value(
     ThsnSegment* /*mut*/ segment, ThsnTag tag, ThsnSlice value_slice) {
     BAIL_ON_NULL_INPUT(segment);
@@ -111,6 +175,21 @@ static inline ThsnResult thsn_segment_store_int(ThsnSegment* /*mut*/ segment,
         THSN_SLICE_FROM_VAR(value));
 }
 
+static inline ThsnResult thsn_segment_store_uint(ThsnSegment* /*mut*/ segment,
+                                                 unsigned long long value) {
+    if (value <= LLONG_MAX) {
+        return thsn_segment_store_int(segment, (long long)value);
+    }
+    const uint64_t uint64_value = value;
+    return thsn_segment_store_tagged_value(
+        segment, thsn_tag_make(THSN_TAG_UINT, sizeof(uint64_t)),
+        THSN_SLICE_FROM_VAR(uint64_value));
+}
+
+/* Handles of lazily parsed composites overwrite their unparsed slices */
+_Static_assert(sizeof(ThsnValueHandle) <= sizeof(uint64_t),
+               "value handles must fit into 8 bytes");
+
 static inline ThsnResult thsn_segment_store_value_handle(
     ThsnSegment* /*mut*/ segment, ThsnValueHandle value_handle) {
     return thsn_segment_store_tagged_value(
@@ -118,8 +197,22 @@ static inline ThsnResult thsn_segment_store_value_handle(
         THSN_SLICE_FROM_VAR(value_handle));
 }
 
+static inline ThsnResult thsn_segment_store_unparsed(
+    ThsnSegment* /*mut*/ segment, ThsnSlice composite_slice) {
+    return thsn_segment_store_tagged_value(
+        segment, thsn_tag_make(THSN_TAG_UNPARSED, THSN_TAG_SIZE_ZERO),
+        THSN_SLICE_FROM_VAR(composite_slice));
+}
+
 static inline ThsnResult thsn_segment_store_string(ThsnSegment* /*mut*/ segment,
                                                    ThsnSlice string_slice) {
+    if (thsn_find_char(string_slice, '\\') != NULL) {
+        const ThsnSlice escaped_string[2] = {string_slice,
+                                             thsn_slice_make_empty()};
+        return thsn_segment_store_tagged_value(
+            segment, thsn_tag_make(THSN_TAG_REF_STRING, THSN_TAG_SIZE_ESCAPED),
+            THSN_SLICE_FROM_VAR(escaped_string));
+    }
     if (string_slice.size <= THSN_TAG_SIZE_MAX) {
         return thsn_segment_store_tagged_value(
             segment, thsn_tag_make(THSN_TAG_SMALL_STRING, string_slice.size),
@@ -131,54 +224,172 @@ static inline ThsnResult thsn_segment_store_string(ThsnSegment* /*mut*/ segment,
     }
 }
 
+/* `decoded_slice` is only for strings with escapes, and stored after the
+ * string. */
+static inline ThsnResult thsn_segment_store_inline_string(
+    ThsnSegment* /*mut*/ segment, ThsnSlice string_slice,
+    const ThsnSlice* /*maybe in*/ decoded_slice) {
+    BAIL_ON_NULL_INPUT(segment);
+    const size_t size = string_slice.size;
+    size_t stored_size = sizeof(ThsnTag) + sizeof(size) + size;
+    if (decoded_slice != NULL) {
+        stored_size += sizeof(decoded_slice->size) + decoded_slice->size;
+    }
+    const ThsnTag tag = thsn_tag_make(
+        THSN_TAG_INLINE_STRING,
+        decoded_slice != NULL ? THSN_TAG_SIZE_ESCAPED : THSN_TAG_SIZE_INBOUND);
+    ThsnMutSlice allocated_data;
+    BAIL_ON_ERROR(thsn_vector_grow(segment, stored_size, &allocated_data));
+    BAIL_ON_ERROR(THSN_MUT_SLICE_WRITE_VAR(allocated_data, tag));
+    BAIL_ON_ERROR(THSN_MUT_SLICE_WRITE_VAR(allocated_data, size));
+    BAIL_ON_ERROR(thsn_mut_slice_write(&allocated_data, string_slice));
+    if (decoded_slice != NULL) {
+        BAIL_ON_ERROR(
+            THSN_MUT_SLICE_WRITE_VAR(allocated_data, decoded_slice->size));
+        BAIL_ON_ERROR(thsn_mut_slice_write(&allocated_data, *decoded_slice));
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Consumes the size and the data of an inline string */
+static inline ThsnResult thsn_slice_read_inline_string(
+    ThsnSlice* /*mut*/ slice, ThsnSlice* /*out*/ string_slice) {
+    size_t size;
+    BAIL_ON_ERROR(THSN_SLICE_READ_VAR(*slice, size));
+    BAIL_WITH_INPUT_ERROR_UNLESS(size <= slice->size);
+    *string_slice = thsn_slice_make(slice->data, size);
+    thsn_slice_advance_unsafe(slice, size);
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline size_t thsn_composite_offset_size(ThsnTag tag) {
+    return (thsn_tag_size(tag) & ~THSN_TAG_SIZE_ESCAPED_KEYS) ==
+                   THSN_TAG_SIZE_COMPACT
+               ? sizeof(uint32_t)
+               : sizeof(size_t);
+}
+
+static inline size_t thsn_composite_header_size(ThsnTag tag) {
+    return sizeof(ThsnTag) + 2 * thsn_composite_offset_size(tag) +
+           (thsn_tag_type(tag) == THSN_TAG_OBJECT ? sizeof(ThsnObjectCaches)
+                                                  : 0);
+}
+
+static inline ThsnResult thsn_mut_slice_write_offset(
+    ThsnMutSlice* /*mut*/ slice, size_t offset_size, size_t offset) {
+    if (offset_size == sizeof(uint32_t)) {
+        BAIL_WITH_INPUT_ERROR_UNLESS(offset <= UINT32_MAX);
+        const uint32_t compact_offset = (uint32_t)offset;
+        return THSN_MUT_SLICE_WRITE_VAR(*slice, compact_offset);
+    }
+    return THSN_MUT_SLICE_WRITE_VAR(*slice, offset);
+}
+
+static inline ThsnResult thsn_slice_read_offset(ThsnSlice* /*mut*/ slice,
+                                                size_t offset_size,
+                                                size_t* /*out*/ offset) {
+    if (offset_size == sizeof(uint32_t)) {
+        uint32_t compact_offset;
+        BAIL_ON_ERROR(THSN_SLICE_READ_VAR(*slice, compact_offset));
+        *offset = compact_offset;
+        return THSN_RESULT_SUCCESS;
+    }
+    return THSN_SLICE_READ_VAR(*slice, *offset);
+}
+
+/* The counts and offsets are filled in by
+ * `thsn_segment_store_composite_elements_table`. */
 static inline ThsnResult thsn_segment_store_composite_header(
-    ThsnSegment* /*mut*/ segment, ThsnTag tag, bool reserve_sorted_table_offset,
-    size_t* /*out*/ header_offset) {
+    ThsnSegment* /*mut*/ segment, ThsnTag tag, size_t* /*out*/ header_offset) {
     BAIL_ON_NULL_INPUT(segment);
     BAIL_ON_NULL_INPUT(header_offset);
-    const size_t composite_header_size =
-        sizeof(ThsnTag) +
-        (reserve_sorted_table_offset ? 3 : 2) * sizeof(size_t);
     size_t composite_header_offset = thsn_vector_current_offset(*segment);
     ThsnMutSlice composite_header_mut_slice;
-    BAIL_ON_ERROR(thsn_vector_grow(segment, composite_header_size,
+    BAIL_ON_ERROR(thsn_vector_grow(segment, thsn_composite_header_size(tag),
                                    &composite_header_mut_slice));
     BAIL_ON_ERROR(THSN_MUT_SLICE_WRITE_VAR(composite_header_mut_slice, tag));
     *header_offset = composite_header_offset;
     return THSN_RESULT_SUCCESS;
 }
 
+/* `elements_table` holds the `size_t` offsets of an object's elements, which
+ * start with their keys. */
+static inline ThsnResult thsn_segment_find_escaped_keys(
+    const ThsnSegment* /*in*/ segment, ThsnSlice elements_table,
+    bool* /*out*/ escaped_keys) {
+    BAIL_ON_NULL_INPUT(segment);
+    BAIL_ON_NULL_INPUT(escaped_keys);
+    *escaped_keys = false;
+    while (!thsn_slice_is_empty(elements_table) && !*escaped_keys) {
+        size_t kv_offset;
+        BAIL_ON_ERROR(THSN_SLICE_READ_VAR(elements_table, kv_offset));
+        ThsnSlice key_tag_slice;
+        ThsnTag key_tag;
+        BAIL_ON_ERROR(thsn_vector_slice_at_offset(
+            *segment, kv_offset, sizeof(ThsnTag), &key_tag_slice));
+        BAIL_ON_ERROR(THSN_SLICE_READ_VAR(key_tag_slice, key_tag));
+        *escaped_keys = thsn_tag_is_escaped_string(key_tag);
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+/* `elements_table` holds `size_t` offsets, they're narrowed for compact
+ * composites. Objects with escaped keys get `THSN_TAG_SIZE_ESCAPED_KEYS`
+ * added to their tag. */
 static inline ThsnResult thsn_segment_store_composite_elements_table(
     ThsnSegment* /*mut*/ segment, size_t composite_header_offset,
-    ThsnSlice elements_table, bool reserve_sorted_table) {
+    ThsnSlice elements_table) {
     BAIL_ON_NULL_INPUT(segment);
-    ThsnMutSlice elements_table_dst;
+    ThsnSlice tag_slice;
+    ThsnTag tag;
+    BAIL_ON_ERROR(thsn_vector_slice_at_offset(
+        *segment, composite_header_offset, sizeof(ThsnTag), &tag_slice));
+    BAIL_ON_ERROR(THSN_SLICE_READ_VAR(tag_slice, tag));
+    const size_t offset_size = thsn_composite_offset_size(tag);
+    const ThsnSlice element_offsets = elements_table;
     const size_t composite_elements_count =
         elements_table.size / sizeof(size_t);
     const size_t elements_offsets_table_offset =
         thsn_vector_current_offset(*segment);
-    BAIL_ON_ERROR(
-        thsn_vector_grow(segment, elements_table.size, &elements_table_dst));
-    BAIL_ON_ERROR(thsn_mut_slice_write(&elements_table_dst, elements_table));
-    size_t sorted_elements_offsets_table_offset =
-        thsn_vector_current_offset(*segment);
-    if (reserve_sorted_table) {
-        BAIL_ON_ERROR(thsn_vector_grow(segment, elements_table.size,
-                                       &elements_table_dst));
+    ThsnMutSlice elements_table_dst;
+    BAIL_ON_ERROR(thsn_vector_grow(segment,
+                                   composite_elements_count * offset_size,
+                                   &elements_table_dst));
+    if (offset_size == sizeof(size_t)) {
         BAIL_ON_ERROR(
             thsn_mut_slice_write(&elements_table_dst, elements_table));
+    } else {
+        while (!thsn_slice_is_empty(elements_table)) {
+            size_t element_offset;
+            BAIL_ON_ERROR(THSN_SLICE_READ_VAR(elements_table, element_offset));
+            BAIL_ON_ERROR(thsn_mut_slice_write_offset(
+                &elements_table_dst, offset_size, element_offset));
+        }
     }
     ThsnMutSlice composite_header;
     BAIL_ON_ERROR(thsn_vector_mut_slice_at_offset(
         *segment, composite_header_offset + sizeof(ThsnTag),
-        sizeof(size_t) * (reserve_sorted_table ? 3 : 2), &composite_header));
-    BAIL_ON_ERROR(
-        THSN_MUT_SLICE_WRITE_VAR(composite_header, composite_elements_count));
-    BAIL_ON_ERROR(THSN_MUT_SLICE_WRITE_VAR(composite_header,
-                                           elements_offsets_table_offset));
-    if (reserve_sorted_table) {
-        BAIL_ON_ERROR(THSN_MUT_SLICE_WRITE_VAR(
-            composite_header, sorted_elements_offsets_table_offset));
+        thsn_composite_header_size(tag) - sizeof(ThsnTag), &composite_header));
+    BAIL_ON_ERROR(thsn_mut_slice_write_offset(&composite_header, offset_size,
+                                              composite_elements_count));
+    BAIL_ON_ERROR(thsn_mut_slice_write_offset(&composite_header, offset_size,
+                                              elements_offsets_table_offset));
+    if (thsn_tag_type(tag) == THSN_TAG_OBJECT) {
+        const ThsnObjectCaches object_caches = {0};
+        BAIL_ON_ERROR(
+            THSN_MUT_SLICE_WRITE_VAR(composite_header, object_caches));
+        bool escaped_keys;
+        BAIL_ON_ERROR(thsn_segment_find_escaped_keys(
+            segment, element_offsets, &escaped_keys));
+        if (escaped_keys) {
+            ThsnMutSlice tag_dst;
+            BAIL_ON_ERROR(thsn_vector_mut_slice_at_offset(
+                *segment, composite_header_offset, sizeof(ThsnTag), &tag_dst));
+            tag = thsn_tag_make(
+                THSN_TAG_OBJECT,
+                thsn_tag_size(tag) | THSN_TAG_SIZE_ESCAPED_KEYS);
+            BAIL_ON_ERROR(THSN_MUT_SLICE_WRITE_VAR(tag_dst, tag));
+        }
     }
     return THSN_RESULT_SUCCESS;
 }
@@ -193,11 +404,21 @@ static inline ThsnResult thsn_segment_read_string_from_slice(
     *string_slice = thsn_slice_make_empty();
     switch (thsn_tag_type(key_str_tag)) {
         case THSN_TAG_REF_STRING:
-            BAIL_WITH_INPUT_ERROR_UNLESS(thsn_tag_size(key_str_tag) ==
-                                         THSN_TAG_SIZE_INBOUND);
             BAIL_ON_ERROR(THSN_SLICE_READ_VAR(slice, *string_slice));
-            if (stored_length != NULL) {
-                *stored_length = sizeof(ThsnTag) + sizeof(ThsnSlice);
+            switch (thsn_tag_size(key_str_tag)) {
+                case THSN_TAG_SIZE_INBOUND:
+                    if (stored_length != NULL) {
+                        *stored_length = sizeof(ThsnTag) + sizeof(ThsnSlice);
+                    }
+                    break;
+                case THSN_TAG_SIZE_ESCAPED:
+                    if (stored_length != NULL) {
+                        *stored_length =
+                            sizeof(ThsnTag) + 2 * sizeof(ThsnSlice);
+                    }
+                    break;
+                default:
+                    return THSN_RESULT_INPUT_ERROR;
             }
             break;
         case THSN_TAG_SMALL_STRING: {
@@ -209,46 +430,50 @@ static inline ThsnResult thsn_segment_read_string_from_slice(
             }
             break;
         }
+        case THSN_TAG_INLINE_STRING: {
+            const char* const payload = slice.data;
+            BAIL_ON_ERROR(thsn_slice_read_inline_string(&slice, string_slice));
+            switch (thsn_tag_size(key_str_tag)) {
+                case THSN_TAG_SIZE_INBOUND:
+                    break;
+                case THSN_TAG_SIZE_ESCAPED: {
+                    ThsnSlice decoded_slice;
+                    BAIL_ON_ERROR(
+                        thsn_slice_read_inline_string(&slice, &decoded_slice));
+                    break;
+                }
+                default:
+                    return THSN_RESULT_INPUT_ERROR;
+            }
+            if (stored_length != NULL) {
+                *stored_length =
+                    sizeof(ThsnTag) + (size_t)(slice.data - payload);
+            }
+            break;
+        }
         default:
             return THSN_RESULT_INPUT_ERROR;
     }
     return THSN_RESULT_SUCCESS;
 }
 
+/* Keys are read once before sorting, so the comparator needs no access to
+ * the segment and the sort is reentrant. */
+typedef struct {
+    ThsnSlice key;
+    size_t kv_offset;
+} ThsnSortedKv;
+
 static inline int thsn_compare_kv_keys(const void* a, const void* b) {
-    if (CURRENT_SEGMENT == NULL) {
-        return 0;
-    }
-    const ThsnSlice* result_slice = CURRENT_SEGMENT;
-    size_t a_offset;
-    size_t b_offset;
-    memcpy(&a_offset, a, sizeof(size_t));
-    memcpy(&b_offset, b, sizeof(size_t));
-    ThsnSlice a_key_slice;
-    ThsnSlice b_key_slice;
-    if (thsn_slice_at_offset(*result_slice, a_offset, 1, &a_key_slice) !=
-        THSN_RESULT_SUCCESS) {
-        return 0;
-    }
-    if (thsn_slice_at_offset(*result_slice, b_offset, 1, &b_key_slice) !=
-        THSN_RESULT_SUCCESS) {
-        return 0;
-    }
-    ThsnSlice a_key_str_slice;
-    ThsnSlice b_key_str_slice;
-    if (thsn_segment_read_string_from_slice(a_key_slice, &a_key_str_slice,
-                                            NULL)) {
-        return 0;
-    }
-    if (thsn_segment_read_string_from_slice(b_key_slice, &b_key_str_slice,
-                                            NULL)) {
-        return 0;
-    }
+    const ThsnSlice a_key_str_slice = ((const ThsnSortedKv*)a)->key;
+    const ThsnSlice b_key_str_slice = ((const ThsnSortedKv*)b)->key;
     const size_t min_len = a_key_str_slice.size < b_key_str_slice.size
                                ? a_key_str_slice.size
                                : b_key_str_slice.size;
     const int cmp_result =
-        memcmp(a_key_str_slice.data, b_key_str_slice.data, min_len);
+        min_len == 0
+            ? 0
+            : memcmp(a_key_str_slice.data, b_key_str_slice.data, min_len);
     if (cmp_result == 0) {
         if (a_key_str_slice.size == b_key_str_slice.size) {
             return 0;
@@ -263,10 +488,38 @@ static inline int thsn_compare_kv_keys(const void* a, const void* b) {
 }
 
 static inline ThsnResult thsn_segment_sort_elements_table(
-    ThsnMutSlice elements_table, ThsnSlice result_slice) {
-    CURRENT_SEGMENT = &result_slice;
-    qsort(elements_table.data, elements_table.size / sizeof(size_t),
-          sizeof(size_t), thsn_compare_kv_keys);
+    ThsnMutSlice elements_table, size_t offset_size, ThsnSlice result_slice) {
+    const size_t elements_count = elements_table.size / offset_size;
+    if (elements_count < 2) {
+        return THSN_RESULT_SUCCESS;
+    }
+    ThsnSortedKv* sorted_kvs = malloc(elements_count * sizeof(ThsnSortedKv));
+    BAIL_ON_ALLOC_FAILURE(sorted_kvs);
+    ThsnSlice table_slice = thsn_slice_from_mut_slice(elements_table);
+    for (size_t i = 0; i < elements_count; ++i) {
+        ThsnSlice kv_slice;
+        if (thsn_slice_read_offset(&table_slice, offset_size,
+                                   &sorted_kvs[i].kv_offset) !=
+                THSN_RESULT_SUCCESS ||
+            thsn_slice_at_offset(result_slice, sorted_kvs[i].kv_offset, 1,
+                                 &kv_slice) != THSN_RESULT_SUCCESS ||
+            thsn_segment_read_string_from_slice(kv_slice, &sorted_kvs[i].key,
+                                                NULL) != THSN_RESULT_SUCCESS) {
+            free(sorted_kvs);
+            return THSN_RESULT_INPUT_ERROR;
+        }
+    }
+    qsort(sorted_kvs, elements_count, sizeof(ThsnSortedKv),
+          thsn_compare_kv_keys);
+    for (size_t i = 0; i < elements_count; ++i) {
+        if (thsn_mut_slice_write_offset(&elements_table, offset_size,
+                                        sorted_kvs[i].kv_offset) !=
+            THSN_RESULT_SUCCESS) {
+            free(sorted_kvs);
+            return THSN_RESULT_INPUT_ERROR;
+        }
+    }
+    free(sorted_kvs);
     return THSN_RESULT_SUCCESS;
 }
 
@@ -281,15 +534,6 @@ static inline ThsnResult thsn_segment_read_tagged_value(
     return THSN_RESULT_SUCCESS;
 }
 
-static inline ThsnResult thsn_segment_update_tag(
-    ThsnSegmentMutSlice segment_mut_slice, size_t offset, ThsnTag tag) {
-    ThsnMutSlice tag_mut_slice;
-    BAIL_ON_ERROR(thsn_mut_slice_at_offset(segment_mut_slice, offset,
-                                           sizeof(ThsnTag), &tag_mut_slice));
-    BAIL_ON_ERROR(THSN_MUT_SLICE_WRITE_VAR(tag_mut_slice, tag));
-    return THSN_RESULT_SUCCESS;
-}
-
 static inline ThsnResult thsn_segment_read_bool(ThsnSegmentSlice segment_slice,
                                                 size_t offset,
                                                 bool* /*out*/ value) {
@@ -317,6 +561,51 @@ static inline ThsnResult thsn_segment_read_bool(ThsnSegmentSlice segment_slice,
     return THSN_RESULT_SUCCESS;
 }
 
+static inline ThsnResult thsn_segment_read_int_payload(
+    ThsnTag value_tag, ThsnSlice value_slice, int64_t* /*out*/ value) {
+    switch (thsn_tag_size(value_tag)) {
+        case THSN_TAG_SIZE_ZERO:
+            *value = 0;
+            break;
+        case sizeof(int8_t): {
+            int8_t int8_value;
+            BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, int8_value));
+            *value = int8_value;
+            break;
+        }
+        case sizeof(int16_t): {
+            int16_t int16_value;
+            BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, int16_value));
+            *value = int16_value;
+            break;
+        }
+        case sizeof(int32_t): {
+            int32_t int32_value;
+            BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, int32_value));
+            *value = int32_value;
+            break;
+        }
+        case sizeof(int64_t):
+            BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, *value));
+            break;
+        default:
+            return THSN_RESULT_INPUT_ERROR;
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline ThsnResult thsn_segment_read_uint_payload(
+    ThsnTag value_tag, ThsnSlice value_slice, uint64_t* /*out*/ value) {
+    BAIL_WITH_INPUT_ERROR_UNLESS(thsn_tag_size(value_tag) == sizeof(uint64_t));
+    return THSN_SLICE_READ_VAR(value_slice, *value);
+}
+
+static inline ThsnResult thsn_segment_read_double_payload(
+    ThsnTag value_tag, ThsnSlice value_slice, double* /*out*/ value) {
+    BAIL_WITH_INPUT_ERROR_UNLESS(thsn_tag_size(value_tag) == THSN_TAG_SIZE_F64);
+    return THSN_SLICE_READ_VAR(value_slice, *value);
+}
+
 static inline ThsnResult thsn_segment_read_number(
     ThsnSegmentSlice segment_slice, size_t offset, double* /*out*/ value) {
     BAIL_ON_NULL_INPUT(value);
@@ -326,52 +615,111 @@ static inline ThsnResult thsn_segment_read_number(
                                                  &value_tag, &value_slice));
     switch (thsn_tag_type(value_tag)) {
         case THSN_TAG_INT: {
-            switch (thsn_tag_size(value_tag)) {
-                case THSN_TAG_SIZE_ZERO:
-                    *value = 0;
-                    break;
-                case sizeof(int8_t): {
-                    int8_t int8_value;
-                    BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, int8_value));
-                    *value = (double)int8_value;
-                    break;
-                }
-                case sizeof(int16_t): {
-                    int16_t int16_value;
-                    BAIL_ON_ERROR(
-                        THSN_SLICE_READ_VAR(value_slice, int16_value));
-                    *value = (double)int16_value;
-                    break;
-                }
-                case sizeof(int32_t): {
-                    int32_t int32_value;
-                    BAIL_ON_ERROR(
-                        THSN_SLICE_READ_VAR(value_slice, int32_value));
-                    *value = (double)int32_value;
-                    break;
-                }
-                case sizeof(int64_t): {
-                    int64_t int64_value;
-                    BAIL_ON_ERROR(
-                        THSN_SLICE_READ_VAR(value_slice, int64_value));
-                    *value = (double)int64_value;
-                    break;
-                }
-                default:
-                    return THSN_RESULT_INPUT_ERROR;
-            }
-            break;
+            int64_t int64_value;
+            BAIL_ON_ERROR(thsn_segment_read_int_payload(value_tag, value_slice,
+                                                        &int64_value));
+            *value = (double)int64_value;
+            return THSN_RESULT_SUCCESS;
+        }
+        case THSN_TAG_UINT: {
+            uint64_t uint64_value;
+            BAIL_ON_ERROR(thsn_segment_read_uint_payload(value_tag, value_slice,
+                                                         &uint64_value));
+            *value = (double)uint64_value;
+            return THSN_RESULT_SUCCESS;
         }
+        case THSN_TAG_DOUBLE:
+            return thsn_segment_read_double_payload(value_tag, value_slice,
+                                                    value);
+        default:
+            return THSN_RESULT_INPUT_ERROR;
+    }
+}
+
+static inline ThsnResult thsn_segment_read_number_type(
+    ThsnSegmentSlice segment_slice, size_t offset,
+    ThsnNumberType* /*out*/ number_type) {
+    BAIL_ON_NULL_INPUT(number_type);
+    ThsnTag value_tag;
+    ThsnSlice value_slice;
+    BAIL_ON_ERROR(thsn_segment_read_tagged_value(segment_slice, offset,
+                                                 &value_tag, &value_slice));
+    switch (thsn_tag_type(value_tag)) {
+        case THSN_TAG_INT:
+            *number_type = THSN_NUMBER_INT;
+            return THSN_RESULT_SUCCESS;
+        case THSN_TAG_UINT:
+            *number_type = THSN_NUMBER_UINT;
+            return THSN_RESULT_SUCCESS;
+        case THSN_TAG_DOUBLE:
+            *number_type = THSN_NUMBER_DOUBLE;
+            return THSN_RESULT_SUCCESS;
+        default:
+            return THSN_RESULT_INPUT_ERROR;
+    }
+}
+
+/* Doubles are accepted only if they convert exactly. */
+static inline ThsnResult thsn_segment_read_int64(ThsnSegmentSlice segment_slice,
+                                                 size_t offset,
+                                                 int64_t* /*out*/ value) {
+    BAIL_ON_NULL_INPUT(value);
+    ThsnTag value_tag;
+    ThsnSlice value_slice;
+    BAIL_ON_ERROR(thsn_segment_read_tagged_value(segment_slice, offset,
+                                                 &value_tag, &value_slice));
+    switch (thsn_tag_type(value_tag)) {
+        case THSN_TAG_INT:
+            return thsn_segment_read_int_payload(value_tag, value_slice, value);
         case THSN_TAG_DOUBLE: {
-            BAIL_WITH_INPUT_ERROR_UNLESS(thsn_tag_size(value_tag) ==
-                                         THSN_TAG_SIZE_F64);
-            BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, *value));
-            break;
+            double double_value;
+            BAIL_ON_ERROR(thsn_segment_read_double_payload(
+                value_tag, value_slice, &double_value));
+            BAIL_WITH_INPUT_ERROR_UNLESS(
+                double_value >= -9223372036854775808.0 &&
+                double_value < 9223372036854775808.0 &&
+                (double)(int64_t)double_value == double_value);
+            *value = (int64_t)double_value;
+            return THSN_RESULT_SUCCESS;
+        }
+        default:
+            return THSN_RESULT_INPUT_ERROR;
+    }
+}
+
+/* Doubles are accepted only if they convert exactly. */
+static inline ThsnResult thsn_segment_read_uint64(
+    ThsnSegmentSlice segment_slice, size_t offset, uint64_t* /*out*/ value) {
+    BAIL_ON_NULL_INPUT(value);
+    ThsnTag value_tag;
+    ThsnSlice value_slice;
+    BAIL_ON_ERROR(thsn_segment_read_tagged_value(segment_slice, offset,
+                                                 &value_tag, &value_slice));
+    switch (thsn_tag_type(value_tag)) {
+        case THSN_TAG_INT: {
+            int64_t int64_value;
+            BAIL_ON_ERROR(thsn_segment_read_int_payload(value_tag, value_slice,
+                                                        &int64_value));
+            BAIL_WITH_INPUT_ERROR_UNLESS(int64_value >= 0);
+            *value = (uint64_t)int64_value;
+            return THSN_RESULT_SUCCESS;
+        }
+        case THSN_TAG_UINT:
+            return thsn_segment_read_uint_payload(value_tag, value_slice,
+                                                  value);
+        case THSN_TAG_DOUBLE: {
+            double double_value;
+            BAIL_ON_ERROR(thsn_segment_read_double_payload(
+                value_tag, value_slice, &double_value));
+            BAIL_WITH_INPUT_ERROR_UNLESS(
+                double_value >= 0.0 && double_value < 18446744073709551616.0 &&
+                (double)(uint64_t)double_value == double_value);
+            *value = (uint64_t)double_value;
+            return THSN_RESULT_SUCCESS;
         }
         default:
             return THSN_RESULT_INPUT_ERROR;
     }
-    return THSN_RESULT_SUCCESS;
 }
 
 static inline ThsnResult thsn_segment_read_string_ex(
@@ -385,71 +733,195 @@ static inline ThsnResult thsn_segment_read_string_ex(
                                                consumed_size);
 }
 
-static inline ThsnResult thsn_segment_read_composite(
-    ThsnSegmentMutSlice segment_slice, size_t offset, ThsnTagType expected_type,
-    ThsnSlice* /*out*/ elements_table, bool read_sorted_table) {
-    BAIL_ON_NULL_INPUT(elements_table);
+/* Reads the string decoded if it has no escapes or its decoded copy is at
+ * hand, without writing to the segment. Otherwise `*decoded` is false and
+ * the escaped string is read. */
+static inline ThsnResult thsn_segment_read_string_if_decoded(
+    ThsnSegmentSlice segment_slice, size_t offset,
+    ThsnSlice* /*out*/ string_slice, bool* /*out*/ decoded,
+    size_t* /*maybe out*/ stored_length) {
+    BAIL_ON_NULL_INPUT(string_slice);
+    BAIL_ON_NULL_INPUT(decoded);
     ThsnTag value_tag;
     ThsnSlice value_slice;
+    BAIL_ON_ERROR(thsn_segment_read_tagged_value(segment_slice, offset,
+                                                 &value_tag, &value_slice));
+    *decoded = true;
+    if (thsn_tag_size(value_tag) == THSN_TAG_SIZE_ESCAPED) {
+        switch (thsn_tag_type(value_tag)) {
+            case THSN_TAG_REF_STRING: {
+                ThsnSlice escaped_string[2];
+                BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, escaped_string));
+                *decoded = escaped_string[1].data != NULL;
+                *string_slice = escaped_string[*decoded ? 1 : 0];
+                if (stored_length != NULL) {
+                    *stored_length = sizeof(ThsnTag) + sizeof(escaped_string);
+                }
+                return THSN_RESULT_SUCCESS;
+            }
+            case THSN_TAG_INLINE_STRING:
+                /* The decoded copy follows the escaped string */
+                BAIL_ON_ERROR(
+                    thsn_slice_read_inline_string(&value_slice, string_slice));
+                BAIL_ON_ERROR(
+                    thsn_slice_read_inline_string(&value_slice, string_slice));
+                if (stored_length != NULL) {
+                    *stored_length = (size_t)(value_slice.data -
+                                              (segment_slice.data + offset));
+                }
+                return THSN_RESULT_SUCCESS;
+            default:
+                break;
+        }
+    }
+    return thsn_segment_read_string_ex(segment_slice, offset, string_slice,
+                                       stored_length);
+}
+
+/* Escaped strings are decoded into `arena` on first access, and the decoded
+ * copy is cached in the segment. */
+static inline ThsnResult thsn_segment_read_string_decoded(
+    ThsnSegmentMutSlice segment_slice, size_t offset,
+    ThsnArena** /*mut*/ arena, ThsnSlice* /*out*/ string_slice) {
+    BAIL_ON_NULL_INPUT(arena);
+    BAIL_ON_NULL_INPUT(string_slice);
+    bool decoded;
+    BAIL_ON_ERROR(thsn_segment_read_string_if_decoded(
+        thsn_slice_from_mut_slice(segment_slice), offset, string_slice,
+        &decoded, NULL));
+    if (decoded) {
+        return THSN_RESULT_SUCCESS;
+    }
+    /* Only escaped `THSN_TAG_REF_STRING`s have a slot to fill */
+    const ThsnSlice escaped_slice = *string_slice;
+    char* decoded_data;
+    size_t decoded_size;
     BAIL_ON_ERROR(
-        thsn_segment_read_tagged_value(thsn_slice_from_mut_slice(segment_slice),
-                                       offset, &value_tag, &value_slice));
+        thsn_arena_allocate(arena, escaped_slice.size, &decoded_data));
+    BAIL_ON_ERROR(
+        thsn_unescape_string(escaped_slice, decoded_data, &decoded_size));
+    *string_slice = thsn_slice_make(decoded_data, decoded_size);
+    memcpy(segment_slice.data + offset + sizeof(ThsnTag) + sizeof(ThsnSlice),
+           string_slice, sizeof(ThsnSlice));
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline ThsnResult thsn_segment_read_composite_header(
+    ThsnSegmentSlice segment_slice, size_t offset, ThsnTagType expected_type,
+    ThsnCompositeHeader* /*out*/ header) {
+    BAIL_ON_NULL_INPUT(header);
+    ThsnTag value_tag;
+    ThsnSlice value_slice;
+    BAIL_ON_ERROR(thsn_segment_read_tagged_value(segment_slice, offset,
+                                                 &value_tag, &value_slice));
     BAIL_WITH_INPUT_ERROR_UNLESS(thsn_tag_type(value_tag) == expected_type);
-    switch (thsn_tag_size(value_tag)) {
-        case THSN_TAG_SIZE_ZERO:
-            *elements_table = thsn_slice_make_empty();
-            break;
+    *header = (ThsnCompositeHeader){.offset_size = sizeof(size_t)};
+    header->escaped_keys = thsn_tag_type(value_tag) == THSN_TAG_OBJECT &&
+                           (thsn_tag_size(value_tag) &
+                            THSN_TAG_SIZE_ESCAPED_KEYS) != 0;
+    switch (thsn_tag_size(value_tag) & ~THSN_TAG_SIZE_ESCAPED_KEYS) {
+        case THSN_TAG_SIZE_EMPTY:
+            return THSN_RESULT_SUCCESS;
         case THSN_TAG_SIZE_INBOUND:
-        case THSN_TAG_SIZE_INBOUND_SORTED: {
-            size_t table_offset;
-            size_t table_len;
-            BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, table_len));
-            BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, table_offset));
-            if (read_sorted_table) {
-                BAIL_ON_ERROR(THSN_SLICE_READ_VAR(value_slice, table_offset));
-            }
-            const size_t table_size = table_len * sizeof(size_t);
-            BAIL_ON_ERROR(
-                thsn_slice_at_offset(thsn_slice_from_mut_slice(segment_slice),
-                                     table_offset, table_size, elements_table));
-            BAIL_ON_ERROR(thsn_slice_truncate(elements_table, table_size));
-            if (read_sorted_table &&
-                thsn_tag_size(value_tag) != THSN_TAG_SIZE_INBOUND_SORTED) {
-                BAIL_ON_ERROR(thsn_segment_sort_elements_table(
-                    thsn_mut_slice_make((char*)elements_table->data,
-                                        elements_table->size),
-                    thsn_slice_from_mut_slice(segment_slice)));
-                BAIL_ON_ERROR(thsn_segment_update_tag(
-                    segment_slice, offset,
-                    thsn_tag_make(expected_type,
-                                  THSN_TAG_SIZE_INBOUND_SORTED)));
-            }
-            break;
-        }
+        case THSN_TAG_SIZE_COMPACT:
+            header->offset_size = thsn_composite_offset_size(value_tag);
+            BAIL_ON_ERROR(thsn_slice_read_offset(
+                &value_slice, header->offset_size, &header->elements_count));
+            BAIL_ON_ERROR(thsn_slice_read_offset(
+                &value_slice, header->offset_size, &header->table_offset));
+            header->caches_offset =
+                offset + sizeof(ThsnTag) + 2 * header->offset_size;
+            return THSN_RESULT_SUCCESS;
         default:
             return THSN_RESULT_INPUT_ERROR;
     }
+}
+
+static inline ThsnResult thsn_segment_read_composite(
+    ThsnSegmentSlice segment_slice, size_t offset, ThsnTagType expected_type,
+    ThsnSlice* /*out*/ elements_table, size_t* /*out*/ offset_size) {
+    BAIL_ON_NULL_INPUT(elements_table);
+    BAIL_ON_NULL_INPUT(offset_size);
+    ThsnCompositeHeader header;
+    BAIL_ON_ERROR(thsn_segment_read_composite_header(
+        segment_slice, offset, expected_type, &header));
+    *offset_size = header.offset_size;
+    if (header.elements_count == 0) {
+        *elements_table = thsn_slice_make_empty();
+        return THSN_RESULT_SUCCESS;
+    }
+    const size_t table_size = header.elements_count * header.offset_size;
+    BAIL_ON_ERROR(thsn_slice_at_offset(segment_slice, header.table_offset,
+                                       table_size, elements_table));
+    BAIL_ON_ERROR(thsn_slice_truncate(elements_table, table_size));
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline ThsnResult thsn_segment_read_object_caches(
+    ThsnSegmentSlice segment_slice, ThsnCompositeHeader header,
+    ThsnObjectCaches* /*out*/ object_caches) {
+    ThsnSlice caches_slice;
+    BAIL_ON_ERROR(thsn_slice_at_offset(segment_slice, header.caches_offset,
+                                       sizeof(*object_caches), &caches_slice));
+    return THSN_SLICE_READ_VAR(caches_slice, *object_caches);
+}
+
+/* The sorted copy of the table is made on first access and cached in the
+ * object header. */
+static inline ThsnResult thsn_segment_read_object_sorted(
+    ThsnSegmentMutSlice segment_slice, size_t offset,
+    ThsnArena** /*mut*/ arena, ThsnSlice* /*out*/ sorted_elements_table,
+    size_t* /*out*/ offset_size) {
+    BAIL_ON_NULL_INPUT(sorted_elements_table);
+    BAIL_ON_ERROR(thsn_segment_read_composite(
+        thsn_slice_from_mut_slice(segment_slice), offset, THSN_TAG_OBJECT,
+        sorted_elements_table, offset_size));
+    if (sorted_elements_table->size <= *offset_size) {
+        return THSN_RESULT_SUCCESS;
+    }
+    ThsnCompositeHeader header;
+    ThsnObjectCaches object_caches;
+    BAIL_ON_ERROR(thsn_segment_read_composite_header(
+        thsn_slice_from_mut_slice(segment_slice), offset, THSN_TAG_OBJECT,
+        &header));
+    BAIL_ON_ERROR(thsn_segment_read_object_caches(
+        thsn_slice_from_mut_slice(segment_slice), header, &object_caches));
+    if (object_caches.sorted_table == NULL) {
+        char* sorted_table;
+        BAIL_ON_ERROR(thsn_arena_allocate(arena, sorted_elements_table->size,
+                                          &sorted_table));
+        memcpy(sorted_table, sorted_elements_table->data,
+               sorted_elements_table->size);
+        BAIL_ON_ERROR(thsn_segment_sort_elements_table(
+            thsn_mut_slice_make(sorted_table, sorted_elements_table->size),
+            *offset_size, thsn_slice_from_mut_slice(segment_slice)));
+        object_caches.sorted_table = sorted_table;
+        memcpy(segment_slice.data + header.caches_offset +
+                   offsetof(ThsnObjectCaches, sorted_table),
+               &object_caches.sorted_table, sizeof(const char*));
+    }
+    sorted_elements_table->data = object_caches.sorted_table;
     return THSN_RESULT_SUCCESS;
 }
 
 static inline ThsnResult thsn_segment_composite_index_element_offset(
-    ThsnSlice elements_table, size_t element_no,
+    ThsnSlice elements_table, size_t offset_size, size_t element_no,
     size_t* /*out*/ element_offset) {
     BAIL_ON_NULL_INPUT(element_offset);
     ThsnSlice element_handle_slice;
     BAIL_ON_ERROR(thsn_slice_at_offset(elements_table,
-                                       element_no * sizeof(size_t),
-                                       sizeof(size_t), &element_handle_slice));
-    BAIL_ON_ERROR(THSN_SLICE_READ_VAR(element_handle_slice, *element_offset));
-    return THSN_RESULT_SUCCESS;
+                                       element_no * offset_size, offset_size,
+                                       &element_handle_slice));
+    return thsn_slice_read_offset(&element_handle_slice, offset_size,
+                                  element_offset);
 }
 
 static inline ThsnResult thsn_segment_composite_consume_element_offset(
-    ThsnSlice* /*mut*/ elements_table, size_t* /*out*/ element_offset) {
+    ThsnSlice* /*mut*/ elements_table, size_t offset_size,
+    size_t* /*out*/ element_offset) {
     BAIL_ON_NULL_INPUT(elements_table);
     BAIL_ON_NULL_INPUT(element_offset);
-    BAIL_ON_ERROR(THSN_SLICE_READ_VAR(*elements_table, *element_offset));
-    return THSN_RESULT_SUCCESS;
+    return thsn_slice_read_offset(elements_table, offset_size, element_offset);
 }
 
 static inline ThsnResult thsn_segment_object_read_kv(
@@ -466,18 +938,18 @@ static inline ThsnResult thsn_segment_object_read_kv(
 
 static inline ThsnResult thsn_segment_object_index(
     ThsnSegmentSlice segment_slice, ThsnSlice sorted_elements_table,
-    ThsnSlice key_slice, size_t* /*out*/ element_offset, bool* /*out*/ found) {
+    size_t offset_size, ThsnSlice key_slice, size_t* /*out*/ element_offset,
+    bool* /*out*/ found) {
     BAIL_ON_NULL_INPUT(element_offset);
     BAIL_ON_NULL_INPUT(found);
     ThsnSlice element_key_slice = thsn_slice_make_empty();
     *found = false;
     while (!thsn_slice_is_empty(sorted_elements_table)) {
-        const size_t elements_count =
-            sorted_elements_table.size / sizeof(size_t);
+        const size_t elements_count = sorted_elements_table.size / offset_size;
         const size_t midpoint = elements_count / 2;
         size_t kv_offset;
         BAIL_ON_ERROR(thsn_segment_composite_index_element_offset(
-            sorted_elements_table, midpoint, &kv_offset));
+            sorted_elements_table, offset_size, midpoint, &kv_offset));
         BAIL_ON_ERROR(thsn_segment_object_read_kv(
             segment_slice, kv_offset, &element_key_slice, element_offset));
         const size_t min_len = key_slice.size < element_key_slice.size
@@ -494,15 +966,170 @@ static inline ThsnResult thsn_segment_object_index(
             return THSN_RESULT_SUCCESS;
         } else if (cmp_result < 0) {
             BAIL_ON_ERROR(thsn_slice_truncate(&sorted_elements_table,
-                                              midpoint * sizeof(size_t)));
+                                              midpoint * offset_size));
         } else {
             BAIL_ON_ERROR(thsn_slice_at_offset(
-                sorted_elements_table, (midpoint + 1) * sizeof(size_t),
-                (elements_count - midpoint - 1) * sizeof(size_t),
+                sorted_elements_table, (midpoint + 1) * offset_size,
+                (elements_count - midpoint - 1) * offset_size,
                 &sorted_elements_table));
         }
     }
     return THSN_RESULT_SUCCESS;
 }
 
+/* FNV-1a */
+static inline uint32_t thsn_hash_key(ThsnSlice key_slice) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < key_slice.size; ++i) {
+        hash ^= (unsigned char)key_slice.data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline ThsnResult thsn_segment_build_object_index(
+    ThsnSegmentSlice segment_slice, ThsnSlice elements_table,
+    size_t offset_size, ThsnArena** /*mut*/ arena,
+    ThsnObjectIndex** /*out*/ hash_index) {
+    BAIL_ON_NULL_INPUT(hash_index);
+    const size_t elements_count = elements_table.size / offset_size;
+    size_t capacity = 2;
+    while (capacity < elements_count * 2) {
+        capacity *= 2;
+    }
+    char* hash_index_data;
+    BAIL_ON_ERROR(thsn_arena_allocate_aligned(
+        arena,
+        sizeof(ThsnObjectIndex) + capacity * sizeof(ThsnObjectIndexEntry),
+        _Alignof(ThsnObjectIndex), &hash_index_data));
+    ThsnObjectIndex* const index = (ThsnObjectIndex*)hash_index_data;
+    index->capacity = capacity;
+    for (size_t i = 0; i < capacity; ++i) {
+        index->entries[i].kv_offset = SIZE_MAX;
+    }
+    while (!thsn_slice_is_empty(elements_table)) {
+        size_t kv_offset;
+        size_t element_offset;
+        ThsnSlice key_slice;
+        BAIL_ON_ERROR(thsn_segment_composite_consume_element_offset(
+            &elements_table, offset_size, &kv_offset));
+        BAIL_ON_ERROR(thsn_segment_object_read_kv(segment_slice, kv_offset,
+                                                  &key_slice, &element_offset));
+        const uint32_t key_hash = thsn_hash_key(key_slice);
+        size_t entry_no = key_hash & (capacity - 1);
+        while (index->entries[entry_no].kv_offset != SIZE_MAX) {
+            entry_no = (entry_no + 1) & (capacity - 1);
+        }
+        index->entries[entry_no] =
+            (ThsnObjectIndexEntry){.key_hash = key_hash,
+                                   .key_size = (uint32_t)key_slice.size,
+                                   .kv_offset = kv_offset};
+    }
+    *hash_index = index;
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Builds the index on first access and caches it in the object header. */
+static inline ThsnResult thsn_segment_read_object_index(
+    ThsnSegmentMutSlice segment_slice, size_t offset,
+    ThsnArena** /*mut*/ arena, const ThsnObjectIndex** /*out*/ hash_index) {
+    BAIL_ON_NULL_INPUT(hash_index);
+    ThsnCompositeHeader header;
+    BAIL_ON_ERROR(thsn_segment_read_composite_header(
+        thsn_slice_from_mut_slice(segment_slice), offset, THSN_TAG_OBJECT,
+        &header));
+    if (header.elements_count == 0) {
+        *hash_index = NULL;
+        return THSN_RESULT_SUCCESS;
+    }
+    ThsnObjectCaches object_caches;
+    BAIL_ON_ERROR(thsn_segment_read_object_caches(
+        thsn_slice_from_mut_slice(segment_slice), header, &object_caches));
+    if (object_caches.hash_index == NULL) {
+        ThsnSlice elements_table;
+        size_t offset_size;
+        BAIL_ON_ERROR(thsn_segment_read_composite(
+            thsn_slice_from_mut_slice(segment_slice), offset, THSN_TAG_OBJECT,
+            &elements_table, &offset_size));
+        BAIL_ON_ERROR(thsn_segment_build_object_index(
+            thsn_slice_from_mut_slice(segment_slice), elements_table,
+            offset_size, arena, &object_caches.hash_index));
+        memcpy(segment_slice.data + header.caches_offset +
+                   offsetof(ThsnObjectCaches, hash_index),
+               &object_caches.hash_index, sizeof(ThsnObjectIndex*));
+    }
+    *hash_index = object_caches.hash_index;
+    return THSN_RESULT_SUCCESS;
+}
+
+/* `key_hash` is `thsn_hash_key(key_slice)`, so keys looked up repeatedly can
+ * be hashed once. */
+static inline ThsnResult thsn_segment_object_index_lookup_hashed(
+    ThsnSegmentSlice segment_slice, const ThsnObjectIndex* /*in*/ hash_index,
+    ThsnSlice key_slice, uint32_t key_hash, size_t* /*out*/ element_offset,
+    bool* /*out*/ found) {
+    BAIL_ON_NULL_INPUT(hash_index);
+    BAIL_ON_NULL_INPUT(element_offset);
+    BAIL_ON_NULL_INPUT(found);
+    *found = false;
+    const size_t mask = hash_index->capacity - 1;
+    for (size_t entry_no = key_hash & mask;
+         hash_index->entries[entry_no].kv_offset != SIZE_MAX;
+         entry_no = (entry_no + 1) & mask) {
+        const ThsnObjectIndexEntry* const entry =
+            &hash_index->entries[entry_no];
+        if (entry->key_hash != key_hash ||
+            entry->key_size != (uint32_t)key_slice.size) {
+            continue;
+        }
+        ThsnSlice element_key_slice;
+        BAIL_ON_ERROR(thsn_segment_object_read_kv(
+            segment_slice, entry->kv_offset, &element_key_slice,
+            element_offset));
+        if (element_key_slice.size == key_slice.size &&
+            (key_slice.size == 0 ||
+             memcmp(element_key_slice.data, key_slice.data, key_slice.size) ==
+                 0)) {
+            *found = true;
+            return THSN_RESULT_SUCCESS;
+        }
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline ThsnResult thsn_segment_object_index_lookup(
+    ThsnSegmentSlice segment_slice, const ThsnObjectIndex* /*in*/ hash_index,
+    ThsnSlice key_slice, size_t* /*out*/ element_offset, bool* /*out*/ found) {
+    return thsn_segment_object_index_lookup_hashed(
+        segment_slice, hash_index, key_slice, thsn_hash_key(key_slice),
+        element_offset, found);
+}
+
+/* Goes through the elements in order, for objects with neither of the caches
+ * built. */
+static inline ThsnResult thsn_segment_object_scan(
+    ThsnSegmentSlice segment_slice, ThsnSlice elements_table,
+    size_t offset_size, ThsnSlice key_slice, size_t* /*out*/ element_offset,
+    bool* /*out*/ found) {
+    BAIL_ON_NULL_INPUT(element_offset);
+    BAIL_ON_NULL_INPUT(found);
+    *found = false;
+    while (!thsn_slice_is_empty(elements_table)) {
+        size_t kv_offset;
+        ThsnSlice element_key_slice;
+        BAIL_ON_ERROR(thsn_segment_composite_consume_element_offset(
+            &elements_table, offset_size, &kv_offset));
+        BAIL_ON_ERROR(thsn_segment_object_read_kv(
+            segment_slice, kv_offset, &element_key_slice, element_offset));
+        if (element_key_slice.size == key_slice.size &&
+            (key_slice.size == 0 ||
+             memcmp(element_key_slice.data, key_slice.data, key_slice.size) ==
+                 0)) {
+            *found = true;
+            return THSN_RESULT_SUCCESS;
+        }
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
 #endif
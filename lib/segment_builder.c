@@ -0,0 +1,282 @@
+#include "segment_builder.h"
+
+#include "document.h"
+#include "unescape.h"
+
+/* An array or object copied up to its remaining elements */
+typedef struct {
+    ThsnSlice elements_table;
+    size_t offset_size;
+    size_t elements_count;
+    /* Offset of the copy's header */
+    size_t header_offset;
+    uint16_t segment_no;
+    bool object;
+} ThsnSegmentBuilderFrame;
+
+void thsn_segment_builder_init(ThsnSegmentBuilder* /*out*/ builder,
+                               ThsnDocument* /*mut*/ document,
+                               const ThsnAllocator* /*maybe in*/ allocator,
+                               bool inline_strings) {
+    *builder = (ThsnSegmentBuilder){
+        .document = document,
+        .segment = thsn_vector_make_empty_with_allocator(allocator),
+        .composite_tag_size = THSN_TAG_SIZE_COMPACT,
+        .inline_strings = inline_strings,
+        .composites = thsn_vector_make_empty_with_allocator(allocator),
+        .element_offsets = thsn_vector_make_empty_with_allocator(allocator),
+        .stack = thsn_vector_make_empty_with_allocator(allocator),
+        .decoded = thsn_vector_make_empty_with_allocator(allocator),
+    };
+}
+
+void thsn_segment_builder_free(ThsnSegmentBuilder* /*mut*/ builder) {
+    thsn_vector_free(&builder->segment);
+    thsn_vector_free(&builder->composites);
+    thsn_vector_free(&builder->element_offsets);
+    thsn_vector_free(&builder->stack);
+    thsn_vector_free(&builder->decoded);
+}
+
+void thsn_segment_builder_reset(ThsnSegmentBuilder* /*mut*/ builder,
+                                ThsnTagSize composite_tag_size) {
+    builder->composite_tag_size = composite_tag_size;
+    builder->too_large = false;
+    builder->segment.offset = 0;
+    builder->composites.offset = 0;
+    builder->element_offsets.offset = 0;
+    builder->stack.offset = 0;
+}
+
+/* Strings pointing elsewhere stay valid as long as the document does, so
+ * unless they're to be inlined, strings are copied as they're stored. */
+static ThsnResult thsn_segment_builder_copy_string(
+    ThsnSegmentBuilder* /*mut*/ builder, ThsnSegmentSlice segment_slice,
+    size_t offset, size_t* /*maybe out*/ stored_size) {
+    ThsnTag value_tag;
+    ThsnSlice value_slice;
+    BAIL_ON_ERROR(thsn_segment_read_tagged_value(segment_slice, offset,
+                                                 &value_tag, &value_slice));
+    ThsnSlice string_slice;
+    size_t string_stored_size;
+    BAIL_ON_ERROR(thsn_segment_read_string_ex(
+        segment_slice, offset, &string_slice, &string_stored_size));
+    if (stored_size != NULL) {
+        *stored_size = string_stored_size;
+    }
+    if (!builder->inline_strings ||
+        thsn_tag_type(value_tag) == THSN_TAG_SMALL_STRING) {
+        BAIL_ON_ERROR(thsn_slice_truncate(
+            &value_slice, string_stored_size - sizeof(ThsnTag)));
+        return thsn_segment_store_tagged_value(&builder->segment, value_tag,
+                                               value_slice);
+    }
+    if (thsn_tag_size(value_tag) != THSN_TAG_SIZE_ESCAPED) {
+        return thsn_segment_store_inline_string(&builder->segment,
+                                                string_slice, NULL);
+    }
+    ThsnSlice decoded_slice;
+    bool decoded;
+    BAIL_ON_ERROR(thsn_segment_read_string_if_decoded(
+        segment_slice, offset, &decoded_slice, &decoded, NULL));
+    if (!decoded) {
+        ThsnVector* const decoded_string = &builder->decoded;
+        decoded_string->offset = 0;
+        BAIL_ON_ERROR(thsn_vector_reserve(decoded_string, string_slice.size));
+        BAIL_ON_ERROR(thsn_unescape_string(
+            string_slice, decoded_string->buffer, &decoded_string->offset));
+        decoded_slice = thsn_vector_as_slice(*decoded_string);
+    }
+    return thsn_segment_store_inline_string(&builder->segment, string_slice,
+                                            &decoded_slice);
+}
+
+/* Scalars are copied as they are. Arrays and objects with elements only get
+ * their header copied, and a frame for the elements to be copied from. */
+static ThsnResult thsn_segment_builder_copy_value(
+    ThsnSegmentBuilder* /*mut*/ builder, ThsnValueHandle value_handle) {
+    ThsnDocument* const document = builder->document;
+    BAIL_ON_ERROR(thsn_document_follow_handle(document, &value_handle));
+    const ThsnSegmentSlice segment_slice =
+        thsn_slice_from_mut_slice(document->segments[value_handle.segment_no]);
+    ThsnTag value_tag;
+    ThsnSlice value_slice;
+    BAIL_ON_ERROR(thsn_segment_read_tagged_value(
+        segment_slice, value_handle.offset, &value_tag, &value_slice));
+    size_t payload_size = 0;
+    switch (thsn_tag_type(value_tag)) {
+        case THSN_TAG_NULL:
+        case THSN_TAG_BOOL:
+            break;
+        case THSN_TAG_INT:
+            payload_size = thsn_tag_size(value_tag);
+            break;
+        case THSN_TAG_UINT:
+        case THSN_TAG_DOUBLE:
+            payload_size = sizeof(uint64_t);
+            break;
+        case THSN_TAG_SMALL_STRING:
+        case THSN_TAG_REF_STRING:
+        case THSN_TAG_INLINE_STRING:
+            return thsn_segment_builder_copy_string(
+                builder, segment_slice, value_handle.offset, NULL);
+        case THSN_TAG_ARRAY:
+        case THSN_TAG_OBJECT: {
+            ThsnSegmentBuilderFrame frame = {
+                .segment_no = value_handle.segment_no,
+                .object = thsn_tag_type(value_tag) == THSN_TAG_OBJECT};
+            BAIL_ON_ERROR(thsn_segment_read_composite(
+                segment_slice, value_handle.offset, thsn_tag_type(value_tag),
+                &frame.elements_table, &frame.offset_size));
+            frame.elements_count =
+                frame.elements_table.size / frame.offset_size;
+            if (frame.elements_count == 0) {
+                return thsn_segment_store_tagged_value(
+                    &builder->segment,
+                    thsn_tag_make(thsn_tag_type(value_tag),
+                                  THSN_TAG_SIZE_EMPTY),
+                    thsn_slice_make_empty());
+            }
+            BAIL_ON_ERROR(thsn_segment_store_composite_header(
+                &builder->segment,
+                thsn_tag_make(thsn_tag_type(value_tag),
+                              builder->composite_tag_size),
+                &frame.header_offset));
+            return THSN_VECTOR_PUSH_VAR(builder->stack, frame);
+        }
+        default:
+            return THSN_RESULT_INPUT_ERROR;
+    }
+    BAIL_ON_ERROR(thsn_slice_truncate(&value_slice, payload_size));
+    return thsn_segment_store_tagged_value(&builder->segment, value_tag,
+                                           value_slice);
+}
+
+/* Copies the key of object elements, and the value up to its header */
+static ThsnResult thsn_segment_builder_copy_element_header(
+    ThsnSegmentBuilder* /*mut*/ builder, ThsnValueHandle element_handle,
+    bool object) {
+    if (object) {
+        size_t key_size;
+        BAIL_ON_ERROR(thsn_segment_builder_copy_string(
+            builder,
+            thsn_slice_from_mut_slice(
+                builder->document->segments[element_handle.segment_no]),
+            element_handle.offset, &key_size));
+        element_handle.offset += key_size;
+    }
+    return thsn_segment_builder_copy_value(builder, element_handle);
+}
+
+/* Stores the elements table of the composite once its elements are copied */
+static ThsnResult thsn_segment_builder_finish_composite(
+    ThsnSegmentBuilder* /*mut*/ builder,
+    const ThsnSegmentBuilderFrame* /*in*/ frame) {
+    if (builder->composite_tag_size == THSN_TAG_SIZE_COMPACT &&
+        thsn_vector_current_offset(builder->segment) > UINT32_MAX) {
+        builder->too_large = true;
+        return THSN_RESULT_SUCCESS;
+    }
+    ThsnSlice elements_table;
+    BAIL_ON_ERROR(thsn_vector_shrink(&builder->element_offsets,
+                                     frame->elements_count * sizeof(size_t),
+                                     &elements_table));
+    BAIL_ON_ERROR(THSN_VECTOR_PUSH_VAR(builder->composites,
+                                       frame->header_offset));
+    return thsn_segment_store_composite_elements_table(
+        &builder->segment, frame->header_offset, elements_table);
+}
+
+/* Copies the elements of the composites on the stack */
+static ThsnResult thsn_segment_builder_copy_stack(
+    ThsnSegmentBuilder* /*mut*/ builder) {
+    while (!thsn_vector_is_empty(builder->stack) && !builder->too_large) {
+        ThsnSegmentBuilderFrame frame;
+        BAIL_ON_ERROR(THSN_VECTOR_POP_VAR(builder->stack, frame));
+        if (thsn_slice_is_empty(frame.elements_table)) {
+            BAIL_ON_ERROR(
+                thsn_segment_builder_finish_composite(builder, &frame));
+            continue;
+        }
+        size_t element_offset;
+        BAIL_ON_ERROR(thsn_segment_composite_consume_element_offset(
+            &frame.elements_table, frame.offset_size, &element_offset));
+        BAIL_ON_ERROR(THSN_VECTOR_PUSH_VAR(builder->stack, frame));
+        const size_t copied_element_offset =
+            thsn_vector_current_offset(builder->segment);
+        BAIL_ON_ERROR(THSN_VECTOR_PUSH_VAR(builder->element_offsets,
+                                           copied_element_offset));
+        BAIL_ON_ERROR(thsn_segment_builder_copy_element_header(
+            builder,
+            (ThsnValueHandle){.segment_no = frame.segment_no,
+                              .offset = element_offset},
+            frame.object));
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_segment_builder_build(ThsnSegmentBuilder* /*mut*/ builder) {
+    BAIL_ON_NULL_INPUT(builder);
+    const ThsnTagSize composite_tag_sizes[] = {THSN_TAG_SIZE_COMPACT,
+                                               THSN_TAG_SIZE_INBOUND};
+    for (size_t i = 0; i < 2; ++i) {
+        thsn_segment_builder_reset(builder, composite_tag_sizes[i]);
+        BAIL_ON_ERROR(thsn_segment_builder_copy_value(
+            builder, thsn_value_handle_first()));
+        BAIL_ON_ERROR(thsn_segment_builder_copy_stack(builder));
+        if (!builder->too_large) {
+            return THSN_RESULT_SUCCESS;
+        }
+    }
+    return THSN_RESULT_INPUT_ERROR;
+}
+
+ThsnResult thsn_segment_builder_copy_element(
+    ThsnSegmentBuilder* /*mut*/ builder, ThsnValueHandle element_handle,
+    bool object) {
+    BAIL_ON_NULL_INPUT(builder);
+    if (builder->too_large) {
+        return THSN_RESULT_SUCCESS;
+    }
+    BAIL_ON_ERROR(
+        thsn_segment_builder_copy_element_header(builder, element_handle,
+                                                 object));
+    return thsn_segment_builder_copy_stack(builder);
+}
+
+ThsnResult thsn_segment_relocate(ThsnMutSlice segment_part,
+                                 ThsnSlice composites, size_t base) {
+    const ThsnSlice part_slice = thsn_slice_from_mut_slice(segment_part);
+    while (!thsn_slice_is_empty(composites)) {
+        size_t header_offset;
+        BAIL_ON_ERROR(THSN_SLICE_READ_VAR(composites, header_offset));
+        ThsnTag tag;
+        ThsnSlice value_slice;
+        BAIL_ON_ERROR(thsn_segment_read_tagged_value(part_slice, header_offset,
+                                                     &tag, &value_slice));
+        ThsnCompositeHeader header;
+        BAIL_ON_ERROR(thsn_segment_read_composite_header(
+            part_slice, header_offset, thsn_tag_type(tag), &header));
+        const size_t table_size = header.elements_count * header.offset_size;
+        ThsnSlice elements_table;
+        BAIL_ON_ERROR(thsn_slice_at_offset(part_slice, header.table_offset,
+                                           table_size, &elements_table));
+        BAIL_ON_ERROR(thsn_slice_truncate(&elements_table, table_size));
+        ThsnMutSlice table_dst = thsn_mut_slice_make(
+            segment_part.data + header.table_offset, table_size);
+        while (!thsn_slice_is_empty(elements_table)) {
+            size_t element_offset;
+            BAIL_ON_ERROR(thsn_slice_read_offset(
+                &elements_table, header.offset_size, &element_offset));
+            BAIL_ON_ERROR(thsn_mut_slice_write_offset(
+                &table_dst, header.offset_size, base + element_offset));
+        }
+        ThsnMutSlice table_offset_dst = thsn_mut_slice_make(
+            segment_part.data + header_offset + sizeof(ThsnTag) +
+                header.offset_size,
+            header.offset_size);
+        BAIL_ON_ERROR(thsn_mut_slice_write_offset(
+            &table_offset_dst, header.offset_size, base + header.table_offset));
+    }
+    return THSN_RESULT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+#ifndef THSN_SEGMENT_BUILDER_H
+#define THSN_SEGMENT_BUILDER_H
+
+#include <stdbool.h>
+
+#include "result.h"
+#include "segment.h"
+#include "slice.h"
+#include "threason.h"
+#include "vector.h"
+
+/* Copies values of a document into a single segment in the order they're
+ * parsed in, with the elements of each composite right after its header,
+ * like a single-threaded parse would store them. Handles are followed, so
+ * the copy has none. */
+typedef struct {
+    ThsnDocument* document;
+    ThsnSegment segment;
+    ThsnTagSize composite_tag_size;
+    /* Strings that don't fit into their tag are copied into the segment,
+     * escaped ones along with their decoded copy, rather than as they are */
+    bool inline_strings;
+    /* The segment outgrew 32-bit offsets of compact composites */
+    bool too_large;
+    /* Header offsets of the copied composites with elements, for
+     * `thsn_segment_relocate` */
+    ThsnVector composites;
+    /* Offsets of the copied elements of the composites being copied, the
+     * innermost one's last */
+    ThsnVector element_offsets;
+    /* Frames of the composites being copied */
+    ThsnVector stack;
+    /* Escaped strings the document has no decoded copy of yet are decoded
+     * here */
+    ThsnVector decoded;
+} ThsnSegmentBuilder;
+
+void thsn_segment_builder_init(ThsnSegmentBuilder* /*out*/ builder,
+                               ThsnDocument* /*mut*/ document,
+                               const ThsnAllocator* /*maybe in*/ allocator,
+                               bool inline_strings);
+
+void thsn_segment_builder_free(ThsnSegmentBuilder* /*mut*/ builder);
+
+/* Empties the segment, keeping its buffer, to copy values with composites of
+ * `composite_tag_size` into it. */
+void thsn_segment_builder_reset(ThsnSegmentBuilder* /*mut*/ builder,
+                                ThsnTagSize composite_tag_size);
+
+/* Copies the whole value tree, with compact composites unless the segment
+ * turns out too large for them. */
+ThsnResult thsn_segment_builder_build(ThsnSegmentBuilder* /*mut*/ builder);
+
+/* Copies an element of an array, or a key and its value for objects, the
+ * handle pointing at the key. Nothing is copied once `too_large` is set. */
+ThsnResult thsn_segment_builder_copy_element(
+    ThsnSegmentBuilder* /*mut*/ builder, ThsnValueHandle element_handle,
+    bool object);
+
+/* Adds `base` to the offsets in the headers and elements tables of
+ * `composites`, for a segment built from offset 0 and then moved to `base`
+ * of another one. `segment_part` is where it's been moved to. */
+ThsnResult thsn_segment_relocate(ThsnMutSlice segment_part,
+                                 ThsnSlice composites, size_t base);
+
+#endif
@@ -0,0 +1,315 @@
+#include "allocator.h"
+#include "document.h"
+#include "number.h"
+#include "result.h"
+#include "segment.h"
+#include "slice.h"
+#include "structural.h"
+#include "unescape.h"
+#include "vector.h"
+
+static const char THSN_HEX_DIGITS[] = "0123456789abcdef";
+
+/* An array or object written up to its remaining elements */
+typedef struct {
+    ThsnSlice elements_table;
+    size_t offset_size;
+    uint16_t segment_no;
+    bool object;
+    /* Whether an element was written already, and needs a comma after it */
+    bool started;
+} ThsnSerializeFrame;
+
+typedef struct {
+    ThsnDocument* document;
+    ThsnVector output;
+    /* Escaped strings the document has no decoded copy of yet are decoded
+     * here, so nothing gets cached */
+    ThsnVector decoded;
+    /* `ThsnSerializeFrame`s of the arrays and objects being written */
+    ThsnVector stack;
+    bool pretty;
+    size_t indent;
+} ThsnSerializer;
+
+/* Makes room for `size` more bytes, so they can be put without checks */
+static inline ThsnResult thsn_serializer_reserve(
+    ThsnSerializer* /*mut*/ serializer, size_t size) {
+    ThsnVector* const output = &serializer->output;
+    if (thsn_vector_space_left(*output) >= size) {
+        return THSN_RESULT_SUCCESS;
+    }
+    BAIL_WITH_INPUT_ERROR_UNLESS(size <= PTRDIFF_MAX - output->offset);
+    const size_t required_capacity = output->offset + size;
+    return thsn_vector_reserve(output, required_capacity > output->capacity * 2
+                                           ? required_capacity
+                                           : output->capacity * 2);
+}
+
+static inline void thsn_serializer_put(ThsnSerializer* /*mut*/ serializer,
+                                       const char* /*in*/ data, size_t size) {
+    memcpy(serializer->output.buffer + serializer->output.offset, data, size);
+    serializer->output.offset += size;
+}
+
+static inline ThsnResult thsn_serializer_write(
+    ThsnSerializer* /*mut*/ serializer, const char* /*in*/ data, size_t size) {
+    BAIL_ON_ERROR(thsn_serializer_reserve(serializer, size));
+    thsn_serializer_put(serializer, data, size);
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Starts a line `depth` levels deep, only in pretty output */
+static ThsnResult thsn_serializer_write_newline(
+    ThsnSerializer* /*mut*/ serializer, size_t depth) {
+    if (!serializer->pretty) {
+        return THSN_RESULT_SUCCESS;
+    }
+    const size_t spaces_count = depth * serializer->indent;
+    BAIL_ON_ERROR(thsn_serializer_reserve(serializer, 1 + spaces_count));
+    char* const line_start =
+        serializer->output.buffer + serializer->output.offset;
+    line_start[0] = '\n';
+    memset(line_start + 1, ' ', spaces_count);
+    serializer->output.offset += 1 + spaces_count;
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Copies runs of characters allowed in JSON strings as is, a SIMD lane at a
+ * time, and escapes the ones in between. */
+static ThsnResult thsn_serializer_write_escaped(
+    ThsnSerializer* /*mut*/ serializer, ThsnSlice string_slice) {
+    /* Both quotes, and the rest of the string each time an escape makes it
+     * longer */
+    BAIL_ON_ERROR(thsn_serializer_reserve(serializer, string_slice.size + 2));
+    thsn_serializer_put(serializer, "\"", 1);
+    while (true) {
+        const char* const escape = thsn_find_escape(string_slice);
+        const size_t run_size = escape == NULL
+                                    ? string_slice.size
+                                    : (size_t)(escape - string_slice.data);
+        thsn_serializer_put(serializer, string_slice.data, run_size);
+        if (escape == NULL) {
+            break;
+        }
+        char escape_sequence[6] = {'\\', 'u', '0', '0'};
+        size_t escape_size = 2;
+        switch (*escape) {
+            case '"':
+            case '\\':
+                escape_sequence[1] = *escape;
+                break;
+            case '\b':
+                escape_sequence[1] = 'b';
+                break;
+            case '\f':
+                escape_sequence[1] = 'f';
+                break;
+            case '\n':
+                escape_sequence[1] = 'n';
+                break;
+            case '\r':
+                escape_sequence[1] = 'r';
+                break;
+            case '\t':
+                escape_sequence[1] = 't';
+                break;
+            default:
+                escape_sequence[4] = THSN_HEX_DIGITS[*escape >> 4];
+                escape_sequence[5] = THSN_HEX_DIGITS[*escape & 0xf];
+                escape_size = 6;
+                break;
+        }
+        thsn_slice_advance_unsafe(&string_slice, run_size + 1);
+        BAIL_ON_ERROR(thsn_serializer_reserve(
+            serializer, escape_size + string_slice.size + 1));
+        thsn_serializer_put(serializer, escape_sequence, escape_size);
+    }
+    thsn_serializer_put(serializer, "\"", 1);
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Writes the string stored at `offset`, a value or an object key, and tells
+ * how much of the segment it takes. */
+static ThsnResult thsn_serializer_write_string(
+    ThsnSerializer* /*mut*/ serializer, ThsnSegmentSlice segment_slice,
+    size_t offset, size_t* /*maybe out*/ stored_size) {
+    ThsnSlice string_slice;
+    bool decoded;
+    BAIL_ON_ERROR(thsn_segment_read_string_if_decoded(
+        segment_slice, offset, &string_slice, &decoded, stored_size));
+    if (!decoded) {
+        ThsnVector* const decoded_string = &serializer->decoded;
+        decoded_string->offset = 0;
+        BAIL_ON_ERROR(thsn_vector_reserve(decoded_string, string_slice.size));
+        BAIL_ON_ERROR(thsn_unescape_string(
+            string_slice, decoded_string->buffer, &decoded_string->offset));
+        string_slice = thsn_vector_as_slice(*decoded_string);
+    }
+    return thsn_serializer_write_escaped(serializer, string_slice);
+}
+
+/* Arrays and objects with elements are only opened, and get a frame for the
+ * elements to be written from. */
+static ThsnResult thsn_serializer_write_value(
+    ThsnSerializer* /*mut*/ serializer, ThsnValueHandle value_handle) {
+    ThsnDocument* const document = serializer->document;
+    BAIL_WITH_INPUT_ERROR_UNLESS(value_handle.segment_no <
+                                 document->segment_count);
+    const ThsnSegmentSlice segment_slice =
+        thsn_slice_from_mut_slice(document->segments[value_handle.segment_no]);
+    ThsnTag value_tag;
+    ThsnSlice value_slice;
+    BAIL_ON_ERROR(thsn_segment_read_tagged_value(
+        segment_slice, value_handle.offset, &value_tag, &value_slice));
+    BAIL_ON_ERROR(
+        thsn_serializer_reserve(serializer, THSN_MAX_FORMATTED_NUMBER_SIZE));
+    /* Numbers are formatted straight into the output */
+    char* const number = serializer->output.buffer + serializer->output.offset;
+    switch (thsn_tag_type(value_tag)) {
+        case THSN_TAG_NULL:
+            return thsn_serializer_write(serializer, "null", 4);
+        case THSN_TAG_BOOL:
+            return thsn_tag_size(value_tag) == THSN_TAG_SIZE_TRUE
+                       ? thsn_serializer_write(serializer, "true", 4)
+                       : thsn_serializer_write(serializer, "false", 5);
+        case THSN_TAG_INT: {
+            int64_t int64_value;
+            BAIL_ON_ERROR(thsn_segment_read_int_payload(value_tag, value_slice,
+                                                        &int64_value));
+            serializer->output.offset +=
+                thsn_number_format_int(int64_value, number);
+            return THSN_RESULT_SUCCESS;
+        }
+        case THSN_TAG_UINT: {
+            uint64_t uint64_value;
+            BAIL_ON_ERROR(thsn_segment_read_uint_payload(value_tag, value_slice,
+                                                         &uint64_value));
+            serializer->output.offset +=
+                thsn_number_format_uint(uint64_value, number);
+            return THSN_RESULT_SUCCESS;
+        }
+        case THSN_TAG_DOUBLE: {
+            double double_value;
+            BAIL_ON_ERROR(thsn_segment_read_double_payload(
+                value_tag, value_slice, &double_value));
+            serializer->output.offset +=
+                thsn_number_format_double(double_value, number);
+            return THSN_RESULT_SUCCESS;
+        }
+        case THSN_TAG_SMALL_STRING:
+        case THSN_TAG_REF_STRING:
+        case THSN_TAG_INLINE_STRING:
+            return thsn_serializer_write_string(serializer, segment_slice,
+                                                value_handle.offset, NULL);
+        case THSN_TAG_ARRAY:
+        case THSN_TAG_OBJECT: {
+            ThsnSerializeFrame frame = {
+                .segment_no = value_handle.segment_no,
+                .object = thsn_tag_type(value_tag) == THSN_TAG_OBJECT,
+                .started = false,
+            };
+            BAIL_ON_ERROR(thsn_segment_read_composite(
+                segment_slice, value_handle.offset, thsn_tag_type(value_tag),
+                &frame.elements_table, &frame.offset_size));
+            if (thsn_slice_is_empty(frame.elements_table)) {
+                return thsn_serializer_write(serializer,
+                                             frame.object ? "{}" : "[]", 2);
+            }
+            BAIL_ON_ERROR(
+                thsn_serializer_write(serializer, frame.object ? "{" : "[", 1));
+            return THSN_VECTOR_PUSH_VAR(serializer->stack, frame);
+        }
+        default:
+            /* Handles are followed before values get here */
+            return THSN_RESULT_INPUT_ERROR;
+    }
+}
+
+static ThsnResult thsn_serializer_write_document(
+    ThsnSerializer* /*mut*/ serializer, ThsnValueHandle value_handle) {
+    ThsnDocument* const document = serializer->document;
+    BAIL_ON_ERROR(thsn_document_follow_handle(document, &value_handle));
+    BAIL_ON_ERROR(thsn_serializer_write_value(serializer, value_handle));
+    while (!thsn_vector_is_empty(serializer->stack)) {
+        ThsnSerializeFrame frame;
+        BAIL_ON_ERROR(THSN_VECTOR_POP_VAR(serializer->stack, frame));
+        /* Of the frame's brackets, its elements are one level deeper */
+        const size_t depth =
+            thsn_vector_current_offset(serializer->stack) / sizeof(frame);
+        if (thsn_slice_is_empty(frame.elements_table)) {
+            BAIL_ON_ERROR(thsn_serializer_write_newline(serializer, depth));
+            BAIL_ON_ERROR(
+                thsn_serializer_write(serializer, frame.object ? "}" : "]", 1));
+            continue;
+        }
+        if (frame.started) {
+            BAIL_ON_ERROR(thsn_serializer_write(serializer, ",", 1));
+        }
+        BAIL_ON_ERROR(thsn_serializer_write_newline(serializer, depth + 1));
+        frame.started = true;
+        size_t element_offset;
+        BAIL_ON_ERROR(thsn_segment_composite_consume_element_offset(
+            &frame.elements_table, frame.offset_size, &element_offset));
+        BAIL_ON_ERROR(THSN_VECTOR_PUSH_VAR(serializer->stack, frame));
+        if (frame.object) {
+            size_t key_size;
+            BAIL_ON_ERROR(thsn_serializer_write_string(
+                serializer,
+                thsn_slice_from_mut_slice(
+                    document->segments[frame.segment_no]),
+                element_offset, &key_size));
+            BAIL_ON_ERROR(serializer->pretty
+                              ? thsn_serializer_write(serializer, ": ", 2)
+                              : thsn_serializer_write(serializer, ":", 1));
+            element_offset += key_size;
+        }
+        ThsnValueHandle element_handle = {.segment_no = frame.segment_no,
+                                          .offset = element_offset};
+        BAIL_ON_ERROR(thsn_document_follow_handle(document, &element_handle));
+        BAIL_ON_ERROR(thsn_serializer_write_value(serializer, element_handle));
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_document_serialize(
+    ThsnDocument* /*mut*/ document, ThsnValueHandle value_handle,
+    const ThsnSerializeOptions* /*maybe in*/ options,
+    ThsnOutputBuffer* /*mut*/ output_buffer) {
+    BAIL_ON_NULL_INPUT(document);
+    BAIL_ON_NULL_INPUT(output_buffer);
+    ThsnSerializer serializer = {
+        .document = document,
+        .output = {.buffer = output_buffer->data,
+                   .capacity = output_buffer->capacity,
+                   .offset = output_buffer->size,
+                   .allocator = output_buffer->allocator},
+        .decoded = thsn_vector_make_empty(),
+        .stack = thsn_vector_make_empty(),
+        .pretty = options != NULL && options->pretty,
+        .indent = options == NULL ? 0 : options->indent,
+    };
+    const ThsnResult result =
+        thsn_serializer_write_document(&serializer, value_handle);
+    thsn_vector_free(&serializer.decoded);
+    thsn_vector_free(&serializer.stack);
+    /* The buffer may have been reallocated either way */
+    output_buffer->data = serializer.output.buffer;
+    output_buffer->capacity = serializer.output.capacity;
+    if (result == THSN_RESULT_SUCCESS) {
+        output_buffer->size = serializer.output.offset;
+    }
+    return result;
+}
+
+ThsnResult thsn_output_buffer_free(ThsnOutputBuffer* /*mut*/ output_buffer) {
+    BAIL_ON_NULL_INPUT(output_buffer);
+    if (output_buffer->data != NULL) {
+        thsn_free(output_buffer->allocator, output_buffer->data,
+                  output_buffer->capacity);
+    }
+    output_buffer->data = NULL;
+    output_buffer->size = 0;
+    output_buffer->capacity = 0;
+    return THSN_RESULT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "document.h"
+#include "file.h"
+#include "result.h"
+#include "segment.h"
+#include "segment_builder.h"
+#include "slice.h"
+#include "vector.h"
+
+#define THSN_SNAPSHOT_VERSION 2
+/* Reads back as something else on a machine with the other byte order */
+#define THSN_SNAPSHOT_BYTE_ORDER 0x01020304
+
+static const char THSN_SNAPSHOT_MAGIC[8] = {'T', 'H', 'S', 'N',
+                                            'S', 'N', 'A', 'P'};
+
+/* Followed by the segment of the snapshot, which holds the whole value tree
+ * and all of its strings */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    /* `sizeof(size_t)`, the size of wide offsets and of string sizes */
+    uint32_t word_size;
+    uint32_t reserved;
+    uint64_t segment_size;
+    /* `thsn_snapshot_checksum` of the segment */
+    uint64_t checksum;
+} ThsnSnapshotHeader;
+
+/* A word at a time, four words per round to keep several multiplications in
+ * flight. Catches truncated and corrupted files, not deliberate changes. */
+static uint64_t thsn_snapshot_checksum(ThsnSlice data) {
+    static const uint64_t prime_1 = 0x9e3779b185ebca87ULL;
+    static const uint64_t prime_2 = 0xc2b2ae3d27d4eb4fULL;
+    uint64_t lanes[4] = {prime_1, prime_2, ~prime_1, ~prime_2};
+    while (data.size >= sizeof(lanes)) {
+        for (size_t i = 0; i < 4; ++i) {
+            uint64_t word;
+            memcpy(&word, data.data + i * sizeof(word), sizeof(word));
+            lanes[i] += word * prime_2;
+            lanes[i] = ((lanes[i] << 31) | (lanes[i] >> 33)) * prime_1;
+        }
+        thsn_slice_advance_unsafe(&data, sizeof(lanes));
+    }
+    uint64_t checksum = data.size;
+    for (size_t i = 0; i < 4; ++i) {
+        checksum = (checksum ^ lanes[i]) * prime_1;
+    }
+    for (size_t i = 0; i < data.size; ++i) {
+        checksum = (checksum ^ (unsigned char)data.data[i]) * prime_2;
+    }
+    return checksum ^ (checksum >> 29);
+}
+
+static ThsnResult thsn_snapshot_write(int fd, ThsnSlice data) {
+    while (!thsn_slice_is_empty(data)) {
+        const ssize_t written_size = write(fd, data.data, data.size);
+        if (written_size < 0) {
+            BAIL_WITH_INPUT_ERROR_UNLESS(errno == EINTR);
+            continue;
+        }
+        thsn_slice_advance_unsafe(&data, (size_t)written_size);
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_document_save(ThsnDocument* /*mut*/ document, int fd) {
+    BAIL_ON_NULL_INPUT(document);
+    ThsnSegmentBuilder builder;
+    thsn_segment_builder_init(&builder, document, NULL, true);
+    ThsnResult result = thsn_segment_builder_build(&builder);
+    if (result == THSN_RESULT_SUCCESS) {
+        const ThsnSlice segment_slice = thsn_vector_as_slice(builder.segment);
+        ThsnSnapshotHeader header = {
+            .version = THSN_SNAPSHOT_VERSION,
+            .byte_order = THSN_SNAPSHOT_BYTE_ORDER,
+            .word_size = sizeof(size_t),
+            .segment_size = segment_slice.size,
+            .checksum = thsn_snapshot_checksum(segment_slice),
+        };
+        memcpy(header.magic, THSN_SNAPSHOT_MAGIC, sizeof(header.magic));
+        result = thsn_snapshot_write(fd, THSN_SLICE_FROM_VAR(header));
+        if (result == THSN_RESULT_SUCCESS) {
+            result = thsn_snapshot_write(fd, segment_slice);
+        }
+    }
+    thsn_segment_builder_free(&builder);
+    return result;
+}
+
+static ThsnResult thsn_snapshot_check(ThsnSlice snapshot_slice,
+                                      ThsnSlice* /*out*/ segment_slice) {
+    ThsnSnapshotHeader header;
+    BAIL_ON_ERROR(THSN_SLICE_READ_VAR(snapshot_slice, header));
+    BAIL_WITH_INPUT_ERROR_UNLESS(
+        memcmp(header.magic, THSN_SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == THSN_SNAPSHOT_VERSION &&
+        header.byte_order == THSN_SNAPSHOT_BYTE_ORDER &&
+        header.word_size == sizeof(size_t) &&
+        header.segment_size == snapshot_slice.size);
+    BAIL_WITH_INPUT_ERROR_UNLESS(thsn_snapshot_checksum(snapshot_slice) ==
+                                 header.checksum);
+    *segment_slice = snapshot_slice;
+    return THSN_RESULT_SUCCESS;
+}
+
+ThsnResult thsn_document_load_mmap(const char* /*in*/ path,
+                                   ThsnDocument** /*out*/ document) {
+    BAIL_ON_NULL_INPUT(path);
+    BAIL_ON_NULL_INPUT(document);
+    ThsnOwningSlice mapping;
+    BAIL_ON_ERROR(thsn_file_map(path, true, &mapping));
+    ThsnSlice segment_slice;
+    ThsnResult result = thsn_snapshot_check(mapping, &segment_slice);
+    if (result == THSN_RESULT_SUCCESS) {
+        result = thsn_document_create(NULL, document);
+    }
+    if (result != THSN_RESULT_SUCCESS) {
+        thsn_file_unmap(mapping);
+        return result;
+    }
+    thsn_file_mapping_parsed(mapping);
+    (*document)->mapped_input = mapping;
+    (*document)->mapped_segment = true;
+    /* The mapping is private and writable, so the caches built on first
+     * access go to copies of the pages */
+    (*document)->segments[0] =
+        thsn_mut_slice_make((char*)segment_slice.data, segment_slice.size);
+    (*document)->segment_capacity = segment_slice.size;
+    return THSN_RESULT_SUCCESS;
+}
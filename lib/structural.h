@@ -0,0 +1,433 @@
+#ifndef THSN_STRUCTURAL_H
+#define THSN_STRUCTURAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "slice.h"
+
+/* Bit `i` of every mask describes the `i`-th byte of a block. */
+#define THSN_BLOCK_SIZE 64
+
+#define THSN_EVEN_BITS 0x5555555555555555ULL
+
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    /* Same set of characters as `isspace` in the "C" locale */
+    uint64_t whitespace;
+    /* `[` and `{`, and `]` and `}`, for skipping composites */
+    uint64_t opening;
+    uint64_t closing;
+} ThsnBlockMasks;
+
+static inline size_t thsn_popcount(uint64_t bitmask) {
+#if defined(__GNUC__)
+    return (size_t)__builtin_popcountll(bitmask);
+#else
+    bitmask = bitmask - ((bitmask >> 1) & THSN_EVEN_BITS);
+    bitmask = (bitmask & 0x3333333333333333ULL) +
+              ((bitmask >> 2) & 0x3333333333333333ULL);
+    bitmask = (bitmask + (bitmask >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (size_t)((bitmask * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/* `bitmask` must not be zero */
+static inline size_t thsn_trailing_zeros(uint64_t bitmask) {
+#if defined(__GNUC__)
+    return (size_t)__builtin_ctzll(bitmask);
+#else
+    return thsn_popcount((bitmask & (0 - bitmask)) - 1);
+#endif
+}
+
+static inline uint64_t thsn_block_size_mask(size_t block_size) {
+    return block_size >= THSN_BLOCK_SIZE ? UINT64_MAX
+                                         : (1ULL << block_size) - 1;
+}
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define THSN_SIMD_WIDTH 32
+
+static inline void thsn_simd_classify_lane(const char* /*in*/ lane,
+                                           unsigned shift,
+                                           ThsnBlockMasks* /*mut*/ masks) {
+    const __m256i v = _mm256_loadu_si256((const __m256i*)lane);
+#define THSN_EQ(c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+#define THSN_MOVEMASK(m) \
+    ((uint64_t)(uint32_t)_mm256_movemask_epi8(m) << shift)
+    const __m256i control = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8('\t')), v),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8('\r')), v));
+    masks->quote |= THSN_MOVEMASK(THSN_EQ('"'));
+    masks->backslash |= THSN_MOVEMASK(THSN_EQ('\\'));
+    masks->whitespace |=
+        THSN_MOVEMASK(_mm256_or_si256(THSN_EQ(' '), control));
+    masks->opening |=
+        THSN_MOVEMASK(_mm256_or_si256(THSN_EQ('['), THSN_EQ('{')));
+    masks->closing |=
+        THSN_MOVEMASK(_mm256_or_si256(THSN_EQ(']'), THSN_EQ('}')));
+#undef THSN_MOVEMASK
+#undef THSN_EQ
+}
+
+static inline uint64_t thsn_simd_char_lane(const char* /*in*/ lane, char c) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i*)lane), _mm256_set1_epi8(c)));
+}
+
+static inline uint64_t thsn_simd_escape_lane(const char* /*in*/ lane) {
+    const __m256i v = _mm256_loadu_si256((const __m256i*)lane);
+    const __m256i control =
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1f)), v);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        control));
+}
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define THSN_SIMD_WIDTH 16
+
+static inline void thsn_simd_classify_lane(const char* /*in*/ lane,
+                                           unsigned shift,
+                                           ThsnBlockMasks* /*mut*/ masks) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)lane);
+#define THSN_EQ(c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define THSN_MOVEMASK(m) ((uint64_t)(uint16_t)_mm_movemask_epi8(m) << shift)
+    const __m128i control = _mm_and_si128(
+        _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8('\t')), v),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8('\r')), v));
+    masks->quote |= THSN_MOVEMASK(THSN_EQ('"'));
+    masks->backslash |= THSN_MOVEMASK(THSN_EQ('\\'));
+    masks->whitespace |= THSN_MOVEMASK(_mm_or_si128(THSN_EQ(' '), control));
+    masks->opening |= THSN_MOVEMASK(_mm_or_si128(THSN_EQ('['), THSN_EQ('{')));
+    masks->closing |= THSN_MOVEMASK(_mm_or_si128(THSN_EQ(']'), THSN_EQ('}')));
+#undef THSN_MOVEMASK
+#undef THSN_EQ
+}
+
+static inline uint64_t thsn_simd_char_lane(const char* /*in*/ lane, char c) {
+    return (uint16_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)lane), _mm_set1_epi8(c)));
+}
+
+static inline uint64_t thsn_simd_escape_lane(const char* /*in*/ lane) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)lane);
+    const __m128i control =
+        _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v);
+    return (uint16_t)_mm_movemask_epi8(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+                     control));
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define THSN_SIMD_WIDTH 16
+
+static inline uint64_t thsn_neon_movemask(uint8x16_t bytes) {
+    static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                     1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t masked = vandq_u8(bytes, vld1q_u8(bits));
+    return (uint64_t)vaddv_u8(vget_low_u8(masked)) |
+           ((uint64_t)vaddv_u8(vget_high_u8(masked)) << 8);
+}
+
+static inline void thsn_simd_classify_lane(const char* /*in*/ lane,
+                                           unsigned shift,
+                                           ThsnBlockMasks* /*mut*/ masks) {
+    const uint8x16_t v = vld1q_u8((const uint8_t*)lane);
+#define THSN_EQ(c) vceqq_u8(v, vdupq_n_u8(c))
+#define THSN_MOVEMASK(m) (thsn_neon_movemask(m) << shift)
+    const uint8x16_t control =
+        vandq_u8(vcgeq_u8(v, vdupq_n_u8('\t')), vcleq_u8(v, vdupq_n_u8('\r')));
+    masks->quote |= THSN_MOVEMASK(THSN_EQ('"'));
+    masks->backslash |= THSN_MOVEMASK(THSN_EQ('\\'));
+    masks->whitespace |= THSN_MOVEMASK(vorrq_u8(THSN_EQ(' '), control));
+    masks->opening |= THSN_MOVEMASK(vorrq_u8(THSN_EQ('['), THSN_EQ('{')));
+    masks->closing |= THSN_MOVEMASK(vorrq_u8(THSN_EQ(']'), THSN_EQ('}')));
+#undef THSN_MOVEMASK
+#undef THSN_EQ
+}
+
+static inline uint64_t thsn_simd_char_lane(const char* /*in*/ lane, char c) {
+    return thsn_neon_movemask(
+        vceqq_u8(vld1q_u8((const uint8_t*)lane), vdupq_n_u8((uint8_t)c)));
+}
+
+static inline uint64_t thsn_simd_escape_lane(const char* /*in*/ lane) {
+    const uint8x16_t v = vld1q_u8((const uint8_t*)lane);
+    return thsn_neon_movemask(vorrq_u8(
+        vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\'))),
+        vcleq_u8(v, vdupq_n_u8(0x1f))));
+}
+
+#else
+#define THSN_SIMD_WIDTH 1
+
+static inline void thsn_simd_classify_lane(const char* /*in*/ lane,
+                                           unsigned shift,
+                                           ThsnBlockMasks* /*mut*/ masks) {
+    const uint64_t bit = 1ULL << shift;
+    switch (*lane) {
+        case '"':
+            masks->quote |= bit;
+            break;
+        case '\\':
+            masks->backslash |= bit;
+            break;
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\v':
+        case '\f':
+        case '\r':
+            masks->whitespace |= bit;
+            break;
+        case '[':
+        case '{':
+            masks->opening |= bit;
+            break;
+        case ']':
+        case '}':
+            masks->closing |= bit;
+            break;
+        default:
+            break;
+    }
+}
+
+static inline uint64_t thsn_simd_char_lane(const char* /*in*/ lane, char c) {
+    return *lane == c;
+}
+
+static inline uint64_t thsn_simd_escape_lane(const char* /*in*/ lane) {
+    return *lane == '"' || *lane == '\\' || (unsigned char)*lane < 0x20;
+}
+#endif
+
+/* Bytes past `block_size` are never read, and their bits are cleared. */
+static inline void thsn_block_classify(const char* /*in*/ block,
+                                       size_t block_size,
+                                       ThsnBlockMasks* /*out*/ masks) {
+    *masks = (ThsnBlockMasks){0};
+    if (block_size < THSN_BLOCK_SIZE) {
+        char padded_block[THSN_BLOCK_SIZE] = {0};
+        memcpy(padded_block, block, block_size);
+        thsn_block_classify(padded_block, THSN_BLOCK_SIZE, masks);
+        const uint64_t size_mask = thsn_block_size_mask(block_size);
+        masks->quote &= size_mask;
+        masks->backslash &= size_mask;
+        masks->whitespace &= size_mask;
+        masks->opening &= size_mask;
+        masks->closing &= size_mask;
+        return;
+    }
+    for (unsigned shift = 0; shift < THSN_BLOCK_SIZE;
+         shift += THSN_SIMD_WIDTH) {
+        thsn_simd_classify_lane(block + shift, shift, masks);
+    }
+}
+
+/* Returns NULL if there is no `c` in the slice. */
+static inline const char* thsn_find_char(ThsnSlice slice, char c) {
+    const char* iter = slice.data;
+    const char* const end = thsn_slice_end(slice);
+    for (; end - iter >= THSN_SIMD_WIDTH; iter += THSN_SIMD_WIDTH) {
+        const uint64_t found = thsn_simd_char_lane(iter, c);
+        if (found != 0) {
+            return iter + thsn_trailing_zeros(found);
+        }
+    }
+    for (; iter != end; ++iter) {
+        if (*iter == c) {
+            return iter;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the first character JSON strings can't have as is, a quote, a
+ * backslash or a control character, or NULL if there are none. */
+static inline const char* thsn_find_escape(ThsnSlice slice) {
+    const char* iter = slice.data;
+    const char* const end = thsn_slice_end(slice);
+    for (; end - iter >= THSN_SIMD_WIDTH; iter += THSN_SIMD_WIDTH) {
+        const uint64_t found = thsn_simd_escape_lane(iter);
+        if (found != 0) {
+            return iter + thsn_trailing_zeros(found);
+        }
+    }
+    if (iter != end) {
+        /* The padding needs no escaping */
+        char lane[THSN_SIMD_WIDTH];
+        memset(lane, ' ', sizeof(lane));
+        memcpy(lane, iter, end - iter);
+        const uint64_t found = thsn_simd_escape_lane(lane);
+        if (found != 0) {
+            return iter + thsn_trailing_zeros(found);
+        }
+    }
+    return NULL;
+}
+
+/* Characters escaped by a preceding odd-length run of backslashes.
+ * `prev_escaped` carries the state over to the next block. */
+static inline uint64_t thsn_block_escaped(uint64_t backslash,
+                                          uint64_t* /*mut*/ prev_escaped) {
+    backslash &= ~*prev_escaped;
+    const uint64_t follows_escape = (backslash << 1) | *prev_escaped;
+    const uint64_t odd_sequence_starts =
+        backslash & ~THSN_EVEN_BITS & ~follows_escape;
+    const uint64_t sequences_starting_on_even_bits =
+        odd_sequence_starts + backslash;
+    /* The run reaching the last bit overflows the addition */
+    *prev_escaped = sequences_starting_on_even_bits < odd_sequence_starts;
+    const uint64_t invert_mask = sequences_starting_on_even_bits << 1;
+    return (THSN_EVEN_BITS ^ invert_mask) & follows_escape;
+}
+
+/* Bit `i` of the result is the parity of bits `0..i` */
+static inline uint64_t thsn_prefix_xor(uint64_t bitmask) {
+    bitmask ^= bitmask << 1;
+    bitmask ^= bitmask << 2;
+    bitmask ^= bitmask << 4;
+    bitmask ^= bitmask << 8;
+    bitmask ^= bitmask << 16;
+    bitmask ^= bitmask << 32;
+    return bitmask;
+}
+
+/* Bytes inside strings, opening quotes included and closing ones excluded.
+ * `prev_in_string` is either all zeros or all ones. */
+static inline uint64_t thsn_block_in_string(uint64_t unescaped_quote,
+                                            uint64_t* /*mut*/ prev_in_string) {
+    const uint64_t in_string =
+        thsn_prefix_xor(unescaped_quote) ^ *prev_in_string;
+    *prev_in_string = 0 - (in_string >> 63);
+    return in_string;
+}
+
+static inline bool thsn_is_out_of_string_char(char c) {
+    switch (c) {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ',':
+        case ':':
+        case '"':
+        case '-':
+        case '+':
+        case '.':
+        case 'e':
+        case 'E':
+        case 't':
+        case 'r':
+        case 'u':
+        case 'f':
+        case 'a':
+        case 'l':
+        case 's':
+        case 'n':
+            return true;
+        default:
+            return c >= '0' && c <= '9';
+    }
+}
+
+#define THSN_SPECULATION_WINDOW (16 * 1024)
+#define THSN_SPECULATION_MARGIN 16
+
+/* Guesses whether `buffer_slice` starts inside a string. Assuming it doesn't,
+ * the quote parity splits the buffer into string and non-string bytes,
+ * assuming it does flips them. The guess that leaves fewer characters which
+ * can't appear outside of strings wins. */
+static inline bool thsn_speculate_starts_in_string(ThsnSlice buffer_slice) {
+    uint64_t prev_escaped = 0;
+    uint64_t prev_in_string = 0;
+    size_t not_in_string_score = 0;
+    size_t in_string_score = 0;
+    size_t scanned = 0;
+    while (!thsn_slice_is_empty(buffer_slice) &&
+           scanned < THSN_SPECULATION_WINDOW) {
+        const size_t block_size = buffer_slice.size < THSN_BLOCK_SIZE
+                                      ? buffer_slice.size
+                                      : THSN_BLOCK_SIZE;
+        ThsnBlockMasks masks;
+        thsn_block_classify(buffer_slice.data, block_size, &masks);
+        const uint64_t escaped =
+            thsn_block_escaped(masks.backslash, &prev_escaped);
+        const uint64_t in_string =
+            thsn_block_in_string(masks.quote & ~escaped, &prev_in_string);
+        uint64_t suspicious = 0;
+        for (size_t i = 0; i < block_size; ++i) {
+            suspicious |=
+                (uint64_t)!thsn_is_out_of_string_char(buffer_slice.data[i])
+                << i;
+        }
+        not_in_string_score += thsn_popcount(suspicious & ~in_string);
+        in_string_score += thsn_popcount(suspicious & in_string);
+        if (not_in_string_score >= in_string_score + THSN_SPECULATION_MARGIN ||
+            in_string_score >= not_in_string_score + THSN_SPECULATION_MARGIN) {
+            break;
+        }
+        thsn_slice_advance_unsafe(&buffer_slice, block_size);
+        scanned += block_size;
+    }
+    return in_string_score < not_in_string_score;
+}
+
+/* `buffer_slice` starts right after an opening bracket or brace, it's advanced
+ * past the matching closing one. Only brackets outside of strings are counted,
+ * the skipped value isn't validated. Blocks without enough closing brackets to
+ * get back to depth 0 are skipped as a whole. */
+static inline ThsnResult thsn_skip_composite(ThsnSlice* /*mut*/ buffer_slice) {
+    uint64_t prev_escaped = 0;
+    uint64_t prev_in_string = 0;
+    size_t depth = 1;
+    for (ThsnSlice block_slice = *buffer_slice;
+         !thsn_slice_is_empty(block_slice);) {
+        const size_t block_size = block_slice.size < THSN_BLOCK_SIZE
+                                      ? block_slice.size
+                                      : THSN_BLOCK_SIZE;
+        ThsnBlockMasks masks;
+        thsn_block_classify(block_slice.data, block_size, &masks);
+        const uint64_t escaped =
+            thsn_block_escaped(masks.backslash, &prev_escaped);
+        const uint64_t out_of_string =
+            ~thsn_block_in_string(masks.quote & ~escaped, &prev_in_string);
+        const uint64_t opening = masks.opening & out_of_string;
+        const uint64_t closing = masks.closing & out_of_string;
+        if (thsn_popcount(closing) < depth) {
+            depth = depth + thsn_popcount(opening) - thsn_popcount(closing);
+        } else {
+            for (uint64_t brackets = opening | closing; brackets != 0;
+                 brackets &= brackets - 1) {
+                const uint64_t bracket = brackets & (0 - brackets);
+                if ((opening & bracket) != 0) {
+                    ++depth;
+                } else if (--depth == 0) {
+                    thsn_slice_advance_unsafe(
+                        buffer_slice, block_slice.data +
+                                          thsn_trailing_zeros(bracket) + 1 -
+                                          buffer_slice->data);
+                    return THSN_RESULT_SUCCESS;
+                }
+            }
+        }
+        thsn_slice_advance_unsafe(&block_slice, block_size);
+    }
+    return THSN_RESULT_INPUT_ERROR;
+}
+
+#endif
@@ -1,6 +1,12 @@
 #ifndef THSN_TEST_DOCUMENT_H
 #define THSN_TEST_DOCUMENT_H
 
+#include <stdatomic.h>
+#include <stdio.h>
+#include <threads.h>
+
+#include "document.h"
+#include "parser.h"
 #include "testing.h"
 #include "threason.h"
 #include "vector.h"
@@ -46,6 +52,81 @@ TEST(indexes_object_by_key) {
     thsn_document_free(&document);
 }
 
+TEST(indexes_object_by_key_hash) {
+    const size_t keys_count = 500;
+    ThsnVector object_str = thsn_vector_make_empty();
+    ASSERT_SUCCESS(thsn_vector_allocate(&object_str, 16 * 1024));
+    char kv_str[64];
+    ASSERT_SUCCESS(thsn_vector_push(&object_str, thsn_slice_from_c_str("{\"\": -1")));
+    for (size_t i = 0; i < keys_count; ++i) {
+        snprintf(kv_str, sizeof(kv_str), ", \"key_%zu\": %zu", i, i);
+        ASSERT_SUCCESS(thsn_vector_push(&object_str, thsn_slice_from_c_str(kv_str)));
+    }
+    /* Duplicate keys resolve to the first occurrence */
+    ASSERT_SUCCESS(thsn_vector_push(&object_str, thsn_slice_from_c_str(", \"key_7\": 0}")));
+
+    for (size_t threads_count = 1; threads_count <= 4; threads_count += 3) {
+        ThsnSlice object_str_slice = thsn_vector_as_slice(object_str);
+        ThsnDocument* document;
+        ASSERT_SUCCESS(thsn_document_parse_multithreaded(&object_str_slice, &document,
+                                                         threads_count));
+        ThsnValueObjectTable object_table;
+        ASSERT_SUCCESS(
+            thsn_document_read_object_indexed(document, thsn_value_handle_first(), &object_table));
+        ASSERT_NEQ(object_table.hash_index, NULL);
+        ASSERT_EQ(thsn_document_object_length(object_table), keys_count + 2);
+        for (size_t i = 0; i < keys_count; ++i) {
+            snprintf(kv_str, sizeof(kv_str), "key_%zu", i);
+            ThsnValueHandle element_handle = thsn_value_handle_not_found();
+            ASSERT_SUCCESS(thsn_document_object_index(
+                document, object_table, thsn_slice_from_c_str(kv_str), &element_handle));
+            int64_t value = -1;
+            ASSERT_SUCCESS(thsn_document_read_int64(document, element_handle, &value));
+            ASSERT_EQ(value, (int64_t)i);
+        }
+        ThsnValueHandle element_handle = thsn_value_handle_not_found();
+        ASSERT_SUCCESS(thsn_document_object_index(document, object_table,
+                                                  thsn_slice_make_empty(), &element_handle));
+        ASSERT_FALSE(thsn_value_handle_is_not_found(element_handle));
+        char* non_existing_keys[] = {"key_", "key_500", "key_1 ", "some_key"};
+        for (size_t i = 0; i < sizeof(non_existing_keys) / sizeof(non_existing_keys[0]); ++i) {
+            ASSERT_SUCCESS(thsn_document_object_index(document, object_table,
+                                                      thsn_slice_from_c_str(non_existing_keys[i]),
+                                                      &element_handle));
+            ASSERT_TRUE(thsn_value_handle_is_not_found(element_handle));
+        }
+
+        /* The index is cached and doesn't interfere with the sorted table */
+        ThsnValueObjectTable cached_object_table;
+        ASSERT_SUCCESS(thsn_document_read_object_indexed(document, thsn_value_handle_first(),
+                                                         &cached_object_table));
+        ASSERT_EQ(cached_object_table.hash_index, object_table.hash_index);
+        ThsnValueObjectTable sorted_object_table;
+        ASSERT_SUCCESS(thsn_document_read_object_sorted(document, thsn_value_handle_first(),
+                                                        &sorted_object_table));
+        ASSERT_EQ(sorted_object_table.hash_index, NULL);
+        ASSERT_SUCCESS(thsn_document_object_index(
+            document, sorted_object_table, thsn_slice_from_c_str("key_123"), &element_handle));
+        int64_t value = -1;
+        ASSERT_SUCCESS(thsn_document_read_int64(document, element_handle, &value));
+        ASSERT_EQ(value, 123);
+        thsn_document_free(&document);
+    }
+
+    ThsnSlice empty_object_slice = thsn_slice_from_c_str("{}");
+    ThsnDocument* document;
+    ASSERT_SUCCESS(thsn_document_parse(&empty_object_slice, &document));
+    ThsnValueObjectTable object_table;
+    ASSERT_SUCCESS(
+        thsn_document_read_object_indexed(document, thsn_value_handle_first(), &object_table));
+    ThsnValueHandle element_handle = thsn_value_handle_first();
+    ASSERT_SUCCESS(thsn_document_object_index(document, object_table, thsn_slice_from_c_str("a"),
+                                              &element_handle));
+    ASSERT_TRUE(thsn_value_handle_is_not_found(element_handle));
+    thsn_document_free(&document);
+    ASSERT_SUCCESS(thsn_vector_free(&object_str));
+}
+
 TEST(parses_simple_documents) {
     ThsnDocument* document;
     const char* documents[] = {
@@ -73,6 +154,288 @@ TEST(parses_simple_documents) {
     }
 }
 
+TEST(parses_into_compact_and_wide_segments) {
+    const char* document_str = "[{\"b\": [1, 2], \"a\": \"x\"}, [], {}, [[3]]]";
+    /* Inputs that could outgrow 32-bit offsets get full-width segments */
+    const size_t input_sizes[] = {strlen(document_str), SIZE_MAX};
+    const size_t offset_sizes[] = {sizeof(uint32_t), sizeof(size_t)};
+    size_t segment_sizes[2] = {0};
+    for (size_t i = 0; i < 2; ++i) {
+        ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+        ThsnDocument* document = NULL;
+        ASSERT_SUCCESS(thsn_document_allocate(&document, NULL, 1));
+        ThsnParserContext parser_context;
+        ASSERT_SUCCESS(thsn_parser_context_init(&parser_context, NULL, input_sizes[i]));
+        bool finished = false;
+        while (!finished) {
+            ThsnToken token = THSN_TOKEN_EOF;
+            ThsnSlice token_slice = thsn_slice_make_empty();
+            ASSERT_SUCCESS(thsn_next_token(&document_slice, &token_slice, &token));
+            ASSERT_SUCCESS(
+                thsn_parser_parse_next_token(&parser_context, token, token_slice, &finished));
+        }
+        ASSERT_SUCCESS(thsn_parser_context_finish(&parser_context, &document->segments[0]));
+        document->segment_capacity = document->segments[0].size;
+        segment_sizes[i] = document->segments[0].size;
+
+        ThsnValueArrayTable array_table;
+        ASSERT_SUCCESS(thsn_document_read_array(document, thsn_value_handle_first(), &array_table));
+        ASSERT_EQ(array_table.offset_size, offset_sizes[i]);
+        ASSERT_EQ(thsn_document_array_length(array_table), 4);
+        ThsnValueHandle object_handle = thsn_value_handle_not_found();
+        ASSERT_SUCCESS(thsn_document_index_array_element(document, array_table, 0, &object_handle));
+        ThsnValueObjectTable object_table;
+        ASSERT_SUCCESS(thsn_document_read_object_sorted(document, object_handle, &object_table));
+        ASSERT_EQ(object_table.offset_size, offset_sizes[i]);
+        ThsnSlice key_slice = thsn_slice_make_empty();
+        ThsnValueHandle element_handle = thsn_value_handle_not_found();
+        ASSERT_SUCCESS(thsn_document_object_index_element(document, object_table, 0, &key_slice,
+                                                          &element_handle));
+        ASSERT_STRN_EQ(key_slice.data, "a", key_slice.size);
+        ASSERT_SUCCESS(thsn_document_read_object_indexed(document, object_handle, &object_table));
+        ASSERT_SUCCESS(thsn_document_object_index(document, object_table,
+                                                  thsn_slice_from_c_str("b"), &element_handle));
+        ThsnValueArrayTable inner_array_table;
+        ASSERT_SUCCESS(thsn_document_read_array(document, element_handle, &inner_array_table));
+        ASSERT_EQ(thsn_document_array_length(inner_array_table), 2);
+        ASSERT_SUCCESS(
+            thsn_document_index_array_element(document, inner_array_table, 1, &element_handle));
+        int64_t value = 0;
+        ASSERT_SUCCESS(thsn_document_read_int64(document, element_handle, &value));
+        ASSERT_EQ(value, 2);
+        ASSERT_SUCCESS(thsn_document_freeze(document));
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+    ASSERT_TRUE(segment_sizes[0] < segment_sizes[1]);
+}
+
+TEST(parses_out_of_range_ints_as_doubles) {
+    struct {
+        const char* input;
+        double expected;
+    } test_values[] = {{"9223372036854775807", 9223372036854775807.0},
+                       {"-9223372036854775808", -9223372036854775808.0},
+                       {"9223372036854775808", 9223372036854775808.0},
+                       {"-123456789012345678901234567890", -123456789012345678901234567890.0}};
+    for (size_t i = 0; i < sizeof(test_values) / sizeof(test_values[0]); ++i) {
+        ThsnSlice input_slice = thsn_slice_from_c_str(test_values[i].input);
+        ThsnDocument* document;
+        ASSERT_SUCCESS(thsn_document_parse(&input_slice, &document));
+        double number = 0.0;
+        ASSERT_SUCCESS(thsn_document_read_number(document, thsn_value_handle_first(), &number));
+        ASSERT_EQ(number, test_values[i].expected);
+        thsn_document_free(&document);
+    }
+}
+
+TEST(reads_integers_exactly) {
+    const char* document_str =
+        "[9007199254740993, -9223372036854775808, 18446744073709551615, 1e3, 1.5, "
+        "-2.0, 1e30]";
+    ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+    ThsnDocument* document;
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+    ThsnValueArrayTable array_table;
+    ASSERT_SUCCESS(thsn_document_read_array(document, thsn_value_handle_first(), &array_table));
+
+    struct {
+        ThsnNumberType number_type;
+        bool is_int64;
+        int64_t int64_value;
+        bool is_uint64;
+        uint64_t uint64_value;
+    } expected[] = {
+        {THSN_NUMBER_INT, true, 9007199254740993LL, true, 9007199254740993ULL},
+        {THSN_NUMBER_INT, true, INT64_MIN, false, 0},
+        {THSN_NUMBER_UINT, false, 0, true, UINT64_MAX},
+        {THSN_NUMBER_DOUBLE, true, 1000, true, 1000},
+        {THSN_NUMBER_DOUBLE, false, 0, false, 0},
+        {THSN_NUMBER_DOUBLE, true, -2, false, 0},
+        {THSN_NUMBER_DOUBLE, false, 0, false, 0},
+    };
+    ASSERT_EQ(thsn_document_array_length(array_table), sizeof(expected) / sizeof(expected[0]));
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+        ThsnValueHandle element_handle = thsn_value_handle_not_found();
+        ASSERT_SUCCESS(
+            thsn_document_index_array_element(document, array_table, i, &element_handle));
+        ThsnNumberType number_type = THSN_NUMBER_INT;
+        ASSERT_SUCCESS(thsn_document_number_type(document, element_handle, &number_type));
+        ASSERT_EQ(number_type, expected[i].number_type);
+        int64_t int64_value = 0;
+        ASSERT_EQ(thsn_document_read_int64(document, element_handle, &int64_value),
+                  expected[i].is_int64 ? THSN_RESULT_SUCCESS : THSN_RESULT_INPUT_ERROR);
+        ASSERT_EQ(int64_value, expected[i].int64_value);
+        uint64_t uint64_value = 0;
+        ASSERT_EQ(thsn_document_read_uint64(document, element_handle, &uint64_value),
+                  expected[i].is_uint64 ? THSN_RESULT_SUCCESS : THSN_RESULT_INPUT_ERROR);
+        ASSERT_EQ(uint64_value, expected[i].uint64_value);
+    }
+    thsn_document_free(&document);
+}
+
+TEST(reads_decoded_strings) {
+    const char* document_str =
+        "[\"plain\", \"tab\\t\", \"\\u00e9t\\u00e9 with a tail longer than fifteen\", "
+        "{\"k\\\"ey\": 1}]";
+    ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+    ThsnDocument* document;
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+    ThsnValueArrayTable array_table;
+    ASSERT_SUCCESS(thsn_document_read_array(document, thsn_value_handle_first(), &array_table));
+
+    struct {
+        const char* raw;
+        const char* decoded;
+    } expected[] = {
+        {"plain", "plain"},
+        {"tab\\t", "tab\t"},
+        {"\\u00e9t\\u00e9 with a tail longer than fifteen",
+         "\xc3\xa9t\xc3\xa9 with a tail longer than fifteen"},
+    };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+        ThsnValueHandle element_handle = thsn_value_handle_not_found();
+        ASSERT_SUCCESS(
+            thsn_document_index_array_element(document, array_table, i, &element_handle));
+        ThsnSlice raw_slice = thsn_slice_make_empty();
+        ASSERT_SUCCESS(thsn_document_read_string(document, element_handle, &raw_slice));
+        ASSERT_EQ(raw_slice.size, strlen(expected[i].raw));
+        ASSERT_STRN_EQ(raw_slice.data, expected[i].raw, raw_slice.size);
+        ThsnSlice decoded_slice = thsn_slice_make_empty();
+        ASSERT_SUCCESS(thsn_document_read_string_decoded(document, element_handle, &decoded_slice));
+        ASSERT_EQ(decoded_slice.size, strlen(expected[i].decoded));
+        ASSERT_STRN_EQ(decoded_slice.data, expected[i].decoded, decoded_slice.size);
+        if (strcmp(expected[i].raw, expected[i].decoded) == 0) {
+            /* Strings without escapes aren't copied */
+            ASSERT_EQ(decoded_slice.data, raw_slice.data);
+        } else {
+            ASSERT_NEQ(decoded_slice.data, raw_slice.data);
+        }
+        /* The decoded copy is cached */
+        ThsnSlice cached_slice = thsn_slice_make_empty();
+        ASSERT_SUCCESS(thsn_document_read_string_decoded(document, element_handle, &cached_slice));
+        ASSERT_EQ(cached_slice.data, decoded_slice.data);
+        ASSERT_EQ(cached_slice.size, decoded_slice.size);
+    }
+
+    /* Keys with escapes are still stored raw */
+    ThsnValueHandle object_handle = thsn_value_handle_not_found();
+    ASSERT_SUCCESS(thsn_document_index_array_element(document, array_table, 3, &object_handle));
+    ThsnValueObjectTable object_table;
+    ASSERT_SUCCESS(thsn_document_read_object_sorted(document, object_handle, &object_table));
+    ThsnValueHandle value_handle = thsn_value_handle_not_found();
+    ASSERT_SUCCESS(thsn_document_object_index(document, object_table,
+                                              thsn_slice_from_c_str("k\\\"ey"), &value_handle));
+    ASSERT_FALSE(thsn_value_handle_is_not_found(value_handle));
+    thsn_document_free(&document);
+}
+
+#define FROZEN_OBJECTS_COUNT 64
+#define FROZEN_KEYS_COUNT 32
+#define FROZEN_READERS_COUNT 8
+
+static bool frozen_value_matches(ThsnDocument* document, ThsnValueHandle value_handle,
+                                 size_t object_no, size_t key_no) {
+    char expected_str[32];
+    snprintf(expected_str, sizeof(expected_str), "%zu\t%zu", object_no, key_no);
+    ThsnSlice value_slice = thsn_slice_make_empty();
+    return thsn_document_read_string_decoded(document, value_handle, &value_slice) ==
+               THSN_RESULT_SUCCESS &&
+           value_slice.size == strlen(expected_str) &&
+           memcmp(value_slice.data, expected_str, value_slice.size) == 0;
+}
+
+/* Returns the number of mismatches */
+static int read_frozen_document(void* user_data) {
+    ThsnDocument* document = user_data;
+    int mismatches = 0;
+    char key_str[32];
+    for (size_t round = 0; round < 16; ++round) {
+        ThsnValueArrayTable array_table;
+        if (thsn_document_read_array(document, thsn_value_handle_first(), &array_table) !=
+            THSN_RESULT_SUCCESS) {
+            return 1;
+        }
+        for (size_t i = 0; i < FROZEN_OBJECTS_COUNT; ++i) {
+            const size_t object_no = (i * 7 + round) % FROZEN_OBJECTS_COUNT;
+            ThsnValueHandle object_handle = thsn_value_handle_not_found();
+            ThsnValueObjectTable sorted_table;
+            ThsnValueObjectTable indexed_table;
+            if (thsn_document_index_array_element(document, array_table, object_no,
+                                                  &object_handle) != THSN_RESULT_SUCCESS ||
+                thsn_document_read_object_sorted(document, object_handle, &sorted_table) !=
+                    THSN_RESULT_SUCCESS ||
+                thsn_document_read_object_indexed(document, object_handle, &indexed_table) !=
+                    THSN_RESULT_SUCCESS) {
+                return 1;
+            }
+            for (size_t key_no = 0; key_no < FROZEN_KEYS_COUNT; ++key_no) {
+                snprintf(key_str, sizeof(key_str), "key_%03zu", key_no);
+                ThsnSlice key_slice = thsn_slice_make_empty();
+                ThsnValueHandle value_handle = thsn_value_handle_not_found();
+                if (thsn_document_object_index_element(document, sorted_table, key_no, &key_slice,
+                                                       &value_handle) != THSN_RESULT_SUCCESS ||
+                    key_slice.size != strlen(key_str) ||
+                    memcmp(key_slice.data, key_str, key_slice.size) != 0 ||
+                    !frozen_value_matches(document, value_handle, object_no, key_no)) {
+                    ++mismatches;
+                }
+                if (thsn_document_object_index(document, indexed_table,
+                                               thsn_slice_from_c_str(key_str),
+                                               &value_handle) != THSN_RESULT_SUCCESS ||
+                    !frozen_value_matches(document, value_handle, object_no, key_no)) {
+                    ++mismatches;
+                }
+            }
+        }
+    }
+    return mismatches;
+}
+
+static ThsnResult make_frozen_document_str(ThsnVector* document_str) {
+    BAIL_ON_ERROR(thsn_vector_allocate(document_str, 64 * 1024));
+    char kv_str[64];
+    for (size_t object_no = 0; object_no < FROZEN_OBJECTS_COUNT; ++object_no) {
+        BAIL_ON_ERROR(
+            thsn_vector_push(document_str, thsn_slice_from_c_str(object_no == 0 ? "[{" : ", {")));
+        /* Keys go in reverse, so the sorted tables differ from the parsed ones */
+        for (size_t key_no = FROZEN_KEYS_COUNT; key_no-- > 0;) {
+            snprintf(kv_str, sizeof(kv_str), "\"key_%03zu\": \"%zu\\t%zu\"%s", key_no, object_no,
+                     key_no, key_no == 0 ? "}" : ", ");
+            BAIL_ON_ERROR(thsn_vector_push(document_str, thsn_slice_from_c_str(kv_str)));
+        }
+    }
+    return thsn_vector_push(document_str, thsn_slice_from_c_str("]"));
+}
+
+TEST(reads_frozen_documents_concurrently) {
+    ThsnVector document_str = thsn_vector_make_empty();
+    ASSERT_SUCCESS(make_frozen_document_str(&document_str));
+
+    ThsnSlice document_slice = thsn_vector_as_slice(document_str);
+    ThsnDocument* document;
+    ASSERT_SUCCESS(thsn_document_parse_multithreaded(&document_slice, &document, 4));
+    ASSERT_SUCCESS(thsn_document_freeze(document));
+    /* Freezing twice is harmless */
+    ASSERT_SUCCESS(thsn_document_freeze(document));
+
+    thrd_t readers[FROZEN_READERS_COUNT];
+    size_t readers_count = 0;
+    for (; readers_count < FROZEN_READERS_COUNT; ++readers_count) {
+        if (thrd_create(&readers[readers_count], read_frozen_document, document) !=
+            thrd_success) {
+            break;
+        }
+    }
+    ASSERT_EQ(readers_count, FROZEN_READERS_COUNT);
+    for (size_t i = 0; i < readers_count; ++i) {
+        int mismatches = -1;
+        thrd_join(readers[i], &mismatches);
+        ASSERT_EQ(mismatches, 0);
+    }
+    thsn_document_free(&document);
+    ASSERT_SUCCESS(thsn_vector_free(&document_str));
+}
+
 TEST(fails_at_invalid_documents) {
     ThsnDocument* document;
     const char* documents[] = {",", ":",   "]",     "(",   "{",     "}",
@@ -92,6 +455,155 @@ TEST(fails_at_invalid_documents) {
 
 #define RAW(...) #__VA_ARGS__
 
+/* `[{"id": 0, "name": "element 0", "tags": ["a", "b\"]"]}, ...]`, large
+ * enough to be split between several threads */
+static char* generate_array_document(size_t elements_count) {
+    const size_t max_element_size = 128;
+    char* document_str = malloc(elements_count * max_element_size + 3);
+    if (document_str == NULL) {
+        return NULL;
+    }
+    char* write_point = document_str;
+    *write_point++ = '[';
+    for (size_t i = 0; i < elements_count; ++i) {
+        write_point += snprintf(
+            write_point, max_element_size,
+            "%s{\"id\": %zu, \"name\": \"element %zu\", \"tags\": "
+            "[\"a\", \"b\\\"]\"]}",
+            i == 0 ? "" : ", ", i, i);
+    }
+    *write_point++ = ']';
+    *write_point = '\0';
+    return document_str;
+}
+
+static size_t check_array_document(ThsnDocument* document,
+                                   size_t elements_count) {
+    size_t mismatches = 0;
+    ThsnValueArrayTable array_table;
+    if (thsn_document_read_array(document, thsn_value_handle_first(),
+                                 &array_table) != THSN_RESULT_SUCCESS ||
+        thsn_document_array_length(array_table) != elements_count) {
+        return elements_count;
+    }
+    for (size_t i = 0; i < elements_count; ++i) {
+        ThsnValueHandle element_handle = thsn_value_handle_not_found();
+        ThsnValueObjectTable object_table;
+        ThsnValueHandle id_handle;
+        double id = -1;
+        if (thsn_document_index_array_element(document, array_table, i,
+                                              &element_handle) !=
+                THSN_RESULT_SUCCESS ||
+            thsn_document_read_object_sorted(document, element_handle,
+                                             &object_table) !=
+                THSN_RESULT_SUCCESS ||
+            thsn_document_object_index(document, object_table,
+                                       thsn_slice_from_c_str("id"),
+                                       &id_handle) != THSN_RESULT_SUCCESS ||
+            thsn_document_read_number(document, id_handle, &id) !=
+                THSN_RESULT_SUCCESS ||
+            id != (double)i) {
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+TEST(parses_large_documents_with_threads) {
+    const size_t elements_count = 2000;
+    char* document_str = generate_array_document(elements_count);
+    ASSERT_NEQ(document_str, NULL);
+    const size_t threads_counts[] = {1, 2, 3, 4, 8};
+    for (size_t i = 0; i < sizeof(threads_counts) / sizeof(threads_counts[0]);
+         ++i) {
+        ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+        ThsnDocument* document;
+        ASSERT_SUCCESS(thsn_document_parse_multithreaded(
+            &document_slice, &document, threads_counts[i]));
+        ASSERT_EQ(check_array_document(document, elements_count), 0);
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+    free(document_str);
+}
+
+TEST(parses_documents_in_more_chunks_than_threads) {
+    /* Large enough for more than 255 segments with 40 threads */
+    const size_t elements_count = 600000;
+    char* document_str = generate_array_document(elements_count);
+    ASSERT_NEQ(document_str, NULL);
+    const size_t threads_counts[] = {2, 4, 40};
+    for (size_t i = 0; i < sizeof(threads_counts) / sizeof(threads_counts[0]);
+         ++i) {
+        ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+        ThsnDocument* document;
+        ASSERT_SUCCESS(thsn_document_parse_multithreaded(
+            &document_slice, &document, threads_counts[i]));
+        if (threads_counts[i] == 40) {
+            ASSERT_TRUE(document->segment_count > UINT8_MAX);
+        }
+        ASSERT_EQ(check_array_document(document, elements_count), 0);
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+    free(document_str);
+}
+
+TEST(parses_documents_in_more_chunks_than_segments) {
+    /* Some 18 chunks with 4 threads */
+    const size_t elements_count = 20000;
+    char* document_str = generate_array_document(elements_count);
+    ASSERT_NEQ(document_str, NULL);
+    const size_t max_segments_counts[] = {1, 2, 5};
+    for (size_t i = 0;
+         i < sizeof(max_segments_counts) / sizeof(max_segments_counts[0]);
+         ++i) {
+        for (int copy_strings = 0; copy_strings <= 1; ++copy_strings) {
+            ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+            ThsnDocument* document;
+            ASSERT_SUCCESS(thsn_document_parse_in_threads(
+                NULL, &document_slice, &document, 4, copy_strings,
+                max_segments_counts[i]));
+            ASSERT_TRUE(document->segment_count <= max_segments_counts[i]);
+            ASSERT_EQ(check_array_document(document, elements_count), 0);
+            ASSERT_SUCCESS(thsn_document_free(&document));
+        }
+    }
+    ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+    ThsnDocument* document;
+    ASSERT_INPUT_ERROR(thsn_document_parse_in_threads(
+        NULL, &document_slice, &document, 4, false, 0));
+    free(document_str);
+}
+
+TEST(parses_documents_with_pool) {
+    ThsnParserPool* pool = NULL;
+    ASSERT_NULL_INPUT_ERROR(thsn_parser_pool_create(4, NULL));
+    ASSERT_INPUT_ERROR(thsn_parser_pool_create(0, &pool));
+    ASSERT_SUCCESS(thsn_parser_pool_create(4, &pool));
+    const size_t elements_counts[] = {1, 10, 2000, 500, 3000};
+    for (size_t i = 0;
+         i < sizeof(elements_counts) / sizeof(elements_counts[0]); ++i) {
+        char* document_str = generate_array_document(elements_counts[i]);
+        ASSERT_NEQ(document_str, NULL);
+        ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+        ThsnDocument* document;
+        ASSERT_SUCCESS(
+            thsn_document_parse_with_pool(pool, &document_slice, &document));
+        ASSERT_EQ(check_array_document(document, elements_counts[i]), 0);
+        ASSERT_SUCCESS(thsn_document_free(&document));
+        free(document_str);
+    }
+    const char* invalid_documents[] = {"[1, 2}", "{\"a\": [1, 2, 3, {}]"};
+    for (size_t i = 0;
+         i < sizeof(invalid_documents) / sizeof(invalid_documents[0]); ++i) {
+        ThsnSlice document_slice = thsn_slice_from_c_str(invalid_documents[i]);
+        ThsnDocument* document;
+        ASSERT_INPUT_ERROR(
+            thsn_document_parse_with_pool(pool, &document_slice, &document));
+    }
+    ASSERT_SUCCESS(thsn_parser_pool_free(&pool));
+    ASSERT_EQ(pool, NULL);
+}
+
 TEST(parses_a_document_and_navigates_through_it) {
     const char* document_str = RAW([
         {"processed" : false, "items" : [ "apples", "oragnes" ], "cost" : 123.00},
@@ -132,12 +644,1206 @@ TEST(parses_a_document_and_navigates_through_it) {
     ASSERT_EQ(thsn_document_array_length(array_table), 1);
     ASSERT_SUCCESS(thsn_document_free(&document));
 }
+TEST(reuses_documents_for_parsing) {
+    const char* documents[] = {RAW({"ab" : [ 1, 2, 3 ], "c" : {"d" : null}}), RAW([ 1, "x" ]),
+                               "\"\\u0041bc\"", RAW(42)};
+    const ThsnValueType value_types[] = {THSN_VALUE_OBJECT, THSN_VALUE_ARRAY, THSN_VALUE_STRING,
+                                         THSN_VALUE_NUMBER};
+    ThsnDocument* document = NULL;
+    char* segment_data = NULL;
+    char* stack_data = NULL;
+    for (size_t round = 0; round < 3; ++round) {
+        for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); ++i) {
+            ThsnSlice document_slice = thsn_slice_from_c_str(documents[i]);
+            ASSERT_SUCCESS(thsn_document_parse_into(&document, &document_slice));
+            ThsnValueType value_type;
+            ASSERT_SUCCESS(
+                thsn_document_value_type(document, thsn_value_handle_first(), &value_type));
+            ASSERT_EQ(value_type, value_types[i]);
+            if (value_type == THSN_VALUE_OBJECT) {
+                ThsnValueObjectTable object_table;
+                ASSERT_SUCCESS(thsn_document_read_object_indexed(
+                    document, thsn_value_handle_first(), &object_table));
+                ThsnValueHandle element_handle;
+                ASSERT_SUCCESS(thsn_document_object_index(
+                    document, object_table, thsn_slice_from_c_str("ab"), &element_handle));
+                ASSERT_SUCCESS(thsn_document_value_type(document, element_handle, &value_type));
+                ASSERT_EQ(value_type, THSN_VALUE_ARRAY);
+            } else if (value_type == THSN_VALUE_STRING) {
+                ThsnSlice string_slice;
+                ASSERT_SUCCESS(thsn_document_read_string_decoded(
+                    document, thsn_value_handle_first(), &string_slice));
+                ASSERT_EQ(string_slice.size, 3);
+                ASSERT_EQ(memcmp(string_slice.data, "Abc", 3), 0);
+            }
+            if (round == 0 && i == 0) {
+                segment_data = document->segments[0].data;
+                stack_data = document->parser_stack.data;
+            }
+            /* The buffers fit all the documents after the first one */
+            ASSERT_EQ(document->segments[0].data, segment_data);
+            ASSERT_EQ(document->parser_stack.data, stack_data);
+        }
+        ThsnSlice invalid_slice = thsn_slice_from_c_str("[1, 2}");
+        ASSERT_INPUT_ERROR(thsn_document_parse_into(&document, &invalid_slice));
+        ASSERT_EQ(document->segments[0].size, 0);
+    }
+    ASSERT_SUCCESS(thsn_document_free(&document));
+    ASSERT_EQ(document, NULL);
+    /* Documents from the multithreaded parser can be reused too */
+    ThsnSlice document_slice = thsn_slice_from_c_str(RAW([ [1], [2], [3], [4] ]));
+    ASSERT_SUCCESS(thsn_document_parse_multithreaded(&document_slice, &document, 4));
+    document_slice = thsn_slice_from_c_str(RAW({"a" : 1}));
+    ASSERT_SUCCESS(thsn_document_parse_into(&document, &document_slice));
+    ASSERT_EQ(document->segment_count, 1);
+    ThsnValueType value_type = THSN_VALUE_NULL;
+    ASSERT_SUCCESS(thsn_document_value_type(document, thsn_value_handle_first(), &value_type));
+    ASSERT_EQ(value_type, THSN_VALUE_OBJECT);
+    ASSERT_SUCCESS(thsn_document_free(&document));
+}
+
+typedef struct {
+    atomic_size_t allocations_count;
+    atomic_size_t live_count;
+    /* Checks the sizes passed to `reallocate` and `free` */
+    atomic_size_t live_size;
+} CountingAllocator;
+
+static void* counting_allocate(void* user_data, size_t size) {
+    CountingAllocator* counting_allocator = user_data;
+    atomic_fetch_add(&counting_allocator->allocations_count, 1);
+    atomic_fetch_add(&counting_allocator->live_count, 1);
+    atomic_fetch_add(&counting_allocator->live_size, size);
+    return malloc(size);
+}
+
+static void* counting_reallocate(void* user_data, void* ptr, size_t old_size, size_t new_size) {
+    CountingAllocator* counting_allocator = user_data;
+    atomic_fetch_sub(&counting_allocator->live_size, old_size);
+    atomic_fetch_add(&counting_allocator->live_size, new_size);
+    return realloc(ptr, new_size);
+}
+
+static void counting_free(void* user_data, void* ptr, size_t size) {
+    CountingAllocator* counting_allocator = user_data;
+    atomic_fetch_sub(&counting_allocator->live_count, 1);
+    atomic_fetch_sub(&counting_allocator->live_size, size);
+    free(ptr);
+}
+
+TEST(parses_documents_with_allocators) {
+    ThsnVector document_str = thsn_vector_make_empty();
+    ASSERT_SUCCESS(make_frozen_document_str(&document_str));
+    CountingAllocator counting_allocator = {0};
+    const ThsnAllocator allocator = {.allocate = counting_allocate,
+                                     .reallocate = counting_reallocate,
+                                     .free = counting_free,
+                                     .user_data = &counting_allocator};
+    ThsnParserPool* pool = NULL;
+    ASSERT_SUCCESS(thsn_parser_pool_create(4, &pool));
+    for (size_t parse_call = 0; parse_call < 3; ++parse_call) {
+        ThsnSlice document_slice = thsn_vector_as_slice(document_str);
+        ThsnDocument* document = NULL;
+        switch (parse_call) {
+            case 0:
+                ASSERT_SUCCESS(
+                    thsn_document_parse_with_allocator(&allocator, &document_slice, &document));
+                break;
+            case 1:
+                ASSERT_SUCCESS(thsn_document_parse_multithreaded_with_allocator(
+                    &allocator, &document_slice, &document, 4));
+                break;
+            default:
+                ASSERT_SUCCESS(thsn_document_parse_with_pool_and_allocator(
+                    pool, &allocator, &document_slice, &document));
+                break;
+        }
+        /* Fills the caches too */
+        ASSERT_EQ(read_frozen_document(document), 0);
+        ASSERT_SUCCESS(thsn_document_free(&document));
+        ASSERT_EQ(atomic_load(&counting_allocator.live_count), 0);
+        ASSERT_EQ(atomic_load(&counting_allocator.live_size), 0);
+    }
+    ASSERT_TRUE(atomic_load(&counting_allocator.allocations_count) > 0);
+    ThsnSlice invalid_slice = thsn_slice_from_c_str("[1, 2}");
+    ThsnDocument* document = NULL;
+    ASSERT_INPUT_ERROR(thsn_document_parse_with_allocator(&allocator, &invalid_slice, &document));
+    ASSERT_EQ(atomic_load(&counting_allocator.live_count), 0);
+    ASSERT_EQ(atomic_load(&counting_allocator.live_size), 0);
+    ASSERT_SUCCESS(thsn_parser_pool_free(&pool));
+    ASSERT_SUCCESS(thsn_vector_free(&document_str));
+}
+
+TEST(parses_documents_into_bump_arenas) {
+    ThsnVector document_str = thsn_vector_make_empty();
+    ASSERT_SUCCESS(make_frozen_document_str(&document_str));
+    ThsnBumpArena* bump_arena = NULL;
+    ASSERT_SUCCESS(thsn_bump_arena_create(&bump_arena));
+    const ThsnAllocator allocator = thsn_bump_arena_allocator(bump_arena);
+    ThsnParserPool* pool = NULL;
+    ASSERT_SUCCESS(thsn_parser_pool_create(4, &pool));
+    for (size_t request = 0; request < 4; ++request) {
+        ThsnSlice document_slice = thsn_vector_as_slice(document_str);
+        ThsnDocument* document = NULL;
+        ASSERT_SUCCESS(thsn_document_parse_with_pool_and_allocator(pool, &allocator,
+                                                                   &document_slice, &document));
+        ASSERT_EQ(read_frozen_document(document), 0);
+        ThsnDocument* small_document = NULL;
+        ASSERT_SUCCESS(thsn_document_create(&allocator, &small_document));
+        for (size_t i = 0; i < 3; ++i) {
+            ThsnSlice small_slice = thsn_slice_from_c_str("{\"a\": [1, \"b\\n\"]}");
+            ASSERT_SUCCESS(thsn_document_parse_into(&small_document, &small_slice));
+        }
+        ThsnValueType value_type = THSN_VALUE_NULL;
+        ASSERT_SUCCESS(
+            thsn_document_value_type(small_document, thsn_value_handle_first(), &value_type));
+        ASSERT_EQ(value_type, THSN_VALUE_OBJECT);
+        /* The first document stays valid until the reset */
+        ASSERT_EQ(read_frozen_document(document), 0);
+        ASSERT_SUCCESS(thsn_bump_arena_reset(bump_arena));
+    }
+    ASSERT_SUCCESS(thsn_parser_pool_free(&pool));
+    ASSERT_SUCCESS(thsn_bump_arena_free(&bump_arena));
+    ASSERT_EQ(bump_arena, NULL);
+    ASSERT_SUCCESS(thsn_vector_free(&document_str));
+}
+
+TEST(reuses_bump_arena_chunks_after_resets) {
+    char* document_str = generate_array_document(20000);
+    ASSERT_NEQ(document_str, NULL);
+    CountingAllocator counting_allocator = {0};
+    const ThsnAllocator chunks_allocator = {.allocate = counting_allocate,
+                                            .reallocate = counting_reallocate,
+                                            .free = counting_free,
+                                            .user_data = &counting_allocator};
+    ThsnBumpArena* bump_arena = NULL;
+    ASSERT_SUCCESS(thsn_bump_arena_create_with_allocator(&chunks_allocator, &bump_arena));
+    const ThsnAllocator allocator = thsn_bump_arena_allocator(bump_arena);
+    size_t first_footprint = 0;
+    for (size_t request = 0; request < 40; ++request) {
+        ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+        ThsnDocument* document = NULL;
+        ASSERT_SUCCESS(thsn_document_parse_multithreaded_with_allocator(
+            &allocator, &document_slice, &document, 4));
+        ASSERT_EQ(check_array_document(document, 20000), 0);
+        ASSERT_SUCCESS(thsn_bump_arena_reset(bump_arena));
+        if (request == 0) {
+            first_footprint = atomic_load(&counting_allocator.live_size);
+        }
+    }
+    /* Requests of the same shape reuse the chunks instead of adding more with
+     * each reset */
+    ASSERT_TRUE(atomic_load(&counting_allocator.live_size) <= 2 * first_footprint);
+    ASSERT_SUCCESS(thsn_bump_arena_free(&bump_arena));
+    ASSERT_EQ(atomic_load(&counting_allocator.live_count), 0);
+    ASSERT_EQ(atomic_load(&counting_allocator.live_size), 0);
+    free(document_str);
+}
+
+TEST(parses_mapped_files) {
+    const char* path = "thsn_test_parses_mapped_files.json";
+    const char* document_str = "{\"a\": [\"not a small string\", 1], \"d\\n\": null}";
+    FILE* file = fopen(path, "wb");
+    ASSERT_NEQ(file, NULL);
+    ASSERT_EQ(fwrite(document_str, 1, strlen(document_str), file), strlen(document_str));
+    ASSERT_EQ(fclose(file), 0);
+    for (size_t threads_count = 1; threads_count <= 2; ++threads_count) {
+        ThsnDocument* document = NULL;
+        ASSERT_SUCCESS(thsn_document_parse_file(path, &document, threads_count));
+        ASSERT_EQ(document->mapped_input.size, strlen(document_str));
+        ThsnValueObjectTable object_table;
+        ASSERT_SUCCESS(
+            thsn_document_read_object_sorted(document, thsn_value_handle_first(), &object_table));
+        ThsnValueHandle array_handle = thsn_value_handle_not_found();
+        ASSERT_SUCCESS(thsn_document_object_index(document, object_table,
+                                                  thsn_slice_from_c_str("a"), &array_handle));
+        ThsnValueArrayTable array_table;
+        ASSERT_SUCCESS(thsn_document_read_array(document, array_handle, &array_table));
+        ThsnValueHandle string_handle = thsn_value_handle_not_found();
+        ASSERT_SUCCESS(thsn_document_index_array_element(document, array_table, 0, &string_handle));
+        ThsnSlice string_slice = thsn_slice_make_empty();
+        ASSERT_SUCCESS(thsn_document_read_string(document, string_handle, &string_slice));
+        /* Points into the mapping, the input isn't copied */
+        ASSERT_TRUE(string_slice.data >= document->mapped_input.data &&
+                    string_slice.data < thsn_slice_end(document->mapped_input));
+        ASSERT_STRN_EQ(string_slice.data, "not a small string", string_slice.size);
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+    ThsnDocument* document = NULL;
+    ASSERT_EQ(remove(path), 0);
+    ASSERT_INPUT_ERROR(thsn_document_parse_file(path, &document, 1));
+    ASSERT_INPUT_ERROR(thsn_document_parse_file(path, &document, 0));
+    ASSERT_NULL_INPUT_ERROR(thsn_document_parse_file(NULL, &document, 1));
+}
+
+typedef struct {
+    size_t records_count;
+    size_t abort_at;
+    bool in_order;
+} RecordsState;
+
+static ThsnVisitorResult check_record(void* user_data, size_t record_no, ThsnDocument* document) {
+    RecordsState* state = user_data;
+    ThsnValueObjectTable object_table;
+    ThsnValueHandle id_handle = thsn_value_handle_not_found();
+    int64_t id = -1;
+    if (thsn_document_read_object(document, thsn_value_handle_first(), &object_table) !=
+            THSN_RESULT_SUCCESS ||
+        thsn_document_object_index(document, object_table, thsn_slice_from_c_str("id"),
+                                   &id_handle) != THSN_RESULT_SUCCESS ||
+        thsn_document_read_int64(document, id_handle, &id) != THSN_RESULT_SUCCESS ||
+        record_no != state->records_count || id != (int64_t)record_no) {
+        state->in_order = false;
+    }
+    thsn_document_free(&document);
+    return state->records_count++ == state->abort_at ? THSN_VISITOR_RESULT_ABORT_SUCCESS
+                                                     : THSN_VISITOR_RESULT_CONTINUE;
+}
+
+static ThsnResult make_ndjson_str(ThsnVector* json_lines_str, size_t invalid_record_no) {
+    char record[64];
+    for (size_t i = 0; i < 1000; ++i) {
+        const char* format = i == invalid_record_no ? "{\"id\": %zu} 1\n"
+                             : i % 3 == 0           ? "{\"id\": %zu, \"tags\": [\"a\\nb\"]}\r\n"
+                                                    : "  {\"id\": %zu}\n";
+        const int record_size = snprintf(record, sizeof(record), format, i);
+        BAIL_ON_ERROR(thsn_vector_push(json_lines_str, thsn_slice_make(record, record_size)));
+        if (i % 100 == 0) {
+            BAIL_ON_ERROR(thsn_vector_push(json_lines_str, thsn_slice_from_c_str(" \n\n")));
+        }
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+TEST(parses_ndjson_records_in_order) {
+    ThsnVector json_lines_str = thsn_vector_make_empty();
+    ASSERT_SUCCESS(make_ndjson_str(&json_lines_str, SIZE_MAX));
+    ThsnVector invalid_json_lines_str = thsn_vector_make_empty();
+    ASSERT_SUCCESS(make_ndjson_str(&invalid_json_lines_str, 700));
+    for (size_t threads_count = 1; threads_count <= 4; ++threads_count) {
+        RecordsState state = {.abort_at = SIZE_MAX, .in_order = true};
+        ASSERT_SUCCESS(thsn_document_parse_ndjson(thsn_vector_as_slice(json_lines_str),
+                                                  threads_count, check_record, &state));
+        ASSERT_EQ(state.records_count, 1000);
+        ASSERT_TRUE(state.in_order);
+
+        state = (RecordsState){.abort_at = 300, .in_order = true};
+        ASSERT_SUCCESS(thsn_document_parse_ndjson(thsn_vector_as_slice(json_lines_str),
+                                                  threads_count, check_record, &state));
+        ASSERT_EQ(state.records_count, 301);
+        ASSERT_TRUE(state.in_order);
+
+        /* Records before the invalid one are passed on */
+        state = (RecordsState){.abort_at = SIZE_MAX, .in_order = true};
+        ASSERT_INPUT_ERROR(thsn_document_parse_ndjson(thsn_vector_as_slice(invalid_json_lines_str),
+                                                      threads_count, check_record, &state));
+        ASSERT_EQ(state.records_count, 700);
+        ASSERT_TRUE(state.in_order);
+    }
+    RecordsState state = {.abort_at = SIZE_MAX, .in_order = true};
+    ASSERT_SUCCESS(
+        thsn_document_parse_ndjson(thsn_slice_from_c_str(""), 2, check_record, &state));
+    ASSERT_EQ(state.records_count, 0);
+    ASSERT_INPUT_ERROR(thsn_document_parse_ndjson(thsn_slice_from_c_str("{\"id\": 0}\n{"), 1,
+                                                  check_record, &state));
+    ASSERT_EQ(state.records_count, 1);
+    ASSERT_INPUT_ERROR(
+        thsn_document_parse_ndjson(thsn_vector_as_slice(json_lines_str), 0, check_record, &state));
+    ASSERT_NULL_INPUT_ERROR(
+        thsn_document_parse_ndjson(thsn_vector_as_slice(json_lines_str), 1, NULL, &state));
+    ASSERT_SUCCESS(thsn_vector_free(&json_lines_str));
+    ASSERT_SUCCESS(thsn_vector_free(&invalid_json_lines_str));
+}
+
+static bool values_match(ThsnDocument* document, ThsnValueHandle value_handle,
+                         ThsnDocument* other_document, ThsnValueHandle other_value_handle) {
+    ThsnValueType value_type;
+    ThsnValueType other_value_type;
+    if (thsn_document_value_type(document, value_handle, &value_type) != THSN_RESULT_SUCCESS ||
+        thsn_document_value_type(other_document, other_value_handle, &other_value_type) !=
+            THSN_RESULT_SUCCESS ||
+        value_type != other_value_type) {
+        return false;
+    }
+    switch (value_type) {
+        case THSN_VALUE_NULL:
+            return true;
+        case THSN_VALUE_BOOL: {
+            bool value;
+            bool other_value;
+            return thsn_document_read_bool(document, value_handle, &value) ==
+                       THSN_RESULT_SUCCESS &&
+                   thsn_document_read_bool(other_document, other_value_handle, &other_value) ==
+                       THSN_RESULT_SUCCESS &&
+                   value == other_value;
+        }
+        case THSN_VALUE_NUMBER: {
+            double value;
+            double other_value;
+            return thsn_document_read_number(document, value_handle, &value) ==
+                       THSN_RESULT_SUCCESS &&
+                   thsn_document_read_number(other_document, other_value_handle, &other_value) ==
+                       THSN_RESULT_SUCCESS &&
+                   value == other_value;
+        }
+        case THSN_VALUE_STRING: {
+            ThsnSlice value;
+            ThsnSlice other_value;
+            return thsn_document_read_string_decoded(document, value_handle, &value) ==
+                       THSN_RESULT_SUCCESS &&
+                   thsn_document_read_string_decoded(other_document, other_value_handle,
+                                                     &other_value) == THSN_RESULT_SUCCESS &&
+                   value.size == other_value.size &&
+                   memcmp(value.data, other_value.data, value.size) == 0;
+        }
+        case THSN_VALUE_ARRAY: {
+            ThsnValueArrayTable table;
+            ThsnValueArrayTable other_table;
+            if (thsn_document_read_array(document, value_handle, &table) != THSN_RESULT_SUCCESS ||
+                thsn_document_read_array(other_document, other_value_handle, &other_table) !=
+                    THSN_RESULT_SUCCESS ||
+                thsn_document_array_length(table) != thsn_document_array_length(other_table)) {
+                return false;
+            }
+            for (size_t i = 0; i < thsn_document_array_length(table); ++i) {
+                ThsnValueHandle element_handle;
+                ThsnValueHandle other_element_handle;
+                if (thsn_document_index_array_element(document, table, i, &element_handle) !=
+                        THSN_RESULT_SUCCESS ||
+                    thsn_document_index_array_element(other_document, other_table, i,
+                                                      &other_element_handle) !=
+                        THSN_RESULT_SUCCESS ||
+                    !values_match(document, element_handle, other_document,
+                                  other_element_handle)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case THSN_VALUE_OBJECT: {
+            ThsnValueObjectTable table;
+            ThsnValueObjectTable other_table;
+            if (thsn_document_read_object(document, value_handle, &table) != THSN_RESULT_SUCCESS ||
+                thsn_document_read_object(other_document, other_value_handle, &other_table) !=
+                    THSN_RESULT_SUCCESS ||
+                thsn_document_object_length(table) != thsn_document_object_length(other_table)) {
+                return false;
+            }
+            for (size_t i = 0; i < thsn_document_object_length(table); ++i) {
+                ThsnSlice key;
+                ThsnSlice other_key;
+                ThsnValueHandle element_handle;
+                ThsnValueHandle other_element_handle;
+                if (thsn_document_object_index_element(document, table, i, &key,
+                                                       &element_handle) != THSN_RESULT_SUCCESS ||
+                    thsn_document_object_index_element(other_document, other_table, i, &other_key,
+                                                       &other_element_handle) !=
+                        THSN_RESULT_SUCCESS ||
+                    key.size != other_key.size || memcmp(key.data, other_key.data, key.size) != 0 ||
+                    !values_match(document, element_handle, other_document,
+                                  other_element_handle)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST(parses_documents_pushed_in_chunks) {
+    const char* document_str =
+        " {\"a long key, not a small string\": [1, -2.5e+3, 12345678901234567890, true, false, "
+        "null], \"e\\\"sc\": \"\\u00e9 and a long escaped string\\\\\", \"\": [{}, [], \"\"],"
+        " \"n\": 0.125} ";
+    ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+    ThsnDocument* expected_document = NULL;
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &expected_document));
+    ThsnPushParser* push_parser = NULL;
+    ASSERT_SUCCESS(thsn_push_parser_create(NULL, &push_parser));
+    char chunk[256];
+    for (size_t chunk_size = 1; chunk_size <= strlen(document_str); ++chunk_size) {
+        for (size_t offset = 0; offset < strlen(document_str); offset += chunk_size) {
+            const size_t size = offset + chunk_size < strlen(document_str)
+                                    ? chunk_size
+                                    : strlen(document_str) - offset;
+            /* The chunk gets overwritten, nothing may point into it */
+            memcpy(chunk, document_str + offset, size);
+            ASSERT_SUCCESS(thsn_push_parser_feed(push_parser, thsn_slice_make(chunk, size)));
+            memset(chunk, '?', sizeof(chunk));
+        }
+        ThsnDocument* document = NULL;
+        ASSERT_SUCCESS(thsn_push_parser_finish(push_parser, &document));
+        ASSERT_TRUE(values_match(document, thsn_value_handle_first(), expected_document,
+                                 thsn_value_handle_first()));
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+    ASSERT_SUCCESS(thsn_document_free(&expected_document));
+
+    const char* scalars[] = {"12", "-1.5e10", "true", "null", "\"a\\\"b\""};
+    for (size_t i = 0; i < sizeof(scalars) / sizeof(scalars[0]); ++i) {
+        for (size_t split = 0; split <= strlen(scalars[i]); ++split) {
+            ASSERT_SUCCESS(thsn_push_parser_feed(push_parser, thsn_slice_make(scalars[i], split)));
+            ASSERT_SUCCESS(thsn_push_parser_feed(
+                push_parser, thsn_slice_from_c_str(scalars[i] + split)));
+            ThsnDocument* document = NULL;
+            ASSERT_SUCCESS(thsn_push_parser_finish(push_parser, &document));
+            document_slice = thsn_slice_from_c_str(scalars[i]);
+            ASSERT_SUCCESS(thsn_document_parse(&document_slice, &expected_document));
+            ASSERT_TRUE(values_match(document, thsn_value_handle_first(), expected_document,
+                                     thsn_value_handle_first()));
+            ASSERT_SUCCESS(thsn_document_free(&document));
+            ASSERT_SUCCESS(thsn_document_free(&expected_document));
+        }
+    }
+
+    const char* invalid_documents[] = {"[1, 2", "tru", "[1] 2", "\"abc", "1e+", "{\"a\" 1}", "[x]"};
+    for (size_t i = 0; i < sizeof(invalid_documents) / sizeof(invalid_documents[0]); ++i) {
+        const ThsnResult feed_result =
+            thsn_push_parser_feed(push_parser, thsn_slice_from_c_str(invalid_documents[i]));
+        ThsnDocument* document = NULL;
+        ASSERT_INPUT_ERROR(thsn_push_parser_finish(push_parser, &document));
+        ASSERT_EQ(document, NULL);
+        if (feed_result != THSN_RESULT_SUCCESS) {
+            ASSERT_INPUT_ERROR(feed_result);
+        }
+    }
+    ASSERT_SUCCESS(thsn_push_parser_free(&push_parser));
+    ASSERT_EQ(push_parser, NULL);
+    ASSERT_NULL_INPUT_ERROR(thsn_push_parser_feed(NULL, thsn_slice_from_c_str("1")));
+}
+
+/* Logs every callback with its context, skipping values under "skip" keys */
+static ThsnVisitorResult log_visit(const ThsnVisitorContext* context, void* user_data,
+                                   const char* event) {
+    char entry[128];
+    const int entry_size =
+        snprintf(entry, sizeof(entry), "%s:%.*s:%d%d%d ", event, (int)context->key.size,
+                 context->key.data == NULL ? "" : context->key.data, context->in_array,
+                 context->in_object, context->last);
+    if (thsn_vector_push(user_data, thsn_slice_make(entry, entry_size)) != THSN_RESULT_SUCCESS) {
+        return THSN_VISITOR_RESULT_ABORT_ERROR;
+    }
+    return context->key.size == 4 && memcmp(context->key.data, "skip", 4) == 0
+               ? THSN_VISITOR_RESULT_SKIP
+               : THSN_VISITOR_RESULT_CONTINUE;
+}
+
+static ThsnVisitorResult log_number(const ThsnVisitorContext* context, void* user_data,
+                                    double value) {
+    char event[32];
+    snprintf(event, sizeof(event), "%g", value);
+    return log_visit(context, user_data, event);
+}
+
+static ThsnVisitorResult log_null(const ThsnVisitorContext* context, void* user_data) {
+    return log_visit(context, user_data, "null");
+}
+
+static ThsnVisitorResult log_bool(const ThsnVisitorContext* context, void* user_data, bool value) {
+    return log_visit(context, user_data, value ? "true" : "false");
+}
+
+static ThsnVisitorResult log_string(const ThsnVisitorContext* context, void* user_data,
+                                    ThsnSlice value) {
+    char event[64];
+    snprintf(event, sizeof(event), "\"%.*s\"", (int)value.size, value.data);
+    return log_visit(context, user_data, event);
+}
+
+static ThsnVisitorResult log_array_start(const ThsnVisitorContext* context, void* user_data) {
+    return log_visit(context, user_data, "[");
+}
+
+static ThsnVisitorResult log_array_end(const ThsnVisitorContext* context, void* user_data) {
+    return log_visit(context, user_data, "]");
+}
+
+static ThsnVisitorResult log_object_start(const ThsnVisitorContext* context, void* user_data) {
+    return log_visit(context, user_data, "{");
+}
+
+static ThsnVisitorResult log_object_end(const ThsnVisitorContext* context, void* user_data) {
+    return log_visit(context, user_data, "}");
+}
+
+TEST(visits_documents_while_parsing) {
+    const ThsnVisitorVTable vtables[] = {
+        {.visit_number = log_number,
+         .visit_null = log_null,
+         .visit_bool = log_bool,
+         .visit_string = log_string,
+         .visit_array_start = log_array_start,
+         .visit_array_end = log_array_end,
+         .visit_object_start = log_object_start,
+         .visit_object_end = log_object_end},
+        /* Without the composite callbacks, nothing is looked ahead */
+        {.visit_number = log_number, .visit_string = log_string},
+    };
+    /* Brackets in strings and whitespace between blocks, and deep nesting
+     * that only takes one pass to tell which composites are last */
+    char brackets_str[101];
+    memset(brackets_str, ']', sizeof(brackets_str) - 1);
+    brackets_str[sizeof(brackets_str) - 1] = '\0';
+    char spaced_document[512];
+    snprintf(spaced_document, sizeof(spaced_document),
+             "[[1]%100s, [\"%s\"]%100s, {\"k\": [\"\\\"]]\", []]}]", "",
+             brackets_str, "");
+    const size_t depth = 100000;
+    char* deep_document = malloc(2 * depth + 1);
+    ASSERT_NEQ(deep_document, NULL);
+    memset(deep_document, '[', depth);
+    memset(deep_document + depth, ']', depth);
+    deep_document[2 * depth] = '\0';
+    const char* documents[] = {
+        "[1, 2.5, \"s\\\"tr\", null, true, false]",
+        "{\"a\": {\"b\": [[], {}, [1, [2]]], \"skip\": [1, {\"]\": \"[\"}]}, \"c\": [{}], "
+        "\"skip\": {\"x\": [1, \"}\"]}, \"d\": -3e2}",
+        "[[[[[]]]], {\"skip\": 1, \"last\": {\"in\": [true]}}]",
+        "\"just a string\"",
+        "{\"skip\": [\"}\"]}",
+        "[]",
+        spaced_document,
+        deep_document,
+    };
+    for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); ++i) {
+        ThsnSlice document_slice = thsn_slice_from_c_str(documents[i]);
+        ThsnDocument* document = NULL;
+        ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+        for (size_t j = 0; j < sizeof(vtables) / sizeof(vtables[0]); ++j) {
+            ThsnVector expected_log = thsn_vector_make_empty();
+            ThsnVector log = thsn_vector_make_empty();
+            ASSERT_SUCCESS(thsn_vector_allocate(&expected_log, 1024));
+            ASSERT_SUCCESS(thsn_vector_allocate(&log, 1024));
+            ASSERT_SUCCESS(thsn_document_visit(document, &vtables[j], &expected_log));
+            ThsnSlice visited_slice = thsn_slice_from_c_str(documents[i]);
+            ASSERT_SUCCESS(thsn_parse_visit(&visited_slice, &vtables[j], &log));
+            ASSERT_EQ(thsn_vector_current_offset(log), thsn_vector_current_offset(expected_log));
+            ASSERT_STRN_EQ(log.buffer, expected_log.buffer, thsn_vector_current_offset(log));
+            ASSERT_SUCCESS(thsn_vector_free(&log));
+            ASSERT_SUCCESS(thsn_vector_free(&expected_log));
+        }
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+    free(deep_document);
+    /* Skipped values are only bracket-matched */
+    const char* invalid_documents[] = {"{\"skip\": [}, \"a\": 1}", "{\"a\": [}, \"b\": 1}",
+                                       "[1 2]", "{\"a\" 1}", "[1, 2", "{\"skip\": [1, 2}"};
+    for (size_t i = 0; i < sizeof(invalid_documents) / sizeof(invalid_documents[0]); ++i) {
+        ThsnVector log = thsn_vector_make_empty();
+        ASSERT_SUCCESS(thsn_vector_allocate(&log, 1024));
+        ThsnSlice visited_slice = thsn_slice_from_c_str(invalid_documents[i]);
+        ASSERT_EQ(thsn_parse_visit(&visited_slice, &vtables[0], &log),
+                  i == 0 ? THSN_RESULT_SUCCESS : THSN_RESULT_INPUT_ERROR);
+        ASSERT_SUCCESS(thsn_vector_free(&log));
+    }
+}
+
+static int64_t query_int64(ThsnDocument* document, const char* path_str) {
+    ThsnPath* path = NULL;
+    ThsnValueHandle value_handle = thsn_value_handle_not_found();
+    int64_t value = -1;
+    if (thsn_path_compile(thsn_slice_from_c_str(path_str), &path) != THSN_RESULT_SUCCESS ||
+        thsn_document_query(document, path, &value_handle) != THSN_RESULT_SUCCESS ||
+        thsn_document_read_int64(document, value_handle, &value) != THSN_RESULT_SUCCESS) {
+        value = -1;
+    }
+    thsn_path_free(&path);
+    return value;
+}
+
+static bool query_is_not_found(ThsnDocument* document, const char* path_str) {
+    ThsnPath* path = NULL;
+    ThsnValueHandle value_handle = thsn_value_handle_first();
+    const bool not_found =
+        thsn_path_compile(thsn_slice_from_c_str(path_str), &path) == THSN_RESULT_SUCCESS &&
+        thsn_document_query(document, path, &value_handle) == THSN_RESULT_SUCCESS &&
+        thsn_value_handle_is_not_found(value_handle);
+    thsn_path_free(&path);
+    return not_found;
+}
+
+TEST(queries_compiled_paths) {
+    const char* document_str = RAW(
+        [{"statuses": [{"retweet_count": 0}, {"retweet_count": 1, "a/b": 2, "m~n": 3, "0": 4,
+                                              "": 5, "key with a long name": [6, 7]}]},
+         8]);
+    /* Objects are looked up one key at a time, in the sorted tables and in the hash indexes */
+    for (size_t caches = 0; caches < 3; ++caches) {
+        ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+        ThsnDocument* document;
+        ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+        if (caches == 1) {
+            const char* object_paths[] = {"/0", "/0/statuses/1"};
+            for (size_t i = 0; i < sizeof(object_paths) / sizeof(object_paths[0]); ++i) {
+                ThsnPath* path = NULL;
+                ThsnValueHandle object_handle;
+                ThsnValueObjectTable object_table;
+                ASSERT_SUCCESS(thsn_path_compile(thsn_slice_from_c_str(object_paths[i]), &path));
+                ASSERT_SUCCESS(thsn_document_query(document, path, &object_handle));
+                ASSERT_SUCCESS(
+                    thsn_document_read_object_sorted(document, object_handle, &object_table));
+                ASSERT_SUCCESS(thsn_path_free(&path));
+            }
+        } else if (caches == 2) {
+            ASSERT_SUCCESS(thsn_document_freeze(document));
+        }
+        ASSERT_EQ(query_int64(document, "/0/statuses/0/retweet_count"), 0);
+        ASSERT_EQ(query_int64(document, "/0/statuses/1/retweet_count"), 1);
+        ASSERT_EQ(query_int64(document, "/0/statuses/1/a~1b"), 2);
+        ASSERT_EQ(query_int64(document, "/0/statuses/1/m~0n"), 3);
+        ASSERT_EQ(query_int64(document, "/0/statuses/1/0"), 4);
+        ASSERT_EQ(query_int64(document, "/0/statuses/1/"), 5);
+        ASSERT_EQ(query_int64(document, "/0/statuses/1/key with a long name/1"), 7);
+        ASSERT_EQ(query_int64(document, "/1"), 8);
+
+        ASSERT_TRUE(query_is_not_found(document, "/2"));
+        ASSERT_TRUE(query_is_not_found(document, "/-"));
+        ASSERT_TRUE(query_is_not_found(document, "/01"));
+        ASSERT_TRUE(query_is_not_found(document, "/0/statuses/1/a/b"));
+        ASSERT_TRUE(query_is_not_found(document, "/0/statuses/1/retweet_count/0"));
+        ASSERT_TRUE(query_is_not_found(document, "/0/statuses/18446744073709551616"));
+        ASSERT_TRUE(query_is_not_found(document, "/0/Statuses"));
+        ASSERT_TRUE(query_is_not_found(document, "/1/0"));
+
+        ThsnPath* path = NULL;
+        ThsnValueHandle value_handle = thsn_value_handle_not_found();
+        ASSERT_SUCCESS(thsn_path_compile(thsn_slice_make_empty(), &path));
+        ASSERT_SUCCESS(thsn_document_query(document, path, &value_handle));
+        ThsnValueType value_type = THSN_VALUE_NULL;
+        ASSERT_SUCCESS(thsn_document_value_type(document, value_handle, &value_type));
+        ASSERT_EQ(value_type, THSN_VALUE_ARRAY);
+        ASSERT_NULL_INPUT_ERROR(thsn_document_query(document, NULL, &value_handle));
+        ASSERT_NULL_INPUT_ERROR(thsn_document_query(NULL, path, &value_handle));
+        ASSERT_SUCCESS(thsn_path_free(&path));
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+
+    /* Keys are compared decoded, whether or not their decoded copies are there */
+    char escaped_document_str[512];
+    char long_key[301];
+    memset(long_key, 'k', sizeof(long_key) - 1);
+    long_key[sizeof(long_key) - 1] = '\0';
+    snprintf(escaped_document_str, sizeof(escaped_document_str),
+             "{\"x\\\"y\": 11, \"a\\/b\": 3, \"a\\u0062\": 1, \"c\\\\d\": 12, \"e\\\\\\\\f\": 13, "
+             "\"%s\\u0041\": 14, \"plain\": 15, \"o\": {\"xy\": 16}}",
+             long_key);
+    for (size_t caches = 0; caches < 3; ++caches) {
+        ThsnSlice document_slice = thsn_slice_from_c_str(escaped_document_str);
+        ThsnDocument* document;
+        ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+        if (caches == 1) {
+            ASSERT_SUCCESS(thsn_document_freeze(document));
+        }
+        /* Compaction rebuilds the objects, along with their escaped keys marks */
+        if (caches == 2) {
+            ASSERT_SUCCESS(thsn_document_compact(document, 1));
+        }
+        ASSERT_EQ(query_int64(document, "/x\"y"), 11);
+        ASSERT_EQ(query_int64(document, "/a~1b"), 3);
+        ASSERT_EQ(query_int64(document, "/ab"), 1);
+        ASSERT_EQ(query_int64(document, "/c\\d"), 12);
+        ASSERT_EQ(query_int64(document, "/e\\\\f"), 13);
+        char long_path[320];
+        snprintf(long_path, sizeof(long_path), "/%sA", long_key);
+        ASSERT_EQ(query_int64(document, long_path), 14);
+        ASSERT_EQ(query_int64(document, "/plain"), 15);
+        ASSERT_EQ(query_int64(document, "/o/xy"), 16);
+        ASSERT_TRUE(query_is_not_found(document, "/o/x\"y"));
+        /* Not by their spelling in the input */
+        ASSERT_TRUE(query_is_not_found(document, "/x\\\"y"));
+        ASSERT_TRUE(query_is_not_found(document, "/a\\~1b"));
+        ASSERT_TRUE(query_is_not_found(document, "/a\\u0062"));
+        ASSERT_TRUE(query_is_not_found(document, "/c\\\\d"));
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+
+    const char* invalid_paths[] = {"a", "a/b", "/~", "/~2", "/a~/b"};
+    for (size_t i = 0; i < sizeof(invalid_paths) / sizeof(invalid_paths[0]); ++i) {
+        ThsnPath* path = NULL;
+        ASSERT_INPUT_ERROR(thsn_path_compile(thsn_slice_from_c_str(invalid_paths[i]), &path));
+        ASSERT_EQ(path, NULL);
+    }
+    ASSERT_NULL_INPUT_ERROR(thsn_path_compile(thsn_slice_from_c_str("/0"), NULL));
+
+    /* Values split between the segments of a multithreaded parse */
+    const size_t elements_count = 2000;
+    char* array_document_str = generate_array_document(elements_count);
+    ASSERT_NEQ(array_document_str, NULL);
+    ThsnSlice document_slice = thsn_slice_from_c_str(array_document_str);
+    ThsnDocument* document;
+    ASSERT_SUCCESS(thsn_document_parse_multithreaded(&document_slice, &document, 4));
+    char path_str[64];
+    size_t mismatches = 0;
+    for (size_t i = 0; i < elements_count; ++i) {
+        snprintf(path_str, sizeof(path_str), "/%zu/id", i);
+        mismatches += query_int64(document, path_str) != (int64_t)i;
+    }
+    ASSERT_EQ(mismatches, 0);
+    ASSERT_SUCCESS(thsn_document_free(&document));
+    free(array_document_str);
+}
+
+TEST(parses_documents_lazily) {
+    const char* documents_strs[] = {
+        RAW({"a": [1, [2, [3, {"b": "a string with ] and } in it"}]], {}, []], "c": {"d": null},
+             "e\"sc": "é", "": [{}, [[]], ""], "n": -0.125}),
+        RAW([[], {}, [[], {}], "[not an array]"]),
+        RAW("a scalar root"),
+        RAW([{"k": 1}, {"k": 2}]),
+    };
+    for (size_t i = 0; i < sizeof(documents_strs) / sizeof(documents_strs[0]); ++i) {
+        ThsnSlice document_slice = thsn_slice_from_c_str(documents_strs[i]);
+        ThsnDocument* expected_document = NULL;
+        ASSERT_SUCCESS(thsn_document_parse(&document_slice, &expected_document));
+        ThsnSlice lazy_document_slice = thsn_slice_from_c_str(documents_strs[i]);
+        ThsnDocument* document = NULL;
+        ASSERT_SUCCESS(thsn_document_parse_lazy(&lazy_document_slice, &document));
+        ASSERT_EQ(lazy_document_slice.size, document_slice.size);
+        ASSERT_TRUE(values_match(document, thsn_value_handle_first(), expected_document,
+                                 thsn_value_handle_first()));
+        /* Parsed composites are read from the segments they went to */
+        ASSERT_TRUE(values_match(document, thsn_value_handle_first(), expected_document,
+                                 thsn_value_handle_first()));
+        ASSERT_SUCCESS(thsn_document_free(&document));
+        ASSERT_SUCCESS(thsn_document_free(&expected_document));
+    }
+
+    /* Nested values are only validated once they're read */
+    ThsnSlice invalid_document_slice = thsn_slice_from_c_str(RAW({"valid": 1, "invalid": [1 2]}));
+    ThsnDocument* document = NULL;
+    ASSERT_SUCCESS(thsn_document_parse_lazy(&invalid_document_slice, &document));
+    ASSERT_EQ(query_int64(document, "/valid"), 1);
+    ThsnPath* path = NULL;
+    ThsnValueHandle value_handle;
+    ASSERT_SUCCESS(thsn_path_compile(thsn_slice_from_c_str("/invalid/0"), &path));
+    ASSERT_INPUT_ERROR(thsn_document_query(document, path, &value_handle));
+    ASSERT_SUCCESS(thsn_path_free(&path));
+    ASSERT_INPUT_ERROR(thsn_document_freeze(document));
+    ASSERT_SUCCESS(thsn_document_free(&document));
+    const char* invalid_documents_strs[] = {"{", "[1 2]", "[[1, 2]", "{\"a\": [}"};
+    for (size_t i = 0; i < sizeof(invalid_documents_strs) / sizeof(invalid_documents_strs[0]);
+         ++i) {
+        invalid_document_slice = thsn_slice_from_c_str(invalid_documents_strs[i]);
+        ASSERT_INPUT_ERROR(thsn_document_parse_lazy(&invalid_document_slice, &document));
+        ASSERT_EQ(document, NULL);
+    }
+
+    /* Enough composites to fill several segments */
+    const size_t elements_count = 20000;
+    char* array_document_str = generate_array_document(elements_count);
+    ASSERT_NEQ(array_document_str, NULL);
+    ThsnSlice document_slice = thsn_slice_from_c_str(array_document_str);
+    ASSERT_SUCCESS(thsn_document_parse_lazy(&document_slice, &document));
+    ASSERT_EQ(query_int64(document, "/12345/id"), 12345);
+    ASSERT_SUCCESS(thsn_document_freeze(document));
+    ASSERT_TRUE(document->segment_count > 2);
+    ASSERT_EQ(check_array_document(document, elements_count), 0);
+    ASSERT_SUCCESS(thsn_document_free(&document));
+    free(array_document_str);
+}
+
+static bool serializes_as(ThsnDocument* document, const char* path_str,
+                          const ThsnSerializeOptions* options, const char* expected) {
+    ThsnPath* path = NULL;
+    ThsnValueHandle value_handle;
+    ThsnOutputBuffer output_buffer = {0};
+    const bool serialized =
+        thsn_path_compile(thsn_slice_from_c_str(path_str), &path) == THSN_RESULT_SUCCESS &&
+        thsn_document_query(document, path, &value_handle) == THSN_RESULT_SUCCESS &&
+        thsn_document_serialize(document, value_handle, options, &output_buffer) ==
+            THSN_RESULT_SUCCESS &&
+        output_buffer.size == strlen(expected) &&
+        memcmp(output_buffer.data, expected, output_buffer.size) == 0;
+    thsn_path_free(&path);
+    thsn_output_buffer_free(&output_buffer);
+    return serialized;
+}
+
+TEST(serializes_documents) {
+    const char* document_str =
+        "{\"s\": \"a\\\"b\\\\c\\u0001\\t\\u00e9\x01\", \"k\\u0041\": \"short\",\n"
+        " \"n\": [0, -1, 18446744073709551615, 1.50, 1e400, 0.1, -0.0],\n"
+        " \"l\": [true, false, null, {}, [], {\"o\": [[1]]}]}";
+    ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+    ThsnDocument* document;
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+    ASSERT_TRUE(serializes_as(document, "", NULL,
+                              "{\"s\":\"a\\\"b\\\\c\\u0001\\t\xc3\xa9\\u0001\",\"kA\":\"short\","
+                              "\"n\":[0,-1,18446744073709551615,1.5,1e999,0.1,-0.0],"
+                              "\"l\":[true,false,null,{},[],{\"o\":[[1]]}]}"));
+    const ThsnSerializeOptions pretty_options = {.pretty = true, .indent = 2};
+    ASSERT_TRUE(serializes_as(document, "/l", &pretty_options,
+                              "[\n  true,\n  false,\n  null,\n  {},\n  [],\n  {\n    \"o\": [\n"
+                              "      [\n        1\n      ]\n    ]\n  }\n]"));
+    ASSERT_TRUE(serializes_as(document, "/n/3", &pretty_options, "1.5"));
+    ASSERT_TRUE(serializes_as(document, "/l/5", NULL, "{\"o\":[[1]]}"));
+
+    /* Output is appended, and left as is on errors */
+    ThsnOutputBuffer output_buffer = {0};
+    ASSERT_SUCCESS(
+        thsn_document_serialize(document, thsn_value_handle_first(), NULL, &output_buffer));
+    const size_t output_size = output_buffer.size;
+    ASSERT_SUCCESS(
+        thsn_document_serialize(document, thsn_value_handle_first(), NULL, &output_buffer));
+    ASSERT_EQ(output_buffer.size, 2 * output_size);
+    ASSERT_EQ(memcmp(output_buffer.data, output_buffer.data + output_size, output_size), 0);
+    ASSERT_SUCCESS(thsn_document_free(&document));
+    document_slice = thsn_slice_from_c_str("[\"valid\", \"invalid \\x\"]");
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+    ASSERT_INPUT_ERROR(
+        thsn_document_serialize(document, thsn_value_handle_first(), NULL, &output_buffer));
+    ASSERT_EQ(output_buffer.size, 2 * output_size);
+    ASSERT_NULL_INPUT_ERROR(
+        thsn_document_serialize(document, thsn_value_handle_first(), NULL, NULL));
+    ASSERT_SUCCESS(thsn_document_free(&document));
+    ASSERT_SUCCESS(thsn_output_buffer_free(&output_buffer));
+    ASSERT_EQ(output_buffer.data, NULL);
+
+    /* Output parses back to the same values, from every kind of document */
+    const size_t elements_count = 2000;
+    char* array_document_str = generate_array_document(elements_count);
+    ASSERT_NEQ(array_document_str, NULL);
+    for (size_t kind = 0; kind < 3; ++kind) {
+        document_slice = thsn_slice_from_c_str(array_document_str);
+        if (kind == 0) {
+            ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+        } else if (kind == 1) {
+            ASSERT_SUCCESS(thsn_document_parse_multithreaded(&document_slice, &document, 4));
+        } else {
+            ASSERT_SUCCESS(thsn_document_parse_lazy(&document_slice, &document));
+        }
+        ASSERT_SUCCESS(thsn_document_serialize(document, thsn_value_handle_first(),
+                                               kind == 1 ? &pretty_options : NULL,
+                                               &output_buffer));
+        ThsnSlice output_slice = thsn_slice_make(output_buffer.data, output_buffer.size);
+        ThsnDocument* output_document;
+        ASSERT_SUCCESS(thsn_document_parse(&output_slice, &output_document));
+        ASSERT_TRUE(values_match(document, thsn_value_handle_first(), output_document,
+                                 thsn_value_handle_first()));
+        ASSERT_SUCCESS(thsn_document_free(&output_document));
+        ASSERT_SUCCESS(thsn_document_free(&document));
+        ASSERT_SUCCESS(thsn_output_buffer_free(&output_buffer));
+    }
+    free(array_document_str);
+}
+
+TEST(parses_self_contained_documents) {
+    ThsnVector document_str = thsn_vector_make_empty();
+    ASSERT_SUCCESS(thsn_vector_push(&document_str, thsn_slice_from_c_str("[")));
+    char element_str[160];
+    for (size_t i = 0; i < 3000; ++i) {
+        snprintf(element_str, sizeof(element_str),
+                 "%s{\"id\": %zu, \"a key long enough to be copied\": \"a string value %zu\", "
+                 "\"e\\u0073c\": \"\\u00e9\\\"\", \"short\": \"str\"}",
+                 i == 0 ? "" : ", ", i, i);
+        ASSERT_SUCCESS(thsn_vector_push(&document_str, thsn_slice_from_c_str(element_str)));
+    }
+    ASSERT_SUCCESS(thsn_vector_push(&document_str, thsn_slice_make("]", 2)));
+    ThsnSlice expected_document_slice = thsn_vector_as_slice(document_str);
+    --expected_document_slice.size;
+    ThsnDocument* expected_document;
+    ASSERT_SUCCESS(thsn_document_parse(&expected_document_slice, &expected_document));
+    const size_t threads_counts[] = {1, 4};
+    for (size_t i = 0; i < sizeof(threads_counts) / sizeof(threads_counts[0]); ++i) {
+        /* The input is gone by the time the document is read */
+        char* input = malloc(document_str.offset);
+        ASSERT_NEQ(input, NULL);
+        memcpy(input, document_str.buffer, document_str.offset);
+        ThsnSlice document_slice = thsn_slice_make(input, document_str.offset - 1);
+        ThsnDocument* document;
+        ASSERT_SUCCESS(
+            thsn_document_parse_self_contained(&document_slice, &document, threads_counts[i]));
+        memset(input, ' ', document_str.offset);
+        free(input);
+        ASSERT_TRUE(values_match(document, thsn_value_handle_first(), expected_document,
+                                 thsn_value_handle_first()));
+        ASSERT_EQ(query_int64(document, "/2999/id"), 2999);
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+    ASSERT_SUCCESS(thsn_document_free(&expected_document));
+
+    ThsnSlice invalid_document_slice = thsn_slice_from_c_str(RAW(["a string long enough", 1 2]));
+    ThsnDocument* document = NULL;
+    ASSERT_INPUT_ERROR(thsn_document_parse_self_contained(&invalid_document_slice, &document, 1));
+    ASSERT_EQ(document, NULL);
+    ASSERT_INPUT_ERROR(thsn_document_parse_self_contained(&invalid_document_slice, &document, 0));
+    ASSERT_SUCCESS(thsn_vector_free(&document_str));
+}
+
+static ThsnResult save_snapshot(ThsnDocument* document, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return THSN_RESULT_INPUT_ERROR;
+    }
+    const ThsnResult result = thsn_document_save(document, fileno(file));
+    return fclose(file) == 0 ? result : THSN_RESULT_INPUT_ERROR;
+}
+
+TEST(saves_and_loads_snapshots) {
+    const char* path = "thsn_test_saves_and_loads_snapshots.bin";
+    const char* document_str =
+        "{\"s\": \"a\\\"b\\u00e9\", \"long\": \"a string long enough to be stored apart\",\n"
+        " \"e\\u0073c\": [0, -1, 18446744073709551615, 1.5, true, false, null, {}, []]}";
+    ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+    ThsnDocument* document;
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+    ASSERT_SUCCESS(save_snapshot(document, path));
+    ASSERT_SUCCESS(thsn_document_free(&document));
+    ASSERT_SUCCESS(thsn_document_load_mmap(path, &document));
+    ASSERT_EQ(document->segment_count, 1);
+    ThsnSlice string_slice = thsn_slice_make_empty();
+    ThsnPath* path_s = NULL;
+    ThsnValueHandle value_handle;
+    ASSERT_SUCCESS(thsn_path_compile(thsn_slice_from_c_str("/s"), &path_s));
+    ASSERT_SUCCESS(thsn_document_query(document, path_s, &value_handle));
+    ASSERT_SUCCESS(thsn_path_free(&path_s));
+    ASSERT_SUCCESS(thsn_document_read_string_decoded(document, value_handle, &string_slice));
+    ASSERT_STRN_EQ(string_slice.data, "a\"b\xc3\xa9", string_slice.size);
+    /* Strings are read from the snapshot itself */
+    ASSERT_TRUE(string_slice.data >= document->mapped_input.data &&
+                string_slice.data < thsn_slice_end(document->mapped_input));
+    ASSERT_SUCCESS(thsn_document_freeze(document));
+    ASSERT_TRUE(serializes_as(document, "", NULL,
+                              "{\"s\":\"a\\\"b\xc3\xa9\","
+                              "\"long\":\"a string long enough to be stored apart\","
+                              "\"esc\":[0,-1,18446744073709551615,1.5,true,false,null,{},[]]}"));
+    /* A loaded document can be parsed into like any other */
+    document_slice = thsn_slice_from_c_str("[1]");
+    ASSERT_SUCCESS(thsn_document_parse_into(&document, &document_slice));
+    ASSERT_EQ(document->mapped_input.data, NULL);
+    ASSERT_TRUE(serializes_as(document, "", NULL, "[1]"));
+    ASSERT_SUCCESS(thsn_document_free(&document));
+
+    /* Snapshots of every kind of document read as the document */
+    const size_t elements_count = 3000;
+    char* array_document_str = generate_array_document(elements_count);
+    ASSERT_NEQ(array_document_str, NULL);
+    for (size_t kind = 0; kind < 3; ++kind) {
+        document_slice = thsn_slice_from_c_str(array_document_str);
+        if (kind == 0) {
+            ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+        } else if (kind == 1) {
+            ASSERT_SUCCESS(thsn_document_parse_multithreaded(&document_slice, &document, 4));
+        } else {
+            ASSERT_SUCCESS(thsn_document_parse_lazy(&document_slice, &document));
+        }
+        ASSERT_SUCCESS(save_snapshot(document, path));
+        ThsnDocument* loaded_document;
+        ASSERT_SUCCESS(thsn_document_load_mmap(path, &loaded_document));
+        ASSERT_TRUE(values_match(document, thsn_value_handle_first(), loaded_document,
+                                 thsn_value_handle_first()));
+        ASSERT_EQ(check_array_document(loaded_document, elements_count), 0);
+        ASSERT_SUCCESS(thsn_document_free(&loaded_document));
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+    free(array_document_str);
+
+    /* Corrupted and truncated snapshots are rejected */
+    FILE* file = fopen(path, "r+b");
+    ASSERT_NEQ(file, NULL);
+    ASSERT_EQ(fseek(file, -1, SEEK_END), 0);
+    ASSERT_EQ(fputc(' ', file), ' ');
+    ASSERT_EQ(fclose(file), 0);
+    document = NULL;
+    ASSERT_INPUT_ERROR(thsn_document_load_mmap(path, &document));
+    ASSERT_EQ(document, NULL);
+    file = fopen(path, "wb");
+    ASSERT_NEQ(file, NULL);
+    ASSERT_EQ(fwrite("THSNSNAP", 1, 8, file), 8);
+    ASSERT_EQ(fclose(file), 0);
+    ASSERT_INPUT_ERROR(thsn_document_load_mmap(path, &document));
+    ASSERT_EQ(remove(path), 0);
+    ASSERT_INPUT_ERROR(thsn_document_load_mmap(path, &document));
+    ASSERT_NULL_INPUT_ERROR(thsn_document_load_mmap(NULL, &document));
+    ASSERT_NULL_INPUT_ERROR(thsn_document_save(NULL, 1));
+}
+
+TEST(compacts_documents) {
+    /* Objects at the root are split between the threads as well */
+    char document_str[4096] = "{";
+    size_t document_size = 1;
+    for (size_t i = 0; i < 100; ++i) {
+        document_size += (size_t)snprintf(document_str + document_size,
+                                          sizeof(document_str) - document_size,
+                                          "%s\"k%zu\": [\"v\\u00e9%zu\", {\"n\": %zu}]",
+                                          i == 0 ? "" : ", ", i, i, i);
+    }
+    strcpy(document_str + document_size, "}");
+    ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+    ThsnDocument* document;
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+    ASSERT_SUCCESS(thsn_document_freeze(document));
+    ASSERT_SUCCESS(thsn_document_compact(document, 4));
+    ASSERT_EQ(document->segment_count, 1);
+    ASSERT_EQ(query_int64(document, "/k99/1/n"), 99);
+    ASSERT_TRUE(serializes_as(document, "/k42", NULL, "[\"v\xc3\xa9" "42\",{\"n\":42}]"));
+    ASSERT_SUCCESS(thsn_document_freeze(document));
+    ASSERT_TRUE(serializes_as(document, "/k0", NULL, "[\"v\xc3\xa9" "0\",{\"n\":0}]"));
+    ASSERT_SUCCESS(thsn_document_free(&document));
+
+    /* Compacted documents of every kind read as the document */
+    const size_t elements_count = 3000;
+    char* array_document_str = generate_array_document(elements_count);
+    ASSERT_NEQ(array_document_str, NULL);
+    document_slice = thsn_slice_from_c_str(array_document_str);
+    ThsnDocument* expected_document;
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &expected_document));
+    const size_t threads_counts[] = {1, 4};
+    for (size_t kind = 0; kind < 3; ++kind) {
+        for (size_t i = 0; i < 2; ++i) {
+            document_slice = thsn_slice_from_c_str(array_document_str);
+            if (kind == 0) {
+                ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+            } else if (kind == 1) {
+                ASSERT_SUCCESS(thsn_document_parse_multithreaded(&document_slice, &document, 4));
+            } else {
+                ASSERT_SUCCESS(thsn_document_parse_lazy(&document_slice, &document));
+            }
+            ASSERT_SUCCESS(thsn_document_compact(document, threads_counts[i]));
+            ASSERT_EQ(document->segment_count, 1);
+            ASSERT_TRUE(values_match(document, thsn_value_handle_first(), expected_document,
+                                     thsn_value_handle_first()));
+            ASSERT_EQ(check_array_document(document, elements_count), 0);
+            /* Compacted documents can be parsed into like any other */
+            document_slice = thsn_slice_from_c_str("[1]");
+            ASSERT_SUCCESS(thsn_document_parse_into(&document, &document_slice));
+            ASSERT_TRUE(serializes_as(document, "", NULL, "[1]"));
+            ASSERT_SUCCESS(thsn_document_free(&document));
+        }
+    }
+    ASSERT_SUCCESS(thsn_document_free(&expected_document));
+    free(array_document_str);
+
+    document_slice = thsn_slice_from_c_str("[1]");
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &document));
+    ASSERT_INPUT_ERROR(thsn_document_compact(document, 0));
+    ASSERT_SUCCESS(thsn_document_free(&document));
+    ASSERT_NULL_INPUT_ERROR(thsn_document_compact(NULL, 1));
+}
+
+TEST(parses_value_handles_as_first_array_elements) {
+    /* What the main thread sees of `[[{"id": 0}, {"id": 1}]]` when a chunk
+     * starts right after the inner `[` and a worker preparsed its first
+     * element into segment 1 */
+    ThsnDocument* document = NULL;
+    ASSERT_SUCCESS(thsn_document_allocate(&document, NULL, 2));
+    ThsnSlice element_slice = thsn_slice_from_c_str("{\"id\": 0}");
+    ThsnParserContext parser_context;
+    ASSERT_SUCCESS(
+        thsn_parser_context_init(&parser_context, NULL, element_slice.size));
+    bool finished = false;
+    /* Stops at the end of the input if a token fails to parse */
+    while (!finished && !thsn_slice_is_empty(element_slice)) {
+        ThsnToken token = THSN_TOKEN_EOF;
+        ThsnSlice token_slice = thsn_slice_make_empty();
+        ASSERT_SUCCESS(thsn_next_token(&element_slice, &token_slice, &token));
+        ASSERT_SUCCESS(thsn_parser_parse_next_token(&parser_context, token,
+                                                    token_slice, &finished));
+    }
+    ASSERT_SUCCESS(
+        thsn_parser_context_finish(&parser_context, &document->segments[1]));
+
+    ThsnSlice document_slice = thsn_slice_from_c_str("[[@, {\"id\": 1}]]");
+    ASSERT_SUCCESS(
+        thsn_parser_context_init(&parser_context, NULL, document_slice.size));
+    finished = false;
+    while (!finished && !thsn_slice_is_empty(document_slice)) {
+        ThsnToken token = THSN_TOKEN_EOF;
+        ThsnSlice token_slice = thsn_slice_make_empty();
+        /* `@` stands for the preparsed element */
+        if (document_slice.data[0] == '@') {
+            ASSERT_SUCCESS(thsn_parser_add_value_handle(
+                &parser_context,
+                (ThsnValueHandle){.segment_no = 1, .offset = 0}));
+            thsn_slice_advance_unsafe(&document_slice, 1);
+            continue;
+        }
+        ASSERT_SUCCESS(thsn_next_token(&document_slice, &token_slice, &token));
+        ASSERT_SUCCESS(thsn_parser_parse_next_token(&parser_context, token,
+                                                    token_slice, &finished));
+    }
+    ASSERT_SUCCESS(
+        thsn_parser_context_finish(&parser_context, &document->segments[0]));
+    document->segment_capacity = document->segments[0].size;
+    ASSERT_EQ(query_int64(document, "/0/0/id"), 0);
+    ASSERT_EQ(query_int64(document, "/0/1/id"), 1);
+    ASSERT_SUCCESS(thsn_document_free(&document));
+}
+
+TEST(parses_documents_with_chunks_starting_in_arrays) {
+    /* `[0, 0, ..., [{"id": 0, ...}, ...]]` with the second of two chunks
+     * starting right after the inner `[` */
+    const size_t elements_count = 200;
+    char* inner_str = generate_array_document(elements_count);
+    ASSERT_NEQ(inner_str, NULL);
+    const size_t inner_size = strlen(inner_str);
+    char* document_str = malloc(2 * inner_size + 2);
+    ASSERT_NEQ(document_str, NULL);
+    document_str[0] = '[';
+    memset(document_str + 1, ' ', inner_size - 1);
+    for (size_t i = 1; i + 3 <= inner_size; i += 3) {
+        memcpy(document_str + i, "0, ", 3);
+    }
+    memcpy(document_str + inner_size, inner_str, inner_size);
+    strcpy(document_str + 2 * inner_size, "]");
+    ThsnSlice document_slice = thsn_slice_from_c_str(document_str);
+    ThsnDocument* expected_document;
+    ASSERT_SUCCESS(thsn_document_parse(&document_slice, &expected_document));
+    const size_t inner_no = (inner_size - 1) / 3;
+    ThsnValueArrayTable array_table;
+    ASSERT_SUCCESS(thsn_document_read_array(
+        expected_document, thsn_value_handle_first(), &array_table));
+    ASSERT_EQ(thsn_document_array_length(array_table), inner_no + 1);
+    /* Whether a worker gets to the second chunk before the main thread does
+     * is up to the scheduler */
+    for (size_t i = 0; i < 100; ++i) {
+        document_slice = thsn_slice_from_c_str(document_str);
+        ThsnDocument* document;
+        ASSERT_SUCCESS(
+            thsn_document_parse_multithreaded(&document_slice, &document, 2));
+        ASSERT_TRUE(values_match(document, thsn_value_handle_first(),
+                                 expected_document,
+                                 thsn_value_handle_first()));
+        ASSERT_SUCCESS(thsn_document_free(&document));
+    }
+    ASSERT_SUCCESS(thsn_document_free(&expected_document));
+    free(document_str);
+    free(inner_str);
+}
+
 /* clang-format off */
 TEST_SUITE(document)
     indexes_object_by_key,
+    indexes_object_by_key_hash,
     parses_simple_documents,
+    parses_into_compact_and_wide_segments,
+    parses_out_of_range_ints_as_doubles,
+    reads_integers_exactly,
+    reads_decoded_strings,
+    reads_frozen_documents_concurrently,
     fails_at_invalid_documents,
     parses_a_document_and_navigates_through_it,
+    parses_large_documents_with_threads,
+    parses_documents_in_more_chunks_than_threads,
+    parses_documents_in_more_chunks_than_segments,
+    parses_value_handles_as_first_array_elements,
+    parses_documents_with_chunks_starting_in_arrays,
+    parses_documents_with_pool,
+    reuses_documents_for_parsing,
+    parses_documents_with_allocators,
+    parses_documents_into_bump_arenas,
+    reuses_bump_arena_chunks_after_resets,
+    parses_mapped_files,
+    parses_ndjson_records_in_order,
+    parses_documents_pushed_in_chunks,
+    visits_documents_while_parsing,
+    queries_compiled_paths,
+    parses_documents_lazily,
+    serializes_documents,
+    parses_self_contained_documents,
+    saves_and_loads_snapshots,
+    compacts_documents,
 END_TEST_SUITE()
 
 #endif
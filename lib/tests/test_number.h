@@ -0,0 +1,196 @@
+#ifndef THSN_TEST_NUMBER_H
+#define THSN_TEST_NUMBER_H
+
+#include <math.h>
+#include <stdio.h>
+
+#include "number.h"
+#include "testing.h"
+
+static bool same_double(double a, double b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+TEST(parses_ints_and_detects_overflow) {
+    struct {
+        const char* input;
+        bool fits;
+        long long value;
+    } test_values[] = {
+        {"0", true, 0},
+        {"-0", true, 0},
+        {"00012", true, 12},
+        {"-1234567890", true, -1234567890LL},
+        {"9223372036854775807", true, LLONG_MAX},
+        {"-9223372036854775808", true, LLONG_MIN},
+        {"9223372036854775808", false, 0},
+        {"-9223372036854775809", false, 0},
+        {"18446744073709551616", false, 0},
+        {"123456789012345678901234567890", false, 0},
+        {"-", false, 0},
+        {"", false, 0},
+        {"1.5", false, 0},
+    };
+    for (size_t i = 0; i < sizeof(test_values) / sizeof(test_values[0]); ++i) {
+        long long value = 0;
+        ASSERT_EQ(thsn_number_parse_int(
+                      thsn_slice_from_c_str(test_values[i].input), &value),
+                  test_values[i].fits);
+        if (test_values[i].fits) {
+            ASSERT_EQ(value, test_values[i].value);
+        }
+    }
+}
+
+TEST(parses_doubles_like_strtod) {
+    const char* test_values[] = {
+        "0",
+        "-0.0",
+        "1.",
+        "-.5",
+        "0.1",
+        "1e",
+        "1.e5",
+        "3.141592653589793",
+        "9007199254740993",
+        "9007199254740993e-3",
+        "1e22",
+        "1e23",
+        "8.98846567431158e307",
+        "1.7976931348623157e308",
+        "1.7976931348623159e308",
+        "1e309",
+        "2.2250738585072011e-308",
+        "2.2250738585072014e-308",
+        "4.9406564584124654e-324",
+        "2.4703282292062327e-324",
+        "2.4703282292062328e-324",
+        "1e-400",
+        "123456789012345678901234567890",
+        "0.000000000000000000000000000001000000000000000000000000000001",
+        "7.0420557077594588669468784357561207962098443483187940792729600000e-"
+        "59",
+        "1e99999999999999999999",
+        "-1e-99999999999999999999",
+    };
+    for (size_t i = 0; i < sizeof(test_values) / sizeof(test_values[0]); ++i) {
+        double value = NAN;
+        ASSERT_SUCCESS(thsn_number_parse_double(
+            thsn_slice_from_c_str(test_values[i]), &value));
+        ASSERT_TRUE(same_double(value, strtod(test_values[i], NULL)));
+    }
+
+    /* Random mantissas and exponents, including every rounding path */
+    char buffer[64];
+    uint64_t state = 42;
+    for (size_t i = 0; i < 20000; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        const int digits_count = 1 + (int)((state >> 33) % 20);
+        const int exponent = (int)((state >> 13) % 700) - 350;
+        int offset = 0;
+        if (state & 1) {
+            buffer[offset++] = '-';
+        }
+        for (int digit = 0; digit < digits_count; ++digit) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            buffer[offset++] = (char)('0' + (state >> 60) % 10);
+            if (digit == 0 && (state & 2)) {
+                buffer[offset++] = '.';
+            }
+        }
+        snprintf(buffer + offset, sizeof(buffer) - offset, "e%d", exponent);
+        double value = NAN;
+        ASSERT_SUCCESS(thsn_number_parse_double(thsn_slice_from_c_str(buffer),
+                                                &value));
+        ASSERT_TRUE(same_double(value, strtod(buffer, NULL)));
+    }
+}
+
+TEST(rejects_invalid_doubles) {
+    const char* test_values[] = {"", "-", ".", "-.", "e5", "1e5x", "1.2.3"};
+    for (size_t i = 0; i < sizeof(test_values) / sizeof(test_values[0]); ++i) {
+        double value;
+        ASSERT_INPUT_ERROR(thsn_number_parse_double(
+            thsn_slice_from_c_str(test_values[i]), &value));
+    }
+    ASSERT_NULL_INPUT_ERROR(
+        thsn_number_parse_double(thsn_slice_from_c_str("1"), NULL));
+}
+
+static bool formats_as(double value, const char* expected) {
+    char buffer[THSN_MAX_FORMATTED_NUMBER_SIZE];
+    const size_t size = thsn_number_format_double(value, buffer);
+    return size == strlen(expected) && memcmp(buffer, expected, size) == 0;
+}
+
+TEST(formats_numbers_shortest) {
+    char buffer[THSN_MAX_FORMATTED_NUMBER_SIZE];
+    ASSERT_EQ(thsn_number_format_uint(0, buffer), 1);
+    ASSERT_EQ(memcmp(buffer, "0", 1), 0);
+    ASSERT_EQ(thsn_number_format_uint(UINT64_MAX, buffer), 20);
+    ASSERT_EQ(memcmp(buffer, "18446744073709551615", 20), 0);
+    ASSERT_EQ(thsn_number_format_int(INT64_MIN, buffer), 20);
+    ASSERT_EQ(memcmp(buffer, "-9223372036854775808", 20), 0);
+    ASSERT_EQ(thsn_number_format_int(-1234567890, buffer), 11);
+    ASSERT_EQ(memcmp(buffer, "-1234567890", 11), 0);
+
+    struct {
+        double value;
+        const char* expected;
+    } test_values[] = {
+        {0.0, "0.0"},
+        {-0.0, "-0.0"},
+        {1.0, "1.0"},
+        {100.0, "100.0"},
+        {-0.125, "-0.125"},
+        {0.1, "0.1"},
+        {0.000001, "0.000001"},
+        {1e-7, "1e-7"},
+        {123456789012345678901.0, "123456789012345680000.0"},
+        {1e21, "1e21"},
+        {1.5e300, "1.5e300"},
+        {5e-324, "5e-324"},
+        {2.2250738585072014e-308, "2.2250738585072014e-308"},
+        {1.7976931348623157e308, "1.7976931348623157e308"},
+        {INFINITY, "1e999"},
+        {-INFINITY, "-1e999"},
+        {NAN, "null"},
+    };
+    for (size_t i = 0; i < sizeof(test_values) / sizeof(test_values[0]); ++i) {
+        ASSERT_TRUE(
+            formats_as(test_values[i].value, test_values[i].expected));
+    }
+
+    /* Random bit patterns parse back exactly, with no shorter form */
+    uint64_t state = 42;
+    for (size_t i = 0; i < 20000; ++i) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        double value;
+        memcpy(&value, &state, sizeof(value));
+        if (!isfinite(value)) {
+            continue;
+        }
+        const size_t size = thsn_number_format_double(value, buffer);
+        ASSERT_TRUE(size <= sizeof(buffer));
+        double parsed_value = NAN;
+        ASSERT_SUCCESS(thsn_number_parse_double(thsn_slice_make(buffer, size),
+                                                &parsed_value));
+        ASSERT_TRUE(same_double(parsed_value, value));
+        char shorter_buffer[64];
+        snprintf(shorter_buffer, sizeof(shorter_buffer), "%.15g", value);
+        if (strtod(shorter_buffer, NULL) == value) {
+            ASSERT_TRUE(size <= strlen(shorter_buffer) + 2);
+        }
+    }
+}
+
+/* clang-format off */
+
+TEST_SUITE(number)
+    parses_ints_and_detects_overflow,
+    parses_doubles_like_strtod,
+    rejects_invalid_doubles,
+    formats_numbers_shortest,
+END_TEST_SUITE()
+
+#endif
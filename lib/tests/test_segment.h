@@ -14,7 +14,7 @@ TEST(stores_and_reads_null) {
     ASSERT_NULL_INPUT_ERROR(thsn_segment_store_null(NULL));
     ASSERT_SUCCESS(thsn_segment_store_null(&vector));
     ThsnTag tag = THSN_TAG_VALUE_HANDLE;
-    ThsnSlice value_slice;
+    ThsnSlice value_slice = thsn_slice_make_empty();
     ASSERT_SUCCESS(thsn_segment_read_tagged_value(thsn_vector_as_slice(vector),
                                                   0, &tag, &value_slice));
     ASSERT_EQ(tag, thsn_tag_make(THSN_TAG_NULL, THSN_TAG_SIZE_EMPTY));
@@ -38,6 +38,16 @@ TEST(stores_and_reads_value_handle) {
     ASSERT_SUCCESS(THSN_SLICE_READ_VAR(value_slice, value_handle));
     ASSERT_TRUE(thsn_value_handle_is_not_found(value_handle));
     ASSERT_EQ(value_slice.size, 0);
+    const size_t handle_offset = thsn_vector_current_offset(vector);
+    ASSERT_SUCCESS(thsn_segment_store_value_handle(
+        &vector, (ThsnValueHandle){.segment_no = UINT16_MAX - 1,
+                                   .offset = (1ULL << 48) - 1}));
+    ASSERT_SUCCESS(thsn_segment_read_tagged_value(
+        thsn_vector_as_slice(vector), handle_offset, &tag, &value_slice));
+    ASSERT_SUCCESS(THSN_SLICE_READ_VAR(value_slice, value_handle));
+    ASSERT_FALSE(thsn_value_handle_is_not_found(value_handle));
+    ASSERT_EQ(value_handle.segment_no, UINT16_MAX - 1);
+    ASSERT_EQ(value_handle.offset, (1ULL << 48) - 1);
     ASSERT_SUCCESS(thsn_vector_free(&vector));
 }
 
@@ -130,6 +140,75 @@ TEST(stores_and_reads_ints) {
     ASSERT_SUCCESS(thsn_vector_free(&vector));
 }
 
+TEST(stores_and_reads_exact_integers) {
+    ASSERT_NULL_INPUT_ERROR(thsn_segment_store_uint(NULL, 0));
+
+    ThsnVector vector = thsn_vector_make_empty();
+    ASSERT_SUCCESS(thsn_vector_allocate(&vector, 1024));
+
+    long long signed_values[] = {-1, LLONG_MIN, (1LL << 53) + 1};
+    unsigned long long unsigned_values[] = {0, (unsigned long long)LLONG_MAX,
+                                            (unsigned long long)LLONG_MAX + 1,
+                                            ULLONG_MAX};
+    const size_t signed_count = sizeof(signed_values) / sizeof(signed_values[0]);
+    const size_t unsigned_count =
+        sizeof(unsigned_values) / sizeof(unsigned_values[0]);
+    size_t signed_offsets[sizeof(signed_values) / sizeof(signed_values[0])];
+    size_t unsigned_offsets[sizeof(unsigned_values) /
+                            sizeof(unsigned_values[0])];
+
+    for (size_t i = 0; i < signed_count; ++i) {
+        signed_offsets[i] = thsn_vector_current_offset(vector);
+        ASSERT_SUCCESS(thsn_segment_store_int(&vector, signed_values[i]));
+    }
+    for (size_t i = 0; i < unsigned_count; ++i) {
+        unsigned_offsets[i] = thsn_vector_current_offset(vector);
+        ASSERT_SUCCESS(thsn_segment_store_uint(&vector, unsigned_values[i]));
+    }
+
+    ThsnSlice slice = thsn_vector_as_slice(vector);
+
+    for (size_t i = 0; i < signed_count; ++i) {
+        ThsnNumberType number_type = THSN_NUMBER_DOUBLE;
+        ASSERT_SUCCESS(thsn_segment_read_number_type(slice, signed_offsets[i],
+                                                     &number_type));
+        ASSERT_EQ(number_type, THSN_NUMBER_INT);
+        int64_t value = 0;
+        ASSERT_SUCCESS(thsn_segment_read_int64(slice, signed_offsets[i], &value));
+        ASSERT_EQ(value, signed_values[i]);
+        uint64_t unsigned_value = 0;
+        ASSERT_EQ(
+            thsn_segment_read_uint64(slice, signed_offsets[i], &unsigned_value),
+            signed_values[i] < 0 ? THSN_RESULT_INPUT_ERROR
+                                 : THSN_RESULT_SUCCESS);
+    }
+    for (size_t i = 0; i < unsigned_count; ++i) {
+        const bool fits_int64 = unsigned_values[i] <= LLONG_MAX;
+        ThsnNumberType number_type = THSN_NUMBER_DOUBLE;
+        ASSERT_SUCCESS(thsn_segment_read_number_type(
+            slice, unsigned_offsets[i], &number_type));
+        ASSERT_EQ(number_type, fits_int64 ? THSN_NUMBER_INT : THSN_NUMBER_UINT);
+        uint64_t value = 0;
+        ASSERT_SUCCESS(
+            thsn_segment_read_uint64(slice, unsigned_offsets[i], &value));
+        ASSERT_EQ(value, unsigned_values[i]);
+        int64_t signed_value = 0;
+        ASSERT_EQ(
+            thsn_segment_read_int64(slice, unsigned_offsets[i], &signed_value),
+            fits_int64 ? THSN_RESULT_SUCCESS : THSN_RESULT_INPUT_ERROR);
+        double double_value;
+        ASSERT_SUCCESS(thsn_segment_read_number(slice, unsigned_offsets[i],
+                                                &double_value));
+        ASSERT_EQ(double_value, (double)unsigned_values[i]);
+    }
+
+    ASSERT_NULL_INPUT_ERROR(thsn_segment_read_int64(slice, 0, NULL));
+    ASSERT_NULL_INPUT_ERROR(thsn_segment_read_uint64(slice, 0, NULL));
+    ASSERT_NULL_INPUT_ERROR(thsn_segment_read_number_type(slice, 0, NULL));
+
+    ASSERT_SUCCESS(thsn_vector_free(&vector));
+}
+
 TEST(stores_and_reads_strings) {
     ASSERT_NULL_INPUT_ERROR(
         thsn_segment_store_string(NULL, thsn_slice_make_empty()));
@@ -181,105 +260,197 @@ TEST(stores_and_reads_strings) {
 }
 
 TEST(stores_and_reads_arrays) {
+    const ThsnTagSize tag_sizes[] = {THSN_TAG_SIZE_INBOUND,
+                                     THSN_TAG_SIZE_COMPACT};
+    for (size_t tag_size_no = 0; tag_size_no < 2; ++tag_size_no) {
+        const ThsnTag tag =
+            thsn_tag_make(THSN_TAG_ARRAY, tag_sizes[tag_size_no]);
+        ThsnVector vector = thsn_vector_make_empty();
+        size_t elements_table[] = {100, 101, 102};
+        size_t header_offset = 0;
+        ASSERT_SUCCESS(
+            thsn_segment_store_composite_header(&vector, tag, &header_offset));
+        ASSERT_EQ(thsn_vector_current_offset(vector),
+                  thsn_composite_header_size(tag));
+        ASSERT_SUCCESS(thsn_segment_store_null(&vector));
+        ASSERT_SUCCESS(thsn_segment_store_int(&vector, 0xffff));
+        ASSERT_SUCCESS(thsn_segment_store_composite_elements_table(
+            &vector, header_offset, THSN_SLICE_FROM_VAR(elements_table)));
+        ThsnSlice out_table = thsn_slice_make_empty();
+        size_t offset_size = 0;
+        ASSERT_SUCCESS(thsn_segment_read_composite(
+            thsn_vector_as_slice(vector), header_offset, THSN_TAG_ARRAY,
+            &out_table, &offset_size));
+        ASSERT_EQ(offset_size, thsn_composite_offset_size(tag));
+        ASSERT_EQ(out_table.size, 3 * offset_size);
+        for (size_t i = 0;
+             i < sizeof(elements_table) / sizeof(elements_table[0]); ++i) {
+            size_t element_offset = 0;
+            ASSERT_SUCCESS(thsn_segment_composite_index_element_offset(
+                out_table, offset_size, i, &element_offset));
+            ASSERT_EQ(element_offset, elements_table[i]);
+        }
+        for (size_t i = 0;
+             i < sizeof(elements_table) / sizeof(elements_table[0]); ++i) {
+            size_t element_offset = 0;
+            ASSERT_SUCCESS(thsn_segment_composite_consume_element_offset(
+                &out_table, offset_size, &element_offset));
+            ASSERT_EQ(element_offset, elements_table[i]);
+        }
+        ASSERT_TRUE(thsn_slice_is_empty(out_table));
+        ASSERT_SUCCESS(thsn_vector_free(&vector));
+    }
+
+    /* Compact tables can't address past 4 GiB */
     ThsnVector vector = thsn_vector_make_empty();
-    size_t elements_table[] = {100, 101, 102};
     size_t header_offset = 0;
+    size_t elements_table[] = {(size_t)UINT32_MAX + 1};
     ASSERT_SUCCESS(thsn_segment_store_composite_header(
-        &vector, thsn_tag_make(THSN_TAG_ARRAY, THSN_TAG_SIZE_INBOUND), false,
+        &vector, thsn_tag_make(THSN_TAG_ARRAY, THSN_TAG_SIZE_COMPACT),
         &header_offset));
-    ASSERT_SUCCESS(thsn_segment_store_null(&vector));
-    ASSERT_SUCCESS(thsn_segment_store_int(&vector, 0xffff));
-    ASSERT_SUCCESS(thsn_segment_store_composite_elements_table(
-        &vector, header_offset, THSN_SLICE_FROM_VAR(elements_table), false));
-    ThsnSlice out_table = thsn_slice_make_empty();
-    ASSERT_SUCCESS(thsn_segment_read_composite(thsn_vector_as_mut_slice(vector),
-                                               header_offset, THSN_TAG_ARRAY,
-                                               &out_table, false));
-    for (size_t i = 0; i < sizeof(elements_table) / sizeof(elements_table[0]);
-         ++i) {
-        size_t element_offset = 0;
-        ASSERT_SUCCESS(thsn_segment_composite_index_element_offset(
-            out_table, i, &element_offset));
-        ASSERT_EQ(element_offset, elements_table[i]);
-    }
-    for (size_t i = 0; i < sizeof(elements_table) / sizeof(elements_table[0]);
-         ++i) {
-        size_t element_offset = 0;
-        ASSERT_SUCCESS(thsn_segment_composite_consume_element_offset(
-            &out_table, &element_offset));
-        ASSERT_EQ(element_offset, elements_table[i]);
-    }
-    ASSERT_TRUE(thsn_slice_is_empty(out_table));
+    ASSERT_INPUT_ERROR(thsn_segment_store_composite_elements_table(
+        &vector, header_offset, THSN_SLICE_FROM_VAR(elements_table)));
     ASSERT_SUCCESS(thsn_vector_free(&vector));
 }
 
 TEST(stores_and_reads_objects) {
-    ThsnVector vector = thsn_vector_make_empty();
-    size_t header_offset = 0;
-    ASSERT_SUCCESS(thsn_segment_store_composite_header(
-        &vector, thsn_tag_make(THSN_TAG_OBJECT, THSN_TAG_SIZE_INBOUND), true,
-        &header_offset));
-    size_t first_kv = thsn_vector_current_offset(vector);
-    ASSERT_SUCCESS(
-        thsn_segment_store_string(&vector, thsn_slice_from_c_str("z")));
-    ASSERT_SUCCESS(thsn_segment_store_int(&vector, 1));
-    size_t second_kv = thsn_vector_current_offset(vector);
-    ASSERT_SUCCESS(thsn_segment_store_string(
-        &vector, thsn_slice_from_c_str("random string")));
-    ASSERT_SUCCESS(thsn_segment_store_null(&vector));
-    size_t third_kv = thsn_vector_current_offset(vector);
-    ThsnSlice string_slice = thsn_slice_from_c_str("a string");
-    ASSERT_SUCCESS(thsn_segment_store_string(&vector, string_slice));
-    ASSERT_SUCCESS(thsn_segment_store_string(&vector, string_slice));
-    size_t elements_table[] = {first_kv, second_kv, third_kv};
-    ASSERT_SUCCESS(thsn_segment_store_composite_elements_table(
-        &vector, header_offset, THSN_SLICE_FROM_VAR(elements_table), true));
-    ThsnSlice out_table = thsn_slice_make_empty();
-    ASSERT_SUCCESS(thsn_segment_read_composite(thsn_vector_as_mut_slice(vector),
-                                               header_offset, THSN_TAG_OBJECT,
-                                               &out_table, false));
-    for (size_t i = 0; i < sizeof(elements_table) / sizeof(elements_table[0]);
-         ++i) {
-        size_t element_offset = 0;
+    const ThsnTagSize tag_sizes[] = {THSN_TAG_SIZE_INBOUND,
+                                     THSN_TAG_SIZE_COMPACT};
+    for (size_t tag_size_no = 0; tag_size_no < 2; ++tag_size_no) {
+        ThsnVector vector = thsn_vector_make_empty();
+        size_t header_offset = 0;
+        ASSERT_SUCCESS(thsn_segment_store_composite_header(
+            &vector, thsn_tag_make(THSN_TAG_OBJECT, tag_sizes[tag_size_no]),
+            &header_offset));
+        size_t first_kv = thsn_vector_current_offset(vector);
+        ASSERT_SUCCESS(
+            thsn_segment_store_string(&vector, thsn_slice_from_c_str("z")));
+        ASSERT_SUCCESS(thsn_segment_store_int(&vector, 1));
+        size_t second_kv = thsn_vector_current_offset(vector);
+        ASSERT_SUCCESS(thsn_segment_store_string(
+            &vector, thsn_slice_from_c_str("random string")));
+        ASSERT_SUCCESS(thsn_segment_store_null(&vector));
+        size_t third_kv = thsn_vector_current_offset(vector);
+        ThsnSlice string_slice = thsn_slice_from_c_str("a string");
+        ASSERT_SUCCESS(thsn_segment_store_string(&vector, string_slice));
+        ASSERT_SUCCESS(thsn_segment_store_string(&vector, string_slice));
+        size_t elements_table[] = {first_kv, second_kv, third_kv};
+        ASSERT_SUCCESS(thsn_segment_store_composite_elements_table(
+            &vector, header_offset, THSN_SLICE_FROM_VAR(elements_table)));
+        ThsnCompositeHeader header;
+        ASSERT_SUCCESS(thsn_segment_read_composite_header(
+            thsn_vector_as_slice(vector), header_offset, THSN_TAG_OBJECT,
+            &header));
+        ASSERT_FALSE(header.escaped_keys);
+        ThsnSlice out_table = thsn_slice_make_empty();
+        size_t offset_size = 0;
+        ASSERT_SUCCESS(thsn_segment_read_composite(
+            thsn_vector_as_slice(vector), header_offset, THSN_TAG_OBJECT,
+            &out_table, &offset_size));
+        for (size_t i = 0;
+             i < sizeof(elements_table) / sizeof(elements_table[0]); ++i) {
+            size_t element_offset = 0;
+            ASSERT_SUCCESS(thsn_segment_composite_index_element_offset(
+                out_table, offset_size, i, &element_offset));
+            ASSERT_EQ(element_offset, elements_table[i]);
+        }
+        for (size_t i = 0;
+             i < sizeof(elements_table) / sizeof(elements_table[0]); ++i) {
+            size_t element_offset = 0;
+            ASSERT_SUCCESS(thsn_segment_composite_consume_element_offset(
+                &out_table, offset_size, &element_offset));
+            ASSERT_EQ(element_offset, elements_table[i]);
+        }
+        ThsnArena* arena = NULL;
+        ThsnSlice sorted_table = thsn_slice_make_empty();
+        ASSERT_SUCCESS(thsn_segment_read_object_sorted(
+            thsn_vector_as_mut_slice(vector), header_offset, &arena,
+            &sorted_table, &offset_size));
+        ASSERT_EQ(sorted_table.size, 3 * offset_size);
+
+        /* The sorted copy is cached and the original order is kept */
+        ThsnSlice cached_sorted_table = thsn_slice_make_empty();
+        ASSERT_SUCCESS(thsn_segment_read_object_sorted(
+            thsn_vector_as_mut_slice(vector), header_offset, &arena,
+            &cached_sorted_table, &offset_size));
+        ASSERT_EQ(cached_sorted_table.data, sorted_table.data);
+        ASSERT_SUCCESS(thsn_segment_read_composite(
+            thsn_vector_as_slice(vector), header_offset, THSN_TAG_OBJECT,
+            &out_table, &offset_size));
+        size_t first_offset = 0;
         ASSERT_SUCCESS(thsn_segment_composite_index_element_offset(
-            out_table, i, &element_offset));
-        ASSERT_EQ(element_offset, elements_table[i]);
+            out_table, offset_size, 0, &first_offset));
+        ASSERT_EQ(first_offset, first_kv);
+        ASSERT_SUCCESS(thsn_segment_composite_index_element_offset(
+            sorted_table, offset_size, 0, &first_offset));
+        ASSERT_EQ(first_offset, third_kv);
+
+        size_t element_offset = 0;
+        bool found = false;
+        ASSERT_SUCCESS(thsn_segment_object_index(
+            thsn_vector_as_slice(vector), sorted_table, offset_size,
+            thsn_slice_from_c_str("a string"), &element_offset, &found));
+        ASSERT_TRUE(found);
+        ASSERT_SUCCESS(thsn_segment_object_index(
+            thsn_vector_as_slice(vector), sorted_table, offset_size,
+            thsn_slice_from_c_str("z"), &element_offset, &found));
+        ASSERT_TRUE(found);
+        double value = 0;
+        ASSERT_SUCCESS(thsn_segment_read_number(thsn_vector_as_slice(vector),
+                                                element_offset, &value));
+        ASSERT_EQ(value, 1);
+        ASSERT_SUCCESS(thsn_segment_object_index(
+            thsn_vector_as_slice(vector), sorted_table, offset_size,
+            thsn_slice_from_c_str("random string"), &element_offset, &found));
+        ASSERT_TRUE(found);
+        ASSERT_SUCCESS(thsn_segment_object_index(
+            thsn_vector_as_slice(vector), sorted_table, offset_size,
+            thsn_slice_from_c_str("another string"), &element_offset, &found));
+        ASSERT_FALSE(found);
+        thsn_arena_free(&arena);
+        ASSERT_SUCCESS(thsn_vector_free(&vector));
     }
-    for (size_t i = 0; i < sizeof(elements_table) / sizeof(elements_table[0]);
-         ++i) {
+}
+
+TEST(marks_objects_with_escaped_keys) {
+    const ThsnTagSize tag_sizes[] = {THSN_TAG_SIZE_INBOUND,
+                                     THSN_TAG_SIZE_COMPACT};
+    for (size_t tag_size_no = 0; tag_size_no < 2; ++tag_size_no) {
+        ThsnVector vector = thsn_vector_make_empty();
+        size_t header_offset = 0;
+        const ThsnTag tag =
+            thsn_tag_make(THSN_TAG_OBJECT, tag_sizes[tag_size_no]);
+        ASSERT_SUCCESS(
+            thsn_segment_store_composite_header(&vector, tag, &header_offset));
+        size_t elements_table[2];
+        elements_table[0] = thsn_vector_current_offset(vector);
+        ASSERT_SUCCESS(
+            thsn_segment_store_string(&vector, thsn_slice_from_c_str("a")));
+        ASSERT_SUCCESS(thsn_segment_store_int(&vector, 1));
+        elements_table[1] = thsn_vector_current_offset(vector);
+        ASSERT_SUCCESS(
+            thsn_segment_store_string(&vector, thsn_slice_from_c_str("b\\n")));
+        ASSERT_SUCCESS(thsn_segment_store_int(&vector, 2));
+        ASSERT_SUCCESS(thsn_segment_store_composite_elements_table(
+            &vector, header_offset, THSN_SLICE_FROM_VAR(elements_table)));
+        ThsnCompositeHeader header;
+        ASSERT_SUCCESS(thsn_segment_read_composite_header(
+            thsn_vector_as_slice(vector), header_offset, THSN_TAG_OBJECT,
+            &header));
+        ASSERT_TRUE(header.escaped_keys);
+        ASSERT_EQ(header.elements_count, 2);
+        ASSERT_EQ(header.offset_size, thsn_composite_offset_size(tag));
+        ThsnSlice out_table = thsn_slice_make_empty();
+        size_t offset_size = 0;
+        ASSERT_SUCCESS(thsn_segment_read_composite(
+            thsn_vector_as_slice(vector), header_offset, THSN_TAG_OBJECT,
+            &out_table, &offset_size));
         size_t element_offset = 0;
-        ASSERT_SUCCESS(thsn_segment_composite_consume_element_offset(
-            &out_table, &element_offset));
-        ASSERT_EQ(element_offset, elements_table[i]);
+        ASSERT_SUCCESS(thsn_segment_composite_index_element_offset(
+            out_table, offset_size, 1, &element_offset));
+        ASSERT_EQ(element_offset, elements_table[1]);
+        ASSERT_SUCCESS(thsn_vector_free(&vector));
     }
-    ThsnSlice sorted_table = thsn_slice_make_empty();
-    ASSERT_SUCCESS(thsn_segment_read_composite(thsn_vector_as_mut_slice(vector),
-                                               header_offset, THSN_TAG_OBJECT,
-                                               &sorted_table, true));
-
-    size_t element_offset = 0;
-    bool found = false;
-    ASSERT_SUCCESS(thsn_segment_object_index(
-        thsn_vector_as_slice(vector), sorted_table,
-        thsn_slice_from_c_str("a string"), &element_offset, &found));
-    ASSERT_TRUE(found);
-    ASSERT_SUCCESS(thsn_segment_object_index(
-        thsn_vector_as_slice(vector), sorted_table, thsn_slice_from_c_str("z"),
-        &element_offset, &found));
-    ASSERT_TRUE(found);
-    double value = 0;
-    ASSERT_SUCCESS(thsn_segment_read_number(thsn_vector_as_slice(vector),
-                                            element_offset, &value));
-    ASSERT_EQ(value, 1);
-    ASSERT_SUCCESS(thsn_segment_object_index(
-        thsn_vector_as_slice(vector), sorted_table,
-        thsn_slice_from_c_str("random string"), &element_offset, &found));
-    ASSERT_TRUE(found);
-    ASSERT_SUCCESS(thsn_segment_object_index(
-        thsn_vector_as_slice(vector), sorted_table,
-        thsn_slice_from_c_str("another string"), &element_offset, &found));
-    ASSERT_FALSE(found);
-    ASSERT_SUCCESS(thsn_vector_free(&vector));
 }
 
 /* clang-format off */
@@ -289,10 +460,12 @@ TEST_SUITE(segment)
     stores_and_reads_bools, 
     stores_and_reads_doubles,
     stores_and_reads_ints, 
+    stores_and_reads_exact_integers,
     stores_and_reads_strings,
     stores_and_reads_value_handle,
     stores_and_reads_arrays,
     stores_and_reads_objects,
+    marks_objects_with_escaped_keys,
 END_TEST_SUITE()
 
 #endif
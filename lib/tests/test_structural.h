@@ -0,0 +1,173 @@
+#ifndef THSN_TEST_STRUCTURAL_H
+#define THSN_TEST_STRUCTURAL_H
+
+#include <ctype.h>
+
+#include "structural.h"
+#include "testing.h"
+
+TEST(classifies_quotes_and_backslashes) {
+    const char* block = "\"a\\\\b\"";
+    ThsnBlockMasks masks;
+    thsn_block_classify(block, strlen(block), &masks);
+    ASSERT_EQ(masks.quote, 0x21);
+    ASSERT_EQ(masks.backslash, 0x0c);
+    thsn_block_classify(block, 3, &masks);
+    ASSERT_EQ(masks.quote, 0x01);
+    ASSERT_EQ(masks.backslash, 0x04);
+}
+
+TEST(classifies_whitespace_and_brackets) {
+    const char* pattern = "{ \"a\\\t\n:[1,]}\r\v\fx";
+    char block[THSN_BLOCK_SIZE];
+    for (size_t i = 0; i < THSN_BLOCK_SIZE; ++i) {
+        block[i] = pattern[i % strlen(pattern)];
+    }
+    for (size_t block_size = 0; block_size <= THSN_BLOCK_SIZE; ++block_size) {
+        ThsnBlockMasks masks;
+        thsn_block_classify(block, block_size, &masks);
+        ThsnBlockMasks expected = {0};
+        for (size_t i = 0; i < block_size; ++i) {
+            const uint64_t bit = 1ULL << i;
+            if (block[i] == '"') {
+                expected.quote |= bit;
+            } else if (block[i] == '\\') {
+                expected.backslash |= bit;
+            } else if (isspace((unsigned char)block[i])) {
+                expected.whitespace |= bit;
+            } else if (block[i] == '[' || block[i] == '{') {
+                expected.opening |= bit;
+            } else if (block[i] == ']' || block[i] == '}') {
+                expected.closing |= bit;
+            }
+        }
+        ASSERT_EQ(masks.quote, expected.quote);
+        ASSERT_EQ(masks.backslash, expected.backslash);
+        ASSERT_EQ(masks.whitespace, expected.whitespace);
+        ASSERT_EQ(masks.opening, expected.opening);
+        ASSERT_EQ(masks.closing, expected.closing);
+    }
+}
+
+TEST(finds_chars) {
+    char buffer[3 * THSN_BLOCK_SIZE];
+    memset(buffer, 'a', sizeof(buffer));
+    for (size_t size = 0; size <= sizeof(buffer); ++size) {
+        const ThsnSlice slice = thsn_slice_make(buffer, size);
+        ASSERT_EQ(thsn_find_char(slice, '\\'), NULL);
+        for (size_t position = 0; position < size; position += 7) {
+            buffer[position] = '\\';
+            ASSERT_EQ(thsn_find_char(slice, '\\'), buffer + position);
+            buffer[position] = 'a';
+        }
+    }
+}
+
+TEST(computes_prefix_xor) {
+    ASSERT_EQ(thsn_prefix_xor(0), 0);
+    ASSERT_EQ(thsn_prefix_xor(1), UINT64_MAX);
+    ASSERT_EQ(thsn_prefix_xor(0x11), 0x0f);
+    ASSERT_EQ(thsn_prefix_xor(0x8000000000000001ULL), 0x7fffffffffffffffULL);
+}
+
+TEST(finds_escaped_characters_across_blocks) {
+    /* Backslash runs of every length, some of them crossing the block
+     * boundary */
+    char buffer[2 * THSN_BLOCK_SIZE];
+    for (size_t seed = 0; seed < 64; ++seed) {
+        size_t state = seed * 2654435761u + 1;
+        for (size_t i = 0; i < sizeof(buffer); ++i) {
+            state = state * 1103515245u + 12345u;
+            buffer[i] = ((state >> 16) % 3) == 0 ? 'a' : '\\';
+        }
+        uint64_t prev_escaped = 0;
+        for (size_t block_no = 0; block_no < 2; ++block_no) {
+            const char* block = buffer + block_no * THSN_BLOCK_SIZE;
+            ThsnBlockMasks masks;
+            thsn_block_classify(block, THSN_BLOCK_SIZE, &masks);
+            const uint64_t escaped =
+                thsn_block_escaped(masks.backslash, &prev_escaped);
+            uint64_t expected = 0;
+            for (size_t i = 0; i < THSN_BLOCK_SIZE; ++i) {
+                size_t backslashes = 0;
+                for (size_t j = block_no * THSN_BLOCK_SIZE + i;
+                     j > 0 && buffer[j - 1] == '\\'; --j) {
+                    ++backslashes;
+                }
+                expected |= (uint64_t)(backslashes % 2) << i;
+            }
+            ASSERT_EQ(escaped, expected);
+        }
+    }
+}
+
+TEST(finds_bytes_inside_strings) {
+    const char* block = "{\"a\\\"\": \"x\"}";
+    ThsnBlockMasks masks;
+    thsn_block_classify(block, strlen(block), &masks);
+    uint64_t prev_escaped = 0;
+    uint64_t prev_in_string = 0;
+    const uint64_t in_string = thsn_block_in_string(
+        masks.quote & ~thsn_block_escaped(masks.backslash, &prev_escaped),
+        &prev_in_string);
+    ASSERT_EQ(in_string, 0x31e);
+    ASSERT_EQ(prev_in_string, 0);
+    prev_in_string = UINT64_MAX;
+    ASSERT_EQ(thsn_block_in_string(0, &prev_in_string), UINT64_MAX);
+    ASSERT_EQ(prev_in_string, UINT64_MAX);
+}
+
+TEST(speculates_whether_buffer_starts_in_string) {
+    struct {
+        const char* buffer;
+        bool in_string;
+    } test_values[] = {
+        {"", false},
+        {"123, 456]", false},
+        {"{\"some key\": \"some value\", \"other key\": [1, 2, 3]}", false},
+        {"me key\": \"some value\", \"other key\": \"other value\"}", true},
+        {"text with \\\"quotes\\\" in it\", \"b\": {\"c\": null}}", true},
+    };
+    for (size_t i = 0; i < sizeof(test_values) / sizeof(test_values[0]); ++i) {
+        ASSERT_EQ(thsn_speculate_starts_in_string(
+                      thsn_slice_from_c_str(test_values[i].buffer)),
+                  test_values[i].in_string);
+    }
+}
+
+TEST(skips_composites) {
+    char buffer[6 * THSN_BLOCK_SIZE];
+    /* Nested long enough to take whole blocks, with brackets in strings */
+    const char* value = "{\"a]\": [1, [2, \"\\\"}\"], {}], \"b\": \"[[[[\"}";
+    for (size_t padding = 0; padding < 2 * THSN_BLOCK_SIZE; padding += 7) {
+        memset(buffer, ' ', sizeof(buffer));
+        buffer[padding] = '[';
+        memcpy(buffer + padding + 1, value, strlen(value));
+        buffer[padding + 1 + strlen(value) + padding] = ']';
+        const size_t value_end = padding + 1 + strlen(value) + padding + 1;
+        const char* const value_start = buffer + padding + 1;
+        ThsnSlice buffer_slice = thsn_slice_make(
+            value_start, buffer + value_end + 3 - value_start);
+        ASSERT_SUCCESS(thsn_skip_composite(&buffer_slice));
+        ASSERT_EQ(buffer_slice.data, buffer + value_end);
+        ASSERT_EQ(buffer_slice.size, 3);
+        buffer_slice =
+            thsn_slice_make(value_start, buffer + value_end - 1 - value_start);
+        ASSERT_INPUT_ERROR(thsn_skip_composite(&buffer_slice));
+    }
+}
+
+/* clang-format off */
+
+TEST_SUITE(structural)
+    classifies_quotes_and_backslashes,
+    classifies_whitespace_and_brackets,
+    finds_chars,
+    computes_prefix_xor,
+    finds_escaped_characters_across_blocks,
+    finds_bytes_inside_strings,
+    speculates_whether_buffer_starts_in_string,
+    skips_composites,
+END_TEST_SUITE()
+
+#endif
@@ -100,11 +100,70 @@ TEST(invalid_tokens) {
     }
 }
 
+TEST(indexed_tokens_match_plain_tokens) {
+    char long_tokens[4 * THSN_BLOCK_SIZE + 64];
+    size_t offset = 0;
+    long_tokens[offset++] = '[';
+    for (size_t i = 0; i < 70; ++i) {
+        long_tokens[offset++] = i % 7 == 0 ? '\n' : ' ';
+    }
+    long_tokens[offset++] = '"';
+    for (size_t i = 0; i < 130; ++i) {
+        long_tokens[offset++] = i % 5 == 0 ? '\\' : 'x';
+    }
+    long_tokens[offset++] = '"';
+    long_tokens[offset++] = ',';
+    long_tokens[offset++] = '"';
+    while (offset < sizeof(long_tokens) - 1) {
+        long_tokens[offset++] = 'y';
+    }
+    long_tokens[offset] = '\0';
+
+    const char* test_values[] = {
+        "",
+        "   \t\n   ",
+        "{\"a\": [1, -2.5e+3, true, false, null], \"b\\\"\": \"\\\\\"}",
+        "\"ABC\\\"\"\"",
+        "\"\\\\\\\"",
+        " \t 12.34e-10!",
+        "[1, 2, nil]",
+        "1.2.3",
+        long_tokens,
+    };
+    for (size_t i = 0; i < sizeof(test_values) / sizeof(test_values[0]); ++i) {
+        ThsnSlice plain_slice = thsn_slice_from_c_str(test_values[i]);
+        ThsnSlice indexed_slice = plain_slice;
+        ThsnStructuralIndex structural_index = thsn_structural_index_make();
+        ThsnToken plain_token = THSN_TOKEN_ERROR;
+        ThsnToken indexed_token = THSN_TOKEN_ERROR;
+        do {
+            ThsnSlice plain_token_slice;
+            ThsnSlice indexed_token_slice;
+            const ThsnResult plain_result =
+                thsn_next_token(&plain_slice, &plain_token_slice, &plain_token);
+            ASSERT_EQ(thsn_next_token_indexed(&structural_index,
+                                              &indexed_slice,
+                                              &indexed_token_slice,
+                                              &indexed_token),
+                      plain_result);
+            if (plain_result != THSN_RESULT_SUCCESS) {
+                break;
+            }
+            ASSERT_EQ(indexed_token, plain_token);
+            ASSERT_EQ(indexed_token_slice.data, plain_token_slice.data);
+            ASSERT_EQ(indexed_token_slice.size, plain_token_slice.size);
+            ASSERT_EQ(indexed_slice.data, plain_slice.data);
+            ASSERT_EQ(indexed_slice.size, plain_slice.size);
+        } while (plain_token != THSN_TOKEN_EOF);
+    }
+}
+
 /* clang-format off */
 
 TEST_SUITE(tokenizer)
     valid_tokens,
     invalid_tokens, 
+    indexed_tokens_match_plain_tokens,
 END_TEST_SUITE()
 
 #endif
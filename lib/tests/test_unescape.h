@@ -0,0 +1,51 @@
+#ifndef THSN_TEST_UNESCAPE_H
+#define THSN_TEST_UNESCAPE_H
+
+#include "testing.h"
+#include "unescape.h"
+
+TEST(unescapes_strings) {
+    struct {
+        const char* escaped;
+        const char* decoded;
+    } test_values[] = {
+        {"", ""},
+        {"no escapes", "no escapes"},
+        {"\\\"\\\\\\/\\b\\f\\n\\r\\t", "\"\\/\b\f\n\r\t"},
+        {"line\\nbreak and a long tail to cross the SIMD lane width",
+         "line\nbreak and a long tail to cross the SIMD lane width"},
+        {"\\u0041\\u00e9\\u20AC", "A\xc3\xa9\xe2\x82\xac"},
+        {"\\ud83d\\ude00!", "\xf0\x9f\x98\x80!"},
+    };
+    for (size_t i = 0; i < sizeof(test_values) / sizeof(test_values[0]); ++i) {
+        const ThsnSlice escaped_slice =
+            thsn_slice_from_c_str(test_values[i].escaped);
+        char output[128];
+        size_t output_size = 0;
+        ASSERT_SUCCESS(
+            thsn_unescape_string(escaped_slice, output, &output_size));
+        ASSERT_EQ(output_size, strlen(test_values[i].decoded));
+        ASSERT_STRN_EQ(output, test_values[i].decoded, output_size);
+    }
+}
+
+TEST(rejects_invalid_escapes) {
+    const char* test_values[] = {
+        "\\", "\\x", "\\u12", "\\u12g4", "\\ud83d", "\\ud83d\\u0041", "\\ude00",
+    };
+    for (size_t i = 0; i < sizeof(test_values) / sizeof(test_values[0]); ++i) {
+        char output[32];
+        size_t output_size;
+        ASSERT_INPUT_ERROR(thsn_unescape_string(
+            thsn_slice_from_c_str(test_values[i]), output, &output_size));
+    }
+}
+
+/* clang-format off */
+
+TEST_SUITE(unescape)
+    unescapes_strings,
+    rejects_invalid_escapes,
+END_TEST_SUITE()
+
+#endif
@@ -130,6 +130,39 @@ TEST(returns_mut_slice_at_offset) {
     ASSERT_SUCCESS(thsn_vector_free(&vector));
 }
 
+TEST(grows_vectors_past_the_mapped_block_size) {
+    const size_t step_size = 1024 * 1024;
+    const size_t steps_count = 2 * THSN_MAPPED_BLOCK_MIN_SIZE / step_size;
+    ThsnVector vector = thsn_vector_make_empty();
+    ASSERT_SUCCESS(thsn_vector_allocate(&vector, 1024));
+    /* A byte per step is enough to check the contents survive remapping */
+    bool grown = true;
+    for (size_t i = 0; i < steps_count && grown; ++i) {
+        ThsnMutSlice step = thsn_mut_slice_make(NULL, 0);
+        grown = thsn_vector_grow(&vector, step_size, &step) ==
+                THSN_RESULT_SUCCESS;
+        if (grown) {
+            step.data[0] = (char)i;
+        }
+    }
+    ASSERT_TRUE(grown);
+    ASSERT_TRUE(vector.capacity >= 2 * THSN_MAPPED_BLOCK_MIN_SIZE);
+    bool preserved = true;
+    for (size_t i = 0; i < steps_count; ++i) {
+        preserved = preserved && vector.buffer[i * step_size] == (char)i;
+    }
+    ASSERT_TRUE(preserved);
+    /* Shrinking below the threshold moves the contents back to the heap */
+    vector.offset = 2 * step_size + 1;
+    ASSERT_SUCCESS(thsn_vector_shrink_to_fit(&vector));
+    ASSERT_EQ(vector.capacity, 2 * step_size + 1);
+    ASSERT_EQ(vector.buffer[step_size], 1);
+    vector.offset = 0;
+    ASSERT_SUCCESS(thsn_vector_shrink_to_fit(&vector));
+    ASSERT_EQ(vector.buffer, NULL);
+    ASSERT_EQ(vector.capacity, 0);
+}
+
 /* clang-format off */
 
 TEST_SUITE(vector)
@@ -141,6 +174,7 @@ TEST_SUITE(vector)
     pushes_and_pops,
     returns_slice_at_offset,
     returns_mut_slice_at_offset,
+    grows_vectors_past_the_mapped_block_size,
 END_TEST_SUITE() 
 
 #endif
@@ -1,7 +1,10 @@
 #include "test_document.h"
+#include "test_number.h"
 #include "test_segment.h"
 #include "test_slice.h"
+#include "test_structural.h"
 #include "test_tokenizer.h"
+#include "test_unescape.h"
 #include "test_vector.h"
 #include "testing.h"
 
@@ -12,5 +15,8 @@ TEST_MAIN()
 	RUN_SUITE(vector);
 	RUN_SUITE(segment);
 	RUN_SUITE(tokenizer);
+	RUN_SUITE(structural);
+	RUN_SUITE(number);
+	RUN_SUITE(unescape);
 	RUN_SUITE(document);
 END_MAIN()
@@ -0,0 +1,321 @@
+#ifndef THSN_THREAD_POOL_H
+#define THSN_THREAD_POOL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+
+#include "result.h"
+#include "vector.h"
+
+/* Number of completion checks before the waiting thread starts yielding, and
+ * then the number of yields before it parks on the condition variable. */
+#define THSN_COMPLETION_SPIN_COUNT 64
+#define THSN_COMPLETION_YIELD_COUNT 16
+
+typedef struct {
+    atomic_bool completed;
+    mtx_t mutex;
+    cnd_t condition;
+} ThsnCompletion;
+
+typedef struct {
+    size_t yield_count;
+    size_t park_count;
+} ThsnCompletionMetrics;
+
+typedef struct {
+    thrd_start_t job_fn;
+    void* user_data;
+} ThsnThreadPoolJob;
+
+typedef struct {
+    mtx_t mutex;
+    cnd_t jobs_available;
+    /* FIFO queue of `ThsnThreadPoolJob`s, pending jobs are stored between
+     * `jobs_head` and the vector's offset. */
+    ThsnVector jobs;
+    size_t jobs_head;
+    bool shutting_down;
+    size_t workers_count;
+    thrd_t* workers;
+} ThsnThreadPool;
+
+static inline ThsnResult thsn_completion_init(
+    ThsnCompletion* /*out*/ completion) {
+    BAIL_ON_NULL_INPUT(completion);
+    atomic_init(&completion->completed, false);
+    if (mtx_init(&completion->mutex, mtx_plain) != thrd_success) {
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    if (cnd_init(&completion->condition) != thrd_success) {
+        mtx_destroy(&completion->mutex);
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline void thsn_completion_destroy(
+    ThsnCompletion* /*mut*/ completion) {
+    /* A waiter can see `completed` before the signalling thread releases the
+     * mutex, wait for it to be done with the completion. */
+    mtx_lock(&completion->mutex);
+    mtx_unlock(&completion->mutex);
+    cnd_destroy(&completion->condition);
+    mtx_destroy(&completion->mutex);
+}
+
+static inline bool thsn_completion_is_completed(
+    ThsnCompletion* /*in*/ completion) {
+    return atomic_load_explicit(&completion->completed, memory_order_acquire);
+}
+
+/* Everything written before the call is visible to the threads returning
+ * from `thsn_completion_wait`. */
+static inline void thsn_completion_signal(ThsnCompletion* /*mut*/ completion) {
+    /* Setting the flag under the mutex guarantees a waiter is either before
+     * its check of `completed` or already parked, so the broadcast can't be
+     * lost. */
+    mtx_lock(&completion->mutex);
+    atomic_store_explicit(&completion->completed, true, memory_order_release);
+    cnd_broadcast(&completion->condition);
+    mtx_unlock(&completion->mutex);
+}
+
+/* Spins, then yields, then parks, so short waits stay cheap and long ones
+ * don't steal CPU from the threads being waited for. */
+static inline void thsn_completion_wait(
+    ThsnCompletion* /*mut*/ completion,
+    ThsnCompletionMetrics* /*maybe mut*/ metrics) {
+    for (size_t i = 0; i < THSN_COMPLETION_SPIN_COUNT; ++i) {
+        if (thsn_completion_is_completed(completion)) {
+            return;
+        }
+    }
+    for (size_t i = 0; i < THSN_COMPLETION_YIELD_COUNT; ++i) {
+        thrd_yield();
+        if (metrics != NULL) {
+            ++metrics->yield_count;
+        }
+        if (thsn_completion_is_completed(completion)) {
+            return;
+        }
+    }
+    mtx_lock(&completion->mutex);
+    while (!thsn_completion_is_completed(completion)) {
+        if (metrics != NULL) {
+            ++metrics->park_count;
+        }
+        cnd_wait(&completion->condition, &completion->mutex);
+    }
+    mtx_unlock(&completion->mutex);
+}
+
+/* Inputs aren't split into chunks smaller than this */
+#define THSN_MIN_THREAD_SLICE_SIZE 1024
+
+static inline size_t thsn_effective_threads_count(size_t input_size,
+                                                  size_t threads_count) {
+    if (input_size / THSN_MIN_THREAD_SLICE_SIZE < threads_count) {
+        threads_count = input_size / THSN_MIN_THREAD_SLICE_SIZE;
+        threads_count = threads_count == 0 ? 1 : threads_count;
+    }
+    return threads_count;
+}
+
+/* Multithreaded parsing splits inputs into this many chunks per thread, so
+ * that threads done with theirs early take over the rest */
+#define THSN_CHUNKS_PER_THREAD 8
+/* Unless the chunks would get smaller than this. Values crossing chunk bounds
+ * are left to the main thread, so small chunks leave it more to parse. */
+#define THSN_MIN_CHUNK_SIZE (64 * 1024)
+
+static inline size_t thsn_effective_chunks_count(size_t input_size,
+                                                 size_t threads_count) {
+    if (threads_count == 1) {
+        return 1;
+    }
+    size_t chunks_count = input_size / THSN_MIN_CHUNK_SIZE;
+    if (chunks_count > threads_count * THSN_CHUNKS_PER_THREAD) {
+        chunks_count = threads_count * THSN_CHUNKS_PER_THREAD;
+    }
+    return chunks_count < threads_count ? threads_count : chunks_count;
+}
+
+/* Work items `[begin, end)` of a worker, packed into one word so that the
+ * worker taking them from the front and other threads stealing them from the
+ * back agree on who takes each. Items are numbered below `UINT32_MAX`. */
+typedef struct {
+    atomic_uint_least64_t packed;
+} ThsnWorkRange;
+
+static inline uint_least64_t thsn_work_range_pack(size_t begin, size_t end) {
+    return (uint_least64_t)end << 32 | (uint_least64_t)begin;
+}
+
+static inline void thsn_work_range_init(ThsnWorkRange* /*out*/ work_range,
+                                        size_t begin, size_t end) {
+    atomic_init(&work_range->packed, thsn_work_range_pack(begin, end));
+}
+
+/* Takes the first item, or only `item` if it's the first one and `item` isn't
+ * `SIZE_MAX` */
+static inline bool thsn_work_range_take_front(ThsnWorkRange* /*mut*/ work_range,
+                                              size_t item,
+                                              size_t* /*out*/ taken_item) {
+    uint_least64_t packed = atomic_load(&work_range->packed);
+    while (true) {
+        const size_t begin = (size_t)(packed & UINT32_MAX);
+        const size_t end = (size_t)(packed >> 32);
+        if (begin >= end || (item != SIZE_MAX && item != begin)) {
+            return false;
+        }
+        if (atomic_compare_exchange_weak(&work_range->packed, &packed,
+                                         thsn_work_range_pack(begin + 1,
+                                                              end))) {
+            *taken_item = begin;
+            return true;
+        }
+    }
+}
+
+static inline bool thsn_work_range_steal_back(
+    ThsnWorkRange* /*mut*/ work_range, size_t* /*out*/ taken_item) {
+    uint_least64_t packed = atomic_load(&work_range->packed);
+    while (true) {
+        const size_t begin = (size_t)(packed & UINT32_MAX);
+        const size_t end = (size_t)(packed >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        if (atomic_compare_exchange_weak(&work_range->packed, &packed,
+                                         thsn_work_range_pack(begin,
+                                                              end - 1))) {
+            *taken_item = end - 1;
+            return true;
+        }
+    }
+}
+
+/* Nothing is taken from the range after this */
+static inline void thsn_work_range_clear(ThsnWorkRange* /*mut*/ work_range) {
+    atomic_store(&work_range->packed, thsn_work_range_pack(0, 0));
+}
+
+static inline bool thsn_thread_pool_try_pop_job(
+    ThsnThreadPool* /*mut*/ thread_pool, ThsnThreadPoolJob* /*out*/ job) {
+    if (thread_pool->jobs_head ==
+        thsn_vector_current_offset(thread_pool->jobs)) {
+        return false;
+    }
+    ThsnSlice job_slice;
+    if (thsn_vector_slice_at_offset(thread_pool->jobs, thread_pool->jobs_head,
+                                    sizeof(*job),
+                                    &job_slice) != THSN_RESULT_SUCCESS ||
+        THSN_SLICE_READ_VAR(job_slice, *job) != THSN_RESULT_SUCCESS) {
+        return false;
+    }
+    thread_pool->jobs_head += sizeof(*job);
+    if (thread_pool->jobs_head ==
+        thsn_vector_current_offset(thread_pool->jobs)) {
+        /* The queue is drained, reuse its buffer from the start */
+        thread_pool->jobs_head = 0;
+        thread_pool->jobs.offset = 0;
+    }
+    return true;
+}
+
+static inline int thsn_thread_pool_worker(void* /*in*/ user_data) {
+    ThsnThreadPool* thread_pool = (ThsnThreadPool*)user_data;
+    while (true) {
+        ThsnThreadPoolJob job;
+        if (mtx_lock(&thread_pool->mutex) != thrd_success) {
+            return 1;
+        }
+        while (!thsn_thread_pool_try_pop_job(thread_pool, &job)) {
+            if (thread_pool->shutting_down ||
+                cnd_wait(&thread_pool->jobs_available, &thread_pool->mutex) !=
+                    thrd_success) {
+                mtx_unlock(&thread_pool->mutex);
+                return 0;
+            }
+        }
+        mtx_unlock(&thread_pool->mutex);
+        job.job_fn(job.user_data);
+    }
+}
+
+/* Jobs still in the queue are run before the workers exit. */
+static inline ThsnResult thsn_thread_pool_destroy(
+    ThsnThreadPool* /*mut*/ thread_pool) {
+    BAIL_ON_NULL_INPUT(thread_pool);
+    if (thread_pool->workers_count > 0) {
+        mtx_lock(&thread_pool->mutex);
+        thread_pool->shutting_down = true;
+        cnd_broadcast(&thread_pool->jobs_available);
+        mtx_unlock(&thread_pool->mutex);
+        for (size_t i = 0; i < thread_pool->workers_count; ++i) {
+            thrd_join(thread_pool->workers[i], NULL);
+        }
+    }
+    free(thread_pool->workers);
+    thsn_vector_free(&thread_pool->jobs);
+    cnd_destroy(&thread_pool->jobs_available);
+    mtx_destroy(&thread_pool->mutex);
+    *thread_pool = (ThsnThreadPool){0};
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline ThsnResult thsn_thread_pool_init(
+    ThsnThreadPool* /*out*/ thread_pool, size_t workers_count) {
+    BAIL_ON_NULL_INPUT(thread_pool);
+    *thread_pool = (ThsnThreadPool){0};
+    if (mtx_init(&thread_pool->mutex, mtx_plain) != thrd_success) {
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    if (cnd_init(&thread_pool->jobs_available) != thrd_success) {
+        mtx_destroy(&thread_pool->mutex);
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    if (workers_count == 0) {
+        return THSN_RESULT_SUCCESS;
+    }
+    if (thsn_vector_allocate(&thread_pool->jobs,
+                             sizeof(ThsnThreadPoolJob) * workers_count) !=
+            THSN_RESULT_SUCCESS ||
+        (thread_pool->workers = calloc(workers_count, sizeof(thrd_t))) ==
+            NULL) {
+        thsn_thread_pool_destroy(thread_pool);
+        return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+    }
+    for (size_t i = 0; i < workers_count; ++i) {
+        if (thrd_create(&thread_pool->workers[i], thsn_thread_pool_worker,
+                        thread_pool) != thrd_success) {
+            thsn_thread_pool_destroy(thread_pool);
+            return THSN_RESULT_OUT_OF_MEMORY_ERROR;
+        }
+        ++thread_pool->workers_count;
+    }
+    return THSN_RESULT_SUCCESS;
+}
+
+static inline ThsnResult thsn_thread_pool_submit(
+    ThsnThreadPool* /*mut*/ thread_pool, thrd_start_t job_fn,
+    void* /*in*/ user_data) {
+    BAIL_ON_NULL_INPUT(thread_pool);
+    BAIL_ON_NULL_INPUT(job_fn);
+    BAIL_WITH_INPUT_ERROR_UNLESS(thread_pool->workers_count > 0);
+    const ThsnThreadPoolJob job = {.job_fn = job_fn, .user_data = user_data};
+    if (mtx_lock(&thread_pool->mutex) != thrd_success) {
+        return THSN_RESULT_INPUT_ERROR;
+    }
+    const ThsnResult push_result = THSN_VECTOR_PUSH_VAR(thread_pool->jobs, job);
+    if (push_result == THSN_RESULT_SUCCESS) {
+        cnd_signal(&thread_pool->jobs_available);
+    }
+    mtx_unlock(&thread_pool->mutex);
+    return push_result;
+}
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "result.h"
 #include "slice.h"
+#include "structural.h"
 
 typedef enum {
     THSN_TOKEN_ERROR,
@@ -199,4 +200,100 @@ static inline ThsnResult thsn_next_token(ThsnSlice* buffer_slice,
             return THSN_RESULT_INPUT_ERROR;
     }
 }
+
+/* Character masks of the block the indexed tokenizer is currently in, so
+ * whitespace and strings are skipped a block at a time. */
+typedef struct {
+    const char* block_start;
+    size_t block_size;
+    ThsnBlockMasks masks;
+} ThsnStructuralIndex;
+
+static inline ThsnStructuralIndex thsn_structural_index_make(void) {
+    return (ThsnStructuralIndex){.block_start = NULL, .block_size = 0};
+}
+
+/* Classifies the block starting at `point` unless the cached one covers it. */
+static inline void thsn_structural_index_seek(
+    ThsnStructuralIndex* /*mut*/ index, const char* /*in*/ point,
+    const char* /*in*/ buffer_end) {
+    if (index->block_start != NULL && point >= index->block_start &&
+        point < index->block_start + index->block_size &&
+        index->block_start + index->block_size <= buffer_end) {
+        return;
+    }
+    const size_t remaining_size = buffer_end - point;
+    index->block_start = point;
+    index->block_size = remaining_size < THSN_BLOCK_SIZE ? remaining_size
+                                                         : THSN_BLOCK_SIZE;
+    thsn_block_classify(point, index->block_size, &index->masks);
+}
+
+/* Same tokens as `thsn_next_token`, but whitespace and string contents are
+ * found with block masks instead of byte by byte. */
+static inline ThsnResult thsn_next_token_indexed(
+    ThsnStructuralIndex* /*mut*/ index, ThsnSlice* /*mut*/ buffer_slice,
+    ThsnSlice* /*out*/ token_slice, ThsnToken* /*out*/ token) {
+    BAIL_ON_NULL_INPUT(index);
+    BAIL_ON_NULL_INPUT(buffer_slice);
+    BAIL_ON_NULL_INPUT(token_slice);
+    BAIL_ON_NULL_INPUT(token);
+
+    const char* const buffer_end = thsn_slice_end(*buffer_slice);
+    const char* point = buffer_slice->data;
+    while (true) {
+        if (point == buffer_end) {
+            thsn_slice_advance_unsafe(buffer_slice, buffer_slice->size);
+            *token = THSN_TOKEN_EOF;
+            *token_slice = thsn_slice_make_empty();
+            return THSN_RESULT_SUCCESS;
+        }
+        thsn_structural_index_seek(index, point, buffer_end);
+        const uint64_t non_whitespace =
+            ~index->masks.whitespace &
+            thsn_block_size_mask(index->block_size) &
+            (UINT64_MAX << (point - index->block_start));
+        if (non_whitespace != 0) {
+            point = index->block_start + thsn_trailing_zeros(non_whitespace);
+            break;
+        }
+        point = index->block_start + index->block_size;
+    }
+    thsn_slice_advance_unsafe(buffer_slice, point - buffer_slice->data);
+
+    if (*point != '"') {
+        return thsn_next_token(buffer_slice, token_slice, token);
+    }
+
+    /* Backslash runs before the opening quote can't spill over it, so the
+     * escapes of the first block are computed from its start. */
+    const char* const string_start = point + 1;
+    uint64_t prev_escaped = 0;
+    uint64_t closing_quotes =
+        index->masks.quote &
+        ~thsn_block_escaped(index->masks.backslash, &prev_escaped) &
+        ((UINT64_MAX << (point - index->block_start)) << 1);
+    while (closing_quotes == 0) {
+        const char* const next_block = index->block_start + index->block_size;
+        if (next_block == buffer_end) {
+            *token = THSN_TOKEN_UNCLOSED_STRING;
+            *token_slice =
+                thsn_slice_make(string_start, buffer_end - string_start);
+            thsn_slice_advance_unsafe(buffer_slice, buffer_slice->size);
+            return THSN_RESULT_SUCCESS;
+        }
+        thsn_structural_index_seek(index, next_block, buffer_end);
+        closing_quotes =
+            index->masks.quote &
+            ~thsn_block_escaped(index->masks.backslash, &prev_escaped);
+    }
+    const char* const string_end =
+        index->block_start + thsn_trailing_zeros(closing_quotes);
+    *token = THSN_TOKEN_STRING;
+    *token_slice = thsn_slice_make(string_start, string_end - string_start);
+    thsn_slice_advance_unsafe(buffer_slice,
+                              string_end + 1 - buffer_slice->data);
+    return THSN_RESULT_SUCCESS;
+}
+
 #endif
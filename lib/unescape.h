@@ -0,0 +1,131 @@
+#ifndef THSN_UNESCAPE_H
+#define THSN_UNESCAPE_H
+
+#include <stdint.h>
+
+#include "result.h"
+#include "slice.h"
+#include "structural.h"
+
+static inline bool thsn_read_hex4(const char* /*in*/ hex,
+                                  uint32_t* /*out*/ code_unit) {
+    *code_unit = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        const char c = hex[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        *code_unit = (*code_unit << 4) | digit;
+    }
+    return true;
+}
+
+static inline size_t thsn_encode_utf8(uint32_t code_point,
+                                      char* /*out*/ output) {
+    if (code_point < 0x80) {
+        output[0] = (char)code_point;
+        return 1;
+    }
+    if (code_point < 0x800) {
+        output[0] = (char)(0xc0 | (code_point >> 6));
+        output[1] = (char)(0x80 | (code_point & 0x3f));
+        return 2;
+    }
+    if (code_point < 0x10000) {
+        output[0] = (char)(0xe0 | (code_point >> 12));
+        output[1] = (char)(0x80 | ((code_point >> 6) & 0x3f));
+        output[2] = (char)(0x80 | (code_point & 0x3f));
+        return 3;
+    }
+    output[0] = (char)(0xf0 | (code_point >> 18));
+    output[1] = (char)(0x80 | ((code_point >> 12) & 0x3f));
+    output[2] = (char)(0x80 | ((code_point >> 6) & 0x3f));
+    output[3] = (char)(0x80 | (code_point & 0x3f));
+    return 4;
+}
+
+/* Decodes JSON escape sequences, `\uXXXX` ones into UTF-8. The result is
+ * never longer than the input, so `output` must have at least
+ * `escaped_slice.size` bytes. Unknown escapes and unpaired surrogates are
+ * errors. */
+static inline ThsnResult thsn_unescape_string(ThsnSlice escaped_slice,
+                                              char* /*out*/ output,
+                                              size_t* /*out*/ output_size) {
+    BAIL_ON_NULL_INPUT(output);
+    BAIL_ON_NULL_INPUT(output_size);
+    char* output_iter = output;
+    while (true) {
+        const char* const backslash = thsn_find_char(escaped_slice, '\\');
+        const size_t run_size = backslash == NULL
+                                    ? escaped_slice.size
+                                    : (size_t)(backslash - escaped_slice.data);
+        memcpy(output_iter, escaped_slice.data, run_size);
+        output_iter += run_size;
+        thsn_slice_advance_unsafe(&escaped_slice, run_size);
+        if (backslash == NULL) {
+            break;
+        }
+        BAIL_WITH_INPUT_ERROR_UNLESS(escaped_slice.size >= 2);
+        const char escaped_char = escaped_slice.data[1];
+        thsn_slice_advance_unsafe(&escaped_slice, 2);
+        switch (escaped_char) {
+            case '"':
+            case '\\':
+            case '/':
+                *output_iter++ = escaped_char;
+                break;
+            case 'b':
+                *output_iter++ = '\b';
+                break;
+            case 'f':
+                *output_iter++ = '\f';
+                break;
+            case 'n':
+                *output_iter++ = '\n';
+                break;
+            case 'r':
+                *output_iter++ = '\r';
+                break;
+            case 't':
+                *output_iter++ = '\t';
+                break;
+            case 'u': {
+                uint32_t code_point;
+                BAIL_WITH_INPUT_ERROR_UNLESS(
+                    escaped_slice.size >= 4 &&
+                    thsn_read_hex4(escaped_slice.data, &code_point));
+                thsn_slice_advance_unsafe(&escaped_slice, 4);
+                BAIL_WITH_INPUT_ERROR_UNLESS(code_point < 0xdc00 ||
+                                             code_point > 0xdfff);
+                if (code_point >= 0xd800 && code_point <= 0xdbff) {
+                    uint32_t low_surrogate;
+                    BAIL_WITH_INPUT_ERROR_UNLESS(
+                        escaped_slice.size >= 6 &&
+                        escaped_slice.data[0] == '\\' &&
+                        escaped_slice.data[1] == 'u' &&
+                        thsn_read_hex4(escaped_slice.data + 2,
+                                       &low_surrogate) &&
+                        low_surrogate >= 0xdc00 && low_surrogate <= 0xdfff);
+                    thsn_slice_advance_unsafe(&escaped_slice, 6);
+                    code_point = 0x10000 + ((code_point - 0xd800) << 10) +
+                                 (low_surrogate - 0xdc00);
+                }
+                output_iter += thsn_encode_utf8(code_point, output_iter);
+                break;
+            }
+            default:
+                return THSN_RESULT_INPUT_ERROR;
+        }
+    }
+    *output_size = output_iter - output;
+    return THSN_RESULT_SUCCESS;
+}
+
+#endif
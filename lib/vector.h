@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "allocator.h"
 #include "result.h"
 #include "slice.h"
 
@@ -12,6 +13,8 @@ typedef struct {
     char* buffer;
     size_t capacity;
     size_t offset;
+    /* NULL for the C library allocator */
+    const ThsnAllocator* allocator;
 } ThsnVector;
 
 #define THSN_VECTOR_PUSH_VAR(vector, var) \
@@ -41,7 +44,14 @@ typedef struct {
         : THSN_RESULT_INPUT_ERROR
 
 static inline ThsnVector thsn_vector_make_empty(void) {
-    return (ThsnVector){.buffer = NULL, .capacity = 0, .offset = 0};
+    return (ThsnVector){
+        .buffer = NULL, .capacity = 0, .offset = 0, .allocator = NULL};
+}
+
+static inline ThsnVector thsn_vector_make_empty_with_allocator(
+    const ThsnAllocator* /*maybe in*/ allocator) {
+    return (ThsnVector){
+        .buffer = NULL, .capacity = 0, .offset = 0, .allocator = allocator};
 }
 
 static inline size_t thsn_vector_space_left(ThsnVector vector) {
@@ -67,7 +77,7 @@ static inline ThsnMutSlice thsn_vector_as_mut_slice(ThsnVector vector) {
 static inline ThsnResult thsn_vector_allocate(ThsnVector* vector,
                                               size_t prealloc_size) {
     BAIL_ON_NULL_INPUT(vector);
-    vector->buffer = malloc(prealloc_size);
+    vector->buffer = thsn_allocate(vector->allocator, prealloc_size);
     BAIL_ON_ALLOC_FAILURE(vector->buffer);
     vector->capacity = prealloc_size;
     vector->offset = 0;
@@ -77,7 +87,7 @@ static inline ThsnResult thsn_vector_allocate(ThsnVector* vector,
 static inline ThsnResult thsn_vector_free(ThsnVector* vector) {
     BAIL_ON_NULL_INPUT(vector);
     if (vector->buffer != NULL) {
-        free(vector->buffer);
+        thsn_free(vector->allocator, vector->buffer, vector->capacity);
         vector->buffer = NULL;
     }
     vector->capacity = 0;
@@ -85,6 +95,39 @@ static inline ThsnResult thsn_vector_free(ThsnVector* vector) {
     return THSN_RESULT_SUCCESS;
 }
 
+/* Never shrinks, invalidates all the pointers into the vector */
+static inline ThsnResult thsn_vector_reserve(ThsnVector* /*mut*/ vector,
+                                             size_t capacity) {
+    BAIL_ON_NULL_INPUT(vector);
+    if (vector->capacity >= capacity) {
+        return THSN_RESULT_SUCCESS;
+    }
+    char* const buffer = thsn_reallocate(vector->allocator, vector->buffer,
+                                         vector->capacity, capacity);
+    BAIL_ON_ALLOC_FAILURE(buffer);
+    vector->buffer = buffer;
+    vector->capacity = capacity;
+    return THSN_RESULT_SUCCESS;
+}
+
+/* Frees the unused capacity, so the buffer can be handed out as a slice and
+ * later freed with its size. Invalidates all the pointers into the vector. */
+static inline ThsnResult thsn_vector_shrink_to_fit(ThsnVector* /*mut*/ vector) {
+    BAIL_ON_NULL_INPUT(vector);
+    if (vector->offset == vector->capacity) {
+        return THSN_RESULT_SUCCESS;
+    }
+    if (vector->offset == 0) {
+        return thsn_vector_free(vector);
+    }
+    char* const buffer = thsn_reallocate(vector->allocator, vector->buffer,
+                                         vector->capacity, vector->offset);
+    BAIL_ON_ALLOC_FAILURE(buffer);
+    vector->buffer = buffer;
+    vector->capacity = vector->offset;
+    return THSN_RESULT_SUCCESS;
+}
+
 /* Invalidates all the pointers into the vector */
 static inline ThsnResult thsn_vector_grow(
     ThsnVector* /*mut*/ vector, size_t data_size,
@@ -100,7 +143,9 @@ static inline ThsnResult thsn_vector_grow(
             vector->capacity < data_size || vector->capacity > addr_space_left
                 ? data_size
                 : vector->capacity;
-        vector->buffer = realloc(vector->buffer, vector->capacity + grow_size);
+        vector->buffer =
+            thsn_reallocate(vector->allocator, vector->buffer,
+                            vector->capacity, vector->capacity + grow_size);
         BAIL_ON_ALLOC_FAILURE(vector->buffer);
         vector->capacity += grow_size;
     }
@@ -1,4 +1,10 @@
+#include <limits.h>
+#include <string.h>
+
+#include "number.h"
 #include "slice.h"
+#include "structural.h"
+#include "tokenizer.h"
 #include "vector.h"
 
 typedef enum {
@@ -197,3 +203,326 @@ error_cleanup:
     thsn_vector_free(&stack);
     return THSN_RESULT_INPUT_ERROR;
 }
+
+/* The context of a value in a container, `last` is only known once its
+ * delimiter is read. */
+static ThsnVisitorContext thsn_visit_element_context(ThsnVisitTag container,
+                                                     ThsnSlice key_slice) {
+    return (ThsnVisitorContext){.key = key_slice,
+                                .in_array = container == THSN_VISIT_TAG_ARRAY,
+                                .in_object =
+                                    container == THSN_VISIT_TAG_OBJECT_KV,
+                                .last = false};
+}
+
+static ThsnToken thsn_visit_closing_token(ThsnVisitTag container) {
+    return container == THSN_VISIT_TAG_ARRAY ? THSN_TOKEN_CLOSED_BRACKET
+                                             : THSN_TOKEN_CLOSED_BRACE;
+}
+
+/* Reads the comma or the closing bracket after a value in `container` */
+static ThsnResult thsn_visit_read_delimiter(
+    ThsnStructuralIndex* /*mut*/ structural_index,
+    ThsnSlice* /*mut*/ buffer_slice, ThsnVisitTag container,
+    ThsnToken* /*out*/ delimiter) {
+    ThsnSlice token_slice;
+    BAIL_ON_ERROR(thsn_next_token_indexed(structural_index, buffer_slice,
+                                          &token_slice, delimiter));
+    BAIL_WITH_INPUT_ERROR_UNLESS(
+        *delimiter == THSN_TOKEN_COMMA ||
+        *delimiter == thsn_visit_closing_token(container));
+    return THSN_RESULT_SUCCESS;
+}
+
+static ThsnResult thsn_visit_stack_top(ThsnVector stack,
+                                       ThsnVisitTag* /*out*/ container) {
+    ThsnSlice top_slice;
+    BAIL_ON_ERROR(thsn_vector_slice_at_offset(
+        stack, thsn_vector_current_offset(stack) - sizeof(*container),
+        sizeof(*container), &top_slice));
+    return THSN_SLICE_READ_VAR(top_slice, *container);
+}
+
+/* Bits at positions `from` and up */
+static uint64_t thsn_visit_bits_from(size_t from) {
+    return from < THSN_BLOCK_SIZE ? UINT64_MAX << from : 0;
+}
+
+/* `buffer_slice` starts right after the root's opening bracket or brace, and
+ * brackets are matched up to its closing one like `thsn_skip_composite` does,
+ * in one pass. Bit `i` of `last_composites` is set for the arrays and objects
+ * opening at offset `i` of `buffer_slice` that aren't followed by a comma, the
+ * rest are left as they are. `open_offsets` is empty again once the root is
+ * closed. */
+static ThsnResult thsn_visit_find_last_composites(
+    ThsnSlice buffer_slice, ThsnVector* /*mut*/ open_offsets,
+    ThsnMutSlice last_composites) {
+    uint64_t prev_escaped = 0;
+    uint64_t prev_in_string = 0;
+    /* A closed composite waits for the first non-whitespace after it */
+    bool delimiter_pending = false;
+    size_t closed_offset = 0;
+    for (size_t block_offset = 0; block_offset < buffer_slice.size;
+         block_offset += THSN_BLOCK_SIZE) {
+        const char* const block = buffer_slice.data + block_offset;
+        const size_t remaining_size = buffer_slice.size - block_offset;
+        const size_t block_size = remaining_size < THSN_BLOCK_SIZE
+                                      ? remaining_size
+                                      : THSN_BLOCK_SIZE;
+        ThsnBlockMasks masks;
+        thsn_block_classify(block, block_size, &masks);
+        const uint64_t escaped =
+            thsn_block_escaped(masks.backslash, &prev_escaped);
+        const uint64_t out_of_string =
+            ~thsn_block_in_string(masks.quote & ~escaped, &prev_in_string);
+        const uint64_t non_whitespace =
+            ~masks.whitespace & thsn_block_size_mask(block_size);
+        const uint64_t brackets =
+            (masks.opening | masks.closing) & out_of_string;
+        size_t from = 0;
+        while (true) {
+            if (delimiter_pending) {
+                const uint64_t next_char =
+                    non_whitespace & thsn_visit_bits_from(from);
+                if (next_char == 0) {
+                    break;
+                }
+                if (block[thsn_trailing_zeros(next_char)] != ',') {
+                    last_composites.data[closed_offset / CHAR_BIT] |=
+                        (char)(1 << (closed_offset % CHAR_BIT));
+                }
+                delimiter_pending = false;
+            }
+            const uint64_t next_brackets =
+                brackets & thsn_visit_bits_from(from);
+            if (next_brackets == 0) {
+                break;
+            }
+            const size_t position = thsn_trailing_zeros(next_brackets);
+            from = position + 1;
+            if ((masks.opening & (1ULL << position)) != 0) {
+                const size_t open_offset = block_offset + position;
+                BAIL_ON_ERROR(THSN_VECTOR_PUSH_VAR(*open_offsets, open_offset));
+                continue;
+            }
+            if (thsn_vector_is_empty(*open_offsets)) {
+                /* The root is closed */
+                return THSN_RESULT_SUCCESS;
+            }
+            BAIL_ON_ERROR(THSN_VECTOR_POP_VAR(*open_offsets, closed_offset));
+            delimiter_pending = true;
+        }
+    }
+    return THSN_RESULT_INPUT_ERROR;
+}
+
+static bool thsn_visit_is_last_composite(ThsnMutSlice last_composites,
+                                         size_t offset) {
+    return (last_composites.data[offset / CHAR_BIT] &
+            (1 << (offset % CHAR_BIT))) != 0;
+}
+
+ThsnResult thsn_parse_visit(ThsnSlice* /*mut*/ json_str_slice,
+                            const ThsnVisitorVTable* /*in*/ vtable,
+                            void* /*in*/ user_data) {
+    BAIL_ON_NULL_INPUT(json_str_slice);
+    BAIL_ON_NULL_INPUT(vtable);
+    ThsnVisitorContext context = {
+        .key = thsn_slice_make_empty(),
+        .in_array = false,
+        .last = false,
+    };
+    /* Pairs of the container's own context and its tag, the innermost
+     * container's tag on top */
+    ThsnVector stack = thsn_vector_make_empty();
+    BAIL_ON_ERROR(thsn_vector_allocate(&stack, 1024));
+    ThsnStructuralIndex structural_index = thsn_structural_index_make();
+    /* A bit per byte after the root's opening bracket, see
+     * `thsn_visit_find_last_composites` */
+    ThsnVector last_composites = thsn_vector_make_empty();
+    ThsnMutSlice last_composites_slice = thsn_mut_slice_make_empty();
+    ThsnVisitTag container = THSN_VISIT_TAG_ARRAY;
+    bool skip = false;
+    ThsnToken token;
+    ThsnSlice token_slice;
+    GOTO_ON_ERROR(thsn_next_token_indexed(&structural_index, json_str_slice,
+                                          &token_slice, &token),
+                  error_cleanup);
+    const char* const composites_start = json_str_slice->data;
+    const bool has_composite_callbacks =
+        vtable->visit_array_start != NULL || vtable->visit_array_end != NULL ||
+        vtable->visit_object_start != NULL || vtable->visit_object_end != NULL;
+    if (has_composite_callbacks && (token == THSN_TOKEN_OPEN_BRACKET ||
+                                    token == THSN_TOKEN_OPEN_BRACE)) {
+        GOTO_ON_ERROR(
+            thsn_vector_grow(&last_composites,
+                             json_str_slice->size / CHAR_BIT + 1,
+                             &last_composites_slice),
+            error_cleanup);
+        memset(last_composites_slice.data, 0, last_composites_slice.size);
+        GOTO_ON_ERROR(thsn_visit_find_last_composites(
+                          *json_str_slice, &stack, last_composites_slice),
+                      error_cleanup);
+    }
+
+    while (true) {
+        const bool in_container = !thsn_vector_is_empty(stack);
+        /* `token` starts a value here, `delimiter` is the token after it */
+        ThsnToken delimiter = THSN_TOKEN_EOF;
+        switch (token) {
+            case THSN_TOKEN_OPEN_BRACKET:
+            case THSN_TOKEN_OPEN_BRACE: {
+                const bool is_array = token == THSN_TOKEN_OPEN_BRACKET;
+                const bool has_callbacks =
+                    is_array ? vtable->visit_array_start != NULL ||
+                                   vtable->visit_array_end != NULL
+                             : vtable->visit_object_start != NULL ||
+                                   vtable->visit_object_end != NULL;
+                if (in_container && has_callbacks) {
+                    context.last = thsn_visit_is_last_composite(
+                        last_composites_slice,
+                        (size_t)(token_slice.data - composites_start));
+                }
+                if (is_array) {
+                    CALL_VISITOR2(vtable->visit_array_start, &context,
+                                  user_data);
+                } else {
+                    CALL_VISITOR2(vtable->visit_object_start, &context,
+                                  user_data);
+                }
+                if (skip) {
+                    GOTO_ON_ERROR(thsn_skip_composite(json_str_slice),
+                                  error_cleanup);
+                    break;
+                }
+                container =
+                    is_array ? THSN_VISIT_TAG_ARRAY : THSN_VISIT_TAG_OBJECT_KV;
+                GOTO_ON_ERROR(
+                    THSN_VECTOR_PUSH_2_VARS(stack, context, container),
+                    error_cleanup);
+                GOTO_ON_ERROR(
+                    thsn_next_token_indexed(&structural_index, json_str_slice,
+                                            &token_slice, &token),
+                    error_cleanup);
+                if (token == thsn_visit_closing_token(container)) {
+                    /* Empty, handled as the end of the container below */
+                    delimiter = token;
+                    break;
+                }
+                if (is_array) {
+                    context = thsn_visit_element_context(
+                        container, thsn_slice_make_empty());
+                    continue;
+                }
+                /* The first key is read below, like the ones after commas */
+                goto read_key;
+            }
+            case THSN_TOKEN_NULL:
+            case THSN_TOKEN_TRUE:
+            case THSN_TOKEN_FALSE:
+            case THSN_TOKEN_INT:
+            case THSN_TOKEN_FLOAT:
+            case THSN_TOKEN_STRING: {
+                double number = 0.0;
+                if (token == THSN_TOKEN_INT || token == THSN_TOKEN_FLOAT) {
+                    GOTO_ON_ERROR(
+                        thsn_number_parse_double(token_slice, &number),
+                        error_cleanup);
+                }
+                if (in_container) {
+                    GOTO_ON_ERROR(thsn_visit_read_delimiter(
+                                      &structural_index, json_str_slice,
+                                      container, &delimiter),
+                                  error_cleanup);
+                    context.last = delimiter != THSN_TOKEN_COMMA;
+                }
+                switch (token) {
+                    case THSN_TOKEN_NULL:
+                        CALL_VISITOR2(vtable->visit_null, &context, user_data);
+                        break;
+                    case THSN_TOKEN_TRUE:
+                    case THSN_TOKEN_FALSE:
+                        CALL_VISITOR3(vtable->visit_bool, &context, user_data,
+                                      token == THSN_TOKEN_TRUE);
+                        break;
+                    case THSN_TOKEN_STRING:
+                        CALL_VISITOR3(vtable->visit_string, &context, user_data,
+                                      token_slice);
+                        break;
+                    default:
+                        CALL_VISITOR3(vtable->visit_number, &context, user_data,
+                                      number);
+                        break;
+                }
+                break;
+            }
+            default:
+                goto error_cleanup;
+        }
+
+        if (thsn_vector_is_empty(stack)) {
+            /* The root value is done */
+            goto success_cleanup;
+        }
+        if (delimiter == THSN_TOKEN_EOF) {
+            /* Composite values don't read theirs */
+            GOTO_ON_ERROR(
+                thsn_visit_read_delimiter(&structural_index, json_str_slice,
+                                          container, &delimiter),
+                error_cleanup);
+        }
+        /* Closes containers until a comma is found after one */
+        while (delimiter != THSN_TOKEN_COMMA) {
+            ThsnVisitTag closed_container;
+            GOTO_ON_ERROR(THSN_VECTOR_POP_2_VARS(stack, closed_container,
+                                                 context),
+                          error_cleanup);
+            if (closed_container == THSN_VISIT_TAG_ARRAY) {
+                CALL_VISITOR2(vtable->visit_array_end, &context, user_data);
+            } else {
+                CALL_VISITOR2(vtable->visit_object_end, &context, user_data);
+            }
+            if (thsn_vector_is_empty(stack)) {
+                goto success_cleanup;
+            }
+            GOTO_ON_ERROR(thsn_visit_stack_top(stack, &container),
+                          error_cleanup);
+            GOTO_ON_ERROR(
+                thsn_visit_read_delimiter(&structural_index, json_str_slice,
+                                          container, &delimiter),
+                error_cleanup);
+        }
+        GOTO_ON_ERROR(thsn_next_token_indexed(&structural_index, json_str_slice,
+                                              &token_slice, &token),
+                      error_cleanup);
+        if (container == THSN_VISIT_TAG_ARRAY) {
+            context =
+                thsn_visit_element_context(container, thsn_slice_make_empty());
+            continue;
+        }
+    read_key:
+        if (token != THSN_TOKEN_STRING) {
+            goto error_cleanup;
+        }
+        context = thsn_visit_element_context(container, token_slice);
+        GOTO_ON_ERROR(thsn_next_token_indexed(&structural_index, json_str_slice,
+                                              &token_slice, &token),
+                      error_cleanup);
+        if (token != THSN_TOKEN_COLON) {
+            goto error_cleanup;
+        }
+        GOTO_ON_ERROR(thsn_next_token_indexed(&structural_index, json_str_slice,
+                                              &token_slice, &token),
+                      error_cleanup);
+    }
+
+success_cleanup:
+    thsn_vector_free(&last_composites);
+    thsn_vector_free(&stack);
+    return THSN_RESULT_SUCCESS;
+
+error_cleanup:
+    thsn_vector_free(&last_composites);
+    thsn_vector_free(&stack);
+    return THSN_RESULT_INPUT_ERROR;
+}